@@ -1,6 +1,7 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
 #include <libgen.h>
 #include <limits.h>
@@ -9,6 +10,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <tss2/tss2_mu.h>
 
@@ -149,6 +152,291 @@ bool files_save_bytes_to_file(const char *path, UINT8 *buf, UINT16 size) {
     return result;
 }
 
+#define SINK_FD_PREFIX "fd:"
+
+static bool sink_open_fd(files_sink *sink, const char *spec) {
+
+    UINT32 fd;
+    bool result = tpm2_util_string_to_uint32(spec, &fd);
+    if (!result || fd > INT_MAX) {
+        LOG_ERR("Invalid file descriptor, got: \"%s\"", spec);
+        return false;
+    }
+
+    if (fcntl(fd, F_GETFD) < 0) {
+        LOG_ERR("File descriptor %"PRIu32" is not open, error: %s", fd,
+                strerror(errno));
+        return false;
+    }
+
+    sink->fd = fd;
+    sink->is_borrowed = true;
+
+    return true;
+}
+
+static bool sink_open_tmpfile(files_sink *sink, mode_t mode) {
+
+#if defined(O_TMPFILE)
+    char *copy = strdup(sink->path);
+    if (!copy) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    sink->fd = open(dirname(copy), O_TMPFILE | O_WRONLY | O_CLOEXEC, mode);
+    free(copy);
+    if (sink->fd < 0) {
+        return false;
+    }
+
+    sink->is_tmpfile = true;
+
+    return true;
+#else
+    UNUSED(sink);
+    UNUSED(mode);
+    return false;
+#endif
+}
+
+bool files_sink_open(files_sink *sink, const char *path, bool is_secret) {
+
+    BAIL_ON_NULL("sink", sink);
+
+    memset(sink, 0, sizeof(*sink));
+    sink->fd = -1;
+
+    if (!path) {
+        /* quiet runs print nothing, like files_write_bytes() */
+        if (!output_enabled) {
+            sink->is_discarded = true;
+            return true;
+        }
+
+        /* keep anything already printed through stdio in order */
+        fflush(stdout);
+        sink->fd = STDOUT_FILENO;
+        sink->is_borrowed = true;
+        return true;
+    }
+
+    if (!strncmp(path, SINK_FD_PREFIX, sizeof(SINK_FD_PREFIX) - 1)) {
+        return sink_open_fd(sink, &path[sizeof(SINK_FD_PREFIX) - 1]);
+    }
+
+    /*
+     * A symlink is followed and its target written, linking the temporary
+     * file to the path itself would replace the link.
+     */
+    struct stat st;
+    if (!lstat(path, &st) && S_ISLNK(st.st_mode)) {
+        sink->path = realpath(path, NULL);
+        if (!sink->path) {
+            LOG_ERR("Could not resolve symlink \"%s\", error: %s", path,
+                    strerror(errno));
+            return false;
+        }
+    } else {
+        sink->path = strdup(path);
+        if (!sink->path) {
+            LOG_ERR("oom");
+            return false;
+        }
+    }
+
+    mode_t mode = is_secret ? S_IRUSR | S_IWUSR :
+            S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP | S_IROTH | S_IWOTH;
+
+    /* devices, pipes and the like are written in place */
+    bool is_special = !lstat(sink->path, &st) && !S_ISREG(st.st_mode);
+    if (!is_special && sink_open_tmpfile(sink, mode)) {
+        return true;
+    }
+
+    sink->fd = open(sink->path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+            mode);
+    if (sink->fd < 0) {
+        LOG_ERR("Could not open file \"%s\", error: %s", sink->path,
+                strerror(errno));
+        files_sink_close(sink);
+        return false;
+    }
+
+    /* an existing file keeps its mode on open, restrict it before writing */
+    if (is_secret && !is_special && fchmod(sink->fd, mode)) {
+        LOG_ERR("Could not restrict the mode of file \"%s\", error: %s",
+                sink->path, strerror(errno));
+        files_sink_close(sink);
+        return false;
+    }
+
+    return true;
+}
+
+bool files_sink_writev(files_sink *sink, const struct iovec *iov,
+        int iovcnt) {
+
+    BAIL_ON_NULL("sink", sink);
+
+    if (sink->is_discarded) {
+        return true;
+    }
+
+    int i = 0;
+    size_t offset = 0;
+    while (i < iovcnt) {
+        ssize_t written;
+        if (offset) {
+            /* finish a buffer a short write split */
+            written = write(sink->fd, (UINT8 *)iov[i].iov_base + offset,
+                    iov[i].iov_len - offset);
+        } else {
+            written = writev(sink->fd, &iov[i],
+                    iovcnt - i < IOV_MAX ? iovcnt - i : IOV_MAX);
+        }
+
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERR("Could not write to \"%s\", error: %s",
+                    sink->path ? sink->path : "file descriptor",
+                    strerror(errno));
+            return false;
+        }
+
+        offset += written;
+        while (i < iovcnt && offset >= iov[i].iov_len) {
+            offset -= iov[i].iov_len;
+            i++;
+        }
+    }
+
+    return true;
+}
+
+bool files_sink_write(files_sink *sink, const void *data, size_t size) {
+
+    struct iovec iov = {
+        .iov_base = (void *)data,
+        .iov_len = size,
+    };
+
+    return files_sink_writev(sink, &iov, 1);
+}
+
+static bool sink_link(int fd, const char *path) {
+
+    /* AT_EMPTY_PATH needs CAP_DAC_READ_SEARCH, /proc does not */
+    if (!linkat(fd, "", AT_FDCWD, path, AT_EMPTY_PATH)) {
+        return true;
+    }
+
+    if (errno == EEXIST) {
+        return false;
+    }
+
+    char proc_path[PATH_MAX];
+    snprintf(proc_path, sizeof(proc_path), "/proc/self/fd/%d", fd);
+
+    return !linkat(AT_FDCWD, proc_path, AT_FDCWD, path, AT_SYMLINK_FOLLOW);
+}
+
+static bool sink_commit_tmpfile(files_sink *sink) {
+
+    if (sink_link(sink->fd, sink->path)) {
+        return true;
+    }
+
+    if (errno != EEXIST) {
+        LOG_ERR("Could not link file \"%s\", error: %s", sink->path,
+                strerror(errno));
+        return false;
+    }
+
+    /* replace the existing file atomically through a temporary name */
+    size_t len = strlen(sink->path) + 32;
+    char *tmp = malloc(len);
+    if (!tmp) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    bool result = false;
+    unsigned i;
+    for (i = 0; i < 128; i++) {
+        snprintf(tmp, len, "%s.%d.%u", sink->path, getpid(), i);
+        result = sink_link(sink->fd, tmp);
+        if (result || errno != EEXIST) {
+            break;
+        }
+    }
+
+    if (!result) {
+        LOG_ERR("Could not link file \"%s\", error: %s", tmp,
+                strerror(errno));
+        goto out;
+    }
+
+    if (rename(tmp, sink->path)) {
+        LOG_ERR("Could not replace file \"%s\", error: %s", sink->path,
+                strerror(errno));
+        unlink(tmp);
+        result = false;
+    }
+
+out:
+    free(tmp);
+    return result;
+}
+
+bool files_sink_commit(files_sink *sink) {
+
+    BAIL_ON_NULL("sink", sink);
+
+    if (sink->is_tmpfile) {
+        bool result = sink_commit_tmpfile(sink);
+        if (result) {
+            sink->is_tmpfile = false;
+        }
+        return result;
+    }
+
+#if defined(F_ADD_SEALS)
+    /* a memfd that allows sealing is made immutable for its reader */
+    int seals = sink->is_borrowed ? fcntl(sink->fd, F_GET_SEALS) : -1;
+    if (seals >= 0 && !(seals & F_SEAL_SEAL)) {
+        int rc = fcntl(sink->fd, F_ADD_SEALS,
+                F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL);
+        if (rc) {
+            LOG_ERR("Could not seal file descriptor %d, error: %s", sink->fd,
+                    strerror(errno));
+            return false;
+        }
+    }
+#endif
+
+    return true;
+}
+
+void files_sink_close(files_sink *sink) {
+
+    if (!sink) {
+        return;
+    }
+
+    if (sink->fd >= 0 && !sink->is_borrowed) {
+        close(sink->fd);
+    }
+
+    free(sink->path);
+    sink->path = NULL;
+    sink->fd = -1;
+    sink->is_tmpfile = false;
+    sink->is_discarded = false;
+}
+
 /*
  * Current version to write TPMS_CONTEXT to disk.
  */
@@ -577,6 +865,51 @@ bool files_write_bytes(FILE *out, uint8_t bytes[], size_t len) {
     return writex(out, bytes, len);
 }
 
+bool files_read_frame(FILE *f, UINT8 *data, UINT16 *size, bool *eof) {
+
+    BAIL_ON_NULL("FILE", f);
+    BAIL_ON_NULL("data", data);
+
+    UINT8 size_bytes[2];
+    size_t bread = fread(size_bytes, 1, sizeof(size_bytes), f);
+    if (!bread && feof(f)) {
+        *eof = true;
+        return true;
+    }
+
+    *eof = false;
+    if (bread != sizeof(size_bytes)) {
+        LOG_ERR("Truncated frame size");
+        return false;
+    }
+
+    UINT16 frame_size = (size_bytes[0] << 8) | size_bytes[1];
+    if (frame_size > *size) {
+        LOG_ERR("Frame of %u bytes exceeds %u bytes", frame_size, *size);
+        return false;
+    }
+
+    bool result = readx(f, data, frame_size);
+    if (!result) {
+        LOG_ERR("Truncated frame of %u bytes", frame_size);
+        return false;
+    }
+
+    *size = frame_size;
+
+    return true;
+}
+
+bool files_write_frame(FILE *f, UINT8 *data, UINT16 size) {
+
+    bool result = files_write_16(f, size);
+    if (!result) {
+        return false;
+    }
+
+    return files_write_bytes(f, data, size);
+}
+
 bool files_write_header(FILE *out, UINT32 version) {
 
     BAIL_ON_NULL("FILE", out);
@@ -5,6 +5,7 @@
 
 #include <stdbool.h>
 #include <stdio.h>
+#include <sys/uio.h>
 
 #include <tss2/tss2_esys.h>
 
@@ -413,4 +414,117 @@ bool files_read_64(FILE *out, UINT64 *data);
  */
 bool files_read_bytes(FILE *out, UINT8 data[], size_t size);
 
+/**
+ * Reads the next frame of a stream of framed data, a big endian 16 bit size
+ * followed by that many bytes. This is the marshaled form of a TPM2B.
+ * @param f
+ *  The file to read from.
+ * @param data
+ *  The buffer to read the frame into.
+ * @param size
+ *  The size of data on call, the size of the frame on a true return.
+ * @param eof
+ *  Set when the stream ended cleanly before a frame.
+ * @return
+ *  True on success, False on error or a truncated frame.
+ */
+bool files_read_frame(FILE *f, UINT8 *data, UINT16 *size, bool *eof);
+
+/**
+ * Writes data as a frame, see files_read_frame().
+ * @param f
+ *  The file to write to.
+ * @param data
+ *  The data to write.
+ * @param size
+ *  The size of data.
+ * @return
+ *  True on success, False otherwise.
+ */
+bool files_write_frame(FILE *f, UINT8 *data, UINT16 size);
+
+/**
+ * An output sink writes buffers straight to a file descriptor with write(2)
+ * and writev(2), so TPM responses are written from the buffers ESYS returned
+ * them in, without FILE buffering and without a UINT16 bound on the size.
+ */
+typedef struct files_sink files_sink;
+struct files_sink {
+    int fd;
+    char *path;
+    bool is_tmpfile;
+    bool is_borrowed;
+    bool is_discarded;
+};
+
+/**
+ * Opens an output sink.
+ *
+ * A NULL path is stdout, or discards everything when output is disabled
+ * with -Q. A path of the form "fd:N" writes to the inherited
+ * file descriptor N, which is not closed by the sink. When that descriptor is
+ * a memfd that allows sealing, it is sealed against any further change on
+ * files_sink_commit(), so a secret can be handed to a child process without
+ * touching disk.
+ *
+ * Any other path is written to an unnamed O_TMPFILE in the directory of the
+ * path, which is linked into place by files_sink_commit(). Readers never see
+ * a partially written file and a failed write never leaves one behind. A
+ * symlink is followed and its target replaced, the link itself is kept.
+ * Paths that exist and are not regular files, and file systems without
+ * O_TMPFILE, are written in place.
+ * @param sink
+ *  The sink to open.
+ * @param path
+ *  The output path, "fd:N" or NULL for stdout.
+ * @param is_secret
+ *  Create the file readable and writable by the owner only.
+ * @return
+ *  True on success, False otherwise.
+ */
+bool files_sink_open(files_sink *sink, const char *path, bool is_secret);
+
+/**
+ * Writes the buffers to the sink in order, continuing on short writes.
+ * @param sink
+ *  The sink to write to.
+ * @param iov
+ *  The buffers to write.
+ * @param iovcnt
+ *  The number of buffers.
+ * @return
+ *  True on success, False otherwise.
+ */
+bool files_sink_writev(files_sink *sink, const struct iovec *iov, int iovcnt);
+
+/**
+ * Like files_sink_writev() for a single buffer.
+ * @param sink
+ *  The sink to write to.
+ * @param data
+ *  The data to write.
+ * @param size
+ *  The size of data.
+ * @return
+ *  True on success, False otherwise.
+ */
+bool files_sink_write(files_sink *sink, const void *data, size_t size);
+
+/**
+ * Makes everything written visible, linking a temporary file to its path
+ * or sealing a memfd.
+ * @param sink
+ *  The sink to commit.
+ * @return
+ *  True on success, False otherwise.
+ */
+bool files_sink_commit(files_sink *sink);
+
+/**
+ * Closes the sink, an uncommitted temporary file is discarded.
+ * @param sink
+ *  The sink to close.
+ */
+void files_sink_close(files_sink *sink);
+
 #endif /* FILES_H */
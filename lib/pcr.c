@@ -1,11 +1,13 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "files.h"
 #include "log.h"
 #include "pcr.h"
 #include "tpm2.h"
@@ -427,3 +429,91 @@ tool_rc pcr_read_pcr_values(ESYS_CONTEXT *esys_context, TPML_PCR_SELECTION *pcrS
 
     return tool_rc_success;
 }
+
+bool pcr_selection_equal(const TPML_PCR_SELECTION *a,
+        const TPML_PCR_SELECTION *b) {
+
+    if (a->count != b->count) {
+        return false;
+    }
+
+    UINT32 i;
+    for (i = 0; i < a->count; i++) {
+        const TPMS_PCR_SELECTION *x = &a->pcrSelections[i];
+        const TPMS_PCR_SELECTION *y = &b->pcrSelections[i];
+        if (x->hash != y->hash) {
+            return false;
+        }
+
+        UINT8 j;
+        for (j = 0; j < sizeof(x->pcrSelect); j++) {
+            UINT8 bx = j < x->sizeofSelect ? x->pcrSelect[j] : 0;
+            UINT8 by = j < y->sizeofSelect ? y->pcrSelect[j] : 0;
+            if (bx != by) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+bool pcr_load_pcr_file(const char *path, TPML_PCR_SELECTION *pcrSel,
+        tpm2_pcrs *pcrs) {
+
+    bool result = false;
+    unsigned long size;
+
+    if (!files_get_file_size_path(path, &size)) {
+        return false;
+    }
+
+    if (!size) {
+        LOG_ERR("The pcr file \"%s\" is empty", path);
+        return false;
+    }
+
+    FILE *pcr_input = fopen(path, "rb");
+    if (!pcr_input) {
+        LOG_ERR("Could not open PCRs input file \"%s\" error: \"%s\"",
+                path, strerror(errno));
+        goto out;
+    }
+
+    // Import TPML_PCR_SELECTION structure to pcr outfile
+    if (fread(pcrSel, sizeof(TPML_PCR_SELECTION), 1, pcr_input) != 1) {
+        LOG_ERR("Failed to read PCR selection from file");
+        goto out;
+    }
+
+    // Import PCR digests to pcr outfile, the count is written as 32 bits
+    UINT32 count;
+    if (fread(&count, sizeof(count), 1, pcr_input) != 1) {
+        LOG_ERR("Failed to read PCR digests header from file");
+        goto out;
+    }
+
+    if (count > ARRAY_LEN(pcrs->pcr_values)) {
+        LOG_ERR("Malformed PCR file, pcr count cannot be greater than %zu, got: %"PRIu32,
+                ARRAY_LEN(pcrs->pcr_values), count);
+        goto out;
+    }
+    pcrs->count = count;
+
+    UINT32 j;
+    for (j = 0; j < pcrs->count; j++) {
+        if (fread(&pcrs->pcr_values[j], sizeof(TPML_DIGEST), 1, pcr_input) != 1) {
+            LOG_ERR("Failed to read PCR digest from file");
+            goto out;
+        }
+    }
+
+    result = true;
+
+out:
+    if (pcr_input) {
+        fclose(pcr_input);
+    }
+
+    return result;
+}
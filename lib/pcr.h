@@ -43,6 +43,35 @@ bool pcr_print_pcr_struct(TPML_PCR_SELECTION *pcrSelect, tpm2_pcrs *pcrs);
  */
 bool pcr_get_id(const char *arg, UINT32 *pcrId);
 
+/**
+ * Reads a PCR file as written by tpm2_quote -o, the raw PCR selection
+ * followed by the PCR values.
+ * @param path
+ *  The path of the PCR file.
+ * @param pcrSel
+ *  The PCR selection the values are for.
+ * @param pcrs
+ *  The PCR values.
+ * @return
+ *  True on success, false otherwise.
+ */
+bool pcr_load_pcr_file(const char *path, TPML_PCR_SELECTION *pcrSel,
+        tpm2_pcrs *pcrs);
+
+/**
+ * Compares two PCR selections, which match when they select the same PCRs
+ * of the same banks in the same order. A shorter select bitmap reads as
+ * zeros.
+ * @param a
+ *  A PCR selection.
+ * @param b
+ *  The PCR selection to compare with.
+ * @return
+ *  True if the selections match, false otherwise.
+ */
+bool pcr_selection_equal(const TPML_PCR_SELECTION *a,
+        const TPML_PCR_SELECTION *b);
+
 bool pcr_print_pcr_selections(TPML_PCR_SELECTION *pcr_selections);
 bool pcr_parse_selections(const char *arg, TPML_PCR_SELECTION *pcrSels);
 tool_rc pcr_get_banks(ESYS_CONTEXT *esys_context, TPMS_CAPABILITY_DATA *capability_data, tpm2_algorithm *algs);
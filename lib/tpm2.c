@@ -722,6 +722,44 @@ tool_rc tpm2_mu_tpmt_public_marshal(
     return tool_rc_success;
 }
 
+tool_rc tpm2_mu_tpms_context_marshal(
+    TPMS_CONTEXT   const *src,
+    uint8_t        buffer[],
+    size_t         buffer_size,
+    size_t         *offset) {
+
+    TSS2_RC rval = Tss2_MU_TPMS_CONTEXT_Marshal(
+        src,
+        buffer,
+        buffer_size,
+        offset);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_TPMS_CONTEXT_Marshal, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_mu_tpms_context_unmarshal(
+    uint8_t const   buffer[],
+    size_t          size,
+    size_t          *offset,
+    TPMS_CONTEXT    *dest) {
+
+    TSS2_RC rval = Tss2_MU_TPMS_CONTEXT_Unmarshal(
+        buffer,
+        size,
+        offset,
+        dest);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_TPMS_CONTEXT_Unmarshal, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_evictcontrol(
     ESYS_CONTEXT *esysContext,
     tpm2_loaded_object *auth_hierarchy_obj,
@@ -1158,6 +1196,54 @@ tool_rc tpm2_rsa_decrypt(
     return tool_rc_success;
 }
 
+tool_rc tpm2_rsa_decrypt_async(
+    ESYS_CONTEXT *ectx,
+    tpm2_loaded_object *keyobj,
+    const TPM2B_PUBLIC_KEY_RSA *cipher_text,
+    const TPMT_RSA_DECRYPT *scheme,
+    const TPM2B_DATA *label) {
+
+    ESYS_TR keyobj_session_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(ectx,
+                            keyobj->tr_handle,
+                            keyobj->session, &keyobj_session_handle);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TSS2_RC rval = Esys_RSA_Decrypt_Async(
+                    ectx, keyobj->tr_handle,
+                    keyobj_session_handle,
+                    ESYS_TR_NONE,
+                    ESYS_TR_NONE,
+                    cipher_text,
+                    scheme,
+                    label);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_RSA_Decrypt_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_rsa_decrypt_finish(
+    ESYS_CONTEXT *ectx,
+    TPM2B_PUBLIC_KEY_RSA **message) {
+
+    TSS2_RC rval;
+    do {
+        rval = Esys_RSA_Decrypt_Finish(ectx, message);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_RSA_Decrypt_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_load(
     ESYS_CONTEXT *esysContext,
     tpm2_loaded_object *parentobj,
@@ -1513,6 +1599,51 @@ tool_rc tpm2_hmac_sequenceupdate(
     return tool_rc_success;
 }
 
+tool_rc tpm2_hmac_sequenceupdate_async(
+    ESYS_CONTEXT *esysContext,
+    ESYS_TR sequenceHandle,
+    tpm2_loaded_object *hmac_key_obj,
+    const TPM2B_MAX_BUFFER *input_buffer) {
+
+    ESYS_TR hmac_key_obj_shandle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esysContext, hmac_key_obj->tr_handle,
+                            hmac_key_obj->session, &hmac_key_obj_shandle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get hmac_key_obj_shandle");
+        return rc;
+    }
+
+    TPM2_RC rval = Esys_SequenceUpdate_Async(
+                    esysContext,
+                    sequenceHandle,
+                    hmac_key_obj_shandle,
+                    ESYS_TR_NONE,
+                    ESYS_TR_NONE,
+                    input_buffer);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_SequenceUpdate_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_hmac_sequenceupdate_finish(
+    ESYS_CONTEXT *esysContext) {
+
+    TPM2_RC rval;
+    do {
+        rval = Esys_SequenceUpdate_Finish(esysContext);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_SequenceUpdate_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_hmac_sequencecomplete(
     ESYS_CONTEXT *esysContext,
     ESYS_TR sequenceHandle,
@@ -1589,7 +1720,8 @@ tool_rc tpm2_nv_definespace(
         ESYS_CONTEXT *esysContext,
         tpm2_loaded_object *auth_hierarchy_obj,
         const TPM2B_AUTH *auth,
-        const TPM2B_NV_PUBLIC *publicInfo) {
+        const TPM2B_NV_PUBLIC *publicInfo,
+        ESYS_TR *nv_handle) {
 
     ESYS_TR shandle1 = ESYS_TR_NONE;
     tool_rc rc = tpm2_auth_util_get_shandle(esysContext,
@@ -1615,6 +1747,10 @@ tool_rc tpm2_nv_definespace(
         return tool_rc_from_tpm(rval);
     }
 
+    if (nv_handle) {
+        *nv_handle = nvHandle;
+    }
+
     return tool_rc_success;
 }
 
@@ -1623,15 +1759,6 @@ tool_rc tpm2_nv_increment(
     tpm2_loaded_object *auth_hierarchy_obj,
     TPM2_HANDLE nv_index) {
 
-    ESYS_TR auth_hierarchy_obj_session_handle = ESYS_TR_NONE;
-    tool_rc rc = tpm2_auth_util_get_shandle(esysContext,
-        auth_hierarchy_obj->tr_handle, auth_hierarchy_obj->session,
-        &auth_hierarchy_obj_session_handle);
-    if (rc != tool_rc_success) {
-        LOG_ERR("Failed to get shandle");
-        return rc;
-    }
-
     // Convert TPM2_HANDLE ctx.nv_index to an ESYS_TR
     ESYS_TR esys_tr_nv_index;
     TSS2_RC rval = Esys_TR_FromTPMPublic(
@@ -1646,10 +1773,28 @@ tool_rc tpm2_nv_increment(
         return tool_rc_from_tpm(rval);
     }
 
-    rval = Esys_NV_Increment(
+    return tpm2_nv_increment_tr(esysContext, auth_hierarchy_obj,
+            esys_tr_nv_index);
+}
+
+tool_rc tpm2_nv_increment_tr(
+    ESYS_CONTEXT *esysContext,
+    tpm2_loaded_object *auth_hierarchy_obj,
+    ESYS_TR nv_index) {
+
+    ESYS_TR auth_hierarchy_obj_session_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esysContext,
+        auth_hierarchy_obj->tr_handle, auth_hierarchy_obj->session,
+        &auth_hierarchy_obj_session_handle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get shandle");
+        return rc;
+    }
+
+    TSS2_RC rval = Esys_NV_Increment(
             esysContext,
             auth_hierarchy_obj->tr_handle,
-            esys_tr_nv_index,
+            nv_index,
             auth_hierarchy_obj_session_handle,
             ESYS_TR_NONE,
             ESYS_TR_NONE);
@@ -1775,6 +1920,83 @@ tool_rc tpm2_nvwrite(
     return tool_rc_success;
 }
 
+tool_rc tpm2_nv_write_tr(
+    ESYS_CONTEXT *esysContext,
+    tpm2_loaded_object *auth_hierarchy_obj,
+    ESYS_TR nv_index,
+    const TPM2B_MAX_NV_BUFFER *data,
+    UINT16 offset) {
+
+    ESYS_TR auth_hierarchy_obj_session_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esysContext,
+        auth_hierarchy_obj->tr_handle, auth_hierarchy_obj->session,
+        &auth_hierarchy_obj_session_handle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get shandle");
+        return rc;
+    }
+
+    TSS2_RC rval = Esys_NV_Write(esysContext, auth_hierarchy_obj->tr_handle,
+        nv_index, auth_hierarchy_obj_session_handle, ESYS_TR_NONE,
+        ESYS_TR_NONE, data, offset);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_NV_Write, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_nv_writelock_tr(
+    ESYS_CONTEXT *esysContext,
+    tpm2_loaded_object *auth_hierarchy_obj,
+    ESYS_TR nv_index) {
+
+    ESYS_TR auth_hierarchy_obj_session_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esysContext,
+        auth_hierarchy_obj->tr_handle, auth_hierarchy_obj->session,
+        &auth_hierarchy_obj_session_handle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get shandle");
+        return rc;
+    }
+
+    TSS2_RC rval = Esys_NV_WriteLock(esysContext,
+        auth_hierarchy_obj->tr_handle, nv_index,
+        auth_hierarchy_obj_session_handle, ESYS_TR_NONE, ESYS_TR_NONE);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_NV_WriteLock, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_nv_readlock_tr(
+    ESYS_CONTEXT *esysContext,
+    tpm2_loaded_object *auth_hierarchy_obj,
+    ESYS_TR nv_index) {
+
+    ESYS_TR auth_hierarchy_obj_session_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_auth_util_get_shandle(esysContext,
+        auth_hierarchy_obj->tr_handle, auth_hierarchy_obj->session,
+        &auth_hierarchy_obj_session_handle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get shandle");
+        return rc;
+    }
+
+    TSS2_RC rval = Esys_NV_ReadLock(esysContext,
+        auth_hierarchy_obj->tr_handle, nv_index,
+        auth_hierarchy_obj_session_handle, ESYS_TR_NONE, ESYS_TR_NONE);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_NV_ReadLock, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_pcr_allocate(
     ESYS_CONTEXT *esysContext,
     tpm2_loaded_object *auth_hierarchy_obj,
@@ -1884,7 +2106,9 @@ tool_rc tpm2_quote(
 tool_rc tpm2_unseal(
     ESYS_CONTEXT *esysContext,
     tpm2_loaded_object *sealkey_obj,
-    TPM2B_SENSITIVE_DATA **outData) {
+    ESYS_TR shandle2,
+    TPM2B_SENSITIVE_DATA **outData,
+    TSS2_RC *rval) {
 
     ESYS_TR sealkey_obj_session_handle = ESYS_TR_NONE;
     tool_rc rc = tpm2_auth_util_get_shandle(
@@ -1896,16 +2120,19 @@ tool_rc tpm2_unseal(
         return rc;
     }
 
-    TSS2_RC rval = Esys_Unseal(
+    TSS2_RC unseal_rval = Esys_Unseal(
                     esysContext,
                     sealkey_obj->tr_handle,
                     sealkey_obj_session_handle,
-                    ESYS_TR_NONE,
+                    shandle2,
                     ESYS_TR_NONE,
                     outData);
-    if (rval != TPM2_RC_SUCCESS) {
-        LOG_PERR(Esys_Unseal, rval);
-        return tool_rc_from_tpm(rval);
+    if (rval) {
+        *rval = unseal_rval;
+    }
+    if (unseal_rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_Unseal, unseal_rval);
+        return tool_rc_from_tpm(unseal_rval);
     }
 
     return tool_rc_success;
@@ -245,6 +245,18 @@ tool_rc tpm2_mu_tpmt_public_marshal(
     size_t         buffer_size,
     size_t         *offset);
 
+tool_rc tpm2_mu_tpms_context_marshal(
+    TPMS_CONTEXT   const *src,
+    uint8_t        buffer[],
+    size_t         buffer_size,
+    size_t         *offset);
+
+tool_rc tpm2_mu_tpms_context_unmarshal(
+    uint8_t const   buffer[],
+    size_t          size,
+    size_t          *offset,
+    TPMS_CONTEXT    *dest);
+
 tool_rc tpm2_evictcontrol(
     ESYS_CONTEXT *esysContext,
     tpm2_loaded_object *auth_hierarchy_obj,
@@ -360,6 +372,17 @@ tool_rc tpm2_rsa_decrypt(
     const TPM2B_DATA *label,
     TPM2B_PUBLIC_KEY_RSA **message);
 
+tool_rc tpm2_rsa_decrypt_async(
+    ESYS_CONTEXT *esysContext,
+    tpm2_loaded_object *keyobj,
+    const TPM2B_PUBLIC_KEY_RSA *cipherText,
+    const TPMT_RSA_DECRYPT *inScheme,
+    const TPM2B_DATA *label);
+
+tool_rc tpm2_rsa_decrypt_finish(
+    ESYS_CONTEXT *esysContext,
+    TPM2B_PUBLIC_KEY_RSA **message);
+
 tool_rc tpm2_load(
     ESYS_CONTEXT *esysContext,
     tpm2_loaded_object *parentobj,
@@ -432,6 +455,15 @@ tool_rc tpm2_hmac_sequenceupdate(
     tpm2_loaded_object *hmac_key_obj,
     const TPM2B_MAX_BUFFER *input_buffer);
 
+tool_rc tpm2_hmac_sequenceupdate_async(
+    ESYS_CONTEXT *esysContext,
+    ESYS_TR sequenceHandle,
+    tpm2_loaded_object *hmac_key_obj,
+    const TPM2B_MAX_BUFFER *input_buffer);
+
+tool_rc tpm2_hmac_sequenceupdate_finish(
+    ESYS_CONTEXT *esysContext);
+
 tool_rc tpm2_hmac_sequencecomplete(
     ESYS_CONTEXT *esysContext,
     ESYS_TR sequenceHandle,
@@ -454,13 +486,19 @@ tool_rc tpm2_nv_definespace(
         ESYS_CONTEXT *esysContext,
         tpm2_loaded_object *auth_hierarchy_obj,
         const TPM2B_AUTH *auth,
-        const TPM2B_NV_PUBLIC *publicInfo);
+        const TPM2B_NV_PUBLIC *publicInfo,
+        ESYS_TR *nv_handle);
 
 tool_rc tpm2_nv_increment(
     ESYS_CONTEXT *esysContext,
     tpm2_loaded_object *auth_hierarchy_obj,
     TPM2_HANDLE nv_index);
 
+tool_rc tpm2_nv_increment_tr(
+    ESYS_CONTEXT *esysContext,
+    tpm2_loaded_object *auth_hierarchy_obj,
+    ESYS_TR nv_index);
+
 tool_rc tpm2_nvreadlock(
     ESYS_CONTEXT *esysContext,
     tpm2_loaded_object *auth_hierarchy_obj,
@@ -478,6 +516,23 @@ tool_rc tpm2_nvwrite(
     const TPM2B_MAX_NV_BUFFER *data,
     UINT16 offset);
 
+tool_rc tpm2_nv_write_tr(
+    ESYS_CONTEXT *esysContext,
+    tpm2_loaded_object *auth_hierarchy_obj,
+    ESYS_TR nv_index,
+    const TPM2B_MAX_NV_BUFFER *data,
+    UINT16 offset);
+
+tool_rc tpm2_nv_writelock_tr(
+    ESYS_CONTEXT *esysContext,
+    tpm2_loaded_object *auth_hierarchy_obj,
+    ESYS_TR nv_index);
+
+tool_rc tpm2_nv_readlock_tr(
+    ESYS_CONTEXT *esysContext,
+    tpm2_loaded_object *auth_hierarchy_obj,
+    ESYS_TR nv_index);
+
 tool_rc tpm2_pcr_allocate(
     ESYS_CONTEXT *esysContext,
     tpm2_loaded_object *auth_hierarchy_obj,
@@ -503,6 +558,8 @@ tool_rc tpm2_quote(
 tool_rc tpm2_unseal(
     ESYS_CONTEXT *esysContext,
     tpm2_loaded_object *sealkey_obj,
-    TPM2B_SENSITIVE_DATA **outData);
+    ESYS_TR shandle2,
+    TPM2B_SENSITIVE_DATA **outData,
+    TSS2_RC *rval);
 
 #endif /* LIB_TPM2_H_ */
@@ -664,6 +664,46 @@ TPM2_ALG_ID tpm2_alg_util_from_optarg(const char *optarg, tpm2_alg_util_flags fl
     return halg;
 }
 
+bool tpm2_alg_util_rsa_decrypt_scheme_from_optarg(const char *optarg,
+        TPMT_RSA_DECRYPT *scheme) {
+
+    char name[32];
+    const char *halg = strchr(optarg, '-');
+    size_t len = halg ? (size_t)(halg - optarg) : strlen(optarg);
+    if (len >= sizeof(name)) {
+        LOG_ERR("Unknown RSA encryption scheme, got: \"%s\"", optarg);
+        return false;
+    }
+
+    memcpy(name, optarg, len);
+    name[len] = '\0';
+
+    TPMT_RSA_DECRYPT s = { 0 };
+    s.scheme = tpm2_alg_util_from_optarg(name, tpm2_alg_util_flags_rsa_scheme);
+    if (s.scheme == TPM2_ALG_ERROR) {
+        LOG_ERR("Unknown RSA encryption scheme, got: \"%s\"", optarg);
+        return false;
+    }
+
+    if (halg) {
+        if (s.scheme != TPM2_ALG_OAEP) {
+            LOG_ERR("Only oaep takes a hash algorithm, got: \"%s\"", optarg);
+            return false;
+        }
+
+        s.details.oaep.hashAlg = tpm2_alg_util_from_optarg(halg + 1,
+                tpm2_alg_util_flags_hash);
+        if (s.details.oaep.hashAlg == TPM2_ALG_ERROR) {
+            LOG_ERR("Unknown OAEP hash algorithm, got: \"%s\"", halg + 1);
+            return false;
+        }
+    }
+
+    *scheme = s;
+
+    return true;
+}
+
 UINT16 tpm2_alg_util_get_hash_size(TPMI_ALG_HASH id) {
 
     switch (id) {
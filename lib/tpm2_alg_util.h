@@ -190,4 +190,17 @@ const char *tpm2_alg_util_ecc_to_str(TPM2_ECC_CURVE curve_id);
  */
 bool tpm2_alg_util_is_aes_size_valid(UINT16 size_in_bytes);
 
+/**
+ * Parses an RSA encryption scheme of the form <scheme>[-<hash>], where only
+ * oaep takes a hash algorithm, ie "rsaes", "null" or "oaep-sha256".
+ * @param optarg
+ *  The scheme string.
+ * @param scheme
+ *  The parsed scheme, only valid on a true return.
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_alg_util_rsa_decrypt_scheme_from_optarg(const char *optarg,
+        TPMT_RSA_DECRYPT *scheme);
+
 #endif /* LIB_TPM2_ALG_UTIL_H_ */
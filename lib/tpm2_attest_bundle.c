@@ -0,0 +1,587 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <tss2/tss2_mu.h>
+
+#include "log.h"
+#include "tpm2_attest_bundle.h"
+#include "tpm2_openssl.h"
+#include "tpm2_util.h"
+
+/* "ATTB", an attestation bundle */
+#define ATTEST_BUNDLE_MAGIC 0x41545442
+#define ATTEST_BUNDLE_VERSION 1
+
+/* magic, version and length */
+#define ATTEST_BUNDLE_HEADER_SIZE 12
+/* tag and length */
+#define ATTEST_BUNDLE_FIELD_HEADER_SIZE 6
+
+/* a field's tag is the position of its flag plus one */
+#define ATTEST_BUNDLE_TAG_ATTEST        1
+#define ATTEST_BUNDLE_TAG_SIGNATURE     2
+#define ATTEST_BUNDLE_TAG_PCR_SELECTION 3
+#define ATTEST_BUNDLE_TAG_PCR_VALUES    4
+#define ATTEST_BUNDLE_TAG_AK_PUBLIC     5
+#define ATTEST_BUNDLE_TAG_AK_NAME       6
+#define ATTEST_BUNDLE_TAG_EVENT_LOG     7
+
+#define TAG_FLAG(tag) (1 << ((tag) - 1))
+
+struct tpm2_attest_bundle_stream {
+    UINT8 *data;
+    size_t size;
+    size_t offset;
+    bool mapped;
+    UINT32 count;
+};
+
+typedef struct field_writer field_writer;
+struct field_writer {
+    UINT8 *buffer;
+    size_t size;
+    size_t offset;
+    size_t start;
+};
+
+static bool field_begin(field_writer *w, UINT16 tag) {
+
+    w->start = w->offset;
+    TSS2_RC rc = Tss2_MU_UINT16_Marshal(tag, w->buffer, w->size, &w->offset);
+    if (rc != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_UINT16_Marshal, rc);
+        return false;
+    }
+
+    /* the length is filled in by field_end() */
+    w->offset += sizeof(UINT32);
+
+    return w->offset <= w->size;
+}
+
+static bool field_end(field_writer *w) {
+
+    size_t at = w->start + sizeof(UINT16);
+    UINT32 length = w->offset - w->start - ATTEST_BUNDLE_FIELD_HEADER_SIZE;
+    TSS2_RC rc = Tss2_MU_UINT32_Marshal(length, w->buffer, w->size, &at);
+    if (rc != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_UINT32_Marshal, rc);
+        return false;
+    }
+
+    return true;
+}
+
+static bool field_bytes(field_writer *w, UINT16 tag, const void *bytes,
+        size_t size) {
+
+    if (!field_begin(w, tag) || size > w->size - w->offset) {
+        return false;
+    }
+
+    memcpy(&w->buffer[w->offset], bytes, size);
+    w->offset += size;
+
+    return field_end(w);
+}
+
+static bool write_fields(const tpm2_attest_bundle *bundle, field_writer *w) {
+
+    bool result = field_bytes(w, ATTEST_BUNDLE_TAG_ATTEST,
+            bundle->attest.attestationData, bundle->attest.size);
+    if (!result) {
+        return false;
+    }
+
+    TSS2_RC rc;
+    result = field_begin(w, ATTEST_BUNDLE_TAG_SIGNATURE);
+    if (!result) {
+        return false;
+    }
+    rc = Tss2_MU_TPMT_SIGNATURE_Marshal(&bundle->signature, w->buffer,
+            w->size, &w->offset);
+    if (rc != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_TPMT_SIGNATURE_Marshal, rc);
+        return false;
+    }
+    result = field_end(w);
+    if (!result) {
+        return false;
+    }
+
+    if (bundle->fields & TPM2_ATTEST_BUNDLE_PCR_SELECTION) {
+        result = field_begin(w, ATTEST_BUNDLE_TAG_PCR_SELECTION);
+        if (!result) {
+            return false;
+        }
+        rc = Tss2_MU_TPML_PCR_SELECTION_Marshal(&bundle->pcr_selection,
+                w->buffer, w->size, &w->offset);
+        if (rc != TSS2_RC_SUCCESS) {
+            LOG_PERR(Tss2_MU_TPML_PCR_SELECTION_Marshal, rc);
+            return false;
+        }
+        result = field_end(w);
+        if (!result) {
+            return false;
+        }
+    }
+
+    if (bundle->fields & TPM2_ATTEST_BUNDLE_PCR_VALUES) {
+        result = field_begin(w, ATTEST_BUNDLE_TAG_PCR_VALUES);
+        if (!result) {
+            return false;
+        }
+        rc = Tss2_MU_UINT32_Marshal(bundle->pcrs.count, w->buffer, w->size,
+                &w->offset);
+        if (rc != TSS2_RC_SUCCESS) {
+            LOG_PERR(Tss2_MU_UINT32_Marshal, rc);
+            return false;
+        }
+        size_t i;
+        for (i = 0; i < bundle->pcrs.count; i++) {
+            rc = Tss2_MU_TPML_DIGEST_Marshal(&bundle->pcrs.pcr_values[i],
+                    w->buffer, w->size, &w->offset);
+            if (rc != TSS2_RC_SUCCESS) {
+                LOG_PERR(Tss2_MU_TPML_DIGEST_Marshal, rc);
+                return false;
+            }
+        }
+        result = field_end(w);
+        if (!result) {
+            return false;
+        }
+    }
+
+    if (bundle->fields & TPM2_ATTEST_BUNDLE_AK_PUBLIC) {
+        result = field_begin(w, ATTEST_BUNDLE_TAG_AK_PUBLIC);
+        if (!result) {
+            return false;
+        }
+        rc = Tss2_MU_TPM2B_PUBLIC_Marshal(&bundle->ak_public, w->buffer,
+                w->size, &w->offset);
+        if (rc != TSS2_RC_SUCCESS) {
+            LOG_PERR(Tss2_MU_TPM2B_PUBLIC_Marshal, rc);
+            return false;
+        }
+        result = field_end(w);
+        if (!result) {
+            return false;
+        }
+    }
+
+    if (bundle->fields & TPM2_ATTEST_BUNDLE_AK_NAME) {
+        result = field_bytes(w, ATTEST_BUNDLE_TAG_AK_NAME,
+                bundle->ak_name.name, bundle->ak_name.size);
+        if (!result) {
+            return false;
+        }
+    }
+
+    if (bundle->fields & TPM2_ATTEST_BUNDLE_EVENT_LOG) {
+        result = field_bytes(w, ATTEST_BUNDLE_TAG_EVENT_LOG,
+                bundle->event_log, strlen(bundle->event_log));
+    }
+
+    return result;
+}
+
+bool tpm2_attest_bundle_save(const tpm2_attest_bundle *bundle,
+        const char *path) {
+
+    UINT32 required = TPM2_ATTEST_BUNDLE_ATTEST | TPM2_ATTEST_BUNDLE_SIGNATURE;
+    if ((bundle->fields & required) != required) {
+        LOG_ERR("An attestation bundle needs the attestation and signature");
+        return false;
+    }
+
+    /* no field marshals to more than its structure */
+    field_writer w = {
+        .size = sizeof(*bundle) + ATTEST_BUNDLE_HEADER_SIZE
+                + 7 * ATTEST_BUNDLE_FIELD_HEADER_SIZE,
+        .offset = ATTEST_BUNDLE_HEADER_SIZE,
+    };
+    w.buffer = malloc(w.size);
+    if (!w.buffer) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    FILE *f = NULL;
+    bool result = write_fields(bundle, &w);
+    if (!result) {
+        LOG_ERR("Could not marshal the attestation bundle");
+        goto out;
+    }
+
+    size_t header = 0;
+    TSS2_RC rc = Tss2_MU_UINT32_Marshal(ATTEST_BUNDLE_MAGIC, w.buffer, w.size,
+            &header);
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_UINT32_Marshal(ATTEST_BUNDLE_VERSION, w.buffer, w.size,
+                &header);
+    }
+    if (rc == TSS2_RC_SUCCESS) {
+        rc = Tss2_MU_UINT32_Marshal(w.offset - ATTEST_BUNDLE_HEADER_SIZE,
+                w.buffer, w.size, &header);
+    }
+    if (rc != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_UINT32_Marshal, rc);
+        result = false;
+        goto out;
+    }
+
+    f = fopen(path, "wb");
+    if (!f) {
+        LOG_ERR("Could not open file \"%s\", error: %s", path,
+                strerror(errno));
+        result = false;
+        goto out;
+    }
+
+    result = fwrite(w.buffer, 1, w.offset, f) == w.offset;
+    if (fclose(f) || !result) {
+        LOG_ERR("Could not write attestation bundle \"%s\"", path);
+        result = false;
+    }
+
+out:
+    free(w.buffer);
+    return result;
+}
+
+static bool read_stdin(tpm2_attest_bundle_stream *stream) {
+
+    size_t capacity = 0;
+    for (;;) {
+        if (stream->size == capacity) {
+            capacity = capacity ? 2 * capacity : 65536;
+            UINT8 *data = realloc(stream->data, capacity);
+            if (!data) {
+                LOG_ERR("oom");
+                return false;
+            }
+            stream->data = data;
+        }
+
+        size_t got = fread(&stream->data[stream->size], 1,
+                capacity - stream->size, stdin);
+        stream->size += got;
+        if (!got) {
+            break;
+        }
+    }
+
+    if (ferror(stdin)) {
+        LOG_ERR("Error reading attestation bundles from stdin");
+        return false;
+    }
+
+    return true;
+}
+
+static bool map_file(tpm2_attest_bundle_stream *stream, const char *path) {
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOG_ERR("Could not open file \"%s\", error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st)) {
+        LOG_ERR("Could not stat file \"%s\", error: %s", path,
+                strerror(errno));
+        close(fd);
+        return false;
+    }
+
+    /* an empty stream holds no bundles, and cannot be mapped */
+    if (!st.st_size) {
+        close(fd);
+        return true;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOG_ERR("Could not map file \"%s\", error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    stream->data = map;
+    stream->size = st.st_size;
+    stream->mapped = true;
+
+    return true;
+}
+
+tpm2_attest_bundle_stream *tpm2_attest_bundle_stream_open(const char *path) {
+
+    tpm2_attest_bundle_stream *stream = calloc(1, sizeof(*stream));
+    if (!stream) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    bool result = path ? map_file(stream, path) : read_stdin(stream);
+    if (!result) {
+        tpm2_attest_bundle_stream_close(stream);
+        return NULL;
+    }
+
+    return stream;
+}
+
+static bool unmarshal_32(const UINT8 *data, size_t size, size_t *offset,
+        UINT32 *value) {
+
+    return Tss2_MU_UINT32_Unmarshal(data, size, offset, value)
+            == TSS2_RC_SUCCESS;
+}
+
+static bool compute_name(const TPM2B_PUBLIC *public, TPM2B_NAME *name) {
+
+    UINT8 buffer[sizeof(TPMT_PUBLIC)];
+    size_t size = 0;
+    TSS2_RC rc = Tss2_MU_TPMT_PUBLIC_Marshal(&public->publicArea, buffer,
+            sizeof(buffer), &size);
+    if (rc != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_TPMT_PUBLIC_Marshal, rc);
+        return false;
+    }
+
+    TPM2B_DIGEST digest = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer);
+    bool result = tpm2_openssl_hash_compute_data(public->publicArea.nameAlg,
+            buffer, size, &digest);
+    if (!result) {
+        return false;
+    }
+
+    size_t offset = 0;
+    rc = Tss2_MU_UINT16_Marshal(public->publicArea.nameAlg, name->name,
+            sizeof(name->name), &offset);
+    if (rc != TSS2_RC_SUCCESS || digest.size > sizeof(name->name) - offset) {
+        return false;
+    }
+    memcpy(&name->name[offset], digest.buffer, digest.size);
+    name->size = offset + digest.size;
+
+    return true;
+}
+
+static bool parse_pcr_values(const UINT8 *value, size_t length,
+        tpm2_pcrs *pcrs) {
+
+    size_t offset = 0;
+    UINT32 count = 0;
+    if (!unmarshal_32(value, length, &offset, &count)
+            || count > ARRAY_LEN(pcrs->pcr_values)) {
+        return false;
+    }
+
+    pcrs->count = count;
+
+    UINT32 i;
+    for (i = 0; i < count; i++) {
+        TSS2_RC rc = Tss2_MU_TPML_DIGEST_Unmarshal(value, length, &offset,
+                &pcrs->pcr_values[i]);
+        if (rc != TSS2_RC_SUCCESS) {
+            return false;
+        }
+    }
+
+    return offset == length;
+}
+
+static bool parse_field(UINT16 tag, const UINT8 *value, size_t length,
+        tpm2_attest_bundle *bundle) {
+
+    size_t offset = 0;
+    TSS2_RC rc = TSS2_RC_SUCCESS;
+
+    switch (tag) {
+    case ATTEST_BUNDLE_TAG_ATTEST:
+        if (length > sizeof(bundle->attest.attestationData)) {
+            return false;
+        }
+        memcpy(bundle->attest.attestationData, value, length);
+        bundle->attest.size = length;
+        return true;
+    case ATTEST_BUNDLE_TAG_SIGNATURE:
+        rc = Tss2_MU_TPMT_SIGNATURE_Unmarshal(value, length, &offset,
+                &bundle->signature);
+        break;
+    case ATTEST_BUNDLE_TAG_PCR_SELECTION:
+        rc = Tss2_MU_TPML_PCR_SELECTION_Unmarshal(value, length, &offset,
+                &bundle->pcr_selection);
+        break;
+    case ATTEST_BUNDLE_TAG_PCR_VALUES:
+        return parse_pcr_values(value, length, &bundle->pcrs);
+    case ATTEST_BUNDLE_TAG_AK_PUBLIC:
+        rc = Tss2_MU_TPM2B_PUBLIC_Unmarshal(value, length, &offset,
+                &bundle->ak_public);
+        break;
+    case ATTEST_BUNDLE_TAG_AK_NAME:
+        if (length > sizeof(bundle->ak_name.name)) {
+            return false;
+        }
+        memcpy(bundle->ak_name.name, value, length);
+        bundle->ak_name.size = length;
+        return true;
+    case ATTEST_BUNDLE_TAG_EVENT_LOG:
+        if (length >= sizeof(bundle->event_log)
+                || memchr(value, '\0', length)) {
+            return false;
+        }
+        memcpy(bundle->event_log, value, length);
+        bundle->event_log[length] = '\0';
+        return true;
+    }
+
+    return rc == TSS2_RC_SUCCESS && offset == length;
+}
+
+static bool parse_fields(const UINT8 *data, size_t size,
+        tpm2_attest_bundle *bundle) {
+
+    size_t offset = 0;
+    while (offset < size) {
+        UINT16 tag = 0;
+        UINT32 length = 0;
+        TSS2_RC rc = Tss2_MU_UINT16_Unmarshal(data, size, &offset, &tag);
+        if (rc != TSS2_RC_SUCCESS || !unmarshal_32(data, size, &offset,
+                &length) || length > size - offset) {
+            LOG_ERR("Truncated field");
+            return false;
+        }
+
+        const UINT8 *value = &data[offset];
+        offset += length;
+
+        /* fields of later versions are skipped */
+        if (tag < ATTEST_BUNDLE_TAG_ATTEST
+                || tag > ATTEST_BUNDLE_TAG_EVENT_LOG) {
+            continue;
+        }
+
+        if (bundle->fields & TAG_FLAG(tag)) {
+            LOG_ERR("Field %u appears twice", tag);
+            return false;
+        }
+
+        bool result = parse_field(tag, value, length, bundle);
+        if (!result) {
+            LOG_ERR("Malformed field %u", tag);
+            return false;
+        }
+        bundle->fields |= TAG_FLAG(tag);
+    }
+
+    UINT32 required = TPM2_ATTEST_BUNDLE_ATTEST | TPM2_ATTEST_BUNDLE_SIGNATURE;
+    if ((bundle->fields & required) != required) {
+        LOG_ERR("Missing the attestation or its signature");
+        return false;
+    }
+
+    if ((bundle->fields & TPM2_ATTEST_BUNDLE_PCR_VALUES)
+            && !(bundle->fields & TPM2_ATTEST_BUNDLE_PCR_SELECTION)) {
+        LOG_ERR("PCR values without their selection");
+        return false;
+    }
+
+    /* the name of the AK is always the one of its public, never as given */
+    if (bundle->fields & TPM2_ATTEST_BUNDLE_AK_PUBLIC) {
+        TPM2B_NAME name;
+        bool result = compute_name(&bundle->ak_public, &name);
+        if (!result) {
+            LOG_ERR("Could not compute the AK name");
+            return false;
+        }
+
+        if ((bundle->fields & TPM2_ATTEST_BUNDLE_AK_NAME)
+                && (name.size != bundle->ak_name.size
+                || memcmp(name.name, bundle->ak_name.name, name.size))) {
+            LOG_ERR("AK name does not match the AK public");
+            return false;
+        }
+
+        bundle->ak_name = name;
+        bundle->fields |= TPM2_ATTEST_BUNDLE_AK_NAME;
+    }
+
+    return true;
+}
+
+bool tpm2_attest_bundle_stream_next(tpm2_attest_bundle_stream *stream,
+        tpm2_attest_bundle *bundle, bool *done) {
+
+    *done = stream->offset == stream->size;
+    if (*done) {
+        return true;
+    }
+
+    memset(bundle, 0, sizeof(*bundle));
+
+    size_t offset = stream->offset;
+    UINT32 magic = 0;
+    UINT32 version = 0;
+    UINT32 length = 0;
+    bool result = unmarshal_32(stream->data, stream->size, &offset, &magic)
+            && unmarshal_32(stream->data, stream->size, &offset, &version)
+            && unmarshal_32(stream->data, stream->size, &offset, &length);
+    if (!result || magic != ATTEST_BUNDLE_MAGIC) {
+        LOG_ERR("Bundle %u is not an attestation bundle", stream->count);
+        goto error;
+    }
+
+    if (version != ATTEST_BUNDLE_VERSION) {
+        LOG_ERR("Bundle %u has unsupported version %u", stream->count,
+                version);
+        goto error;
+    }
+
+    if (length > stream->size - offset) {
+        LOG_ERR("Bundle %u is truncated", stream->count);
+        goto error;
+    }
+
+    result = parse_fields(&stream->data[offset], length, bundle);
+    if (!result) {
+        LOG_ERR("Bundle %u is malformed", stream->count);
+        goto error;
+    }
+
+    stream->offset = offset + length;
+    stream->count++;
+
+    return true;
+
+error:
+    /* nothing after a malformed bundle can be trusted to start a bundle */
+    stream->offset = stream->size;
+    return false;
+}
+
+void tpm2_attest_bundle_stream_close(tpm2_attest_bundle_stream *stream) {
+
+    if (!stream) {
+        return;
+    }
+
+    if (stream->mapped) {
+        munmap(stream->data, stream->size);
+    } else {
+        free(stream->data);
+    }
+
+    free(stream);
+}
@@ -0,0 +1,93 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_ATTEST_BUNDLE_H_
+#define LIB_TPM2_ATTEST_BUNDLE_H_
+
+#include <limits.h>
+#include <stdbool.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+#include "pcr.h"
+
+/* the fields of a bundle, set in fields when present */
+#define TPM2_ATTEST_BUNDLE_ATTEST        (1 << 0)
+#define TPM2_ATTEST_BUNDLE_SIGNATURE     (1 << 1)
+#define TPM2_ATTEST_BUNDLE_PCR_SELECTION (1 << 2)
+#define TPM2_ATTEST_BUNDLE_PCR_VALUES    (1 << 3)
+#define TPM2_ATTEST_BUNDLE_AK_PUBLIC     (1 << 4)
+#define TPM2_ATTEST_BUNDLE_AK_NAME       (1 << 5)
+#define TPM2_ATTEST_BUNDLE_EVENT_LOG     (1 << 6)
+
+/*
+ * Everything a verifier needs of one attestation in a single file: the
+ * TPMS_ATTEST as signed, its signature, the PCR selection and values quoted,
+ * the public area and name of the AK and where to find the event log.
+ * When a parsed bundle carries the AK public, its name is computed from it.
+ *
+ * On disk a bundle is a big endian magic, version and length followed by
+ * that many bytes of fields, each a tag, a length and the TSS marshaled
+ * value. Fields with unknown tags are skipped, and as a bundle carries its
+ * length, bundles are concatenated into a stream as they are.
+ */
+typedef struct tpm2_attest_bundle tpm2_attest_bundle;
+struct tpm2_attest_bundle {
+    UINT32 fields;
+    TPM2B_ATTEST attest;
+    TPMT_SIGNATURE signature;
+    TPML_PCR_SELECTION pcr_selection;
+    tpm2_pcrs pcrs;
+    TPM2B_PUBLIC ak_public;
+    TPM2B_NAME ak_name;
+    char event_log[PATH_MAX];
+};
+
+/* a stream of concatenated bundles being read */
+typedef struct tpm2_attest_bundle_stream tpm2_attest_bundle_stream;
+
+/**
+ * Writes a bundle to a file, replacing it. Append bundles with cat to build
+ * a stream.
+ * @param bundle
+ *  The bundle, with the attestation and its signature at least.
+ * @param path
+ *  The file path.
+ * @return
+ *  true on success, false on error.
+ */
+bool tpm2_attest_bundle_save(const tpm2_attest_bundle *bundle,
+        const char *path);
+
+/**
+ * Opens a stream of bundles, mapping a file or reading stdin whole.
+ * @param path
+ *  The file path or NULL for stdin.
+ * @return
+ *  The stream or NULL on error, close it with
+ *  tpm2_attest_bundle_stream_close().
+ */
+tpm2_attest_bundle_stream *tpm2_attest_bundle_stream_open(const char *path);
+
+/**
+ * Parses the next bundle of a stream.
+ * @param stream
+ *  The stream.
+ * @param bundle
+ *  The bundle.
+ * @param done
+ *  Set to true at the end of the stream, when no bundle was parsed.
+ * @return
+ *  true on success or at the end of the stream, false on a malformed
+ *  bundle, after which the stream cannot be read on.
+ */
+bool tpm2_attest_bundle_stream_next(tpm2_attest_bundle_stream *stream,
+        tpm2_attest_bundle *bundle, bool *done);
+
+/**
+ * Closes a stream.
+ * @param stream
+ *  The stream to close, may be NULL.
+ */
+void tpm2_attest_bundle_stream_close(tpm2_attest_bundle_stream *stream);
+
+#endif /* LIB_TPM2_ATTEST_BUNDLE_H_ */
@@ -161,33 +161,65 @@ static tool_rc handle_session(ESYS_CONTEXT *ectx, const char *path,
     return tool_rc_success;
 }
 
-static tool_rc handle_pcr(ESYS_CONTEXT *ectx, const char *policy, tpm2_session **session) {
+bool tpm2_auth_util_is_pcr(const char *auth) {
 
-    policy += PCR_PREFIX_LEN;
+    return auth && !strncmp(auth, PCR_PREFIX, PCR_PREFIX_LEN);
+}
 
-    tool_rc rc = tool_rc_general_error;
+bool tpm2_auth_util_parse_pcr(const char *auth, TPML_PCR_SELECTION *pcrs,
+        char **raw_path) {
+
+    if (!tpm2_auth_util_is_pcr(auth)) {
+        LOG_ERR("Expected a \"%s\" prefixed authorization, got: \"%s\"",
+                PCR_PREFIX, auth ? auth : "");
+        return false;
+    }
 
-    char *dup = strdup(policy);
+    char *dup = strdup(auth + PCR_PREFIX_LEN);
     if (!dup) {
         LOG_ERR("oom");
-        return tool_rc_general_error;
+        return false;
     }
 
-    const char *pcr_str = dup;
-    const char *raw_path = NULL;
+    const char *path = NULL;
     char *split = strchr(dup, '=');
     if (split) {
         *split = '\0';
-        raw_path = split + 1;
-        raw_path = raw_path[0] == '\0' ? NULL : raw_path;
+        path = split + 1;
+        path = path[0] == '\0' ? NULL : path;
     }
 
-    TPML_PCR_SELECTION pcrs;
-    bool ret = pcr_parse_selections(pcr_str, &pcrs);
+    bool ret = pcr_parse_selections(dup, pcrs);
     if (!ret) {
         goto out;
     }
 
+    *raw_path = NULL;
+    if (path) {
+        *raw_path = strdup(path);
+        if (!*raw_path) {
+            LOG_ERR("oom");
+            ret = false;
+        }
+    }
+
+out:
+    free(dup);
+
+    return ret;
+}
+
+static tool_rc handle_pcr(ESYS_CONTEXT *ectx, const char *policy, tpm2_session **session) {
+
+    tool_rc rc = tool_rc_general_error;
+
+    TPML_PCR_SELECTION pcrs;
+    char *raw_path = NULL;
+    bool ret = tpm2_auth_util_parse_pcr(policy, &pcrs, &raw_path);
+    if (!ret) {
+        return tool_rc_general_error;
+    }
+
     tpm2_session_data *d = tpm2_session_data_new(TPM2_SE_POLICY);
     if (!d) {
         LOG_ERR("oom");
@@ -214,7 +246,30 @@ static tool_rc handle_pcr(ESYS_CONTEXT *ectx, const char *policy, tpm2_session *
     rc = tool_rc_success;
 
 out:
-    free(dup);
+    free(raw_path);
+
+    return rc;
+}
+
+tool_rc tpm2_auth_util_restart_pcr(ESYS_CONTEXT *ectx, const char *auth,
+        tpm2_session *session) {
+
+    if (tpm2_session_get_type(session) != TPM2_SE_POLICY) {
+        LOG_ERR("A \"%s\" authorization requires a policy session",
+                PCR_PREFIX);
+        return tool_rc_general_error;
+    }
+
+    TPML_PCR_SELECTION pcrs;
+    char *raw_path = NULL;
+    bool ret = tpm2_auth_util_parse_pcr(auth, &pcrs, &raw_path);
+    if (!ret) {
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tpm2_policy_restart_pcr(ectx, session, raw_path, &pcrs);
+
+    free(raw_path);
 
     return rc;
 }
@@ -334,7 +389,7 @@ tool_rc tpm2_auth_util_from_optarg(ESYS_CONTEXT *ectx, const char *password,
     }
 
     /* starts with pcr: */
-    bool is_pcr = !strncmp(password, PCR_PREFIX, PCR_PREFIX_LEN);
+    bool is_pcr = tpm2_auth_util_is_pcr(password);
     if (is_pcr) {
         return handle_pcr(ectx, password, session);
     }
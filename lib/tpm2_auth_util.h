@@ -44,6 +44,51 @@ tool_rc tpm2_auth_util_from_optarg(ESYS_CONTEXT *ctx,
         tpm2_session **session,
         bool is_restricted);
 
+/**
+ * Checks whether an authorization string uses the "pcr:" prefix.
+ *
+ * @param auth
+ *  The authorization string, may be NULL.
+ * @return
+ *  True if it is a PCR policy authorization, false otherwise.
+ */
+bool tpm2_auth_util_is_pcr(const char *auth);
+
+/**
+ * Parses a "pcr:<selection>[=<pcr values file>]" authorization string without
+ * starting a session, so callers can satisfy the same PolicyPCR many times.
+ *
+ * @param auth
+ *  The authorization string, including the "pcr:" prefix.
+ * @param pcrs
+ *  The parsed PCR selection.
+ * @param raw_path
+ *  The PCR values file, or NULL when the PCRs should be read from the TPM.
+ *  When set, the caller must free it.
+ * @return
+ *  True on success, false otherwise.
+ */
+bool tpm2_auth_util_parse_pcr(const char *auth, TPML_PCR_SELECTION *pcrs,
+        char **raw_path);
+
+/**
+ * Satisfies a "pcr:" authorization again on a policy session previously
+ * returned by tpm2_auth_util_from_optarg(). The session is reset with
+ * PolicyRestart rather than starting a new one, and the PCR digest comes
+ * from the cache kept by tpm2_policy_get_pcr_digest().
+ *
+ * @param ectx
+ *  Enhanced System API (ESAPI) context
+ * @param auth
+ *  The "pcr:" authorization string.
+ * @param session
+ *  A started policy session.
+ * @return
+ *  A tool_rc indicating status.
+ */
+tool_rc tpm2_auth_util_restart_pcr(ESYS_CONTEXT *ectx, const char *auth,
+        tpm2_session *session);
+
 /**
  * Set up authorisation for a handle and return a session handle for use in
  * ESAPI calls.
@@ -1,5 +1,6 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <inttypes.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
@@ -127,51 +128,114 @@ tool_rc tpm2_capability_get (ESYS_CONTEXT *ectx,
     return tool_rc_success;
 }
 
-tool_rc tpm2_capability_find_vacant_persistent_handle (ESYS_CONTEXT *ctx,
-        UINT32 *vacant) {
+static int handle_cmp(const void *a, const void *b) {
+
+    TPM2_HANDLE x = *(const TPM2_HANDLE *)a;
+    TPM2_HANDLE y = *(const TPM2_HANDLE *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+tool_rc tpm2_capability_find_vacant_persistent_handles (ESYS_CONTEXT *ctx,
+        TPMI_RH_PROVISION hierarchy, UINT32 count,
+        TPMI_DH_PERSISTENT *vacant) {
 
+    if (!count) {
+        return tool_rc_success;
+    }
+
+    TPM2_HANDLE first = TPM2_PERSISTENT_FIRST;
+    TPM2_HANDLE last = TPM2_OWNER_PERSISTENT_LAST;
+    if (hierarchy == TPM2_RH_PLATFORM) {
+        first = TPM2_PLATFORM_PERSISTENT_FIRST;
+        last = TPM2_PERSISTENT_LAST;
+    }
+
+    /* one snapshot of the in-use handles, starting at the sub-range */
     TPMS_CAPABILITY_DATA *capability_data;
-    bool handle_found = false;
-    tool_rc rc = tpm2_capability_get(ctx, TPM2_CAP_HANDLES,
-                    TPM2_PERSISTENT_FIRST, TPM2_MAX_CAP_HANDLES,
-                    &capability_data);
+    tool_rc rc = tpm2_capability_get(ctx, TPM2_CAP_HANDLES, first,
+            TPM2_MAX_CAP_HANDLES, &capability_data);
     if (rc != tool_rc_success) {
         return rc;
     }
 
-    UINT32 count = capability_data->data.handles.count;
-    if (count == 0) {
-        /* There aren't any persistent handles, so use the first */
-        *vacant = TPM2_PERSISTENT_FIRST;
-        handle_found = true;
-    } else if (count == TPM2_MAX_CAP_HANDLES) {
-        /* All persistent handles are already in use */
-        goto out;
-    } else if (count < TPM2_MAX_CAP_HANDLES) {
-        /* iterate over used handles to ensure we're selecting
-            the next available handle. */
-        UINT32 i;
-        for (i = TPM2_PERSISTENT_FIRST;
-            i <= (UINT32)TPM2_PERSISTENT_LAST;
-            ++i) {
-            bool inuse = false;
-            UINT32 c;
-            for (c = 0; c < count; ++c) {
-                if (capability_data->data.handles.handle[c] == i) {
-                    inuse = true;
-                    break;
-                }
-            }
+    /*
+     * The TPM reports handles in ascending order, but don't rely on it. With
+     * a sorted set a single merge walk yields the vacant handles, rather than
+     * rescanning the in-use list for every candidate.
+     */
+    TPML_HANDLE *used = &capability_data->data.handles;
+    qsort(used->handle, used->count, sizeof(used->handle[0]), handle_cmp);
+
+    /*
+     * A full snapshot says nothing about the handles past its last entry, so
+     * don't hand those out.
+     */
+    if (used->count == TPM2_MAX_CAP_HANDLES
+            && used->handle[used->count - 1] < last) {
+        last = used->handle[used->count - 1];
+    }
 
-            if (!inuse) {
-                *vacant = i;
-                handle_found = true;
-                break;
-            }
+    UINT32 found = 0;
+    UINT32 i = 0;
+    TPM2_HANDLE candidate = first;
+    while (found < count) {
+
+        while (i < used->count && used->handle[i] < candidate) {
+            i++;
         }
+
+        if (i >= used->count || used->handle[i] != candidate) {
+            vacant[found++] = candidate;
+        }
+
+        if (candidate == last) {
+            break;
+        }
+        candidate++;
     }
 
-out:
     free(capability_data);
-    return handle_found ? tool_rc_success : tool_rc_general_error;
+
+    if (found < count) {
+        LOG_ERR("Only %"PRIu32" of %"PRIu32" requested persistent handles are"
+                " vacant in range 0x%x - 0x%x", found, count, first, last);
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_capability_find_vacant_persistent_handle (ESYS_CONTEXT *ctx,
+        TPMI_RH_PROVISION hierarchy, UINT32 *vacant) {
+
+    return tpm2_capability_find_vacant_persistent_handles(ctx, hierarchy, 1,
+            vacant);
+}
+
+tool_rc tpm2_capability_get_tpm_property(ESYS_CONTEXT *ctx,
+        TPM2_PT property, UINT32 *value) {
+
+    TPMS_CAPABILITY_DATA *cap_data = NULL;
+    TPMI_YES_NO more_data;
+    tool_rc rc = tpm2_get_capability(ctx, ESYS_TR_NONE, ESYS_TR_NONE,
+            ESYS_TR_NONE, TPM2_CAP_TPM_PROPERTIES, property, 1, &more_data,
+            &cap_data);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    /* a property the TPM lacks is skipped for the next one it has */
+    TPML_TAGGED_TPM_PROPERTY *props = &cap_data->data.tpmProperties;
+    if (!props->count || props->tpmProperty[0].property != property) {
+        LOG_ERR("TPM did not report property 0x%x", property);
+        free(cap_data);
+        return tool_rc_general_error;
+    }
+
+    *value = props->tpmProperty[0].value;
+
+    free(cap_data);
+
+    return tool_rc_success;
 }
@@ -5,6 +5,8 @@
 
 #include <tss2/tss2_esys.h>
 
+#include "tool_rc.h"
+
 /**
  * Invokes GetCapability to retrieve the current value of a capability from the
  * TPM.
@@ -27,16 +29,62 @@ tool_rc tpm2_capability_get (ESYS_CONTEXT *context,
         UINT32 count,
         TPMS_CAPABILITY_DATA **capability_data);
 
+/*
+ * Per the TCG handle registry the persistent range is split in two halves, the
+ * lower one is allocated by the owner and the upper one by the platform.
+ */
+#define TPM2_PLATFORM_PERSISTENT_FIRST (TPM2_PERSISTENT_FIRST + 0x00800000)
+#define TPM2_OWNER_PERSISTENT_LAST     (TPM2_PLATFORM_PERSISTENT_FIRST - 1)
+
 /**
  * Attempts to find a vacant handle in the persistent handle namespace.
  * @param ctx
  *  Enhanced System API (ESAPI) context
+ * @param hierarchy
+ *  TPM2_RH_PLATFORM to search the platform sub-range, otherwise the owner
+ *  sub-range is searched.
  * @param vacant
  *  the vacant handle found by the function if True returned
  * @return
  *  tool_rc indicating status.
  */
 tool_rc tpm2_capability_find_vacant_persistent_handle (ESYS_CONTEXT *ctx,
-        UINT32 *vacant);
+        TPMI_RH_PROVISION hierarchy, UINT32 *vacant);
+
+/**
+ * Reserves count vacant handles in the persistent handle namespace from a
+ * single TPM2_CAP_HANDLES snapshot. The handles are returned in ascending
+ * order and are only a plan, nothing is persisted by this call.
+ * @param ctx
+ *  Enhanced System API (ESAPI) context
+ * @param hierarchy
+ *  TPM2_RH_PLATFORM to search the platform sub-range, otherwise the owner
+ *  sub-range is searched.
+ * @param count
+ *  the number of vacant handles to find.
+ * @param vacant
+ *  An array of at least count elements populated with the vacant handles.
+ * @return
+ *  tool_rc indicating status, an error is returned if fewer than count
+ *  handles are vacant.
+ */
+tool_rc tpm2_capability_find_vacant_persistent_handles (ESYS_CONTEXT *ctx,
+        TPMI_RH_PROVISION hierarchy, UINT32 count,
+        TPMI_DH_PERSISTENT *vacant);
+
+/**
+ * Reads a single TPM property with GetCapability(TPM_PROPERTIES).
+ * @param ctx
+ *  Enhanced System API (ESAPI) context
+ * @param property
+ *  The property to read, a TPM2_PT_* value.
+ * @param value
+ *  The value of the property.
+ * @return
+ *  tool_rc indicating status, an error is returned if the TPM does not
+ *  report the property.
+ */
+tool_rc tpm2_capability_get_tpm_property(ESYS_CONTEXT *ctx,
+        TPM2_PT property, UINT32 *value);
 
 #endif /* LIB_TPM2_CAPABILITY_H_ */
@@ -66,9 +66,8 @@ bool tpm2_convert_pubkey_save(TPM2B_PUBLIC *public, tpm2_convert_pubkey_fmt form
     return false;
 }
 
-static bool convert_pubkey_RSA(TPMT_PUBLIC *public, tpm2_convert_pubkey_fmt format, FILE *fp) {
+RSA *tpm2_convert_pubkey_to_rsa(TPMT_PUBLIC *public) {
 
-    bool ret = false;
     RSA *ssl_rsa_key = NULL;
     BIGNUM *e = NULL, *n = NULL;
 
@@ -104,8 +103,30 @@ static bool convert_pubkey_RSA(TPMT_PUBLIC *public, tpm2_convert_pubkey_fmt form
     }
 #endif
 
-    /* modulus and exponent components are now owned by the RSA struct */
-    n = e = NULL;
+    return ssl_rsa_key;
+
+error:
+    if (n) {
+        BN_free(n);
+    }
+    if (e) {
+        BN_free(e);
+    }
+    if (ssl_rsa_key) {
+        RSA_free(ssl_rsa_key);
+    }
+
+    return NULL;
+}
+
+static bool convert_pubkey_RSA(TPMT_PUBLIC *public, tpm2_convert_pubkey_fmt format, FILE *fp) {
+
+    bool ret = false;
+
+    RSA *ssl_rsa_key = tpm2_convert_pubkey_to_rsa(public);
+    if (!ssl_rsa_key) {
+        return false;
+    }
 
     int ssl_res = 0;
 
@@ -129,20 +150,12 @@ static bool convert_pubkey_RSA(TPMT_PUBLIC *public, tpm2_convert_pubkey_fmt form
     ret = true;
 
 error:
-    if (n) {
-        BN_free(n);
-    }
-    if (e) {
-        BN_free(e);
-    }
-    if (ssl_rsa_key) {
-        RSA_free(ssl_rsa_key);
-    }
+    RSA_free(ssl_rsa_key);
 
     return ret;
 }
 
-static bool convert_pubkey_ECC(TPMT_PUBLIC *public, tpm2_convert_pubkey_fmt format, FILE *fp) {
+static EC_KEY *convert_pubkey_to_ec_key(TPMT_PUBLIC *public) {
 
     BIGNUM *x = NULL;
     BIGNUM *y = NULL;
@@ -157,7 +170,7 @@ static bool convert_pubkey_ECC(TPMT_PUBLIC *public, tpm2_convert_pubkey_fmt form
 
     int nid = tpm2_ossl_curve_to_nid(tpm_ecc->curveID);
     if (nid < 0) {
-        return false;
+        return NULL;
     }
 
     /*
@@ -166,7 +179,7 @@ static bool convert_pubkey_ECC(TPMT_PUBLIC *public, tpm2_convert_pubkey_fmt form
     key = EC_KEY_new_by_curve_name(nid);
     if (!key) {
         print_ssl_error("Failed to create EC key from nid");
-        return false;
+        return NULL;
     }
 
     group = EC_KEY_get0_group(key);
@@ -209,6 +222,34 @@ static bool convert_pubkey_ECC(TPMT_PUBLIC *public, tpm2_convert_pubkey_fmt form
         goto out;
     }
 
+    result = true;
+
+out:
+    if (x) {
+        BN_free(x);
+    }
+    if (y) {
+        BN_free(y);
+    }
+    if (point) {
+        EC_POINT_free(point);
+    }
+    if (!result) {
+        EC_KEY_free(key);
+        key = NULL;
+    }
+
+    return key;
+}
+
+static bool convert_pubkey_ECC(TPMT_PUBLIC *public, tpm2_convert_pubkey_fmt format, FILE *fp) {
+
+    EC_KEY *key = convert_pubkey_to_ec_key(public);
+    if (!key) {
+        return false;
+    }
+
+    bool result = false;
     int ssl_res = 0;
 
     switch(format) {
@@ -231,20 +272,42 @@ static bool convert_pubkey_ECC(TPMT_PUBLIC *public, tpm2_convert_pubkey_fmt form
     result = true;
 
 out:
-    if (x) {
-        BN_free(x);
-    }
-    if (y) {
-        BN_free(y);
-    }
-    if (point) {
-        EC_POINT_free(point);
+    EC_KEY_free(key);
+
+    return result;
+}
+
+EVP_PKEY *tpm2_convert_pubkey_to_evp(TPMT_PUBLIC *public) {
+
+    EVP_PKEY *pkey = EVP_PKEY_new();
+    if (!pkey) {
+        print_ssl_error("Failed to allocate OpenSSL key");
+        return NULL;
     }
-    if (key) {
-        EC_KEY_free(key);
+
+    switch(public->type) {
+    case TPM2_ALG_RSA: {
+        RSA *rsa = tpm2_convert_pubkey_to_rsa(public);
+        if (rsa && EVP_PKEY_assign_RSA(pkey, rsa)) {
+            return pkey;
+        }
+        RSA_free(rsa);
+    } break;
+    case TPM2_ALG_ECC: {
+        EC_KEY *ec = convert_pubkey_to_ec_key(public);
+        if (ec && EVP_PKEY_assign_EC_KEY(pkey, ec)) {
+            return pkey;
+        }
+        EC_KEY_free(ec);
+    } break;
+    default:
+        LOG_ERR("Unsupported key type 0x%x, only RSA and ECC keys can be "
+                "converted", public->type);
     }
 
-    return result;
+    EVP_PKEY_free(pkey);
+
+    return NULL;
 }
 
 static bool tpm2_convert_pubkey_ssl(TPMT_PUBLIC *public, tpm2_convert_pubkey_fmt format, const char *path) {
@@ -554,3 +617,123 @@ nomem:
     LOG_ERR("%s: couldn't allocate memory", __func__);
     return NULL;
 }
+
+bool tpm2_convert_sig_check_key(const TPMT_PUBLIC *public,
+        const TPMT_SIGNATURE *signature) {
+
+    if (!(public->objectAttributes & TPMA_OBJECT_SIGN_ENCRYPT)) {
+        LOG_ERR("The key is not a signing key, sign is not set");
+        return false;
+    }
+
+    /* the scheme of a key binds its signatures, a NULL scheme allows any */
+    const TPMT_ASYM_SCHEME *scheme = &public->parameters.asymDetail.scheme;
+    if (scheme->scheme == TPM2_ALG_NULL) {
+        return true;
+    }
+
+    if (signature->sigAlg != scheme->scheme) {
+        LOG_ERR("Signature scheme 0x%x is not the key's scheme 0x%x",
+                signature->sigAlg, scheme->scheme);
+        return false;
+    }
+
+    if (signature->signature.any.hashAlg != scheme->details.anySig.hashAlg) {
+        LOG_ERR("Signature hash algorithm 0x%x is not the key's 0x%x",
+                signature->signature.any.hashAlg,
+                scheme->details.anySig.hashAlg);
+        return false;
+    }
+
+    return true;
+}
+
+bool tpm2_convert_sig_verify(EVP_PKEY *pkey, TPMT_SIGNATURE *signature,
+        TPM2B_DIGEST *digest) {
+
+    TPMI_ALG_HASH halg;
+    int padding = 0;
+    switch (signature->sigAlg) {
+    case TPM2_ALG_RSASSA:
+        halg = signature->signature.rsassa.hash;
+        padding = RSA_PKCS1_PADDING;
+        break;
+    case TPM2_ALG_RSAPSS:
+        halg = signature->signature.rsapss.hash;
+        padding = RSA_PKCS1_PSS_PADDING;
+        break;
+    case TPM2_ALG_ECDSA:
+        halg = signature->signature.ecdsa.hash;
+        break;
+    default:
+        LOG_ERR("Unsupported signature scheme 0x%x, only rsassa, rsapss and "
+                "ecdsa can be verified with OpenSSL", signature->sigAlg);
+        return false;
+    }
+
+    const EVP_MD *md = tpm2_openssl_halg_from_tpmhalg(halg);
+    if (!md) {
+        LOG_ERR("Unsupported signature hash algorithm 0x%x", halg);
+        return false;
+    }
+
+    UINT16 size;
+    UINT8 *sig = tpm2_convert_sig(&size, signature);
+    if (!sig) {
+        return false;
+    }
+
+    bool result = false;
+
+    EVP_PKEY_CTX *pctx = EVP_PKEY_CTX_new(pkey, NULL);
+    if (!pctx) {
+        print_ssl_error("Failed to allocate OpenSSL key context");
+        goto out;
+    }
+
+    int rc = EVP_PKEY_verify_init(pctx);
+    if (rc <= 0) {
+        print_ssl_error("Failed to initialize signature verification");
+        goto out;
+    }
+
+    rc = EVP_PKEY_CTX_set_signature_md(pctx, md);
+    if (rc <= 0) {
+        print_ssl_error("Failed to set signature hash algorithm");
+        goto out;
+    }
+
+    if (padding) {
+        rc = EVP_PKEY_CTX_set_rsa_padding(pctx, padding);
+        if (rc <= 0) {
+            print_ssl_error("Failed to set RSA padding");
+            goto out;
+        }
+    }
+
+    /*
+     * TPMs differ on the PSS salt length, the digest size or the largest
+     * that fits, so -2 lets OpenSSL take it from the signature.
+     */
+    if (padding == RSA_PKCS1_PSS_PADDING) {
+        rc = EVP_PKEY_CTX_set_rsa_pss_saltlen(pctx, -2);
+        if (rc <= 0) {
+            print_ssl_error("Failed to set RSA PSS salt length");
+            goto out;
+        }
+    }
+
+    rc = EVP_PKEY_verify(pctx, sig, size, digest->buffer, digest->size);
+    if (rc < 0) {
+        print_ssl_error("Failed to verify signature");
+        goto out;
+    }
+
+    result = rc == 1;
+
+out:
+    EVP_PKEY_CTX_free(pctx);
+    free(sig);
+
+    return result;
+}
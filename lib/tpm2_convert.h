@@ -7,6 +7,9 @@
 
 #include <tss2/tss2_sys.h>
 
+#include <openssl/evp.h>
+#include <openssl/rsa.h>
+
 typedef enum tpm2_convert_pubkey_fmt tpm2_convert_pubkey_fmt;
 enum tpm2_convert_pubkey_fmt {
     pubkey_format_tss,
@@ -41,6 +44,31 @@ tpm2_convert_pubkey_fmt tpm2_convert_pubkey_fmt_from_optarg(const char *label);
  */
 bool tpm2_convert_pubkey_save(TPM2B_PUBLIC *public, tpm2_convert_pubkey_fmt format, const char *path);
 
+/**
+ * Converts the public portion of a TPM RSA key into an OpenSSL RSA key, a
+ * zero exponent standing for the default of 65537.
+ *
+ * LOG_ERR is used to communicate errors.
+ *
+ * @param public
+ *  The public area of the RSA key.
+ * @return
+ *  NULL on error or the key, to be freed by the caller via RSA_free().
+ */
+RSA *tpm2_convert_pubkey_to_rsa(TPMT_PUBLIC *public);
+
+/**
+ * Converts the public portion of a TPM RSA or ECC key into an OpenSSL key.
+ *
+ * LOG_ERR is used to communicate errors.
+ *
+ * @param public
+ *  The public area of the key.
+ * @return
+ *  NULL on error or the key, to be freed by the caller via EVP_PKEY_free().
+ */
+EVP_PKEY *tpm2_convert_pubkey_to_evp(TPMT_PUBLIC *public);
+
 /**
  * Parses the given command line signature format option string and returns
  * the corresponding signature_format enum value.
@@ -92,4 +120,41 @@ UINT8 *tpm2_convert_sig(UINT16 *size, TPMT_SIGNATURE *signature);
 bool tpm2_convert_sig_load(const char *path, tpm2_convert_sig_fmt format, TPMI_ALG_SIG_SCHEME sig_alg,
         TPMI_ALG_HASH halg, TPMT_SIGNATURE *signature);
 
+/**
+ * Checks that a key may have made a signature, as TPM2_VerifySignature does:
+ * the key must have the sign attribute and, unless its scheme is NULL, the
+ * signature must be of its scheme and hash algorithm.
+ *
+ * LOG_ERR is used to communicate errors.
+ *
+ * @param public
+ *  The public area of the key.
+ * @param signature
+ *  The signature to check.
+ * @return
+ *  true if the key may have made the signature, false otherwise.
+ */
+bool tpm2_convert_sig_check_key(const TPMT_PUBLIC *public,
+        const TPMT_SIGNATURE *signature);
+
+/**
+ * Verifies a TPM signature over a digest with OpenSSL, the host side
+ * counterpart of TPM2_VerifySignature without the ticket. Supports the
+ * rsassa, rsapss and ecdsa schemes. Check the key with
+ * tpm2_convert_sig_check_key() first.
+ *
+ * LOG_ERR is used to communicate errors.
+ *
+ * @param pkey
+ *  The public key, see tpm2_convert_pubkey_to_evp().
+ * @param signature
+ *  The signature to verify.
+ * @param digest
+ *  The signed digest.
+ * @return
+ *  true if the signature is valid, false if not or on error.
+ */
+bool tpm2_convert_sig_verify(EVP_PKEY *pkey, TPMT_SIGNATURE *signature,
+        TPM2B_DIGEST *digest);
+
 #endif /* CONVERSION_H */
@@ -0,0 +1,342 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <inttypes.h>
+#include <string.h>
+
+#include <tss2/tss2_mu.h>
+
+#include "log.h"
+#include "tpm2_cphash.h"
+#include "tpm2_header.h"
+#include "tpm2_openssl.h"
+#include "tpm2_util.h"
+
+typedef struct cc_handles cc_handles;
+struct cc_handles {
+    TPM2_CC cc;
+    UINT8 count;
+};
+
+/* sorted by command code, see TPM 2.0 Part 3 for the handle areas */
+static const cc_handles handle_table[] = {
+    { TPM2_CC_NV_UndefineSpaceSpecial,     2 },
+    { TPM2_CC_EvictControl,                2 },
+    { TPM2_CC_HierarchyControl,            1 },
+    { TPM2_CC_NV_UndefineSpace,            2 },
+    { TPM2_CC_ChangeEPS,                   1 },
+    { TPM2_CC_ChangePPS,                   1 },
+    { TPM2_CC_Clear,                       1 },
+    { TPM2_CC_ClearControl,                1 },
+    { TPM2_CC_ClockSet,                    1 },
+    { TPM2_CC_HierarchyChangeAuth,         1 },
+    { TPM2_CC_NV_DefineSpace,              1 },
+    { TPM2_CC_PCR_Allocate,                1 },
+    { TPM2_CC_PCR_SetAuthPolicy,           1 },
+    { TPM2_CC_PP_Commands,                 1 },
+    { TPM2_CC_SetPrimaryPolicy,            1 },
+    { TPM2_CC_FieldUpgradeStart,           2 },
+    { TPM2_CC_ClockRateAdjust,             1 },
+    { TPM2_CC_CreatePrimary,               1 },
+    { TPM2_CC_NV_GlobalWriteLock,          1 },
+    { TPM2_CC_GetCommandAuditDigest,       2 },
+    { TPM2_CC_NV_Increment,                2 },
+    { TPM2_CC_NV_SetBits,                  2 },
+    { TPM2_CC_NV_Extend,                   2 },
+    { TPM2_CC_NV_Write,                    2 },
+    { TPM2_CC_NV_WriteLock,                2 },
+    { TPM2_CC_DictionaryAttackLockReset,   1 },
+    { TPM2_CC_DictionaryAttackParameters,  1 },
+    { TPM2_CC_NV_ChangeAuth,               1 },
+    { TPM2_CC_PCR_Event,                   1 },
+    { TPM2_CC_PCR_Reset,                   1 },
+    { TPM2_CC_SequenceComplete,            1 },
+    { TPM2_CC_SetAlgorithmSet,             1 },
+    { TPM2_CC_SetCommandCodeAuditStatus,   1 },
+    { TPM2_CC_FieldUpgradeData,            0 },
+    { TPM2_CC_IncrementalSelfTest,         0 },
+    { TPM2_CC_SelfTest,                    0 },
+    { TPM2_CC_Startup,                     0 },
+    { TPM2_CC_Shutdown,                    0 },
+    { TPM2_CC_StirRandom,                  0 },
+    { TPM2_CC_ActivateCredential,          2 },
+    { TPM2_CC_Certify,                     2 },
+    { TPM2_CC_PolicyNV,                    3 },
+    { TPM2_CC_CertifyCreation,             2 },
+    { TPM2_CC_Duplicate,                   2 },
+    { TPM2_CC_GetTime,                     2 },
+    { TPM2_CC_GetSessionAuditDigest,       3 },
+    { TPM2_CC_NV_Read,                     2 },
+    { TPM2_CC_NV_ReadLock,                 2 },
+    { TPM2_CC_ObjectChangeAuth,            2 },
+    { TPM2_CC_PolicySecret,                2 },
+    { TPM2_CC_Rewrap,                      2 },
+    { TPM2_CC_Create,                      1 },
+    { TPM2_CC_ECDH_ZGen,                   1 },
+    { TPM2_CC_HMAC,                        1 },
+    { TPM2_CC_Import,                      1 },
+    { TPM2_CC_Load,                        1 },
+    { TPM2_CC_Quote,                       1 },
+    { TPM2_CC_RSA_Decrypt,                 1 },
+    { TPM2_CC_HMAC_Start,                  1 },
+    { TPM2_CC_SequenceUpdate,              1 },
+    { TPM2_CC_Sign,                        1 },
+    { TPM2_CC_Unseal,                      1 },
+    { TPM2_CC_PolicySigned,                2 },
+    { TPM2_CC_ContextLoad,                 0 },
+    { TPM2_CC_ContextSave,                 1 },
+    { TPM2_CC_ECDH_KeyGen,                 1 },
+    { TPM2_CC_EncryptDecrypt,              1 },
+    { TPM2_CC_FlushContext,                0 },
+    { TPM2_CC_LoadExternal,                0 },
+    { TPM2_CC_MakeCredential,              1 },
+    { TPM2_CC_NV_ReadPublic,               1 },
+    { TPM2_CC_PolicyAuthorize,             1 },
+    { TPM2_CC_PolicyAuthValue,             1 },
+    { TPM2_CC_PolicyCommandCode,           1 },
+    { TPM2_CC_PolicyCounterTimer,          1 },
+    { TPM2_CC_PolicyCpHash,                1 },
+    { TPM2_CC_PolicyLocality,              1 },
+    { TPM2_CC_PolicyNameHash,              1 },
+    { TPM2_CC_PolicyOR,                    1 },
+    { TPM2_CC_PolicyTicket,                1 },
+    { TPM2_CC_ReadPublic,                  1 },
+    { TPM2_CC_RSA_Encrypt,                 1 },
+    { TPM2_CC_StartAuthSession,            2 },
+    { TPM2_CC_VerifySignature,             1 },
+    { TPM2_CC_ECC_Parameters,              0 },
+    { TPM2_CC_FirmwareRead,                0 },
+    { TPM2_CC_GetCapability,               0 },
+    { TPM2_CC_GetRandom,                   0 },
+    { TPM2_CC_GetTestResult,               0 },
+    { TPM2_CC_Hash,                        0 },
+    { TPM2_CC_PCR_Read,                    0 },
+    { TPM2_CC_PolicyPCR,                   1 },
+    { TPM2_CC_PolicyRestart,               1 },
+    { TPM2_CC_ReadClock,                   0 },
+    { TPM2_CC_PCR_Extend,                  1 },
+    { TPM2_CC_PCR_SetAuthValue,            1 },
+    { TPM2_CC_NV_Certify,                  3 },
+    { TPM2_CC_EventSequenceComplete,       2 },
+    { TPM2_CC_HashSequenceStart,           0 },
+    { TPM2_CC_PolicyPhysicalPresence,      1 },
+    { TPM2_CC_PolicyDuplicationSelect,     1 },
+    { TPM2_CC_PolicyGetDigest,             1 },
+    { TPM2_CC_TestParms,                   0 },
+    { TPM2_CC_Commit,                      1 },
+    { TPM2_CC_PolicyPassword,              1 },
+    { TPM2_CC_ZGen_2Phase,                 1 },
+    { TPM2_CC_EC_Ephemeral,                0 },
+    { TPM2_CC_PolicyNvWritten,             1 },
+    { TPM2_CC_PolicyTemplate,              1 },
+    { TPM2_CC_CreateLoaded,                1 },
+    { TPM2_CC_PolicyAuthorizeNV,           3 },
+    { TPM2_CC_EncryptDecrypt2,             1 },
+    { TPM2_CC_AC_GetCapability,            1 },
+    { TPM2_CC_AC_Send,                     3 },
+    { TPM2_CC_Policy_AC_SendSelect,        1 },
+};
+
+bool tpm2_cphash_get_handle_count(TPM2_CC cc, UINT8 *count) {
+
+    size_t lo = 0;
+    size_t hi = ARRAY_LEN(handle_table);
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (handle_table[mid].cc == cc) {
+            *count = handle_table[mid].count;
+            return true;
+        }
+        if (handle_table[mid].cc < cc) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return false;
+}
+
+bool tpm2_cphash_handle_to_name(TPM2_HANDLE handle, TPM2B_NAME *name) {
+
+    switch (handle >> TPM2_HR_SHIFT) {
+    case TPM2_HT_PCR:
+    case TPM2_HT_HMAC_SESSION:
+    case TPM2_HT_POLICY_SESSION:
+    case TPM2_HT_PERMANENT:
+        break;
+    default:
+        return false;
+    }
+
+    size_t offset = 0;
+    TSS2_RC rval = Tss2_MU_TPM2_HANDLE_Marshal(handle, name->name,
+            sizeof(name->name), &offset);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_TPM2_HANDLE_Marshal, rval);
+        return false;
+    }
+
+    name->size = offset;
+
+    return true;
+}
+
+bool tpm2_cphash_parse_command(const UINT8 *buffer, size_t size,
+        tpm2_cphash_command *command) {
+
+    if (size < TPM2_COMMAND_HEADER_SIZE) {
+        LOG_ERR("Command of %zu bytes is shorter than its header", size);
+        return false;
+    }
+
+    size_t offset = 0;
+    TPMI_ST_COMMAND_TAG tag;
+    TSS2_RC rval = Tss2_MU_TPM2_ST_Unmarshal(buffer, size, &offset, &tag);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_TPM2_ST_Unmarshal, rval);
+        return false;
+    }
+
+    UINT32 command_size;
+    rval = Tss2_MU_UINT32_Unmarshal(buffer, size, &offset, &command_size);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_UINT32_Unmarshal, rval);
+        return false;
+    }
+
+    if (command_size != size) {
+        LOG_ERR("Command header size %"PRIu32" does not match the %zu bytes"
+                " given", command_size, size);
+        return false;
+    }
+
+    rval = Tss2_MU_TPM2_CC_Unmarshal(buffer, size, &offset,
+            &command->command_code);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_TPM2_CC_Unmarshal, rval);
+        return false;
+    }
+
+    if (tag != TPM2_ST_SESSIONS && tag != TPM2_ST_NO_SESSIONS) {
+        LOG_ERR("Unknown command tag 0x%x", tag);
+        return false;
+    }
+
+    bool result = tpm2_cphash_get_handle_count(command->command_code,
+            &command->handle_count);
+    if (!result) {
+        LOG_ERR("Unknown command code 0x%x", command->command_code);
+        return false;
+    }
+
+    UINT8 i;
+    for (i = 0; i < command->handle_count; i++) {
+        rval = Tss2_MU_TPM2_HANDLE_Unmarshal(buffer, size, &offset,
+                &command->handles[i]);
+        if (rval != TSS2_RC_SUCCESS) {
+            LOG_PERR(Tss2_MU_TPM2_HANDLE_Unmarshal, rval);
+            return false;
+        }
+    }
+
+    if (tag == TPM2_ST_SESSIONS) {
+        UINT32 auth_size;
+        rval = Tss2_MU_UINT32_Unmarshal(buffer, size, &offset, &auth_size);
+        if (rval != TSS2_RC_SUCCESS) {
+            LOG_PERR(Tss2_MU_UINT32_Unmarshal, rval);
+            return false;
+        }
+
+        if (auth_size > size - offset) {
+            LOG_ERR("Authorization area of %"PRIu32" bytes exceeds the"
+                    " command", auth_size);
+            return false;
+        }
+
+        offset += auth_size;
+    }
+
+    command->parameters = &buffer[offset];
+    command->parameters_size = size - offset;
+
+    return true;
+}
+
+static bool append_names(UINT8 *buffer, size_t size, size_t *offset,
+        const TPM2B_NAME *names, UINT8 name_count) {
+
+    /* the names are hashed without their size fields */
+    UINT8 i;
+    for (i = 0; i < name_count; i++) {
+        if (names[i].size > size - *offset) {
+            LOG_ERR("Names exceed the hash buffer");
+            return false;
+        }
+        memcpy(&buffer[*offset], names[i].name, names[i].size);
+        *offset += names[i].size;
+    }
+
+    return true;
+}
+
+bool tpm2_cphash_compute(TPMI_ALG_HASH halg, TPM2_CC cc,
+        const TPM2B_NAME *names, UINT8 name_count, const UINT8 *parameters,
+        size_t parameters_size, TPM2B_DIGEST *cp_hash) {
+
+    UINT8 buffer[sizeof(TPM2_CC) + TPM2_CPHASH_HANDLES_MAX * sizeof(TPMU_NAME)
+            + TPM2_MAX_SIZE];
+
+    if (name_count > TPM2_CPHASH_HANDLES_MAX) {
+        LOG_ERR("Commands have at most %u handles, got %u",
+                TPM2_CPHASH_HANDLES_MAX, name_count);
+        return false;
+    }
+
+    size_t offset = 0;
+    TSS2_RC rval = Tss2_MU_TPM2_CC_Marshal(cc, buffer, sizeof(buffer),
+            &offset);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_TPM2_CC_Marshal, rval);
+        return false;
+    }
+
+    bool result = append_names(buffer, sizeof(buffer), &offset, names,
+            name_count);
+    if (!result) {
+        return false;
+    }
+
+    if (parameters_size > sizeof(buffer) - offset) {
+        LOG_ERR("Parameters of %zu bytes exceed the maximum command size",
+                parameters_size);
+        return false;
+    }
+
+    if (parameters_size) {
+        memcpy(&buffer[offset], parameters, parameters_size);
+        offset += parameters_size;
+    }
+
+    return tpm2_openssl_hash_compute_data(halg, buffer, offset, cp_hash);
+}
+
+bool tpm2_cphash_compute_namehash(TPMI_ALG_HASH halg, const TPM2B_NAME *names,
+        UINT8 name_count, TPM2B_DIGEST *name_hash) {
+
+    UINT8 buffer[TPM2_CPHASH_HANDLES_MAX * sizeof(TPMU_NAME)];
+
+    if (name_count > TPM2_CPHASH_HANDLES_MAX) {
+        LOG_ERR("Commands have at most %u handles, got %u",
+                TPM2_CPHASH_HANDLES_MAX, name_count);
+        return false;
+    }
+
+    size_t offset = 0;
+    bool result = append_names(buffer, sizeof(buffer), &offset, names,
+            name_count);
+    if (!result) {
+        return false;
+    }
+
+    return tpm2_openssl_hash_compute_data(halg, buffer, offset, name_hash);
+}
@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_CPHASH_H_
+#define LIB_TPM2_CPHASH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+/* the most handles any command carries in its handle area */
+#define TPM2_CPHASH_HANDLES_MAX 3
+
+/*
+ * A marshaled command split into the parts cpHash covers. The parameters
+ * point into the buffer the command was parsed from.
+ */
+typedef struct tpm2_cphash_command tpm2_cphash_command;
+struct tpm2_cphash_command {
+    TPM2_CC command_code;
+    UINT8 handle_count;
+    TPM2_HANDLE handles[TPM2_CPHASH_HANDLES_MAX];
+    const UINT8 *parameters;
+    size_t parameters_size;
+};
+
+/**
+ * Looks up how many handles a command has in its handle area, as listed in
+ * TPM 2.0 Part 3. Handles passed in the parameter area, like FlushContext's,
+ * do not count.
+ * @param cc
+ *  The command code.
+ * @param count
+ *  The number of handles, only valid on true returns.
+ * @return
+ *  true if the command code is known, false otherwise.
+ */
+bool tpm2_cphash_get_handle_count(TPM2_CC cc, UINT8 *count);
+
+/**
+ * Gets the name of a handle whose name is the handle itself, ie a PCR,
+ * session or permanent handle. Objects and NV indices are named by a digest
+ * of their public area and have to be read or computed instead.
+ * @param handle
+ *  The handle.
+ * @param name
+ *  The name, only valid on true returns.
+ * @return
+ *  true if the handle is its own name, false otherwise.
+ */
+bool tpm2_cphash_handle_to_name(TPM2_HANDLE handle, TPM2B_NAME *name);
+
+/**
+ * Splits a marshaled command, for instance one saved for tpm2_send(1), into
+ * its command code, handles and parameters. The authorization area of a
+ * command with sessions is skipped as it is not part of cpHash.
+ * @param buffer
+ *  The marshaled command, header included.
+ * @param size
+ *  The size of buffer, which must match the size in the header.
+ * @param command
+ *  The parsed command, only valid on true returns.
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_cphash_parse_command(const UINT8 *buffer, size_t size,
+        tpm2_cphash_command *command);
+
+/**
+ * Computes a command parameter hash:
+ *   cpHash = H(commandCode || name1 || name2 || name3 || parameters)
+ * @param halg
+ *  The hash algorithm, that of the session the command will be authorized
+ *  with.
+ * @param cc
+ *  The command code.
+ * @param names
+ *  The names of the command's handles, in handle area order.
+ * @param name_count
+ *  The number of names.
+ * @param parameters
+ *  The marshaled parameter area.
+ * @param parameters_size
+ *  The size of parameters.
+ * @param cp_hash
+ *  The computed cpHash.
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_cphash_compute(TPMI_ALG_HASH halg, TPM2_CC cc,
+        const TPM2B_NAME *names, UINT8 name_count, const UINT8 *parameters,
+        size_t parameters_size, TPM2B_DIGEST *cp_hash);
+
+/**
+ * Computes the digest PolicyNameHash binds a policy to:
+ *   nameHash = H(name1 || name2 || name3)
+ * @param halg
+ *  The hash algorithm.
+ * @param names
+ *  The names of the command's handles, in handle area order.
+ * @param name_count
+ *  The number of names.
+ * @param name_hash
+ *  The computed nameHash.
+ * @return
+ *  true on success, false otherwise.
+ */
+bool tpm2_cphash_compute_namehash(TPMI_ALG_HASH halg, const TPM2B_NAME *names,
+        UINT8 name_count, TPM2B_DIGEST *name_hash);
+
+#endif /* LIB_TPM2_CPHASH_H_ */
@@ -0,0 +1,84 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include "log.h"
+#include "tpm2_entropy.h"
+
+/*
+ * For H = 8 bits of min-entropy per sample and alpha = 2^-40:
+ *  - the repetition count cutoff is 1 + ceil(40 / H)
+ *  - the adaptive proportion cutoff is the smallest count whose binomial
+ *    tail, over the window with a probability of 2^-H per sample, is below
+ *    alpha
+ */
+#define RCT_CUTOFF 6
+#define APT_CUTOFF 20
+
+void tpm2_entropy_health_init(tpm2_entropy_health *health) {
+
+    *health = (tpm2_entropy_health) {
+        .rct = { .cutoff = RCT_CUTOFF },
+        .apt = { .cutoff = APT_CUTOFF },
+    };
+}
+
+static bool rct_sample(tpm2_entropy_health *health, UINT8 sample) {
+
+    if (health->samples && sample == health->rct.last) {
+        health->rct.count++;
+    } else {
+        health->rct.last = sample;
+        health->rct.count = 1;
+    }
+
+    if (health->rct.count < health->rct.cutoff) {
+        return true;
+    }
+
+    LOG_ERR("Repetition count test failed, 0x%02x repeated %u times",
+            sample, health->rct.count);
+    health->rct.failures++;
+    health->rct.count = 1;
+
+    return false;
+}
+
+static bool apt_sample(tpm2_entropy_health *health, UINT8 sample) {
+
+    if (!health->apt.index) {
+        health->apt.first = sample;
+        health->apt.count = 1;
+        health->apt.index = 1;
+        return true;
+    }
+
+    bool result = true;
+    if (sample == health->apt.first
+            && ++health->apt.count == health->apt.cutoff) {
+        LOG_ERR("Adaptive proportion test failed, 0x%02x seen %u times in"
+                " %u samples", health->apt.first, health->apt.count,
+                TPM2_ENTROPY_APT_WINDOW);
+        health->apt.failures++;
+        result = false;
+    }
+
+    if (++health->apt.index == TPM2_ENTROPY_APT_WINDOW) {
+        health->apt.index = 0;
+    }
+
+    return result;
+}
+
+bool tpm2_entropy_health_check(tpm2_entropy_health *health, const UINT8 *data,
+        size_t size) {
+
+    bool result = true;
+
+    size_t i;
+    for (i = 0; i < size; i++) {
+        result &= rct_sample(health, data[i]);
+        result &= apt_sample(health, data[i]);
+        health->samples++;
+    }
+
+    return result;
+}
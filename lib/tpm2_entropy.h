@@ -0,0 +1,62 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_ENTROPY_H_
+#define LIB_TPM2_ENTROPY_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+/* the samples of an adaptive proportion test window, NIST SP 800-90B 4.4.2 */
+#define TPM2_ENTROPY_APT_WINDOW 512
+
+/*
+ * The continuous health tests of NIST SP 800-90B 4.4 over a stream of
+ * bytes, each byte a sample.
+ */
+typedef struct tpm2_entropy_health tpm2_entropy_health;
+struct tpm2_entropy_health {
+    struct {
+        UINT32 cutoff;
+        UINT8 last;
+        UINT32 count;
+        UINT64 failures;
+    } rct;
+    struct {
+        UINT32 cutoff;
+        UINT8 first;
+        UINT32 count;
+        UINT32 index;
+        UINT64 failures;
+    } apt;
+    UINT64 samples;
+};
+
+/**
+ * Initializes the health tests for a source claimed to be of full entropy,
+ * 8 bits per byte, as a TPM's random number generator is. The cutoffs give
+ * a false positive probability of 2^-40 per sample, low enough for a long
+ * running feed.
+ * @param health
+ *  The health test state to initialize.
+ */
+void tpm2_entropy_health_init(tpm2_entropy_health *health);
+
+/**
+ * Runs the repetition count and adaptive proportion tests over the next
+ * samples of the stream.
+ * @param health
+ *  The health test state.
+ * @param data
+ *  The samples.
+ * @param size
+ *  The number of samples.
+ * @return
+ *  true if both tests passed for all samples, false if any failed, the
+ *  failures being counted in health.
+ */
+bool tpm2_entropy_health_check(tpm2_entropy_health *health, const UINT8 *data,
+        size_t size);
+
+#endif /* LIB_TPM2_ENTROPY_H_ */
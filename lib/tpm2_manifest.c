@@ -0,0 +1,86 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "tpm2_manifest.h"
+#include "tpm2_util.h"
+
+bool tpm2_manifest_parse(FILE *f, const char *path,
+        tpm2_manifest_section_fn on_section, tpm2_manifest_field_fn on_field,
+        void *userdata) {
+
+    /* room for the newline and the terminator */
+    char line[TPM2_MANIFEST_LINE_MAX + 2];
+    unsigned lineno = 0;
+    bool in_section = false;
+
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+
+        if (!strchr(line, '\n') && !feof(f)) {
+            LOG_ERR("%s:%u: Line exceeds %u characters", path, lineno,
+                    TPM2_MANIFEST_LINE_MAX);
+            return false;
+        }
+
+        char *s = tpm2_util_trim(line);
+        if (!s[0] || s[0] == '#') {
+            continue;
+        }
+
+        if (s[0] == '[') {
+            char *end = strchr(s, ']');
+            if (!end || end[1] != '\0') {
+                LOG_ERR("%s:%u: Expected \"[section]\", got: \"%s\"", path,
+                        lineno, s);
+                return false;
+            }
+            *end = '\0';
+            if (!on_section(tpm2_util_trim(s + 1), lineno, userdata)) {
+                return false;
+            }
+            in_section = true;
+            continue;
+        }
+
+        char *eq = strchr(s, '=');
+        if (!eq) {
+            LOG_ERR("%s:%u: Expected \"field = value\", got: \"%s\"", path,
+                    lineno, s);
+            return false;
+        }
+
+        if (!in_section) {
+            LOG_ERR("%s:%u: Field outside of a section", path, lineno);
+            return false;
+        }
+
+        *eq = '\0';
+        if (!on_field(tpm2_util_trim(s), tpm2_util_trim(eq + 1), lineno,
+                userdata)) {
+            return false;
+        }
+    }
+
+    if (ferror(f)) {
+        LOG_ERR("Error reading manifest \"%s\": %s", path, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+bool tpm2_manifest_set_string(char **field, const char *value) {
+
+    free(*field);
+    *field = strdup(value);
+    if (!*field) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    return true;
+}
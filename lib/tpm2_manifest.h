@@ -0,0 +1,83 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_MANIFEST_H_
+#define LIB_TPM2_MANIFEST_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+
+/* the longest manifest line, without its newline */
+#define TPM2_MANIFEST_LINE_MAX 1022
+
+/*
+ * A manifest is a list of sections, each a header followed by its fields:
+ *
+ * [section]
+ * field = value
+ *
+ * Blank lines and lines starting with '#' are ignored, and the blanks around
+ * a section name, a field and a value are trimmed.
+ */
+
+/**
+ * Called for a section header.
+ * @param section
+ *  The section name, between the brackets.
+ * @param lineno
+ *  The line of the header.
+ * @param userdata
+ *  The userdata given to tpm2_manifest_parse().
+ * @return
+ *  true to go on, false to stop parsing with an error.
+ */
+typedef bool (*tpm2_manifest_section_fn)(const char *section, unsigned lineno,
+        void *userdata);
+
+/**
+ * Called for a field of the current section.
+ * @param field
+ *  The field name.
+ * @param value
+ *  The field value, may be empty.
+ * @param lineno
+ *  The line of the field.
+ * @param userdata
+ *  The userdata given to tpm2_manifest_parse().
+ * @return
+ *  true to go on, false to stop parsing with an error.
+ */
+typedef bool (*tpm2_manifest_field_fn)(const char *field, const char *value,
+        unsigned lineno, void *userdata);
+
+/**
+ * Parses a manifest, reading it to the end.
+ * @param f
+ *  The manifest file.
+ * @param path
+ *  The path of the manifest, for errors.
+ * @param on_section
+ *  Called for every section header.
+ * @param on_field
+ *  Called for every field, never before the first section.
+ * @param userdata
+ *  Passed to the callbacks.
+ * @return
+ *  true on success, false on a malformed line, a read error or when a
+ *  callback fails.
+ */
+bool tpm2_manifest_parse(FILE *f, const char *path,
+        tpm2_manifest_section_fn on_section, tpm2_manifest_field_fn on_field,
+        void *userdata);
+
+/**
+ * Replaces a string field with a copy of value.
+ * @param field
+ *  The field, freed if set.
+ * @param value
+ *  The value to copy.
+ * @return
+ *  true on success, false when out of memory.
+ */
+bool tpm2_manifest_set_string(char **field, const char *value);
+
+#endif /* LIB_TPM2_MANIFEST_H_ */
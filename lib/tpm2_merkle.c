@@ -0,0 +1,328 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/err.h>
+#include <openssl/evp.h>
+
+#include "files.h"
+#include "log.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_merkle.h"
+#include "tpm2_openssl.h"
+#include "tpm2_util.h"
+
+#define MERKLE_LEAF_PREFIX 0x00
+#define MERKLE_NODE_PREFIX 0x01
+
+/* "MKPR", a Merkle proof */
+#define MERKLE_PROOF_MAGIC 0x4D4B5052
+#define MERKLE_PROOF_VERSION 1
+
+struct tpm2_merkle_tree {
+    TPMI_ALG_HASH halg;
+    UINT8 levels;
+    UINT32 width[TPM2_MERKLE_MAX_DEPTH + 1];
+    TPM2B_DIGEST *level[TPM2_MERKLE_MAX_DEPTH + 1];
+};
+
+static bool hash_prefixed(TPMI_ALG_HASH halg, UINT8 prefix, const UINT8 *a,
+        size_t a_size, const UINT8 *b, size_t b_size, TPM2B_DIGEST *out) {
+
+    const EVP_MD *md = tpm2_openssl_halg_from_tpmhalg(halg);
+    if (!md) {
+        LOG_ERR("Unsupported hash algorithm 0x%x", halg);
+        return false;
+    }
+
+    EVP_MD_CTX *mdctx = EVP_MD_CTX_create();
+    if (!mdctx) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    unsigned size = 0;
+    bool result = EVP_DigestInit_ex(mdctx, md, NULL)
+            && EVP_DigestUpdate(mdctx, &prefix, sizeof(prefix))
+            && EVP_DigestUpdate(mdctx, a, a_size)
+            && (!b_size || EVP_DigestUpdate(mdctx, b, b_size))
+            && EVP_DigestFinal_ex(mdctx, out->buffer, &size);
+    if (!result) {
+        LOG_ERR("%s", ERR_error_string(ERR_get_error(), NULL));
+    }
+    out->size = size;
+
+    EVP_MD_CTX_destroy(mdctx);
+
+    return result;
+}
+
+static bool hash_node(TPMI_ALG_HASH halg, const TPM2B_DIGEST *left,
+        const TPM2B_DIGEST *right, TPM2B_DIGEST *node) {
+
+    return hash_prefixed(halg, MERKLE_NODE_PREFIX, left->buffer, left->size,
+            right->buffer, right->size, node);
+}
+
+bool tpm2_merkle_leaf_hash(TPMI_ALG_HASH halg, const UINT8 *data,
+        size_t size, TPM2B_DIGEST *leaf) {
+
+    return hash_prefixed(halg, MERKLE_LEAF_PREFIX, data, size, NULL, 0, leaf);
+}
+
+bool tpm2_merkle_leaf_hash_file(TPMI_ALG_HASH halg, FILE *f,
+        TPM2B_DIGEST *leaf) {
+
+    UINT8 prefix = MERKLE_LEAF_PREFIX;
+    return tpm2_openssl_hash_file_prefixed(halg, &prefix, f, leaf);
+}
+
+tpm2_merkle_tree *tpm2_merkle_tree_new(TPMI_ALG_HASH halg,
+        const TPM2B_DIGEST *leaves, UINT32 count) {
+
+    if (!count || count > TPM2_MERKLE_MAX_LEAVES) {
+        LOG_ERR("A Merkle tree has between 1 and %u leaves, got: %u",
+                TPM2_MERKLE_MAX_LEAVES, count);
+        return NULL;
+    }
+
+    tpm2_merkle_tree *tree = calloc(1, sizeof(*tree));
+    if (!tree) {
+        LOG_ERR("oom");
+        return NULL;
+    }
+
+    tree->halg = halg;
+    tree->width[0] = count;
+    tree->level[0] = malloc(count * sizeof(TPM2B_DIGEST));
+    if (!tree->level[0]) {
+        LOG_ERR("oom");
+        goto error;
+    }
+    memcpy(tree->level[0], leaves, count * sizeof(TPM2B_DIGEST));
+
+    UINT8 l = 0;
+    while (tree->width[l] > 1) {
+        UINT32 width = (tree->width[l] + 1) / 2;
+        TPM2B_DIGEST *level = malloc(width * sizeof(TPM2B_DIGEST));
+        if (!level) {
+            LOG_ERR("oom");
+            goto error;
+        }
+        tree->level[l + 1] = level;
+        tree->width[l + 1] = width;
+
+        UINT32 i;
+        for (i = 0; i < width; i++) {
+            TPM2B_DIGEST *below = &tree->level[l][2 * i];
+            if (2 * i + 1 == tree->width[l]) {
+                level[i] = *below;
+            } else if (!hash_node(halg, below, below + 1, &level[i])) {
+                goto error;
+            }
+        }
+        l++;
+    }
+
+    tree->levels = l + 1;
+
+    return tree;
+
+error:
+    tpm2_merkle_tree_free(tree);
+    return NULL;
+}
+
+void tpm2_merkle_tree_free(tpm2_merkle_tree *tree) {
+
+    if (!tree) {
+        return;
+    }
+
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(tree->level); i++) {
+        free(tree->level[i]);
+    }
+
+    free(tree);
+}
+
+const TPM2B_DIGEST *tpm2_merkle_tree_root(const tpm2_merkle_tree *tree) {
+
+    return &tree->level[tree->levels - 1][0];
+}
+
+bool tpm2_merkle_tree_proof(const tpm2_merkle_tree *tree, UINT32 index,
+        tpm2_merkle_proof *proof) {
+
+    if (index >= tree->width[0]) {
+        LOG_ERR("Leaf %u is out of range, the tree has %u leaves", index,
+                tree->width[0]);
+        return false;
+    }
+
+    memset(proof, 0, sizeof(*proof));
+    proof->halg = tree->halg;
+    proof->index = index;
+    proof->count = tree->width[0];
+
+    UINT8 l;
+    for (l = 0; l + 1 < tree->levels; l++) {
+        UINT32 sibling = index ^ 1;
+        if (sibling < tree->width[l]) {
+            proof->siblings[proof->depth++] = tree->level[l][sibling];
+        }
+        index >>= 1;
+    }
+
+    return true;
+}
+
+bool tpm2_merkle_proof_root(const TPM2B_DIGEST *leaf,
+        const tpm2_merkle_proof *proof, TPM2B_DIGEST *root) {
+
+    if (!proof->count || proof->count > TPM2_MERKLE_MAX_LEAVES
+            || proof->index >= proof->count
+            || proof->depth > TPM2_MERKLE_MAX_DEPTH) {
+        LOG_ERR("Malformed Merkle proof");
+        return false;
+    }
+
+    UINT16 size = tpm2_alg_util_get_hash_size(proof->halg);
+    if (!size || leaf->size != size) {
+        LOG_ERR("Merkle proof hash algorithm does not match the digests");
+        return false;
+    }
+
+    TPM2B_DIGEST node = *leaf;
+    UINT32 index = proof->index;
+    UINT32 width = proof->count;
+    UINT8 used = 0;
+    while (width > 1) {
+        if ((index ^ 1) < width) {
+            if (used == proof->depth) {
+                LOG_ERR("Merkle proof is missing siblings");
+                return false;
+            }
+
+            const TPM2B_DIGEST *sibling = &proof->siblings[used++];
+            if (sibling->size != size) {
+                LOG_ERR("Malformed Merkle proof sibling");
+                return false;
+            }
+
+            TPM2B_DIGEST parent;
+            bool result = index & 1 ?
+                    hash_node(proof->halg, sibling, &node, &parent) :
+                    hash_node(proof->halg, &node, sibling, &parent);
+            if (!result) {
+                return false;
+            }
+            node = parent;
+        }
+        index >>= 1;
+        width = (width + 1) / 2;
+    }
+
+    if (used != proof->depth) {
+        LOG_ERR("Merkle proof has extra siblings");
+        return false;
+    }
+
+    *root = node;
+
+    return true;
+}
+
+bool tpm2_merkle_proof_verify(const TPM2B_DIGEST *leaf,
+        const tpm2_merkle_proof *proof, const TPM2B_DIGEST *root) {
+
+    TPM2B_DIGEST computed;
+    bool result = tpm2_merkle_proof_root(leaf, proof, &computed);
+    if (!result) {
+        return false;
+    }
+
+    return computed.size == root->size
+            && !memcmp(computed.buffer, root->buffer, root->size);
+}
+
+bool tpm2_merkle_proof_save(const tpm2_merkle_proof *proof, const char *path) {
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        LOG_ERR("Could not open file \"%s\", error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    bool result = files_write_32(f, MERKLE_PROOF_MAGIC)
+            && files_write_32(f, MERKLE_PROOF_VERSION)
+            && files_write_16(f, proof->halg)
+            && files_write_32(f, proof->index)
+            && files_write_32(f, proof->count)
+            && files_write_16(f, proof->depth);
+
+    UINT8 i;
+    for (i = 0; result && i < proof->depth; i++) {
+        TPM2B_DIGEST sibling = proof->siblings[i];
+        result = files_write_frame(f, sibling.buffer, sibling.size);
+    }
+
+    if (fclose(f) || !result) {
+        LOG_ERR("Could not write Merkle proof \"%s\"", path);
+        return false;
+    }
+
+    return true;
+}
+
+bool tpm2_merkle_proof_load(const char *path, tpm2_merkle_proof *proof) {
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        LOG_ERR("Could not open file \"%s\", error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    memset(proof, 0, sizeof(*proof));
+
+    UINT32 magic = 0;
+    UINT32 version = 0;
+    UINT16 depth = 0;
+    bool result = files_read_32(f, &magic)
+            && files_read_32(f, &version)
+            && files_read_16(f, &proof->halg)
+            && files_read_32(f, &proof->index)
+            && files_read_32(f, &proof->count)
+            && files_read_16(f, &depth);
+    if (!result || magic != MERKLE_PROOF_MAGIC
+            || version != MERKLE_PROOF_VERSION
+            || depth > TPM2_MERKLE_MAX_DEPTH) {
+        LOG_ERR("\"%s\" is not a Merkle proof", path);
+        result = false;
+        goto out;
+    }
+
+    proof->depth = depth;
+
+    UINT8 i;
+    for (i = 0; i < proof->depth; i++) {
+        TPM2B_DIGEST *sibling = &proof->siblings[i];
+        sibling->size = sizeof(sibling->buffer);
+        bool eof;
+        result = files_read_frame(f, sibling->buffer, &sibling->size, &eof);
+        if (!result || eof) {
+            LOG_ERR("Truncated Merkle proof \"%s\"", path);
+            result = false;
+            goto out;
+        }
+    }
+
+out:
+    fclose(f);
+    return result;
+}
@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_MERKLE_H_
+#define LIB_TPM2_MERKLE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+/* the most leaves of a tree, so a proof never has more than 20 siblings */
+#define TPM2_MERKLE_MAX_LEAVES (1 << 20)
+#define TPM2_MERKLE_MAX_DEPTH 20
+
+/*
+ * A binary hash tree over a list of leaves, as in RFC 6962 section 2.1:
+ * leaves are hashed as H(0x00 || data) and interior nodes as
+ * H(0x01 || left || right), so a leaf can never pass as a node. A level with
+ * an odd number of nodes promotes its last node unchanged.
+ */
+typedef struct tpm2_merkle_tree tpm2_merkle_tree;
+
+/*
+ * The inclusion proof of a leaf, the siblings on its path to the root from
+ * the bottom up. The leaf index and count tell the verifier on which side
+ * each sibling is and on which levels the node was promoted.
+ */
+typedef struct tpm2_merkle_proof tpm2_merkle_proof;
+struct tpm2_merkle_proof {
+    TPMI_ALG_HASH halg;
+    UINT32 index;
+    UINT32 count;
+    UINT8 depth;
+    TPM2B_DIGEST siblings[TPM2_MERKLE_MAX_DEPTH];
+};
+
+/**
+ * Computes the leaf hash of data.
+ * @param halg
+ *  The hash algorithm of the tree.
+ * @param data
+ *  The leaf data.
+ * @param size
+ *  The size of data.
+ * @param leaf
+ *  The leaf hash.
+ * @return
+ *  true on success, false on error.
+ */
+bool tpm2_merkle_leaf_hash(TPMI_ALG_HASH halg, const UINT8 *data,
+        size_t size, TPM2B_DIGEST *leaf);
+
+/**
+ * Computes the leaf hash of the contents of a file, reading it to the end.
+ * @param halg
+ *  The hash algorithm of the tree.
+ * @param f
+ *  The file to read.
+ * @param leaf
+ *  The leaf hash.
+ * @return
+ *  true on success, false on error.
+ */
+bool tpm2_merkle_leaf_hash_file(TPMI_ALG_HASH halg, FILE *f,
+        TPM2B_DIGEST *leaf);
+
+/**
+ * Builds a tree over leaf hashes.
+ * @param halg
+ *  The hash algorithm of the tree.
+ * @param leaves
+ *  The leaf hashes, see tpm2_merkle_leaf_hash().
+ * @param count
+ *  The number of leaves, at least 1 and at most TPM2_MERKLE_MAX_LEAVES.
+ * @return
+ *  The tree or NULL on error, free it with tpm2_merkle_tree_free().
+ */
+tpm2_merkle_tree *tpm2_merkle_tree_new(TPMI_ALG_HASH halg,
+        const TPM2B_DIGEST *leaves, UINT32 count);
+
+/**
+ * Frees a tree.
+ * @param tree
+ *  The tree to free, may be NULL.
+ */
+void tpm2_merkle_tree_free(tpm2_merkle_tree *tree);
+
+/**
+ * Gets the root of a tree.
+ * @param tree
+ *  The tree.
+ * @return
+ *  The root hash, valid for the life of the tree.
+ */
+const TPM2B_DIGEST *tpm2_merkle_tree_root(const tpm2_merkle_tree *tree);
+
+/**
+ * Gets the inclusion proof of a leaf.
+ * @param tree
+ *  The tree.
+ * @param index
+ *  The index of the leaf.
+ * @param proof
+ *  The proof.
+ * @return
+ *  true on success, false if index is out of range.
+ */
+bool tpm2_merkle_tree_proof(const tpm2_merkle_tree *tree, UINT32 index,
+        tpm2_merkle_proof *proof);
+
+/**
+ * Computes the root of the tree a leaf is part of from its inclusion proof.
+ * @param leaf
+ *  The leaf hash, see tpm2_merkle_leaf_hash().
+ * @param proof
+ *  The inclusion proof of the leaf.
+ * @param root
+ *  The root the proof leads to.
+ * @return
+ *  true on success, false on a malformed proof.
+ */
+bool tpm2_merkle_proof_root(const TPM2B_DIGEST *leaf,
+        const tpm2_merkle_proof *proof, TPM2B_DIGEST *root);
+
+/**
+ * Verifies that a leaf is part of the tree with the given root.
+ * @param leaf
+ *  The leaf hash, see tpm2_merkle_leaf_hash().
+ * @param proof
+ *  The inclusion proof of the leaf.
+ * @param root
+ *  The expected root.
+ * @return
+ *  true if the proof leads from the leaf to the root, false otherwise.
+ */
+bool tpm2_merkle_proof_verify(const TPM2B_DIGEST *leaf,
+        const tpm2_merkle_proof *proof, const TPM2B_DIGEST *root);
+
+/**
+ * Writes a proof to a file, a magic and version followed by the big endian
+ * halg, index, count and depth and the siblings as frames.
+ * @param proof
+ *  The proof to write.
+ * @param path
+ *  The file path.
+ * @return
+ *  true on success, false on error.
+ */
+bool tpm2_merkle_proof_save(const tpm2_merkle_proof *proof, const char *path);
+
+/**
+ * Reads a proof written by tpm2_merkle_proof_save().
+ * @param path
+ *  The file path.
+ * @param proof
+ *  The proof.
+ * @return
+ *  true on success, false on error or a malformed proof.
+ */
+bool tpm2_merkle_proof_load(const char *path, tpm2_merkle_proof *proof);
+
+#endif /* LIB_TPM2_MERKLE_H_ */
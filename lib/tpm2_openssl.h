@@ -21,6 +21,12 @@
 int RSA_set0_key(RSA *r, BIGNUM *n, BIGNUM *e, BIGNUM *d);
 #endif
 
+#if defined(LIBRESSL_VERSION_NUMBER)
+int RSA_padding_add_PKCS1_OAEP_mgf1(unsigned char *to, int tlen,
+        const unsigned char *from, int flen, const unsigned char *param, int plen,
+        const EVP_MD *md, const EVP_MD *mgf1md);
+#endif
+
 
 /**
  * Function prototype for a hashing routine.
@@ -86,6 +92,37 @@ void tpm2_openssl_hmac_free(HMAC_CTX *ctx);
 bool tpm2_openssl_hash_compute_data(TPMI_ALG_HASH halg,
         BYTE *buffer, UINT16 length, TPM2B_DIGEST *digest);
 
+/**
+ * Hash the contents of a file, reading it to the end.
+ * @param halg
+ *  The hashing algorithm to use.
+ * @param f
+ *  The file to be hashed.
+ * @param digest
+ *  The result of hashing the file with halg.
+ * @return
+ *  true on success, false on error.
+ */
+bool tpm2_openssl_hash_file(TPMI_ALG_HASH halg, FILE *f,
+        TPM2B_DIGEST *digest);
+
+/**
+ * Hash a prefix byte followed by the contents of a file, reading it to the
+ * end in fixed size chunks.
+ * @param halg
+ *  The hashing algorithm to use.
+ * @param prefix
+ *  The byte to hash first, or NULL for none.
+ * @param f
+ *  The file to be hashed.
+ * @param digest
+ *  The result of hashing the prefix and the file with halg.
+ * @return
+ *  true on success, false on error.
+ */
+bool tpm2_openssl_hash_file_prefixed(TPMI_ALG_HASH halg,
+        const UINT8 *prefix, FILE *f, TPM2B_DIGEST *digest);
+
 /**
  * Hash a list of PCR digests.
  * @param halg
@@ -0,0 +1,415 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <tss2/tss2_mu.h>
+
+#include "files.h"
+#include "log.h"
+#include "pcr.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_pcr_index.h"
+#include "tpm2_util.h"
+
+/* "PCRI", an index of PCR composite digests */
+#define PCR_INDEX_MAGIC 0x50435249
+#define PCR_INDEX_VERSION 1
+
+typedef struct pcr_index_section pcr_index_section;
+struct pcr_index_section {
+    TPMI_ALG_HASH halg;
+    TPML_PCR_SELECTION selection;
+    UINT16 size;
+    UINT32 count;
+    /* count digests of size bytes, sorted once saved or loaded */
+    const UINT8 *digests;
+    /* the digests of a new index, NULL for a mapped one */
+    UINT8 *owned;
+    UINT32 capacity;
+};
+
+struct tpm2_pcr_index {
+    pcr_index_section *sections;
+    UINT32 count;
+    void *map;
+    size_t map_size;
+};
+
+static const pcr_index_section *find_section(const tpm2_pcr_index *index,
+        TPMI_ALG_HASH halg, const TPML_PCR_SELECTION *selection) {
+
+    UINT32 i;
+    for (i = 0; i < index->count; i++) {
+        const pcr_index_section *section = &index->sections[i];
+        if (section->halg == halg
+                && pcr_selection_equal(&section->selection, selection)) {
+            return section;
+        }
+    }
+
+    return NULL;
+}
+
+tpm2_pcr_index *tpm2_pcr_index_new(void) {
+
+    tpm2_pcr_index *index = calloc(1, sizeof(*index));
+    if (!index) {
+        LOG_ERR("oom");
+    }
+
+    return index;
+}
+
+bool tpm2_pcr_index_add(tpm2_pcr_index *index, TPMI_ALG_HASH halg,
+        const TPML_PCR_SELECTION *selection, const TPM2B_DIGEST *digest) {
+
+    if (index->map) {
+        LOG_ERR("Cannot add to a loaded PCR index");
+        return false;
+    }
+
+    UINT16 size = tpm2_alg_util_get_hash_size(halg);
+    if (!size || digest->size != size) {
+        LOG_ERR("PCR composite digest does not match the hash algorithm");
+        return false;
+    }
+
+    pcr_index_section *section =
+            (pcr_index_section *)find_section(index, halg, selection);
+    if (!section) {
+        pcr_index_section *sections = realloc(index->sections,
+                (index->count + 1) * sizeof(*sections));
+        if (!sections) {
+            LOG_ERR("oom");
+            return false;
+        }
+        index->sections = sections;
+
+        section = &sections[index->count++];
+        memset(section, 0, sizeof(*section));
+        section->halg = halg;
+        section->selection = *selection;
+        section->size = size;
+    }
+
+    if (section->count == section->capacity) {
+        UINT32 capacity = section->capacity ? 2 * section->capacity : 16;
+        UINT8 *owned = realloc(section->owned, (size_t)capacity * size);
+        if (!owned) {
+            LOG_ERR("oom");
+            return false;
+        }
+        section->owned = owned;
+        section->digests = owned;
+        section->capacity = capacity;
+    }
+
+    memcpy(&section->owned[(size_t)section->count * size], digest->buffer,
+            size);
+    section->count++;
+
+    return true;
+}
+
+static int compare_digests(const void *a, const void *b, void *size) {
+
+    return memcmp(a, b, *(UINT16 *)size);
+}
+
+static void sort_section(pcr_index_section *section) {
+
+    size_t size = section->size;
+    qsort_r(section->owned, section->count, size, compare_digests,
+            &section->size);
+
+    UINT32 i;
+    UINT32 unique = 0;
+    for (i = 0; i < section->count; i++) {
+        UINT8 *digest = &section->owned[i * size];
+        if (unique && !memcmp(&section->owned[(unique - 1) * size], digest,
+                size)) {
+            continue;
+        }
+        memmove(&section->owned[unique++ * size], digest, size);
+    }
+
+    section->count = unique;
+}
+
+bool tpm2_pcr_index_save(tpm2_pcr_index *index, const char *path) {
+
+    if (index->map) {
+        LOG_ERR("Cannot save a loaded PCR index");
+        return false;
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        LOG_ERR("Could not open file \"%s\", error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    bool result = files_write_32(f, PCR_INDEX_MAGIC)
+            && files_write_32(f, PCR_INDEX_VERSION)
+            && files_write_32(f, index->count);
+
+    UINT32 i;
+    for (i = 0; result && i < index->count; i++) {
+        pcr_index_section *section = &index->sections[i];
+        sort_section(section);
+
+        UINT8 buffer[sizeof(TPML_PCR_SELECTION)];
+        size_t offset = 0;
+        TSS2_RC rc = Tss2_MU_TPML_PCR_SELECTION_Marshal(&section->selection,
+                buffer, sizeof(buffer), &offset);
+        if (rc != TSS2_RC_SUCCESS) {
+            LOG_PERR(Tss2_MU_TPML_PCR_SELECTION_Marshal, rc);
+            result = false;
+            break;
+        }
+
+        size_t bytes = (size_t)section->count * section->size;
+        result = files_write_16(f, section->halg)
+                && files_write_frame(f, buffer, offset)
+                && files_write_16(f, section->size)
+                && files_write_32(f, section->count)
+                && fwrite(section->owned, 1, bytes, f) == bytes;
+    }
+
+    if (fclose(f) || !result) {
+        LOG_ERR("Could not write PCR index \"%s\"", path);
+        return false;
+    }
+
+    return true;
+}
+
+typedef struct cursor cursor;
+struct cursor {
+    const UINT8 *p;
+    size_t left;
+};
+
+static const UINT8 *take(cursor *c, size_t n) {
+
+    if (n > c->left) {
+        return NULL;
+    }
+
+    const UINT8 *p = c->p;
+    c->p += n;
+    c->left -= n;
+
+    return p;
+}
+
+static bool take_16(cursor *c, UINT16 *value) {
+
+    const UINT8 *p = take(c, sizeof(*value));
+    if (!p) {
+        return false;
+    }
+
+    memcpy(value, p, sizeof(*value));
+    *value = tpm2_util_ntoh_16(*value);
+
+    return true;
+}
+
+static bool take_32(cursor *c, UINT32 *value) {
+
+    const UINT8 *p = take(c, sizeof(*value));
+    if (!p) {
+        return false;
+    }
+
+    memcpy(value, p, sizeof(*value));
+    *value = tpm2_util_ntoh_32(*value);
+
+    return true;
+}
+
+static bool parse_section(cursor *c, pcr_index_section *section) {
+
+    UINT16 selection_size;
+    if (!take_16(c, &section->halg) || !take_16(c, &selection_size)) {
+        return false;
+    }
+
+    const UINT8 *selection = take(c, selection_size);
+    if (!selection) {
+        return false;
+    }
+
+    size_t offset = 0;
+    TSS2_RC rc = Tss2_MU_TPML_PCR_SELECTION_Unmarshal(selection,
+            selection_size, &offset, &section->selection);
+    if (rc != TSS2_RC_SUCCESS || offset != selection_size) {
+        return false;
+    }
+
+    if (!take_16(c, &section->size) || !take_32(c, &section->count)) {
+        return false;
+    }
+
+    UINT16 size = tpm2_alg_util_get_hash_size(section->halg);
+    if (!size || section->size != size) {
+        return false;
+    }
+
+    section->digests = take(c, (size_t)section->count * size);
+
+    return section->digests != NULL;
+}
+
+tpm2_pcr_index *tpm2_pcr_index_load(const char *path) {
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        LOG_ERR("Could not open file \"%s\", error: %s", path,
+                strerror(errno));
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) || !st.st_size) {
+        LOG_ERR("\"%s\" is not a PCR index", path);
+        close(fd);
+        return NULL;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        LOG_ERR("Could not map file \"%s\", error: %s", path,
+                strerror(errno));
+        return NULL;
+    }
+
+    tpm2_pcr_index *index = tpm2_pcr_index_new();
+    if (!index) {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+    index->map = map;
+    index->map_size = st.st_size;
+
+    cursor c = { .p = map, .left = st.st_size };
+    UINT32 magic = 0;
+    UINT32 version = 0;
+    UINT32 count = 0;
+    bool result = take_32(&c, &magic) && magic == PCR_INDEX_MAGIC
+            && take_32(&c, &version) && version == PCR_INDEX_VERSION
+            && take_32(&c, &count)
+            /* a section takes at least 10 bytes */
+            && count <= c.left / 10;
+    if (result) {
+        index->sections = calloc(count, sizeof(*index->sections));
+        result = index->sections != NULL || !count;
+    }
+
+    UINT32 i;
+    for (i = 0; result && i < count; i++) {
+        result = parse_section(&c, &index->sections[i]);
+        index->count += result;
+    }
+
+    if (!result || c.left) {
+        LOG_ERR("\"%s\" is not a PCR index", path);
+        tpm2_pcr_index_free(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+bool tpm2_pcr_index_lookup(const tpm2_pcr_index *index, TPMI_ALG_HASH halg,
+        const TPML_PCR_SELECTION *selection, const TPM2B_DIGEST *digest) {
+
+    const pcr_index_section *section = find_section(index, halg, selection);
+    if (!section || digest->size != section->size) {
+        return false;
+    }
+
+    /*
+     * Interpolate the position from the leading 32 bits of the digests,
+     * which being hashes are spread evenly, so a lookup converges in a
+     * couple of probes. Every probe narrows the range so it also ends on a
+     * skewed index.
+     */
+    size_t size = section->size;
+    UINT32 key;
+    memcpy(&key, digest->buffer, sizeof(key));
+    key = tpm2_util_ntoh_32(key);
+
+    UINT32 lo = 0;
+    UINT32 hi = section->count;
+    while (lo < hi) {
+        const UINT8 *first = &section->digests[lo * size];
+        const UINT8 *last = &section->digests[(hi - 1) * size];
+        UINT32 lo_key;
+        UINT32 hi_key;
+        memcpy(&lo_key, first, sizeof(lo_key));
+        memcpy(&hi_key, last, sizeof(hi_key));
+        lo_key = tpm2_util_ntoh_32(lo_key);
+        hi_key = tpm2_util_ntoh_32(hi_key);
+        if (key < lo_key || key > hi_key) {
+            return false;
+        }
+
+        UINT32 mid = lo;
+        if (hi_key != lo_key) {
+            mid += (UINT64)(key - lo_key) * (hi - 1 - lo) / (hi_key - lo_key);
+        }
+
+        int cmp = memcmp(&section->digests[mid * size], digest->buffer, size);
+        if (!cmp) {
+            return true;
+        }
+
+        if (cmp < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    return false;
+}
+
+UINT32 tpm2_pcr_index_count(const tpm2_pcr_index *index) {
+
+    UINT32 count = 0;
+    UINT32 i;
+    for (i = 0; i < index->count; i++) {
+        count += index->sections[i].count;
+    }
+
+    return count;
+}
+
+void tpm2_pcr_index_free(tpm2_pcr_index *index) {
+
+    if (!index) {
+        return;
+    }
+
+    UINT32 i;
+    for (i = 0; i < index->count; i++) {
+        free(index->sections[i].owned);
+    }
+    free(index->sections);
+
+    if (index->map) {
+        munmap(index->map, index->map_size);
+    }
+
+    free(index);
+}
@@ -0,0 +1,101 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_PCR_INDEX_H_
+#define LIB_TPM2_PCR_INDEX_H_
+
+#include <stdbool.h>
+
+#include <tss2/tss2_tpm2_types.h>
+
+/*
+ * An index of known good PCR composite digests, as found in the pcrDigest
+ * of a quote, kept per PCR selection and hash algorithm. A verifier looks up
+ * the digest a quote attests to rather than recomputing it from the PCR
+ * values.
+ *
+ * On disk the digests of a selection are sorted, and since digests are
+ * uniformly distributed a lookup interpolates from their leading bytes and
+ * touches a handful of entries whatever the size of the index. A loaded
+ * index is mapped rather than read.
+ */
+typedef struct tpm2_pcr_index tpm2_pcr_index;
+
+/**
+ * Creates an empty index to add digests to.
+ * @return
+ *  The index or NULL on error, free it with tpm2_pcr_index_free().
+ */
+tpm2_pcr_index *tpm2_pcr_index_new(void);
+
+/**
+ * Adds a known good composite digest to an index created with
+ * tpm2_pcr_index_new().
+ * @param index
+ *  The index.
+ * @param halg
+ *  The hash algorithm of the composite digest.
+ * @param selection
+ *  The PCR selection the digest is over.
+ * @param digest
+ *  The composite digest.
+ * @return
+ *  true on success, false on error.
+ */
+bool tpm2_pcr_index_add(tpm2_pcr_index *index, TPMI_ALG_HASH halg,
+        const TPML_PCR_SELECTION *selection, const TPM2B_DIGEST *digest);
+
+/**
+ * Writes an index to a file, duplicate digests are written once.
+ * @param index
+ *  The index.
+ * @param path
+ *  The file path.
+ * @return
+ *  true on success, false on error.
+ */
+bool tpm2_pcr_index_save(tpm2_pcr_index *index, const char *path);
+
+/**
+ * Maps an index written by tpm2_pcr_index_save().
+ * @param path
+ *  The file path.
+ * @return
+ *  The index or NULL on error or a malformed index, free it with
+ *  tpm2_pcr_index_free().
+ */
+tpm2_pcr_index *tpm2_pcr_index_load(const char *path);
+
+/**
+ * Looks up a composite digest.
+ * @param index
+ *  The index.
+ * @param halg
+ *  The hash algorithm of the composite digest.
+ * @param selection
+ *  The PCR selection the digest is over, banks and PCRs must match the
+ *  indexed selection while the size of the select bitmaps may differ.
+ * @param digest
+ *  The composite digest.
+ * @return
+ *  true if the digest is known good for the selection, false otherwise.
+ */
+bool tpm2_pcr_index_lookup(const tpm2_pcr_index *index, TPMI_ALG_HASH halg,
+        const TPML_PCR_SELECTION *selection, const TPM2B_DIGEST *digest);
+
+/**
+ * Gets the number of distinct digests in an index.
+ * @param index
+ *  The index.
+ * @return
+ *  The number of digests over all selections.
+ */
+UINT32 tpm2_pcr_index_count(const tpm2_pcr_index *index);
+
+/**
+ * Frees an index.
+ * @param index
+ *  The index to free, may be NULL.
+ */
+void tpm2_pcr_index_free(tpm2_pcr_index *index);
+
+#endif /* LIB_TPM2_PCR_INDEX_H_ */
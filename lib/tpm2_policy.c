@@ -1,13 +1,16 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "files.h"
 #include "log.h"
 #include "tpm2.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_capability.h"
 #include "tpm2_openssl.h"
 #include "tpm2_policy.h"
 #include "tpm2_tool.h"
@@ -76,9 +79,224 @@ static bool evaluate_populate_pcr_digests(TPML_PCR_SELECTION *pcr_selections,
     return true;
 }
 
-tool_rc tpm2_policy_build_pcr(ESYS_CONTEXT *ectx,
-        tpm2_session *policy_session, const char *raw_pcrs_file,
-        TPML_PCR_SELECTION *pcr_selections) {
+/*
+ * Expected PolicyPCR digests computed so far by this process. Entries built
+ * from a PCR values file are reused while the file is unchanged, entries
+ * built from the TPM's PCRs while the TPM's pcrUpdateCounter is unchanged.
+ */
+#define PCR_DIGEST_CACHE_SIZE 8
+
+typedef struct pcr_digest_cache_entry pcr_digest_cache_entry;
+struct pcr_digest_cache_entry {
+    TPMI_ALG_HASH auth_hash;
+    TPML_PCR_SELECTION pcrs;
+    bool from_file;
+    char raw_pcrs_file[PATH_MAX];
+    struct stat file_stat;
+    UINT32 pcr_update_counter;
+    TPM2B_DIGEST digest;
+};
+
+static struct {
+    pcr_digest_cache_entry entries[PCR_DIGEST_CACHE_SIZE];
+    unsigned count;
+    unsigned next;
+    /* PCRs whose extension does not bump pcrUpdateCounter */
+    bool no_increment_valid;
+    TPMS_TAGGED_PCR_SELECT no_increment;
+} pcr_digest_cache;
+
+static bool pcr_selections_equal(const TPML_PCR_SELECTION *a,
+        const TPML_PCR_SELECTION *b) {
+
+    if (a->count != b->count) {
+        return false;
+    }
+
+    UINT32 i;
+    for (i = 0; i < a->count; i++) {
+        const TPMS_PCR_SELECTION *x = &a->pcrSelections[i];
+        const TPMS_PCR_SELECTION *y = &b->pcrSelections[i];
+        if (x->hash != y->hash || x->sizeofSelect != y->sizeofSelect
+                || memcmp(x->pcrSelect, y->pcrSelect, x->sizeofSelect)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static pcr_digest_cache_entry *pcr_digest_cache_find(TPMI_ALG_HASH auth_hash,
+        const char *raw_pcrs_file, const TPML_PCR_SELECTION *pcr_selections) {
+
+    unsigned i;
+    for (i = 0; i < pcr_digest_cache.count; i++) {
+        pcr_digest_cache_entry *e = &pcr_digest_cache.entries[i];
+        if (e->auth_hash != auth_hash
+                || e->from_file != (raw_pcrs_file != NULL)
+                || (raw_pcrs_file && strcmp(e->raw_pcrs_file, raw_pcrs_file))) {
+            continue;
+        }
+
+        if (pcr_selections_equal(&e->pcrs, pcr_selections)) {
+            return e;
+        }
+    }
+
+    return NULL;
+}
+
+static bool pcr_file_unchanged(const char *raw_pcrs_file,
+        const struct stat *cached) {
+
+    struct stat sb;
+    int rc = stat(raw_pcrs_file, &sb);
+    if (rc) {
+        return false;
+    }
+
+    return sb.st_dev == cached->st_dev && sb.st_ino == cached->st_ino
+            && sb.st_size == cached->st_size
+            && sb.st_mtim.tv_sec == cached->st_mtim.tv_sec
+            && sb.st_mtim.tv_nsec == cached->st_mtim.tv_nsec;
+}
+
+static void pcr_digest_cache_add(TPMI_ALG_HASH auth_hash,
+        const char *raw_pcrs_file, const TPML_PCR_SELECTION *pcr_selections,
+        UINT32 pcr_update_counter, const TPM2B_DIGEST *digest) {
+
+    struct stat sb = { 0 };
+    if (raw_pcrs_file && stat(raw_pcrs_file, &sb)) {
+        return;
+    }
+
+    pcr_digest_cache_entry *e = pcr_digest_cache_find(auth_hash,
+            raw_pcrs_file, pcr_selections);
+    if (!e) {
+        if (raw_pcrs_file && strlen(raw_pcrs_file) >= sizeof(e->raw_pcrs_file)) {
+            return;
+        }
+
+        e = &pcr_digest_cache.entries[pcr_digest_cache.next];
+        pcr_digest_cache.next = (pcr_digest_cache.next + 1)
+                % PCR_DIGEST_CACHE_SIZE;
+        if (pcr_digest_cache.count < PCR_DIGEST_CACHE_SIZE) {
+            pcr_digest_cache.count++;
+        }
+
+        e->auth_hash = auth_hash;
+        e->pcrs = *pcr_selections;
+        e->from_file = raw_pcrs_file != NULL;
+        snprintf(e->raw_pcrs_file, sizeof(e->raw_pcrs_file), "%s",
+                raw_pcrs_file ? raw_pcrs_file : "");
+    }
+
+    e->file_stat = sb;
+    e->pcr_update_counter = pcr_update_counter;
+    e->digest = *digest;
+}
+
+/*
+ * A cached digest of TPM read PCRs is only trustworthy when every selected
+ * PCR bumps pcrUpdateCounter when extended, see TPM2_PT_PCR_NO_INCREMENT.
+ */
+static tool_rc pcr_digest_cache_is_tracked(ESYS_CONTEXT *ectx,
+        const TPML_PCR_SELECTION *pcr_selections, bool *is_tracked) {
+
+    *is_tracked = false;
+
+    if (!pcr_digest_cache.no_increment_valid) {
+        TPMS_CAPABILITY_DATA *cap = NULL;
+        tool_rc rc = tpm2_capability_get(ectx, TPM2_CAP_PCR_PROPERTIES,
+                TPM2_PT_PCR_NO_INCREMENT, 1, &cap);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        TPML_TAGGED_PCR_PROPERTY *props = &cap->data.pcrProperties;
+        bool found = props->count
+                && props->pcrProperty[0].tag == TPM2_PT_PCR_NO_INCREMENT;
+        if (found) {
+            pcr_digest_cache.no_increment = props->pcrProperty[0];
+            pcr_digest_cache.no_increment_valid = true;
+        }
+        free(cap);
+
+        if (!found) {
+            return tool_rc_success;
+        }
+    }
+
+    const TPMS_TAGGED_PCR_SELECT *no_inc = &pcr_digest_cache.no_increment;
+
+    UINT32 i;
+    for (i = 0; i < pcr_selections->count; i++) {
+        const TPMS_PCR_SELECTION *sel = &pcr_selections->pcrSelections[i];
+        UINT8 j;
+        for (j = 0; j < sel->sizeofSelect && j < no_inc->sizeofSelect; j++) {
+            if (sel->pcrSelect[j] & no_inc->pcrSelect[j]) {
+                return tool_rc_success;
+            }
+        }
+    }
+
+    *is_tracked = true;
+
+    return tool_rc_success;
+}
+
+static tool_rc pcr_digest_cache_lookup(ESYS_CONTEXT *ectx,
+        TPMI_ALG_HASH auth_hash, const char *raw_pcrs_file,
+        const TPML_PCR_SELECTION *pcr_selections, TPM2B_DIGEST *pcr_digest,
+        bool *hit) {
+
+    *hit = false;
+
+    pcr_digest_cache_entry *e = pcr_digest_cache_find(auth_hash,
+            raw_pcrs_file, pcr_selections);
+    if (!e) {
+        return tool_rc_success;
+    }
+
+    if (raw_pcrs_file && !pcr_file_unchanged(raw_pcrs_file, &e->file_stat)) {
+        return tool_rc_success;
+    }
+
+    if (!raw_pcrs_file) {
+        bool is_tracked = false;
+        tool_rc rc = pcr_digest_cache_is_tracked(ectx, pcr_selections,
+                &is_tracked);
+        if (rc != tool_rc_success || !is_tracked) {
+            return rc;
+        }
+
+        /* an empty selection returns just the update counter */
+        TPML_PCR_SELECTION none = { .count = 0 };
+        UINT32 pcr_update_counter = 0;
+        TPML_PCR_SELECTION *pcrs_out = NULL;
+        TPML_DIGEST *values = NULL;
+        rc = tpm2_pcr_read(ectx, ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
+                &none, &pcr_update_counter, &pcrs_out, &values);
+        free(pcrs_out);
+        free(values);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        if (pcr_update_counter != e->pcr_update_counter) {
+            return tool_rc_success;
+        }
+    }
+
+    *pcr_digest = e->digest;
+    *hit = true;
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_policy_get_pcr_digest(ESYS_CONTEXT *ectx,
+        TPMI_ALG_HASH auth_hash, const char *raw_pcrs_file,
+        TPML_PCR_SELECTION *pcr_selections, TPM2B_DIGEST *pcr_digest) {
 
     TPML_DIGEST pcr_values = { .count = 0 };
 
@@ -87,6 +305,14 @@ tool_rc tpm2_policy_build_pcr(ESYS_CONTEXT *ectx,
         return tool_rc_general_error;
     }
 
+    bool hit = false;
+    tool_rc rc = pcr_digest_cache_lookup(ectx, auth_hash, raw_pcrs_file,
+            pcr_selections, pcr_digest, &hit);
+    if (rc != tool_rc_success || hit) {
+        return rc;
+    }
+
+    UINT32 pcr_update_counter = 0;
     bool result = evaluate_populate_pcr_digests(pcr_selections, raw_pcrs_file,
             &pcr_values);
     if (!result) {
@@ -116,10 +342,9 @@ tool_rc tpm2_policy_build_pcr(ESYS_CONTEXT *ectx,
         }
         fclose(fp);
     } else {
-        UINT32 pcr_update_counter;
         TPML_DIGEST *pcr_val = NULL;
         // Read PCRs
-        tool_rc rc = tpm2_pcr_read(ectx,
+        rc = tpm2_pcr_read(ectx,
                         ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
                         pcr_selections, &pcr_update_counter,
                         NULL, &pcr_val);
@@ -138,16 +363,49 @@ tool_rc tpm2_policy_build_pcr(ESYS_CONTEXT *ectx,
     }
 
     // Calculate hashes
-    TPM2B_DIGEST pcr_digest = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer);
-    TPMI_ALG_HASH auth_hash = tpm2_session_get_authhash(policy_session);
-
+    pcr_digest->size = BUFFER_SIZE(TPM2B_DIGEST, buffer);
     result = tpm2_openssl_hash_pcr_values(auth_hash,
-                &pcr_values, &pcr_digest);
+                &pcr_values, pcr_digest);
     if (!result) {
         LOG_ERR("Could not hash pcr values");
         return tool_rc_general_error;
     }
 
+    pcr_digest_cache_add(auth_hash, raw_pcrs_file, pcr_selections,
+            pcr_update_counter, pcr_digest);
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_policy_restart_pcr(ESYS_CONTEXT *ectx,
+        tpm2_session *policy_session, const char *raw_pcrs_file,
+        TPML_PCR_SELECTION *pcr_selections) {
+
+    ESYS_TR handle = tpm2_session_get_handle(policy_session);
+
+    tool_rc rc = tpm2_policy_restart(ectx, handle,
+                    ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    return tpm2_policy_build_pcr(ectx, policy_session, raw_pcrs_file,
+            pcr_selections);
+}
+
+tool_rc tpm2_policy_build_pcr(ESYS_CONTEXT *ectx,
+        tpm2_session *policy_session, const char *raw_pcrs_file,
+        TPML_PCR_SELECTION *pcr_selections) {
+
+    TPM2B_DIGEST pcr_digest = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer);
+    TPMI_ALG_HASH auth_hash = tpm2_session_get_authhash(policy_session);
+
+    tool_rc rc = tpm2_policy_get_pcr_digest(ectx, auth_hash, raw_pcrs_file,
+            pcr_selections, &pcr_digest);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
     // Call the PolicyPCR command
     ESYS_TR handle = tpm2_session_get_handle(policy_session);
 
@@ -10,6 +10,35 @@
 #include "object.h"
 #include "tpm2_session.h"
 
+/**
+ * Compute the PCR digest used as the pcrDigest argument of PolicyPCR, without
+ * issuing the PolicyPCR command itself. Callers that satisfy the same PCR
+ * policy repeatedly can compute this once and pass it to tpm2_policy_pcr().
+ *
+ * Digests are cached for the life of the process. A digest built from a PCR
+ * values file is reused without re-reading the file, one built from the TPM's
+ * PCRs is reused while the TPM's pcrUpdateCounter is unchanged and no
+ * selected PCR is listed in TPM2_PT_PCR_NO_INCREMENT.
+ * @param context
+ *  The Enhanced System API (ESAPI) context.
+ * @param auth_hash
+ *  The hash algorithm of the policy session the digest is intended for.
+ * @param raw_pcrs_file
+ *  The a file output from tpm2_pcrread -o option. Optional, can be NULL.
+ *  If NULL, the PCR values are read via the pcr_selection value.
+ * @param pcr_selections
+ *  The pcr selections to use when building the pcr policy.
+ * @param pcr_digest
+ *  The computed digest of the selected PCR values.
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_policy_get_pcr_digest(ESYS_CONTEXT *context,
+        TPMI_ALG_HASH auth_hash,
+        const char *raw_pcrs_file,
+        TPML_PCR_SELECTION *pcr_selections,
+        TPM2B_DIGEST *pcr_digest);
+
 /**
  * Build a PCR policy via PolicyPCR.
  * @param context
@@ -32,6 +61,26 @@ tool_rc tpm2_policy_build_pcr(ESYS_CONTEXT *context,
         TPML_PCR_SELECTION *pcr_selections);
 
 
+/**
+ * Like tpm2_policy_build_pcr(), but first resets an already started policy
+ * session with PolicyRestart so it can be reused rather than starting a new
+ * session for every operation.
+ * @param context
+ *  The Enhanced System API (ESAPI) context.
+ * @param policy_session
+ *  A previously started policy session.
+ * @param raw_pcrs_file
+ *  As for tpm2_policy_build_pcr().
+ * @param pcr_selections
+ *  As for tpm2_policy_build_pcr().
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_policy_restart_pcr(ESYS_CONTEXT *context,
+        tpm2_session *policy_session,
+        const char *raw_pcrs_file,
+        TPML_PCR_SELECTION *pcr_selections);
+
 /**
  * Enables a signing authority to authorize policies
  * @param ectx
@@ -21,6 +21,7 @@ struct tpm2_session_data {
     TPMA_SESSION attrs;
     TPM2B_AUTH auth_data;
     const char *path;
+    bool resident;
 };
 
 struct tpm2_session {
@@ -95,6 +96,10 @@ void tpm2_session_set_path(tpm2_session_data *data, const char *path) {
     data->path = path;
 }
 
+void tpm2_session_set_resident(tpm2_session_data *data, bool resident) {
+    data->resident = resident;
+}
+
 TPMI_ALG_HASH tpm2_session_get_authhash(tpm2_session *session) {
     return session->input->authHash;
 }
@@ -206,8 +211,17 @@ tool_rc tpm2_session_open(ESYS_CONTEXT *context,
 /* SESSION_VERSION 1 was used prior to the switch to ESAPI. As the types of
  * several of the tpm2_session_data object members have changed the version is
  * bumped.
+ *
+ * Version 2 followed the type and auth hash with a TPMS_CONTEXT in the
+ * context file format. Version 3 follows them with a flags byte and a single
+ * size prefixed blob, a marshaled TPMS_CONTEXT or, for resident sessions, the
+ * ESYS_TR serialization which restores without any TPM command. Version 2
+ * files are still read.
  */
-#define SESSION_VERSION 2
+#define SESSION_VERSION 3
+#define SESSION_VERSION_CONTEXT_FILE 2
+
+#define SESSION_FLAG_RESIDENT (1 << 0)
 
 /*
  * Checks that two types are equal in size.
@@ -226,6 +240,50 @@ COMPILE_ASSERT_SIZE(ESYS_TR, UINT32);
 COMPILE_ASSERT_SIZE(TPMI_ALG_HASH, UINT16);
 COMPILE_ASSERT_SIZE(TPM2_SE, UINT8);
 
+static tool_rc load_session_blob(ESYS_CONTEXT *ctx, FILE *f, UINT8 flags,
+        ESYS_TR *handle) {
+
+    UINT32 size = 0;
+    bool result = files_read_32(f, &size);
+    if (!result || !size || size > UINT16_MAX) {
+        LOG_ERR("Could not read session blob size");
+        return tool_rc_general_error;
+    }
+
+    UINT8 *blob = malloc(size);
+    if (!blob) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tool_rc_general_error;
+
+    result = files_read_bytes(f, blob, size);
+    if (!result) {
+        LOG_ERR("Could not read session blob");
+        goto out;
+    }
+
+    if (flags & SESSION_FLAG_RESIDENT) {
+        rc = tpm2_tr_deserialize(ctx, blob, size, handle);
+        goto out;
+    }
+
+    TPMS_CONTEXT context;
+    size_t offset = 0;
+    rc = tpm2_mu_tpms_context_unmarshal(blob, size, &offset, &context);
+    if (rc != tool_rc_success) {
+        goto out;
+    }
+
+    rc = tpm2_context_load(ctx, &context, handle);
+
+out:
+    free(blob);
+
+    return rc;
+}
+
 tool_rc tpm2_session_restore(ESYS_CONTEXT *ctx, const char *path, bool is_final, tpm2_session **session) {
 
     tool_rc rc = tool_rc_general_error;
@@ -251,6 +309,16 @@ tool_rc tpm2_session_restore(ESYS_CONTEXT *ctx, const char *path, bool is_final,
 
     uint32_t version;
     bool result = files_read_header(f, &version);
+    if (!result) {
+        LOG_ERR("Could not read session file header");
+        goto out;
+    }
+
+    if (version != SESSION_VERSION && version != SESSION_VERSION_CONTEXT_FILE) {
+        LOG_ERR("Unsupported session file version %u, expected %u",
+                version, SESSION_VERSION);
+        goto out;
+    }
 
     TPM2_SE type;
     result = files_read_bytes(f, &type, sizeof(type));
@@ -266,9 +334,21 @@ tool_rc tpm2_session_restore(ESYS_CONTEXT *ctx, const char *path, bool is_final,
         goto out;
     }
 
+    UINT8 flags = 0;
     ESYS_TR handle;
-    tool_rc tmp_rc = files_load_tpm_context_from_file(ctx,
-                    &handle, f);
+    tool_rc tmp_rc;
+    if (version == SESSION_VERSION_CONTEXT_FILE) {
+        tmp_rc = files_load_tpm_context_from_file(ctx, &handle, f);
+    } else {
+        result = files_read_bytes(f, &flags, sizeof(flags));
+        if (!result) {
+            LOG_ERR("Could not read session flags");
+            goto out;
+        }
+
+        tmp_rc = load_session_blob(ctx, f, flags, &handle);
+    }
+
     if (tmp_rc != tool_rc_success) {
         rc = tmp_rc;
         LOG_ERR("Could not load session context");
@@ -282,6 +362,7 @@ tool_rc tpm2_session_restore(ESYS_CONTEXT *ctx, const char *path, bool is_final,
     }
 
     tpm2_session_set_authhash(d, auth_hash);
+    tpm2_session_set_resident(d, flags & SESSION_FLAG_RESIDENT);
 
     tmp_rc = tpm2_session_open(NULL, d, &s);
     if (tmp_rc != tool_rc_success) {
@@ -295,27 +376,12 @@ tool_rc tpm2_session_restore(ESYS_CONTEXT *ctx, const char *path, bool is_final,
     s->internal.ectx = ctx;
     dup_path = NULL;
 
-    TPM2_HANDLE sapi_handle = 0;
-    TPMA_SESSION attrs = 0;
-
-    if (ctx) {
-        tool_rc tmp_rc = tpm2_util_esys_handle_to_sys_handle(ctx, handle,
-                    &sapi_handle);
-        UNUSED(tmp_rc);
-
-        /* hack this in here, should be done when starting the session */
-        tmp_rc = tpm2_sess_get_attributes(
-                     ctx,
-                     handle,
-                     &attrs);
-        UNUSED(tmp_rc);
-    }
-
     s->internal.is_final = is_final;
 
     *session = s;
 
-    LOG_INFO("Restored session: ESYS_TR(0x%x) SAPI(0x%x) attrs(0x%x)", handle, sapi_handle, attrs);
+    LOG_INFO("Restored session: ESYS_TR(0x%x) resident(%u)", handle,
+            flags & SESSION_FLAG_RESIDENT);
 
     rc = tool_rc_success;
 
@@ -328,6 +394,47 @@ out:
     return rc;
 }
 
+static tool_rc save_session_blob(tpm2_session *session, FILE *f) {
+
+    ESYS_CONTEXT *ectx = session->internal.ectx;
+    ESYS_TR handle = tpm2_session_get_handle(session);
+
+    UINT8 *blob = NULL;
+    size_t size = 0;
+    UINT8 marshaled[sizeof(TPMS_CONTEXT)];
+
+    if (session->input->resident) {
+        /* the session stays loaded, only ESAPI's view of it is saved */
+        tool_rc rc = tpm2_tr_serialize(ectx, handle, &blob, &size);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+    } else {
+        TPMS_CONTEXT *context = NULL;
+        tool_rc rc = tpm2_context_save(ectx, handle, &context);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        rc = tpm2_mu_tpms_context_marshal(context, marshaled,
+                sizeof(marshaled), &size);
+        free(context);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+    }
+
+    bool result = files_write_32(f, size)
+            && files_write_bytes(f, blob ? blob : marshaled, size);
+    free(blob);
+    if (!result) {
+        LOG_ERR("Could not write session context");
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
 tool_rc tpm2_session_close(tpm2_session **s) {
 
     tpm2_session *session = *s;
@@ -396,6 +503,14 @@ tool_rc tpm2_session_close(tpm2_session **s) {
         goto out;
     }
 
+    // UINT8 - flags
+    UINT8 flags = session->input->resident ? SESSION_FLAG_RESIDENT : 0;
+    result = files_write_bytes(session_file, &flags, sizeof(flags));
+    if (!result) {
+        LOG_ERR("Could not write session flags");
+        goto out;
+    }
+
     /*
      * Save session context at end of tpm2_session. With tabrmd support it
      * can be reloaded under certain circumstances.
@@ -409,11 +524,7 @@ tool_rc tpm2_session_close(tpm2_session **s) {
 
     LOG_INFO("Saved session: ESYS_TR(0x%x) SAPI(0x%x)", handle, sapi_handle);
 
-    rc = files_save_tpm_context_to_file(session->internal.ectx,
-                tpm2_session_get_handle(session), session_file);
-    if (rc != tool_rc_success) {
-        LOG_ERR("Could not write session context");
-    }
+    rc = save_session_blob(session, session_file);
 
 out:
     if (session_file) {
@@ -425,6 +536,34 @@ out:
     return rc;
 }
 
+tool_rc tpm2_session_discard(tpm2_session **s) {
+
+    tpm2_session *session = *s;
+    if (!session) {
+        return tool_rc_success;
+    }
+
+    tool_rc rc = tool_rc_success;
+    if (session->internal.ectx
+            && session->output.session_handle != ESYS_TR_PASSWORD) {
+        /*
+         * Flush whatever the TPM still holds of the session so it cannot
+         * leak. Flushing a session that is truly gone fails, then only the
+         * ESYS_TR is released.
+         */
+        rc = tpm2_flush_context(session->internal.ectx,
+                session->output.session_handle);
+        if (rc != tool_rc_success) {
+            rc = tpm2_close(session->internal.ectx,
+                    &session->output.session_handle);
+        }
+    }
+
+    tpm2_session_free(s);
+
+    return rc;
+}
+
 tool_rc tpm2_session_restart(ESYS_CONTEXT *context, tpm2_session *s) {
 
     ESYS_TR handle = tpm2_session_get_handle(s);
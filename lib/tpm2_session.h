@@ -82,6 +82,18 @@ void tpm2_session_set_authhash(tpm2_session_data *data, TPMI_ALG_HASH auth_hash)
 
 void tpm2_session_set_path(tpm2_session_data *data, const char *path);
 
+/**
+ * Keep the session loaded in the TPM when it is saved to its path. Only the
+ * ESYS_TR serialization is written and restoring it issues no TPM command.
+ * Resource managers that flush a client's sessions on disconnect, like
+ * tpm2-abrmd or the kernel's /dev/tpmrm0, defeat this.
+ * @param data
+ *  The session data object to modify.
+ * @param resident
+ *  True to keep the session loaded rather than context saving it.
+ */
+void tpm2_session_set_resident(tpm2_session_data *data, bool resident);
+
 /**
  * Set the session attributes
  * @param data
@@ -179,6 +191,18 @@ tool_rc tpm2_session_close(tpm2_session **session);
  */
 tool_rc tpm2_session_restore(ESYS_CONTEXT *ctx, const char *path, bool is_final, tpm2_session **session);
 
+/**
+ * Frees a session that is no longer wanted without saving it, for instance
+ * one a resource manager appears to have evicted. The session is flushed
+ * from the TPM, and if the TPM no longer holds it only the ESYS_TR is
+ * released.
+ * @param session
+ *  The session to discard, set to NULL on return.
+ * @return
+ *  tool_rc indicating status.
+ */
+tool_rc tpm2_session_discard(tpm2_session **session);
+
 /**
  * restarts the session to it's initial state via a call to
  * PolicyRestart().
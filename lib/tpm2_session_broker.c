@@ -0,0 +1,172 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "tpm2.h"
+#include "tpm2_session_broker.h"
+#include "tpm2_util.h"
+
+struct tpm2_session_broker {
+    ESYS_CONTEXT *ectx;
+    ESYS_TR salt_key;
+    char *path;
+    tpm2_session *session;
+};
+
+tool_rc tpm2_session_broker_new(ESYS_CONTEXT *ectx, ESYS_TR salt_key,
+        const char *path, tpm2_session_broker **broker) {
+
+    if (salt_key == ESYS_TR_NONE) {
+        LOG_ERR("A session broker requires a salt key");
+        return tool_rc_general_error;
+    }
+
+    tpm2_session_broker *b = calloc(1, sizeof(*b));
+    if (!b) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    if (path) {
+        b->path = strdup(path);
+        if (!b->path) {
+            LOG_ERR("oom");
+            free(b);
+            return tool_rc_general_error;
+        }
+    }
+
+    b->ectx = ectx;
+    b->salt_key = salt_key;
+
+    *broker = b;
+
+    return tool_rc_success;
+}
+
+static tool_rc start_session(tpm2_session_broker *b) {
+
+    tpm2_session_data *d = tpm2_session_data_new(TPM2_SE_HMAC);
+    if (!d) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    TPMT_SYM_DEF sym = {
+        .algorithm = TPM2_ALG_AES,
+        .keyBits = { .aes = 128 },
+        .mode = { .aes = TPM2_ALG_CFB }
+    };
+
+    tpm2_session_set_key(d, b->salt_key);
+    tpm2_session_set_symmetric(d, &sym);
+    tpm2_session_set_attrs(d, TPMA_SESSION_CONTINUESESSION
+            | TPMA_SESSION_DECRYPT | TPMA_SESSION_ENCRYPT);
+    tpm2_session_set_path(d, b->path);
+
+    return tpm2_session_open(b->ectx, d, &b->session);
+}
+
+tool_rc tpm2_session_broker_get(tpm2_session_broker *broker,
+        tpm2_session **session) {
+
+    if (!broker->session) {
+        /*
+         * Pick up where the previous user of the session file left off, the
+         * saved context carries the session key and the last nonces. A file
+         * from before a TPM reset will not load, start over in that case.
+         */
+        tool_rc rc = tool_rc_general_error;
+        if (broker->path && !access(broker->path, R_OK)) {
+            rc = tpm2_session_restore(broker->ectx, broker->path, false,
+                    &broker->session);
+            if (rc != tool_rc_success) {
+                LOG_WARN("Could not restore session from \"%s\", starting a"
+                        " new one", broker->path);
+            }
+        }
+
+        if (rc != tool_rc_success) {
+            rc = start_session(broker);
+            if (rc != tool_rc_success) {
+                return rc;
+            }
+        }
+    }
+
+    *session = broker->session;
+
+    return tool_rc_success;
+}
+
+/*
+ * Whether the TPM has dropped a session of the command. A resource manager
+ * such as tpm2-abrmd or /dev/tpmrm0 context saves sessions between commands
+ * and passes the TPM's response codes on in its own layer.
+ */
+static bool is_session_evicted(TSS2_RC tpm_rc) {
+
+    TSS2_RC layer = tpm_rc & TSS2_RC_LAYER_MASK;
+    if (layer != TSS2_TPM_RC_LAYER && layer != TSS2_RESMGR_TPM_RC_LAYER) {
+        return false;
+    }
+
+    TSS2_RC rc = tpm_rc & ~TSS2_RC_LAYER_MASK;
+    if (rc >= TPM2_RC_REFERENCE_S0 && rc <= TPM2_RC_REFERENCE_S6) {
+        return true;
+    }
+
+    /* a format one TPM2_RC_HANDLE, with the number of a session handle */
+    return (rc & (TPM2_RC_FMT1 | TPM2_RC_P | TPM2_RC_S))
+                    == (TPM2_RC_FMT1 | TPM2_RC_S)
+            && (rc & ~TPM2_RC_N_MASK) == TPM2_RC_HANDLE;
+}
+
+tool_rc tpm2_session_broker_run(tpm2_session_broker *broker,
+        tpm2_session_broker_fn fn, void *userdata) {
+
+    tpm2_session *session = NULL;
+    tool_rc rc = tpm2_session_broker_get(broker, &session);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TSS2_RC tpm_rc = TPM2_RC_SUCCESS;
+    rc = fn(broker->ectx, session, userdata, &tpm_rc);
+    if (rc == tool_rc_success || !is_session_evicted(tpm_rc)) {
+        return rc;
+    }
+
+    LOG_WARN("Session was evicted by the TPM, starting a new one");
+
+    tool_rc tmp_rc = tpm2_session_discard(&broker->session);
+    UNUSED(tmp_rc);
+
+    rc = start_session(broker);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    tpm_rc = TPM2_RC_SUCCESS;
+    return fn(broker->ectx, broker->session, userdata, &tpm_rc);
+}
+
+tool_rc tpm2_session_broker_free(tpm2_session_broker **broker) {
+
+    tpm2_session_broker *b = *broker;
+    if (!b) {
+        return tool_rc_success;
+    }
+
+    tool_rc rc = tpm2_session_close(&b->session);
+
+    free(b->path);
+    free(b);
+    *broker = NULL;
+
+    return rc;
+}
@@ -0,0 +1,104 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#ifndef LIB_TPM2_SESSION_BROKER_H_
+#define LIB_TPM2_SESSION_BROKER_H_
+
+#include <tss2/tss2_esys.h>
+
+#include "tool_rc.h"
+#include "tpm2_session.h"
+
+/*
+ * A session broker hands out one salted HMAC session with parameter
+ * encryption (decrypt and encrypt attributes, AES-128-CFB) for any number of
+ * commands, so the TPM's asymmetric salt decryption is paid once rather than
+ * per command. ESAPI rolls the nonces on every use; when the broker is given
+ * a path the session is saved there on free and restored by the next broker,
+ * so the nonces and session key carry over tool and batch boundaries.
+ *
+ * If the TPM or a resource manager evicts the session, so a command fails
+ * with TPM2_RC_REFERENCE_S0 to S6 or TPM2_RC_HANDLE on a session handle,
+ * tpm2_session_broker_run() flushes what is left of it, starts a new one and
+ * runs the callback once more.
+ */
+typedef struct tpm2_session_broker tpm2_session_broker;
+
+/**
+ * A callback issuing one or more commands with the broker's session. It may
+ * be run a second time after a failure, so it must be idempotent: commands
+ * that change TPM state, like NV writes or extends, must not be issued by a
+ * brokered callback unless repeating them is harmless.
+ * @param ectx
+ *  The Enhanced System API (ESAPI) context.
+ * @param session
+ *  The broker's session, valid for the duration of the call only.
+ * @param userdata
+ *  The userdata passed to tpm2_session_broker_run().
+ * @param tpm_rc
+ *  Set to the response code of the TPM command that failed, if any. It is
+ *  TPM2_RC_SUCCESS on entry.
+ * @return
+ *  A tool_rc indicating status.
+ */
+typedef tool_rc (*tpm2_session_broker_fn)(ESYS_CONTEXT *ectx,
+        tpm2_session *session, void *userdata, TSS2_RC *tpm_rc);
+
+/**
+ * Creates a session broker. No TPM command is issued until a session is
+ * first requested.
+ * @param ectx
+ *  The Enhanced System API (ESAPI) context.
+ * @param salt_key
+ *  A loaded decryption key, for instance a storage primary or an EK, used to
+ *  salt the session.
+ * @param path
+ *  Optional, a session file to restore from and save to.
+ * @param broker
+ *  The new broker.
+ * @return
+ *  A tool_rc indicating status.
+ */
+tool_rc tpm2_session_broker_new(ESYS_CONTEXT *ectx, ESYS_TR salt_key,
+        const char *path, tpm2_session_broker **broker);
+
+/**
+ * Gets the broker's session, restoring or starting it as needed.
+ * @param broker
+ *  The broker.
+ * @param session
+ *  The session, owned by the broker.
+ * @return
+ *  A tool_rc indicating status.
+ */
+tool_rc tpm2_session_broker_get(tpm2_session_broker *broker,
+        tpm2_session **session);
+
+/**
+ * Runs a callback with the broker's session. If the callback fails with a
+ * response code saying a session is not loaded, the old session is flushed,
+ * a new one is started and the callback is run once more. Any other failure
+ * is returned as is.
+ * @param broker
+ *  The broker.
+ * @param fn
+ *  The callback.
+ * @param userdata
+ *  Passed to the callback.
+ * @return
+ *  The callback's tool_rc, or a tool_rc indicating why the session could not
+ *  be established.
+ */
+tool_rc tpm2_session_broker_run(tpm2_session_broker *broker,
+        tpm2_session_broker_fn fn, void *userdata);
+
+/**
+ * Frees the broker. The session is saved to the broker's path if one was
+ * given, otherwise it is flushed.
+ * @param broker
+ *  The broker, set to NULL on return.
+ * @return
+ *  A tool_rc indicating status.
+ */
+tool_rc tpm2_session_broker_free(tpm2_session_broker **broker);
+
+#endif /* LIB_TPM2_SESSION_BROKER_H_ */
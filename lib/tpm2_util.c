@@ -245,6 +245,29 @@ bool tpm2_util_string_to_uint32(const char *str, uint32_t *value) {
     return true;
 }
 
+char *tpm2_util_trim(char *s) {
+
+    while (*s == ' ' || *s == '\t') {
+        s++;
+    }
+
+    size_t len = strlen(s);
+    while (len && strchr(" \t\r\n", s[len - 1])) {
+        s[--len] = '\0';
+    }
+
+    return s;
+}
+
+UINT64 tpm2_util_elapsed_us(const struct timespec *start,
+        const struct timespec *end) {
+
+    INT64 ns = (INT64) (end->tv_sec - start->tv_sec) * 1000000000
+            + (end->tv_nsec - start->tv_nsec);
+
+    return (UINT64) ns / 1000;
+}
+
 int tpm2_util_hex_to_byte_structure(const char *inStr, UINT16 *byteLength,
         BYTE *byteBuffer) {
     int strLength; //if the inStr likes "1a2b...", no prefix "0x"
@@ -6,6 +6,7 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <time.h>
 
 #include <tss2/tss2_esys.h>
 
@@ -135,6 +136,27 @@ bool tpm2_util_concat_buffer(TPM2B_MAX_BUFFER *result, TPM2B *append);
  */
 bool tpm2_util_string_to_uint32(const char *str, uint32_t *value);
 
+/**
+ * Trims the blanks around a string, in place.
+ * @param s
+ *  The string, its trailing blanks and line end are cut off.
+ * @return
+ *  s past its leading blanks.
+ */
+char *tpm2_util_trim(char *s);
+
+/**
+ * Computes the time between two clock_gettime() readings.
+ * @param start
+ *  The earlier reading.
+ * @param end
+ *  The later reading, of the same clock.
+ * @return
+ *  The elapsed time in microseconds, rounded down.
+ */
+UINT64 tpm2_util_elapsed_us(const struct timespec *start,
+        const struct timespec *end);
+
 /**
  * Converts a numerical string into a uint16 value.
  * @param str
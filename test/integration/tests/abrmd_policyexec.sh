@@ -0,0 +1,110 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+source helpers.sh
+
+file_primary_key_ctx=prim.ctx
+file_input_data=secret.data
+file_policy=policy.data
+file_policy_steps=policy.steps
+file_policy_script=policy.script
+file_unseal_key_pub=sealkey.pub
+file_unseal_key_priv=sealkey.priv
+file_unseal_key_ctx=sealkey.ctx
+file_output_data=unsealed.data
+file_session_data=session.dat
+
+secret="12345678"
+
+cleanup() {
+    rm -f $file_primary_key_ctx $file_input_data $file_policy \
+    $file_policy_steps $file_policy_script $file_unseal_key_pub \
+    $file_unseal_key_priv $file_unseal_key_ctx $file_output_data \
+    $file_session_data
+
+    tpm2_flushcontext $file_session_data 2>/dev/null || true
+
+    if [ "${1}" != "no-shutdown" ]; then
+        shut_down
+    fi
+}
+trap cleanup EXIT
+
+start_up
+
+cleanup "no-shutdown"
+
+echo $secret > $file_input_data
+
+tpm2_clear
+
+tpm2_createprimary -Q -C o -c $file_primary_key_ctx
+
+cat > $file_policy_script <<END
+# boot state and unseal only
+pcr sha256:0,1,2,3
+
+commandcode unseal
+END
+
+# The script computes the same digest as the individual tools
+tpm2_policyexec -L $file_policy $file_policy_script
+
+tpm2_startauthsession -S $file_session_data
+tpm2_policypcr -Q -S $file_session_data -l sha256:0,1,2,3
+tpm2_policycommandcode -Q -S $file_session_data -L $file_policy_steps unseal
+tpm2_flushcontext $file_session_data
+rm $file_session_data
+
+cmp -s $file_policy $file_policy_steps
+
+tpm2_create -Q -C $file_primary_key_ctx -u $file_unseal_key_pub \
+  -r $file_unseal_key_priv -L $file_policy -i- <<< $secret
+
+tpm2_load -Q -C $file_primary_key_ctx -u $file_unseal_key_pub \
+  -r $file_unseal_key_priv -c $file_unseal_key_ctx
+
+# Satisfy the policy with one tool, checking the script in a trial run first
+tpm2_startauthsession --policy-session -S $file_session_data
+
+tpm2_policyexec -S $file_session_data --trial-first $file_policy_script
+
+tpm2_unseal -p session:$file_session_data -c $file_unseal_key_ctx \
+  > $file_output_data
+
+tpm2_flushcontext $file_session_data
+rm $file_session_data
+
+cmp -s $file_output_data $file_input_data
+
+# A trial run cannot predict the digest of an already extended session
+tpm2_startauthsession --policy-session -S $file_session_data
+tpm2_policycommandcode -Q -S $file_session_data unseal
+trap - ERR
+tpm2_policyexec -S $file_session_data --trial-first $file_policy_script
+if [ $? -eq 0 ]; then
+    echo "tpm2_policyexec: expected an extended session to be refused"
+    exit 1
+fi
+trap onerror ERR
+
+tpm2_flushcontext $file_session_data
+rm $file_session_data
+
+# A script error fails before the session is used
+echo "pcr sha256:0 extra args" > $file_policy_script
+trap - ERR
+tpm2_policyexec $file_policy_script
+if [ $? -eq 0 ]; then
+    echo "tpm2_policyexec: expected a script error"
+    exit 1
+fi
+
+echo "policynope" > $file_policy_script
+tpm2_policyexec $file_policy_script
+if [ $? -eq 0 ]; then
+    echo "tpm2_policyexec: expected an unknown command error"
+    exit 1
+fi
+trap onerror ERR
+
+exit 0
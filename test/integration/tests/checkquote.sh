@@ -23,7 +23,10 @@ cleanup() {
   rm -f $output_ek_pub_pem \
         $output_ak_pub_pem $output_ak_pub_name \
         $output_quote $output_quotesig $output_quotepcr rand.out \
-        $ak_ctx
+        $ak_ctx nonces.txt batch.yaml quote.bundle stream.bundle \
+        bundles.yaml other.pem reselect.bundle \
+        other.ctx foreign.bundle novalues.bundle
+  rm -rf proofs
 
   tpm2_pcrreset 16
   tpm2_evictcontrol -C o -c $handle_ek 2>/dev/null || true
@@ -60,4 +63,168 @@ tpm2_quote -c $handle_ak -l sha256:15,16,22 -q $loaded_randomness -m $output_quo
 # Verify quote
 tpm2_checkquote -u $output_ak_pub_pem -m $output_quote -s $output_quotesig -f $output_quotepcr -g $digestAlg -q $loaded_randomness
 
+# Batch quote, one quote serves every nonce through its inclusion proof
+cat > nonces.txt <<EOF
+# one verifier nonce per line
+abc123
+$loaded_randomness
+
+00112233445566778899
+EOF
+mkdir proofs
+tpm2_quote -c $handle_ak -l sha256:15,16,22 --batch nonces.txt \
+  --proof-dir proofs -m $output_quote -s $output_quotesig -g $digestAlg \
+  -p "$akpw" > batch.yaml
+
+test "$(yaml_get_kv batch.yaml batch hash-algorithm)" == "sha256"
+root=$(yaml_get_kv batch.yaml batch root)
+test "$(xxd -p -c 256 $output_quote | grep -c $root)" -eq 1
+
+tpm2_checkquote -u $output_ak_pub_pem -m $output_quote -s $output_quotesig \
+  -g $digestAlg -q abc123 --proof proofs/0.proof
+tpm2_checkquote -u $output_ak_pub_pem -m $output_quote -s $output_quotesig \
+  -g $digestAlg -q $loaded_randomness --proof proofs/1.proof
+cat nonces.txt | tpm2_quote -c $handle_ak -l sha256:15,16,22 --batch - \
+  --window 500 --proof-dir proofs -m $output_quote -s $output_quotesig \
+  -g $digestAlg -p "$akpw"
+tpm2_checkquote -u $output_ak_pub_pem -m $output_quote -s $output_quotesig \
+  -g $digestAlg -q 00112233445566778899 --proof proofs/2.proof
+
+# Attestation bundles, singly and as a stream
+tpm2_quote -c $handle_ak -l sha256:15,16,22 -q abc123 -g $digestAlg \
+  -p "$akpw" --bundle quote.bundle
+tpm2_checkquote --bundle quote.bundle -u $output_ak_pub_pem -q abc123
+tpm2_checkquote --bundle quote.bundle -u $output_ak_pub_pem
+cat quote.bundle quote.bundle quote.bundle > stream.bundle
+tpm2_checkquote --bundle stream.bundle -u $output_ak_pub_pem -q abc123 \
+  > bundles.yaml
+test "$(grep -c 'verified: true' bundles.yaml)" -eq 3
+ak_name=$(xxd -p -c 256 $output_ak_pub_name)
+test "$(grep -c "ak-name: $ak_name" bundles.yaml)" -eq 3
+cat stream.bundle | tpm2_checkquote --bundle - -u $output_ak_pub_pem
+
+# A bundle signed by another AK, carrying that AK
+tpm2_createak -C $handle_ek -c other.ctx -G $ak_alg -g $digestAlg \
+  -s $signAlg -p "$akpw"
+tpm2_quote -c other.ctx -l sha256:15,16,22 -q abc123 -g $digestAlg \
+  -p "$akpw" --bundle foreign.bundle
+
+trap - ERR
+
+# The AK is only trusted when pinned with -u
+tpm2_checkquote --bundle quote.bundle -q abc123
+if [ $? -eq 0 ]; then
+  echo "checkquote accepted a bundle without a trusted AK"
+  exit 1
+fi
+
+tpm2_checkquote --bundle foreign.bundle -u $output_ak_pub_pem -q abc123
+if [ $? -eq 0 ]; then
+  echo "checkquote accepted a bundle signed by a foreign AK"
+  exit 1
+fi
+
+# A bundle of another nonce or AK fails
+tpm2_checkquote --bundle stream.bundle -u $output_ak_pub_pem -q abc124
+if [ $? -eq 0 ]; then
+  echo "checkquote accepted bundles of another nonce"
+  exit 1
+fi
+
+openssl genrsa 2048 2>/dev/null | openssl rsa -pubout > other.pem
+tpm2_checkquote --bundle quote.bundle -u other.pem
+if [ $? -eq 0 ]; then
+  echo "checkquote accepted a bundle of another AK"
+  exit 1
+fi
+
+# A bundle that selects other PCRs than the quote fails, here 15,16,23
+python3 - <<EOF
+with open("quote.bundle", "rb") as f:
+    data = f.read()
+field = bytes.fromhex("0003" "0000000a" "00000001" "000b" "03")
+at = data.index(field + bytes.fromhex("008041")) + len(field)
+with open("reselect.bundle", "wb") as f:
+    f.write(data[:at] + bytes.fromhex("008081") + data[at + 3:])
+EOF
+tpm2_checkquote --bundle reselect.bundle -u $output_ak_pub_pem
+if [ $? -eq 0 ]; then
+  echo "checkquote accepted a bundle of another PCR selection"
+  exit 1
+fi
+
+# A quote of PCRs is not verified without the PCR values to check it with
+python3 - <<EOF
+import struct
+with open("quote.bundle", "rb") as f:
+    data = f.read()
+magic, version, length = struct.unpack(">III", data[:12])
+fields, at = b"", 12
+while at < 12 + length:
+    tag, size = struct.unpack(">HI", data[at:at + 6])
+    if tag != 4:
+        fields += data[at:at + 6 + size]
+    at += 6 + size
+with open("novalues.bundle", "wb") as f:
+    f.write(struct.pack(">III", magic, version, len(fields)) + fields)
+EOF
+tpm2_checkquote --bundle novalues.bundle -u $output_ak_pub_pem
+if [ $? -eq 0 ]; then
+  echo "checkquote accepted a quote of PCRs without PCR values"
+  exit 1
+fi
+
+# A truncated stream fails
+head -c -10 stream.bundle | tpm2_checkquote --bundle - -u $output_ak_pub_pem
+if [ $? -eq 0 ]; then
+  echo "checkquote accepted a truncated bundle stream"
+  exit 1
+fi
+
+# A nonce outside the batch or the proof of another nonce fails
+tpm2_checkquote -u $output_ak_pub_pem -m $output_quote -s $output_quotesig \
+  -g $digestAlg -q abc124 --proof proofs/0.proof
+if [ $? -eq 0 ]; then
+  echo "checkquote accepted a nonce outside the batch"
+  exit 1
+fi
+
+tpm2_checkquote -u $output_ak_pub_pem -m $output_quote -s $output_quotesig \
+  -g $digestAlg -q abc123 --proof proofs/1.proof
+if [ $? -eq 0 ]; then
+  echo "checkquote accepted the proof of another nonce"
+  exit 1
+fi
+
+# A proof may not pick another hash algorithm than the quote's signature
+python3 - <<EOF
+with open("proofs/0.proof", "rb") as f:
+    proof = bytearray(f.read())
+proof[8:10] = (0x000c).to_bytes(2, "big")
+with open("proofs/sha384.proof", "wb") as f:
+    f.write(proof)
+EOF
+tpm2_checkquote -u $output_ak_pub_pem -m $output_quote -s $output_quotesig \
+  -g $digestAlg -q abc123 --proof proofs/sha384.proof
+if [ $? -eq 0 ]; then
+  echo "checkquote accepted a proof of another hash algorithm"
+  exit 1
+fi
+
+# The plain nonce compare does not accept the batch root's nonces
+tpm2_checkquote -u $output_ak_pub_pem -m $output_quote -s $output_quotesig \
+  -g $digestAlg -q abc123
+if [ $? -eq 0 ]; then
+  echo "checkquote accepted a batch nonce without its proof"
+  exit 1
+fi
+
+# --batch conflicts with -q
+tpm2_quote -c $handle_ak -l sha256:15,16,22 --batch nonces.txt \
+  --proof-dir proofs -q abc123 -g $digestAlg -p "$akpw"
+if [ $? -eq 0 ]; then
+  echo "tpm2_quote accepted --batch with -q"
+  exit 1
+fi
+
 exit 0
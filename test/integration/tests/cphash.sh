@@ -0,0 +1,89 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+source helpers.sh
+
+primary_ctx=prim.ctx
+seal_pub=seal.pub
+seal_priv=seal.priv
+seal_ctx=seal.ctx
+seal_name=seal.name
+unseal_cmd=unseal.cmd
+extend_cmd=extend.cmd
+random_cmd=random.cmd
+cmd_list=commands.list
+out_dir=cphashes
+expected=expected.bin
+output=cphash.yaml
+
+cleanup() {
+    rm -rf $primary_ctx $seal_pub $seal_priv $seal_ctx $seal_name \
+           $unseal_cmd $extend_cmd $random_cmd $cmd_list $out_dir \
+           $expected $output
+
+    if [ "$1" != "no-shut-down" ]; then
+       shut_down
+    fi
+}
+trap cleanup EXIT
+
+start_up
+
+cleanup "no-shut-down"
+
+tpm2_clear
+
+tpm2_createprimary -Q -C o -c $primary_ctx
+tpm2_create -Q -C $primary_ctx -u $seal_pub -r $seal_priv -i- <<< "secret"
+tpm2_load -Q -C $primary_ctx -u $seal_pub -r $seal_priv -c $seal_ctx \
+  -n $seal_name
+
+# TPM2_Unseal of 0x80000001 with a password session
+echo "80020000001b0000015e8000000100000009400000090000000000" \
+  | xxd -r -p > $unseal_cmd
+# TPM2_PCR_Extend of PCR 16, the parameters are hashed as given
+echo "80020000001d0000018200000010000000094000000900000000000102" \
+  | xxd -r -p > $extend_cmd
+# TPM2_GetRandom of 16 bytes, no sessions
+echo "80010000000c0000017b0010" | xxd -r -p > $random_cmd
+
+# cpHash = H(commandCode || names || parameters)
+tpm2_cphash -n $seal_name $unseal_cmd > $output
+(echo "0000015e" | xxd -r -p; cat $seal_name) \
+  | openssl dgst -sha256 -binary > $expected
+yaml_get_kv $output "$unseal_cmd" "cphash" > got.hex
+test "`cat got.hex`" == "`xxd -p -c 64 $expected`"
+rm got.hex
+
+# A handle without a name file needs to be its own name
+trap - ERR
+tpm2_cphash $unseal_cmd 2>/dev/null
+if [ $? -eq 0 ]; then
+    echo "tpm2_cphash: expected an error for a handle without a name"
+    exit 1
+fi
+trap onerror ERR
+
+# Bulk mode, digests saved per command
+mkdir $out_dir
+cat > $cmd_list <<END
+# planned commands
+$unseal_cmd $seal_name
+$extend_cmd
+$random_cmd
+END
+tpm2_cphash -g sha256 -l $cmd_list -o $out_dir > $output
+
+echo "0000017b0010" | xxd -r -p | openssl dgst -sha256 -binary > $expected
+cmp $out_dir/random.cphash $expected
+
+(echo "0000018200000010" | xxd -r -p; echo "0102" | xxd -r -p) \
+  | openssl dgst -sha256 -binary > $expected
+cmp $out_dir/extend.cphash $expected
+
+# nameHash = H(names)
+openssl dgst -sha256 -binary $seal_name > $expected
+cmp $out_dir/unseal.namehash $expected
+
+test ! -e $out_dir/random.namehash
+
+exit 0
@@ -41,4 +41,13 @@ tpm2_evictcontrol -Q -C o -c $phandle
 
 yaml_verify evict.log
 
+# Load the context into an available handle of the platform sub-range, delete it
+tpm2_evictcontrol -C p -c key.dat > evict.log
+phandle=$(yaml_get_kv evict.log "persistent-handle")
+if [ $(( phandle < 0x81800000 )) -eq 1 ]; then
+    echo "Expected a platform persistent handle, got $phandle"
+    exit 1
+fi
+tpm2_evictcontrol -Q -C p -c $phandle
+
 exit 0
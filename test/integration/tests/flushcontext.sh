@@ -32,6 +32,11 @@ tpm2_flushcontext -Q -t
 tpm2_createpolicy -Q --policy-session --policy-pcr -l sha256:0
 tpm2_flushcontext -Q -l
 
+# Test for flushing everything at once
+tpm2_createprimary -Q -C o -g sha256 -G rsa
+tpm2_createpolicy -Q --policy-session --policy-pcr -l sha256:0
+tpm2_flushcontext -Q -a
+
 cleanup "no-shut-down"
 
 exit 0
@@ -3,7 +3,7 @@
 source helpers.sh
 
 cleanup() {
-    rm -f random.out
+    rm -f random.out feed.out feed.yaml
 
     if [ "$1" != "no-shut-down" ]; then
         shut_down
@@ -19,6 +19,16 @@ cleanup "no-shut-down"
 tpm2_getrandom -o random.out 32
 s=`stat -c %s random.out`
 test $s -eq 32
+test "$(stat -c %a random.out)" == "600"
+
+# test overwriting the file in place, and writing to a file descriptor
+tpm2_getrandom -o random.out 16
+s=`stat -c %s random.out`
+test $s -eq 16
+
+tpm2_getrandom -o fd:3 24 3> random.out
+s=`stat -c %s random.out`
+test $s -eq 24
 
 #test stdout
 tpm2_getrandom --hex 4 > random.out
@@ -32,9 +42,32 @@ tpm2_getrandom -Q --hex 4 > random.out
 s=`stat -c %s random.out`
 test $s -eq 0
 
+# test feeding a file, in TPM sized chunks, until the count is reached
+tpm2_getrandom --feed feed.out --count 1000 --stir-interval 1 > feed.yaml
+s=`stat -c %s feed.out`
+test $s -eq 1000
+
+yaml_verify feed.yaml
+test `yaml_get_kv feed.yaml feed bytes` -eq 1000
+grep -q "repetition-count-failures: 0" feed.yaml
+grep -q "adaptive-proportion-failures: 0" feed.yaml
+
+# test the feed rate, 256 bytes at 512 bytes per second take half a second
+start=`date +%s%N`
+tpm2_getrandom -Q --feed feed.out --count 256 --rate 512 32
+end=`date +%s%N`
+test $(( (end - start) / 1000000 )) -ge 400
+
 # negative tests
 trap - ERR
 
+# feed options need --feed
+tpm2_getrandom --count 10 8 &> /dev/null
+if [ $? -eq 0 ]; then
+    echo "tpm2_getrandom should fail with --count but no --feed"
+    exit 1
+fi
+
 # larger than any known hash size should fail
 tpm2_getrandom 2000 &> /dev/null
 if [ $? -eq 0 ]; then
@@ -20,7 +20,8 @@ file_input_data=secret.data
 
 cleanup() {
   rm -f $file_primary_key_ctx $file_hmac_key_pub $file_hmac_key_priv \
-        $file_hmac_key_name $file_hmac_output ticket.out
+        $file_hmac_key_name $file_hmac_output ticket.out \
+        stream*.data hmacs.yaml
 
   if [ $(ina "$@" "keep-context") -ne 0 ]; then
     rm -f $file_hmac_key_ctx $file_input_data
@@ -85,6 +86,35 @@ test -f ticket.out
 # test no output file
 cat $file_input_data | tpm2_hmac -c $file_hmac_key_ctx 1>/dev/null
 
+# test several input files, each HMAC'd with a sequence of its own
+dd if=/dev/urandom of=stream1.data bs=2093 count=1 2>/dev/null
+dd if=/dev/urandom of=stream2.data bs=1024 count=3 2>/dev/null
+cp $file_input_data stream3.data
+: > stream4.data
+
+tpm2_hmac -c $file_hmac_key_ctx stream1.data stream2.data stream3.data \
+    stream4.data > hmacs.yaml
+
+for f in stream1.data stream2.data stream3.data stream4.data; do
+    expected=`tpm2_hmac -c $file_hmac_key_ctx --hex $f`
+    got=`yaml_get_kv hmacs.yaml $f`
+    test "$expected" == "$got"
+done
+
+# a single file read from a pipe takes the sequence path
+expected=`tpm2_hmac -c $file_hmac_key_ctx --hex stream2.data`
+got=`cat stream2.data | tpm2_hmac -c $file_hmac_key_ctx --hex`
+test "$expected" == "$got"
+
+# several input files go to stdout only
+trap - ERR
+tpm2_hmac -c $file_hmac_key_ctx -o $file_hmac_output stream1.data stream2.data
+if [ $? -eq 0 ]; then
+    echo "Expected tpm2_hmac to reject -o with several input files"
+    exit 1
+fi
+trap onerror ERR
+
 # verify that silent is indeed silent
 stdout=`cat $file_input_data | tpm2_hmac -Q -c $file_hmac_key_ctx`
 if [ -n "$stdout" ]; then
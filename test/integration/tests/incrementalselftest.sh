@@ -44,6 +44,20 @@ if [ -n "${alglist}" ]; then
     fi
 fi
 
+# Orchestrated testing of every implemented algorithm, batch by batch
+temp=$(mktemp)
+tpm2_incrementalselftest --orchestrate --batch-size 3 --yield 1 > "${temp}"
+yaml_verify "${temp}"
+test "$(yaml_get_kv "${temp}" "status")" != "failed"
+test "$(yaml_get_kv "${temp}" "batches")" -gt 0
+rm -f "${temp}"
+
+temp=$(mktemp)
+tpm2_incrementalselftest --orchestrate sha256 aes > "${temp}"
+test "$(yaml_get_kv "${temp}" "batches")" -eq 2
+grep -q "algorithm: sha256" "${temp}"
+rm -f "${temp}"
+
 # Finally just verify that every algorithm are
 # effectively being already tested
 aesmodes="$(populate_algs "details['encrypting'] and details['symmetric']")"
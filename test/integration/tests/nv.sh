@@ -17,7 +17,8 @@ cleanup() {
   tpm2_nvundefine -Q   0x1500015 -C 0x40000001 -P owner 2>/dev/null || true
 
   rm -f policy.bin test.bin nv.test_w $large_file_name $large_file_read_name \
-        nv.readlock foo.dat cmp.dat $file_pcr_value $file_policy nv.out cap.out
+        nv.readlock foo.dat cmp.dat $file_pcr_value $file_policy nv.out cap.out \
+        nv.cache
 
   if [ "$1" != "no-shut-down" ]; then
      shut_down
@@ -126,6 +127,28 @@ cmp -s $large_file_read_name $large_file_name
 tpm2_nvreadpublic > nv.out
 yaml_get_kv nv.out "$nv_test_index" > /dev/null
 
+# The inventory hashes the contents and lists the same with its cache
+tpm2_nvreadpublic -g sha256 --cache=nv.cache > nv.out
+yaml_verify nv.out
+digest=$(python3 -c "import yaml; \
+d = yaml.load(open('nv.out'), Loader=yaml.BaseLoader); \
+print(d['$nv_test_index']['contents']['digest'])")
+test "$digest" == "$(sha256sum $large_file_name | cut -d' ' -f1)"
+
+tpm2_nvreadpublic -g sha256 --cache=nv.cache | cmp - nv.out
+
+# Contents rewritten under the same name are hashed again, not taken cached
+base64 /dev/urandom | head -c $(($large_file_size)) > $large_file_name
+tpm2_nvwrite -Q   $nv_test_index -C o -i $large_file_name
+tpm2_nvreadpublic -g sha256 --cache=nv.cache > nv.out
+digest=$(python3 -c "import yaml; \
+d = yaml.load(open('nv.out'), Loader=yaml.BaseLoader); \
+print(d['$nv_test_index']['contents']['digest'])")
+test "$digest" == "$(sha256sum $large_file_name | cut -d' ' -f1)"
+
+tpm2_nvreadpublic --inventory > nv.out
+yaml_get_kv nv.out "$nv_test_index" "name" > /dev/null
+
 tpm2_nvundefine -Q   $nv_test_index -C o
 
 #
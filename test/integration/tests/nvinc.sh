@@ -15,7 +15,8 @@ cleanup() {
   tpm2_nvundefine -Q   0x1500015 -C 0x40000001 -P owner 2>/dev/null || true
 
   rm -f policy.bin test.bin nv.test_inc nv.readlock foo.dat cmp.dat \
-        $file_pcr_value $file_policy nv.out cap.out
+        $file_pcr_value $file_policy nv.out cap.out nv.sock nv.notsock \
+        session.ctx
 
   if [ "$1" != "no-shut-down" ]; then
      shut_down
@@ -138,6 +139,68 @@ fi
 # Check using authorisation with tpm2_nvundefine
 trap onerror ERR
 
+# Counter service, index authorization
+v=$(echo "read 0x1500015" | tpm2_nvincrement -P "index" --service)
+v=${v#ok 0x1500015=}
+
+# Counter service, owner authorization, with an increment listed twice and
+# bad requests that must not stop the service
+printf "inc 0x1500015\nbogus 0x1500015\ninc 0x1500015 0x1500015\nread foo\nread 0x1500015\n" | \
+  tpm2_nvincrement -C 0x40000001 -P "owner" --service > nv.out
+
+cat > cmp.dat <<EOF
+ok 0x1500015=$((v + 1))
+error unknown operation "bogus"
+ok 0x1500015=$((v + 3))
+error invalid NV index "foo"
+ok 0x1500015=$((v + 3))
+EOF
+cmp nv.out cmp.dat
+
+# Counter service over a UNIX socket, stopped by SIGTERM
+tpm2_nvincrement -C 0x40000001 -P "owner" --service --socket=nv.sock &
+pid=$!
+for i in $(seq 50); do
+  test -S nv.sock && break
+  sleep 0.1
+done
+python3 - <<EOF > nv.out
+import socket
+s = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+s.connect("nv.sock")
+f = s.makefile("rw")
+f.write("inc 0x1500015\n")
+f.flush()
+print(f.readline(), end="")
+EOF
+kill -TERM $pid
+wait $pid
+echo "ok 0x1500015=$((v + 4))" | cmp nv.out -
+
+# --socket never removes a path that is not a socket
+echo "keep" > nv.notsock
+trap - ERR
+tpm2_nvincrement -C 0x40000001 -P "owner" --service --socket=nv.notsock \
+  < /dev/null
+if [ $? -eq 0 ]; then
+  echo "the counter service served on a path that is not a socket"
+  exit 1
+fi
+trap onerror ERR
+echo "keep" | cmp nv.notsock -
+
+# a policy session is spent by the first request, the service refuses it
+tpm2_startauthsession -S session.ctx --policy-session
+trap - ERR
+echo "read 0x1500015" | \
+  tpm2_nvincrement -C 0x40000001 -P session:session.ctx --service
+if [ $? -eq 0 ]; then
+  echo "the counter service accepted a policy session"
+  exit 1
+fi
+trap onerror ERR
+tpm2_flushcontext session.ctx
+
 tpm2_nvundefine   0x1500015 -C 0x40000001 -P "owner"
 
 exit 0
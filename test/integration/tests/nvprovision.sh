@@ -0,0 +1,128 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+source helpers.sh
+
+cleanup() {
+    rm -f nv.manifest nvprovision.log config.bin secret.bin nv.out
+
+    # Undefine the indices, we want this to always succeed and never trip
+    # the onerror trap.
+    for i in 0x1500018 0x1500019 0x150001A; do
+        tpm2_nvundefine -Q $i -C o 2>/dev/null || true
+    done
+
+    if [ "$1" != "no-shut-down" ]; then
+      shut_down
+    fi
+}
+trap cleanup EXIT
+
+start_up
+
+cleanup "no-shut-down"
+
+tpm2_clear
+
+echo -n "provisioned configuration" > config.bin
+dd if=/dev/urandom of=secret.bin bs=1 count=48 2>/dev/null
+
+cat > nv.manifest <<EOM
+# written and write locked configuration
+[0x1500018]
+attributes = ownerwrite|ownerread|writedefine
+data = config.bin
+lock = write
+
+# index authorized, larger than its contents
+[0x1500019]
+attributes = authwrite|authread|read_stclear
+size = 64
+auth = nvpass
+data = secret.bin
+lock = read
+
+# defined only
+[0x150001A]
+attributes = ownerwrite|ownerread
+size = 32
+EOM
+
+tpm2_nvprovision nv.manifest > nvprovision.log
+
+yaml_verify nvprovision.log
+
+test "$(yaml_get_kv nvprovision.log 0x1500018 define)" == "defined"
+test "$(yaml_get_kv nvprovision.log 0x1500018 write)" == "written"
+test "$(yaml_get_kv nvprovision.log 0x1500018 lock)" == "locked"
+test "$(yaml_get_kv nvprovision.log 0x1500019 write)" == "written"
+test "$(yaml_get_kv nvprovision.log 0x1500019 lock)" == "locked"
+test "$(yaml_get_kv nvprovision.log 0x150001A write)" == "none"
+test "$(yaml_get_kv nvprovision.log 0x150001A lock)" == "none"
+
+tpm2_nvread 0x1500018 -C o -s 25 > nv.out
+cmp nv.out config.bin
+
+tpm2_nvreadpublic > nv.out
+test "$(yaml_get_kv nv.out 0x1500019 size)" == "64"
+
+# a second run finds everything in place, only contents that cannot be read
+# back are written again
+tpm2_nvprovision nv.manifest > nvprovision.log
+
+test "$(yaml_get_kv nvprovision.log 0x1500018 define)" == "unchanged"
+test "$(yaml_get_kv nvprovision.log 0x1500018 write)" == "unchanged"
+test "$(yaml_get_kv nvprovision.log 0x1500018 lock)" == "unchanged"
+test "$(yaml_get_kv nvprovision.log 0x1500019 define)" == "unchanged"
+test "$(yaml_get_kv nvprovision.log 0x1500019 write)" == "written"
+test "$(yaml_get_kv nvprovision.log 0x1500019 lock)" == "unchanged"
+
+trap - ERR
+
+# an index defined with different attributes must not be touched
+sed -i 's/^size = 32$/size = 16/' nv.manifest
+tpm2_nvprovision nv.manifest 2>/dev/null
+if [ $? -eq 0 ]; then
+  echo "tpm2_nvprovision should fail on a mismatching public area"
+  exit 1
+fi
+
+# sizes are checked before anything is defined
+cleanup "no-shut-down"
+
+cat > nv.manifest <<EOM
+[0x1500018]
+attributes = ownerwrite|ownerread
+size = 32
+
+[0x1500019]
+attributes = ownerwrite|ownerread
+size = 65536
+EOM
+
+tpm2_nvprovision nv.manifest 2>/dev/null
+if [ $? -eq 0 ]; then
+  echo "tpm2_nvprovision should fail on an oversized index"
+  exit 1
+fi
+
+tpm2_nvreadpublic > nv.out
+if grep -q 0x1500018 nv.out; then
+  echo "tpm2_nvprovision should not define indices of a rejected manifest"
+  exit 1
+fi
+
+# locks need matching attributes
+cat > nv.manifest <<EOM
+[0x1500018]
+attributes = ownerwrite|ownerread
+size = 32
+lock = write
+EOM
+
+tpm2_nvprovision nv.manifest 2>/dev/null
+if [ $? -eq 0 ]; then
+  echo "tpm2_nvprovision should fail on a write lock without writedefine"
+  exit 1
+fi
+
+exit 0
@@ -0,0 +1,98 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+source helpers.sh
+
+handle_ek=0x81010009
+handle_ak=0x8101000a
+ak_ctx=ak.ctx
+digestAlg=sha256
+akpw=akpass
+
+cleanup() {
+  rm -f ekpub.pem akpub.pem ak.name $ak_ctx quote.out quotesig.out \
+        golden1.pcr golden2.pcr golden3.pcr current.pcr known.idx \
+        index.yaml
+
+  tpm2_pcrreset 16
+  tpm2_evictcontrol -C o -c $handle_ek 2>/dev/null || true
+  tpm2_evictcontrol -C o -c $handle_ak 2>/dev/null || true
+
+  if [ $(ina "$@" "no-shut-down") -ne 0 ]; then
+    shut_down
+  fi
+}
+trap cleanup EXIT
+
+start_up
+
+cleanup "no-shut-down"
+
+tpm2_createek -c $handle_ek -G rsa -u ekpub.pem -f pem
+tpm2_createak -C $handle_ek -c $ak_ctx -G rsa -g $digestAlg -s rsassa \
+  -u akpub.pem -f pem -n ak.name -p "$akpw"
+tpm2_evictcontrol -Q -c $ak_ctx $handle_ak
+
+# Record three known good PCR states
+quote_state() {
+  tpm2_quote -c $handle_ak -l sha256:15,16,22 -q abc123 -m quote.out \
+    -s quotesig.out -o $1 -g $digestAlg -p "$akpw"
+}
+
+quote_state golden1.pcr
+tpm2_pcrextend 16:sha256=$(printf '%064d' 1)
+quote_state golden2.pcr
+tpm2_pcrextend 16:sha256=$(printf '%064d' 2)
+quote_state golden3.pcr
+
+tpm2_pcrindex -g $digestAlg -o known.idx -j 2 golden1.pcr golden2.pcr \
+  golden3.pcr golden1.pcr > index.yaml
+test "$(yaml_get_kv index.yaml digests)" -eq 3
+
+# The last quote is of a known good state
+tpm2_checkquote -u akpub.pem -m quote.out -s quotesig.out -g $digestAlg \
+  -q abc123 --pcr-index known.idx
+
+# Resetting PCR 16 returns to the first known good state
+tpm2_pcrreset 16
+quote_state current.pcr
+tpm2_checkquote -u akpub.pem -m quote.out -s quotesig.out -g $digestAlg \
+  -q abc123 --pcr-index known.idx
+
+trap - ERR
+
+# A state outside the index fails
+tpm2_pcrextend 16:sha256=$(printf '%064d' 3)
+quote_state current.pcr
+tpm2_checkquote -u akpub.pem -m quote.out -s quotesig.out -g $digestAlg \
+  -q abc123 --pcr-index known.idx
+if [ $? -eq 0 ]; then
+  echo "checkquote accepted a PCR state outside the index"
+  exit 1
+fi
+
+# As does a quote over another selection
+tpm2_quote -c $handle_ak -l sha256:15,16 -q abc123 -m quote.out \
+  -s quotesig.out -g $digestAlg -p "$akpw"
+tpm2_checkquote -u akpub.pem -m quote.out -s quotesig.out -g $digestAlg \
+  -q abc123 --pcr-index known.idx
+if [ $? -eq 0 ]; then
+  echo "checkquote accepted a quote over another PCR selection"
+  exit 1
+fi
+
+# --pcr-index conflicts with -f
+tpm2_checkquote -u akpub.pem -m quote.out -s quotesig.out -g $digestAlg \
+  -q abc123 -f golden1.pcr --pcr-index known.idx
+if [ $? -eq 0 ]; then
+  echo "checkquote accepted -f with --pcr-index"
+  exit 1
+fi
+
+# A golden file that is not a PCR file fails the whole index
+tpm2_pcrindex -o known.idx golden1.pcr ak.name
+if [ $? -eq 0 ]; then
+  echo "tpm2_pcrindex accepted a malformed golden file"
+  exit 1
+fi
+
+exit 0
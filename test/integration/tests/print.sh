@@ -11,10 +11,11 @@ ek_pubkey_file=ek.pub
 
 quote_file=quote.bin
 print_file=quote.yaml
+bundle_file=quote.bundle
 
 cleanup() {
     rm -f $ak_name_file $ak_pubkey_file $ek_pubkey_file \
-          $quote_file $print_file $ak_ctx
+          $quote_file $print_file $ak_ctx $bundle_file stream.bundle
 
     if [ "$1" != "no-shut-down" ]; then
        shut_down
@@ -72,4 +73,41 @@ with open("$print_file") as fd:
     print("OK")
 pyscript
 
+# Print an attestation bundle, and each bundle of a stream
+tpm2_quote -Q -c $ak_ctx -l "sha256:0,2,4" -q "0f8beb45ac" -g sha256 \
+  --bundle $bundle_file --event-log /tmp/event.log
+cat $bundle_file $bundle_file > stream.bundle
+
+tpm2_print -t ATTEST_BUNDLE $bundle_file > $print_file
+
+python << pyscript
+from __future__ import print_function
+
+import yaml
+
+with open("$print_file") as fd:
+    bundle = yaml.safe_load(fd)
+
+    assert(bundle["extraData"] == "0f8beb45ac")
+    assert(bundle["signature"]["alg"] == "rsassa")
+    assert(len(bundle["pcrs"]["sha256"]) == 3)
+    assert(bundle["ak-public"]["type"]["value"] == "rsa")
+    assert(bundle["event-log"] == "/tmp/event.log")
+
+    print("OK")
+pyscript
+
+tpm2_print -t ATTEST_BUNDLE stream.bundle > $print_file
+
+python << pyscript
+from __future__ import print_function
+
+import yaml
+
+with open("$print_file") as fd:
+    assert(len(list(yaml.safe_load_all(fd))) == 2)
+
+    print("OK")
+pyscript
+
 exit 0
@@ -0,0 +1,146 @@
+# SPDX-License-Identifier: BSD-3-Clause
+
+source helpers.sh
+
+cleanup() {
+    rm -f keys.manifest provision.log signer.pem signer.pub decrypter.pub
+
+    # Evict persistent handles, we want them to always succeed and never trip
+    # the onerror trap.
+    for h in 0x81000001 $signer $decrypter; do
+        tpm2_evictcontrol -Q -C o -c $h 2>/dev/null || true
+    done
+
+    if [ "$1" != "no-shut-down" ]; then
+      shut_down
+    fi
+}
+trap cleanup EXIT
+
+start_up
+
+cleanup "no-shut-down"
+
+tpm2_clear
+
+cat > keys.manifest <<EOM
+# children listed before their parent on purpose
+[signer]
+parent = srk
+algorithm = ecc256:ecdsa
+attributes = fixedtpm|fixedparent|sensitivedataorigin|userwithauth|sign
+public = signer.pem
+format = pem
+public = signer.pub
+
+[decrypter]
+parent = srk
+public = decrypter.pub
+
+[srk]
+hierarchy = o
+auth = srkauth
+persistent-handle = 0x81000001
+EOM
+
+tpm2_provision keys.manifest > provision.log
+
+yaml_verify provision.log
+
+srk=$(yaml_get_kv provision.log "srk" "persistent-handle")
+signer=$(yaml_get_kv provision.log "signer" "persistent-handle")
+decrypter=$(yaml_get_kv provision.log "decrypter" "persistent-handle")
+
+test "$srk" == "0x81000001"
+test "$signer" != "$srk"
+test "$decrypter" != "$srk"
+test "$decrypter" != "$signer"
+
+# the exported public keys must match what was persisted
+openssl ec -pubin -in signer.pem -noout
+tpm2_readpublic -c $signer -o signer.pub.2 -Q
+cmp signer.pub signer.pub.2
+rm -f signer.pub.2
+tpm2_readpublic -c $decrypter -o decrypter.pub.2 -Q
+cmp decrypter.pub decrypter.pub.2
+rm -f decrypter.pub.2
+
+cleanup "no-shut-down"
+
+# a parent cycle must be rejected before anything is created
+cat > keys.manifest <<EOM
+[a]
+parent = b
+
+[b]
+parent = a
+EOM
+
+trap - ERR
+
+tpm2_provision keys.manifest
+if [ $? -eq 0 ]; then
+  echo "tpm2_provision should fail on a parent cycle"
+  exit 1
+fi
+
+# handles outside the hierarchy's persistent sub-range are rejected up front
+for h in 0x80000001 0x81800001; do
+  cat > keys.manifest <<EOM
+[srk]
+hierarchy = o
+persistent-handle = $h
+EOM
+
+  tpm2_provision keys.manifest
+  if [ $? -eq 0 ]; then
+    echo "tpm2_provision should fail on owner key handle $h"
+    exit 1
+  fi
+done
+
+# as is a handle claimed twice, before the first key is created
+cat > keys.manifest <<EOM
+[srk]
+hierarchy = o
+persistent-handle = 0x81000001
+
+[other]
+hierarchy = o
+persistent-handle = 0x81000001
+EOM
+
+tpm2_provision keys.manifest
+if [ $? -eq 0 ]; then
+  echo "tpm2_provision should fail on a handle claimed twice"
+  exit 1
+fi
+tpm2_readpublic -c 0x81000001 -Q
+if [ $? -eq 0 ]; then
+  echo "tpm2_provision created a key before failing"
+  exit 1
+fi
+
+# a key failing after its parent was persisted evicts the parent again
+cat > keys.manifest <<EOM
+[srk]
+hierarchy = o
+persistent-handle = 0x81000001
+
+[bad]
+parent = srk
+algorithm = bogus
+EOM
+
+tpm2_provision keys.manifest
+if [ $? -eq 0 ]; then
+  echo "tpm2_provision should fail on an unknown algorithm"
+  exit 1
+fi
+tpm2_readpublic -c 0x81000001 -Q
+if [ $? -eq 0 ]; then
+  echo "tpm2_provision left the keys of a failed run persistent"
+  exit 1
+fi
+
+exit 0
@@ -21,7 +21,9 @@ cleanup() {
     rm -f $file_input_data $file_primary_key_ctx $file_rsaencrypt_key_pub \
     $file_rsaencrypt_key_priv $file_rsaencrypt_key_ctx $file_rsaencrypt_key_name \
     $file_output_data $file_rsa_en_output_data $file_rsa_de_output_data \
-    $file_rsadecrypt_key_ctx label.dat
+    $file_rsadecrypt_key_ctx label.dat batch.enc batch.ptext expected.ptext \
+    msg*.dat msg*.enc tpm.enc host.enc session.ctx pcr.bin pcr.policy \
+    pcr.pub pcr.priv pcr.ctx
 
     if [ "$1" != "no-shut-down" ]; then
         shut_down
@@ -66,7 +68,98 @@ echo "my file label" > label.dat
 tpm2_rsaencrypt -Q -c $file_rsaencrypt_key_ctx -l label.dat -o $file_rsa_en_output_data < $file_input_data
 tpm2_rsadecrypt -Q -c $file_rsadecrypt_key_ctx -l label.dat -p foo -o $file_rsa_de_output_data $file_rsa_en_output_data
 
+# Test batch mode, framed ciphertexts in, framed plaintexts out
+frame() {
+    printf "%04x" $(stat -c%s $1) | xxd -r -p
+    cat $1
+}
+
+rm -f batch.enc expected.ptext
+for i in 1 2 3 4; do
+    echo "message $i" > msg$i.dat
+    tpm2_rsaencrypt -Q -c $file_rsaencrypt_key_ctx -o msg$i.enc < msg$i.dat
+    frame msg$i.enc >> batch.enc
+    frame msg$i.dat >> expected.ptext
+done
+
+tpm2_rsadecrypt -Q -c $file_rsadecrypt_key_ctx -p foo -b -o batch.ptext batch.enc
+cmp batch.ptext expected.ptext
+
+cat batch.enc | tpm2_rsadecrypt -c $file_rsadecrypt_key_ctx -p foo -b > batch.ptext
+cmp batch.ptext expected.ptext
+
+# an empty batch decrypts nothing
+tpm2_rsadecrypt -Q -c $file_rsadecrypt_key_ctx -p foo -b -o batch.ptext /dev/null
+test ! -s batch.ptext
+
+# a policy session is spent by the first decryption, batches refuse it
+tpm2_startauthsession -S session.ctx --policy-session
+trap - ERR
+tpm2_rsadecrypt -Q -c $file_rsadecrypt_key_ctx -p session:session.ctx -b \
+    -o batch.ptext batch.enc
+if [ $? -eq 0 ]; then
+    echo "Batch decryption must refuse a policy session"
+    exit 1
+fi
+trap onerror ERR
+tpm2_flushcontext session.ctx
+
+# a pcr: policy is satisfied again for every ciphertext
+tpm2_pcrread -Q -o pcr.bin sha256:0,1,2,3
+tpm2_createpolicy -Q --policy-pcr -l sha256:0,1,2,3 -f pcr.bin -L pcr.policy
+tpm2_create -Q -C $file_primary_key_ctx -G rsa -L pcr.policy \
+    -a "decrypt|fixedtpm|fixedparent|sensitivedataorigin" \
+    -u pcr.pub -r pcr.priv
+tpm2_load -Q -C $file_primary_key_ctx -u pcr.pub -r pcr.priv -c pcr.ctx
+
+rm -f batch.enc
+for i in 1 2 3 4; do
+    tpm2_rsaencrypt -Q -T none -c pcr.pub -o msg$i.enc < msg$i.dat
+    frame msg$i.enc >> batch.enc
+done
+
+tpm2_rsadecrypt -Q -c pcr.ctx -p pcr:sha256:0,1,2,3=pcr.bin -b \
+    -o batch.ptext batch.enc
+cmp batch.ptext expected.ptext
+
+# Test encryption on the host, decrypted by the TPM
+for scheme in rsaes oaep-sha256 oaep-sha1; do
+    tpm2_rsaencrypt -Q -T none -c $file_rsaencrypt_key_pub -s $scheme \
+        -o $file_rsa_en_output_data < $file_input_data
+    tpm2_rsadecrypt -Q -c $file_rsadecrypt_key_ctx -p foo -s $scheme \
+        -o $file_rsa_de_output_data $file_rsa_en_output_data
+    cmp $file_rsa_de_output_data $file_input_data
+done
+
+tpm2_rsaencrypt -Q -T none -c $file_rsaencrypt_key_pub -s oaep-sha256 \
+    -l mylabel -o $file_rsa_en_output_data < $file_input_data
+tpm2_rsadecrypt -Q -c $file_rsadecrypt_key_ctx -p foo -s oaep-sha256 \
+    -l mylabel -o $file_rsa_de_output_data $file_rsa_en_output_data
+cmp $file_rsa_de_output_data $file_input_data
+
+# the null scheme is deterministic, host and TPM agree byte for byte
+tpm2_rsaencrypt -Q -c $file_rsaencrypt_key_ctx -s null -o tpm.enc \
+    < $file_input_data
+tpm2_rsaencrypt -Q -T none -c $file_rsaencrypt_key_pub -s null -o host.enc \
+    < $file_input_data
+cmp tpm.enc host.enc
+
+# a batch encrypted on the host decrypts as a batch on the TPM
+tpm2_rsaencrypt -Q -T none -c $file_rsaencrypt_key_pub -b -o batch.enc \
+    expected.ptext
+tpm2_rsadecrypt -Q -c $file_rsadecrypt_key_ctx -p foo -b -o batch.ptext batch.enc
+cmp batch.ptext expected.ptext
+
 trap - ERR
+
+# a truncated frame fails the batch
+head -c 10 batch.enc > msg.enc
+tpm2_rsadecrypt -Q -c $file_rsadecrypt_key_ctx -p foo -b -o batch.ptext msg.enc
+if [ $? -eq 0 ]; then
+    echo "tpm2_rsadecrypt should fail on a truncated ciphertext frame"
+    exit 1
+fi
+
 tpm2_rsaencrypt -Q -c $file_rsaencrypt_key_ctx -o $file_rsa_en_output_data -s oaep < $file_input_data
 if [ $? -eq 0 ]; then
     echo "tpm2_rsaencrypt should fail with 'hash algorithm not supported or not appropriate'"
@@ -21,4 +21,39 @@ cat ${TPM2_COMMAND_FILE} | tpm2_send -o /dev/null
 # check -o out and argument file input
 tpm2_send -o /dev/null "${TPM2_COMMAND_FILE}"
 
+# check stream mode, the responses to the same command are the same
+cat "${TPM2_COMMAND_FILE}" "${TPM2_COMMAND_FILE}" "${TPM2_COMMAND_FILE}" \
+    > stream.bin
+tpm2_send -s -o responses.bin stream.bin > stream.yaml
+test "`yaml_get_kv stream.yaml total commands`" == "3"
+
+tpm2_send -s -e responses.bin -o /dev/null stream.bin > stream.yaml
+test "`yaml_get_kv stream.yaml total mismatches`" == "0"
+
+# a response differing from the expected one is reported and fails the run
+python3 -c "import sys
+b = bytearray(open(sys.argv[1], 'rb').read())
+b[-1] ^= 0xff
+open(sys.argv[2], 'wb').write(b)" responses.bin mismatch.bin
+trap - ERR
+tpm2_send -s -e mismatch.bin -o /dev/null stream.bin > stream.yaml
+if [ $? -eq 0 ]; then
+    echo "tpm2_send: expected a response mismatch to fail"
+    exit 1
+fi
+trap onerror ERR
+test "`yaml_get_kv stream.yaml total mismatches`" == "1"
+
+# a truncated stream is an error
+head -c 20 "${TPM2_COMMAND_FILE}" >> stream.bin
+trap - ERR
+tpm2_send -s -o /dev/null stream.bin > /dev/null
+if [ $? -eq 0 ]; then
+    echo "tpm2_send: expected truncated stream to fail"
+    exit 1
+fi
+trap onerror ERR
+
+rm -f stream.bin responses.bin mismatch.bin stream.yaml
+
 exit 0
@@ -3,6 +3,8 @@
 source helpers.sh
 
 cleanup() {
+    rm -f specs.txt testparms.yaml testparms.cache
+
     if [ "$1" != "no-shut-down" ]; then
         shut_down
     fi
@@ -68,4 +70,46 @@ if tpm2_testparms "ecc521:ecdsa:aes256cbc" &>/dev/null; then
 else
     true
 fi
+
+# Bulk mode reports a matrix instead of failing on unsupported suites
+tpm2_testparms rsa2048 ecc521:ecdsa:aes256cbc > testparms.yaml
+yaml_verify testparms.yaml
+grep -q "^  rsa2048: supported$" testparms.yaml
+grep -q "^  ecc521:ecdsa:aes256cbc: unsupported$" testparms.yaml
+
+# Specifications from a list, skipping comments and blank lines
+cat > specs.txt <<EOF
+# common algorithms
+rsa
+
+hmac:sha256
+EOF
+tpm2_testparms -l specs.txt > testparms.yaml
+test "$(grep -c "^  " testparms.yaml)" -eq 2
+grep -q "^  hmac:sha256: supported$" testparms.yaml
+
+# Invalid specifications still fail in bulk mode
+if tpm2_testparms rsa null 2>/dev/null; then
+    echo "tpm2_testparms bulk mode accepted 'null'"
+    exit 1
+fi
+
+# Derived specifications cover the TPM's algorithms
+tpm2_testparms --derive > testparms.yaml
+grep -q "^  rsa2048: supported$" testparms.yaml
+grep -q "^  aes128cfb: supported$" testparms.yaml
+grep -q "^  hmac:sha256: supported$" testparms.yaml
+
+# The cache is written on the first run and reused on the next
+tpm2_testparms --derive --cache=testparms.cache > testparms.yaml
+cmp testparms.cache testparms.yaml
+tpm2_testparms --derive --cache=testparms.cache | cmp - testparms.yaml
+
+# A cache recorded for other firmware is not used
+sed -i 's/^firmware-version: .*/firmware-version: 0x0000000000000000/' \
+    testparms.cache
+sed -i 's/^  rsa2048: supported$/  rsa2048: unsupported/' testparms.cache
+tpm2_testparms rsa2048 --cache=testparms.cache | grep -q "rsa2048: supported"
+grep -q "^  rsa2048: supported$" testparms.cache
+
 exit 0
@@ -21,7 +21,9 @@ secret="12345678"
 cleanup() {
   rm -f $file_input_data $file_primary_key_ctx $file_unseal_key_pub \
         $file_unseal_key_priv $file_unseal_key_ctx $file_unseal_key_name \
-        $file_unseal_output_data $file_pcr_value $file_policy
+        $file_unseal_output_data $file_pcr_value $file_policy \
+        bulk*.data bulk*.pub bulk*.priv bulk.tar
+  rm -rf bulk_out bulk_tar bulk_dup
 
   if [ "$1" != "no-shut-down" ]; then
     shut_down
@@ -76,6 +78,31 @@ unsealed=`tpm2_unseal -V --object-context $file_unseal_key_ctx -p pcr:$pcr_speci
 
 test "$unsealed" == "$secret"
 
+# Test bulk unseal of several objects under one parent with a PCR policy
+
+for i in 1 2 3; do
+  echo "secret$i" > bulk$i.data
+  tpm2_create -Q -g $alg_create_obj -u bulk$i.pub -r bulk$i.priv -i bulk$i.data \
+    -C $file_primary_key_ctx -L $file_policy -a 'fixedtpm|fixedparent'
+done
+
+mkdir -p bulk_out
+
+tpm2_unseal -C $file_primary_key_ctx -p pcr:$pcr_specification -o bulk_out \
+  -u bulk1.pub -r bulk1.priv -u bulk2.pub -r bulk2.priv -u bulk3.pub -r bulk3.priv
+
+tpm2_unseal -C $file_primary_key_ctx -p pcr:$pcr_specification=$file_pcr_value \
+  -o bulk.tar -u bulk1.pub -r bulk1.priv -u bulk2.pub -r bulk2.priv \
+  -u bulk3.pub -r bulk3.priv
+
+mkdir -p bulk_tar
+tar -xf bulk.tar -C bulk_tar
+
+for i in 1 2 3; do
+  cmp -s bulk_out/bulk$i bulk$i.data
+  cmp -s bulk_tar/bulk$i bulk$i.data
+done
+
 # Test that unseal fails if a PCR policy isn't provided
 
 trap - ERR
@@ -86,6 +113,22 @@ if [ $? != 1 ]; then
   exit 1
 fi
 
+# Test that bulk unseal refuses public files that map to the same output name
+
+mkdir -p bulk_dup/a bulk_dup/b
+cp bulk1.pub bulk_dup/a/bulk.pub
+cp bulk2.pub bulk_dup/b/bulk.pub
+tpm2_unseal -C $file_primary_key_ctx -p pcr:$pcr_specification -o bulk_out \
+  -u bulk_dup/a/bulk.pub -r bulk1.priv -u bulk_dup/b/bulk.pub -r bulk2.priv
+if [ $? == 0 ]; then
+  echo "tpm2_unseal didn't fail on clashing output names!"
+  exit 1
+fi
+if [ -e bulk_out/bulk ]; then
+  echo "tpm2_unseal wrote an output before failing on clashing names!"
+  exit 1
+fi
+
 # Test that unseal fails if PCR state isn't the same as the defined PCR policy
 
 tpm2_pcrextend 0:sha1=6c10289a8da7f774cf67bd2fc8502cd4b585346a
@@ -24,7 +24,11 @@ cleanup() {
     rm -f $file_primary_key_ctx $file_signing_key_pub $file_signing_key_priv \
           $file_signing_key_ctx $file_signing_key_name $file_output_data \
           $file_verify_tk_data $file_input_data_hash $file_input_data_hash_tk \
-          $file_input_data
+          $file_input_data item.* items.txt tree.sig tree.yaml sig.pss \
+          ecc.pub ecc.priv ecc.ctx sig.ecc bulk.yaml dec.pub dec.priv \
+          dec.ctx padded.bin forged.sig ext.pem ext.ctx ext.pub ext.sig \
+          ext.pss ext.sha1
+    rm -rf proofs
 
     if [ "$1" != "no-shut-down" ]; then
         shut_down
@@ -55,6 +59,148 @@ tpm2_hash -Q -C n -g $alg_hash -o $file_input_data_hash -t $file_input_data_hash
 rm -f $file_verify_tk_data
 tpm2_verifysignature -Q -c $file_signing_key_ctx -d $file_input_data_hash -s $file_output_data -t $file_verify_tk_data
 
+# Sign a tree of items once, then verify each item with its inclusion proof
+rm -f items.txt
+for i in 0 1 2 3 4; do
+    echo "item $i" > item.$i
+    echo item.$i >> items.txt
+done
+mkdir proofs
+tpm2_sign -c $file_signing_key_ctx -g $alg_hash --tree items.txt \
+    --proof-dir proofs -o tree.sig > tree.yaml
+
+test "$(yaml_get_kv tree.yaml tree hash-algorithm)" == "$alg_hash"
+
+for i in 0 1 2 3 4; do
+    tpm2_verifysignature -Q -c $file_signing_key_ctx -g $alg_hash -m item.$i \
+        -s tree.sig --proof proofs/$i.proof
+done
+
+trap - ERR
+
+# An item verified with the proof of another fails
+tpm2_verifysignature -Q -c $file_signing_key_ctx -g $alg_hash -m item.0 \
+    -s tree.sig --proof proofs/1.proof
+if [ $? -eq 0 ]; then
+    echo "tpm2_verifysignature accepted the proof of another item"
+    exit 1
+fi
+
+# A modified item fails
+echo "item 5" > item.2
+tpm2_verifysignature -Q -c $file_signing_key_ctx -g $alg_hash -m item.2 \
+    -s tree.sig --proof proofs/2.proof
+if [ $? -eq 0 ]; then
+    echo "tpm2_verifysignature accepted a modified item"
+    exit 1
+fi
+
+trap onerror ERR
+
+# Without a ticket the signatures are verified on the host, with the public
+# key from a file no TPM is needed at all
+tpm2_sign -Q -c $file_signing_key_ctx -g $alg_hash -s rsapss -o sig.pss \
+    $file_input_data
+
+tpm2_verifysignature -Q -u $file_signing_key_pub -g $alg_hash \
+    -m $file_input_data -s $file_output_data -T none
+tpm2_verifysignature -Q -u $file_signing_key_pub -g $alg_hash \
+    -m $file_input_data -s sig.pss -T none
+tpm2_verifysignature -Q -c $file_signing_key_ctx -g $alg_hash \
+    -m $file_input_data -s sig.pss
+
+tpm2_create -Q -g $alg_hash -G ecc -u ecc.pub -r ecc.priv \
+    -C $file_primary_key_ctx
+tpm2_load -Q -C $file_primary_key_ctx -u ecc.pub -r ecc.priv -c ecc.ctx
+tpm2_sign -Q -c ecc.ctx -g $alg_hash -o sig.ecc $file_input_data
+tpm2_verifysignature -Q -u ecc.pub -g $alg_hash -m $file_input_data \
+    -s sig.ecc -T none
+
+# Many signatures in one invocation, the key is shared
+tpm2_verifysignature -u $file_signing_key_pub -g $alg_hash \
+    -m $file_input_data -s $file_output_data -s sig.pss -T none \
+    > bulk.yaml
+test "$(grep -c "verified: true" bulk.yaml)" -eq 2
+
+tpm2_verifysignature -Q -u $file_signing_key_pub -g $alg_hash \
+    -m item.0 -m item.1 -m item.3 -s tree.sig --proof proofs/0.proof \
+    --proof proofs/1.proof --proof proofs/3.proof -T none
+
+# A decrypt only key, with which anyone allowed to decrypt can forge a
+# PKCS#1 v1.5 "signature" by decrypting the padded digest
+tpm2_create -Q -g $alg_hash -G rsa2048 -u dec.pub -r dec.priv \
+    -a "decrypt|fixedtpm|fixedparent|sensitivedataorigin|userwithauth" \
+    -C $file_primary_key_ctx
+tpm2_load -Q -C $file_primary_key_ctx -u dec.pub -r dec.priv -c dec.ctx
+python3 - <<EOF
+import hashlib
+with open("$file_input_data", "rb") as f:
+    digest = hashlib.sha256(f.read()).digest()
+info = bytes.fromhex("3031300d060960864801650304020105000420") + digest
+padded = b"\x00\x01" + b"\xff" * (256 - len(info) - 3) + b"\x00" + info
+with open("padded.bin", "wb") as f:
+    f.write(padded)
+EOF
+tpm2_rsadecrypt -Q -c dec.ctx -s null -o forged.sig padded.bin
+
+# A key bound to rsassa-sha256, with signatures of other schemes made by
+# OpenSSL with the same private key
+openssl genrsa -out ext.pem 2048 2>/dev/null
+tpm2_loadexternal -Q -C n -G rsa2048:rsassa-sha256 -a "sign|userwithauth" \
+    -r ext.pem -c ext.ctx
+tpm2_readpublic -Q -c ext.ctx -o ext.pub
+openssl dgst -sha256 -sign ext.pem -out ext.sig $file_input_data
+openssl dgst -sha256 -sign ext.pem -sigopt rsa_padding_mode:pss \
+    -out ext.pss $file_input_data
+openssl dgst -sha1 -sign ext.pem -out ext.sha1 $file_input_data
+tpm2_verifysignature -Q -u ext.pub -g sha256 -m $file_input_data \
+    -s ext.sig -f rsassa -T none
+
+trap - ERR
+
+# Like the TPM, the host refuses a key without sign
+tpm2_verifysignature -Q -u dec.pub -g sha256 -m $file_input_data \
+    -s forged.sig -f rsassa -T none
+if [ $? -eq 0 ]; then
+    echo "tpm2_verifysignature accepted a signature of a decrypt only key"
+    exit 1
+fi
+
+# and a signature of another scheme or hash than the key's
+tpm2_verifysignature -Q -u ext.pub -g sha256 -m $file_input_data \
+    -s ext.pss -f rsapss -T none
+if [ $? -eq 0 ]; then
+    echo "tpm2_verifysignature accepted a scheme other than the key's"
+    exit 1
+fi
+
+tpm2_verifysignature -Q -u ext.pub -g sha1 -m $file_input_data \
+    -s ext.sha1 -f rsassa -T none
+if [ $? -eq 0 ]; then
+    echo "tpm2_verifysignature accepted a hash other than the key's"
+    exit 1
+fi
+
+# A bad signature in a bulk verification is reported and fails the run
+tpm2_verifysignature -u $file_signing_key_pub -g $alg_hash \
+    -m $file_input_data -s $file_output_data -s sig.ecc -T none \
+    > bulk.yaml
+if [ $? -eq 0 ]; then
+    echo "tpm2_verifysignature accepted a bad signature"
+    exit 1
+fi
+test "$(grep -c "verified: false" bulk.yaml)" -eq 1 || exit 1
+
+# A ticket needs the TPM
+tpm2_verifysignature -Q -u $file_signing_key_pub -g $alg_hash \
+    -m $file_input_data -s $file_output_data -t $file_verify_tk_data
+if [ $? -eq 0 ]; then
+    echo "tpm2_verifysignature produced a ticket without the TPM"
+    exit 1
+fi
+
+trap onerror ERR
+
 rm -f $file_verify_tk_data $file_signing_key_ctx -rf
 tpm2_loadexternal -Q -C n -u $file_signing_key_pub -c $file_signing_key_ctx
 
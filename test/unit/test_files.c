@@ -1,16 +1,25 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include <setjmp.h>
 #include <cmocka.h>
 
 #include "files.h"
 
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
 typedef struct test_file test_file;
 struct test_file {
     char *path;
@@ -126,6 +135,70 @@ static void test_file_read_write_0_bytes(void **state) {
     assert_true(res);
 }
 
+static void test_file_read_write_frames(void **state) {
+
+    FILE *f = test_file_from_state(state)->file;
+
+    UINT8 first[] = { 0x01, 0x02, 0x03 };
+    bool res = files_write_frame(f, first, sizeof(first));
+    assert_true(res);
+
+    res = files_write_frame(f, first, 0);
+    assert_true(res);
+
+    rewind(f);
+
+    UINT8 found[16];
+    UINT16 size = sizeof(found);
+    bool eof = true;
+    res = files_read_frame(f, found, &size, &eof);
+    assert_true(res);
+    assert_false(eof);
+    assert_int_equal(size, sizeof(first));
+    assert_memory_equal(found, first, sizeof(first));
+
+    size = sizeof(found);
+    res = files_read_frame(f, found, &size, &eof);
+    assert_true(res);
+    assert_false(eof);
+    assert_int_equal(size, 0);
+
+    res = files_read_frame(f, found, &size, &eof);
+    assert_true(res);
+    assert_true(eof);
+}
+
+static void test_file_read_frame_bad(void **state) {
+
+    FILE *f = test_file_from_state(state)->file;
+
+    /* a frame larger than the buffer */
+    UINT8 data[8] = { 0 };
+    bool res = files_write_frame(f, data, sizeof(data));
+    assert_true(res);
+
+    /* a truncated frame */
+    res = files_write_16(f, 4);
+    assert_true(res);
+    res = files_write_bytes(f, data, 2);
+    assert_true(res);
+
+    rewind(f);
+
+    UINT8 found[4];
+    UINT16 size = sizeof(found);
+    bool eof = false;
+    res = files_read_frame(f, found, &size, &eof);
+    assert_false(res);
+
+    res = files_read_bytes(f, data, sizeof(data));
+    assert_true(res);
+
+    size = sizeof(found);
+    res = files_read_frame(f, found, &size, &eof);
+    assert_false(res);
+}
+
 static void test_file_read_write_header(void **state) {
 
     FILE *f = test_file_from_state(state)->file;
@@ -237,10 +310,224 @@ static void test_file_exists_bad_args(void **state) {
     assert_false(res);
 }
 
-/* link required symbol, but tpm2_tool.c declares it AND main, which
- * we have a main below for cmocka tests.
- */
-bool output_enabled = true;
+static void test_file_sink_writev(void **state) {
+
+    test_file *tf = test_file_from_state(state);
+
+    /* larger than a UINT16 and split over buffers */
+    size_t size = 70000;
+    UINT8 *data = malloc(size);
+    assert_non_null(data);
+
+    size_t i;
+    for (i = 0; i < size; i++) {
+        data[i] = i;
+    }
+
+    struct iovec iov[] = {
+        { .iov_base = data, .iov_len = 3 },
+        { .iov_base = &data[3], .iov_len = 0 },
+        { .iov_base = &data[3], .iov_len = size - 3 },
+    };
+
+    files_sink sink;
+    bool res = files_sink_open(&sink, tf->path, true);
+    assert_true(res);
+
+    res = files_sink_writev(&sink, iov, 3);
+    assert_true(res);
+
+    res = files_sink_commit(&sink);
+    assert_true(res);
+
+    files_sink_close(&sink);
+
+    struct stat st;
+    int rc = stat(tf->path, &st);
+    assert_return_code(rc, errno);
+    assert_int_equal(st.st_size, size);
+    assert_int_equal(st.st_mode & 0777, 0600);
+
+    UINT8 *read_back = malloc(size);
+    assert_non_null(read_back);
+
+    FILE *f = fopen(tf->path, "rb");
+    assert_non_null(f);
+    res = files_read_bytes(f, read_back, size);
+    fclose(f);
+    assert_true(res);
+
+    assert_memory_equal(data, read_back, size);
+
+    free(read_back);
+    free(data);
+}
+
+static void test_file_sink_uncommitted(void **state) {
+
+    (void) state;
+
+    const char *path = "xxx_test_files_sink_xxx.test";
+
+    files_sink sink;
+    bool res = files_sink_open(&sink, path, false);
+    assert_true(res);
+
+    bool is_tmpfile = sink.is_tmpfile;
+
+    res = files_sink_write(&sink, "secret", 6);
+    assert_true(res);
+
+    files_sink_close(&sink);
+
+    /* only a temporary file can be discarded */
+    if (is_tmpfile) {
+        assert_false(files_does_file_exist(path));
+    } else {
+        remove(path);
+    }
+}
+
+static void test_file_sink_fd(void **state) {
+
+    (void) state;
+
+    int fds[2];
+    int rc = pipe(fds);
+    assert_return_code(rc, errno);
+
+    char spec[32];
+    snprintf(spec, sizeof(spec), "fd:%d", fds[1]);
+
+    files_sink sink;
+    bool res = files_sink_open(&sink, spec, true);
+    assert_true(res);
+
+    res = files_sink_write(&sink, "secret", 6);
+    assert_true(res);
+
+    res = files_sink_commit(&sink);
+    assert_true(res);
+
+    files_sink_close(&sink);
+
+    /* an inherited descriptor stays open */
+    rc = close(fds[1]);
+    assert_return_code(rc, errno);
+
+    char buf[6];
+    ssize_t bread = read(fds[0], buf, sizeof(buf));
+    assert_int_equal(bread, sizeof(buf));
+    assert_memory_equal(buf, "secret", sizeof(buf));
+
+    close(fds[0]);
+}
+
+static void test_file_sink_memfd(void **state) {
+
+    (void) state;
+
+#if defined(MFD_ALLOW_SEALING)
+    int fd = memfd_create("secret", MFD_ALLOW_SEALING);
+    assert_return_code(fd, errno);
+
+    char spec[32];
+    snprintf(spec, sizeof(spec), "fd:%d", fd);
+
+    files_sink sink;
+    bool res = files_sink_open(&sink, spec, true);
+    assert_true(res);
+
+    res = files_sink_write(&sink, "secret", 6) && files_sink_commit(&sink);
+    assert_true(res);
+
+    files_sink_close(&sink);
+
+    int seals = fcntl(fd, F_GET_SEALS);
+    assert_true(seals & F_SEAL_WRITE);
+    assert_true(seals & F_SEAL_SEAL);
+
+    ssize_t wrote = write(fd, "x", 1);
+    assert_int_equal(wrote, -1);
+
+    close(fd);
+#else
+    skip();
+#endif
+}
+
+static void test_file_sink_symlink(void **state) {
+
+    (void) state;
+
+    const char *target = "xxx_test_files_target_xxx.test";
+    const char *link = "xxx_test_files_link_xxx.test";
+
+    FILE *f = fopen(target, "wb");
+    assert_non_null(f);
+    fclose(f);
+
+    int rc = symlink(target, link);
+    assert_return_code(rc, errno);
+
+    files_sink sink;
+    bool res = files_sink_open(&sink, link, false);
+    assert_true(res);
+
+    res = files_sink_write(&sink, "secret", 6) && files_sink_commit(&sink);
+    assert_true(res);
+
+    files_sink_close(&sink);
+
+    /* the link is kept and its target written */
+    struct stat st;
+    rc = lstat(link, &st);
+    assert_return_code(rc, errno);
+    assert_true(S_ISLNK(st.st_mode));
+
+    rc = stat(target, &st);
+    assert_return_code(rc, errno);
+    assert_int_equal(st.st_size, 6);
+
+    unlink(link);
+    unlink(target);
+}
+
+static void test_file_sink_quiet(void **state) {
+
+    (void) state;
+
+    output_enabled = false;
+
+    files_sink sink;
+    bool res = files_sink_open(&sink, NULL, false);
+    output_enabled = true;
+    assert_true(res);
+    assert_int_equal(sink.fd, -1);
+
+    res = files_sink_write(&sink, "secret", 6) && files_sink_commit(&sink);
+    assert_true(res);
+
+    files_sink_close(&sink);
+}
+
+static void test_file_sink_bad_args(void **state) {
+
+    (void) state;
+
+    files_sink sink;
+    bool res = files_sink_open(&sink, "fd:abc", false);
+    assert_false(res);
+
+    res = files_sink_open(&sink, "fd:1048576", false);
+    assert_false(res);
+
+    res = files_sink_open(&sink, "this/should/be/a/bad/path", false);
+    assert_false(res);
+
+    res = files_sink_open(NULL, NULL, false);
+    assert_false(res);
+}
 
 int main(int argc, char* argv[]) {
     (void)argc;
@@ -259,6 +546,10 @@ int main(int argc, char* argv[]) {
                 test_setup, test_teardown),
         cmocka_unit_test_setup_teardown(test_file_read_write_header,
                         test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_file_read_write_frames,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_file_read_frame_bad,
+                test_setup, test_teardown),
 
         cmocka_unit_test_setup_teardown(test_file_read_write_bad_params_16,
                 test_setup, test_teardown),
@@ -278,6 +569,15 @@ int main(int argc, char* argv[]) {
                 test_setup, test_teardown),
         cmocka_unit_test_setup_teardown(test_file_exists_bad_args,
                 test_setup, test_teardown),
+
+        cmocka_unit_test_setup_teardown(test_file_sink_writev,
+                test_setup, test_teardown),
+        cmocka_unit_test(test_file_sink_uncommitted),
+        cmocka_unit_test(test_file_sink_symlink),
+        cmocka_unit_test(test_file_sink_quiet),
+        cmocka_unit_test(test_file_sink_fd),
+        cmocka_unit_test(test_file_sink_memfd),
+        cmocka_unit_test(test_file_sink_bad_args),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
@@ -1175,6 +1175,38 @@ static void test_extended_alg_bad(void **state) {
  */
 bool output_enabled = true;
 
+static void test_tpm2_alg_util_rsa_decrypt_scheme(void **state) {
+    (void) state;
+
+    TPMT_RSA_DECRYPT scheme;
+    bool res = tpm2_alg_util_rsa_decrypt_scheme_from_optarg("rsaes", &scheme);
+    assert_true(res);
+    assert_int_equal(scheme.scheme, TPM2_ALG_RSAES);
+
+    res = tpm2_alg_util_rsa_decrypt_scheme_from_optarg("null", &scheme);
+    assert_true(res);
+    assert_int_equal(scheme.scheme, TPM2_ALG_NULL);
+
+    res = tpm2_alg_util_rsa_decrypt_scheme_from_optarg("oaep", &scheme);
+    assert_true(res);
+    assert_int_equal(scheme.scheme, TPM2_ALG_OAEP);
+    assert_int_equal(scheme.details.oaep.hashAlg, 0);
+
+    res = tpm2_alg_util_rsa_decrypt_scheme_from_optarg("oaep-sha256", &scheme);
+    assert_true(res);
+    assert_int_equal(scheme.scheme, TPM2_ALG_OAEP);
+    assert_int_equal(scheme.details.oaep.hashAlg, TPM2_ALG_SHA256);
+
+    res = tpm2_alg_util_rsa_decrypt_scheme_from_optarg("rsaes-sha256", &scheme);
+    assert_false(res);
+
+    res = tpm2_alg_util_rsa_decrypt_scheme_from_optarg("oaep-aes", &scheme);
+    assert_false(res);
+
+    res = tpm2_alg_util_rsa_decrypt_scheme_from_optarg("rsassa", &scheme);
+    assert_false(res);
+}
+
 int main(int argc, char* argv[]) {
     (void) argc;
     (void) argv;
@@ -1229,6 +1261,7 @@ int main(int argc, char* argv[]) {
         cmocka_unit_test(test_tpm2_alg_util_flags_sig),
         cmocka_unit_test(test_tpm2_alg_util_flags_enc_scheme),
         cmocka_unit_test(test_tpm2_alg_util_flags_hash),
+        cmocka_unit_test(test_tpm2_alg_util_rsa_decrypt_scheme),
         cmocka_unit_test(test_extended_alg_rsa2048_non_restricted),
         cmocka_unit_test(test_extended_alg_rsa2048_restricted),
         cmocka_unit_test(test_extended_alg_rsa_non_restricted),
@@ -0,0 +1,200 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_capability.h"
+#include "tpm2_util.h"
+
+#define PLATFORM_FIRST (TPM2_PERSISTENT_FIRST + 0x00800000)
+
+static TPM2_HANDLE *in_use;
+static UINT32 in_use_count;
+
+TSS2_RC __wrap_Esys_GetCapability(ESYS_CONTEXT *context,
+        ESYS_TR session1, ESYS_TR session2, ESYS_TR session3,
+        TPM2_CAP capability, UINT32 property, UINT32 propertyCount,
+        TPMI_YES_NO *moreData, TPMS_CAPABILITY_DATA **capabilityData) {
+
+    UNUSED(context);
+    UNUSED(session1);
+    UNUSED(session2);
+    UNUSED(session3);
+    UNUSED(propertyCount);
+
+    *moreData = TPM2_NO;
+
+    *capabilityData = calloc(1, sizeof(**capabilityData));
+    (*capabilityData)->capability = capability;
+
+    /* the next property the TPM has, at or after the one asked for */
+    if (capability == TPM2_CAP_TPM_PROPERTIES) {
+        TPML_TAGGED_TPM_PROPERTY *props =
+                &(*capabilityData)->data.tpmProperties;
+        if (property <= TPM2_PT_INPUT_BUFFER) {
+            props->count = 1;
+            props->tpmProperty[0].property = TPM2_PT_INPUT_BUFFER;
+            props->tpmProperty[0].value = 1024;
+        }
+        return TSS2_RC_SUCCESS;
+    }
+
+    TPML_HANDLE *handles = &(*capabilityData)->data.handles;
+
+    UINT32 i;
+    for (i = 0; i < in_use_count; i++) {
+        if (in_use[i] >= property) {
+            handles->handle[handles->count++] = in_use[i];
+        }
+    }
+
+    return TSS2_RC_SUCCESS;
+}
+
+#define set_in_use(x) \
+    do { \
+        in_use = x; \
+        in_use_count = ARRAY_LEN(x); \
+    } while (0)
+
+static void test_find_vacant_empty(void **state) {
+    UNUSED(state);
+
+    in_use = NULL;
+    in_use_count = 0;
+
+    UINT32 vacant = 0;
+    tool_rc rc = tpm2_capability_find_vacant_persistent_handle(
+            (ESYS_CONTEXT *) 0xDEADBEEF, TPM2_RH_OWNER, &vacant);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(vacant, TPM2_PERSISTENT_FIRST);
+}
+
+static void test_find_vacant_unsorted(void **state) {
+    UNUSED(state);
+
+    TPM2_HANDLE handles[] = {
+        TPM2_PERSISTENT_FIRST + 1,
+        TPM2_PERSISTENT_FIRST,
+        TPM2_PERSISTENT_FIRST + 3,
+    };
+    set_in_use(handles);
+
+    UINT32 vacant = 0;
+    tool_rc rc = tpm2_capability_find_vacant_persistent_handle(
+            (ESYS_CONTEXT *) 0xDEADBEEF, TPM2_RH_OWNER, &vacant);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(vacant, TPM2_PERSISTENT_FIRST + 2);
+}
+
+static void test_find_vacant_bulk(void **state) {
+    UNUSED(state);
+
+    TPM2_HANDLE handles[] = {
+        TPM2_PERSISTENT_FIRST,
+        TPM2_PERSISTENT_FIRST + 2,
+        TPM2_PERSISTENT_FIRST + 3,
+        0x81010001,
+    };
+    set_in_use(handles);
+
+    TPMI_DH_PERSISTENT vacant[4] = { 0 };
+    tool_rc rc = tpm2_capability_find_vacant_persistent_handles(
+            (ESYS_CONTEXT *) 0xDEADBEEF, TPM2_RH_OWNER, ARRAY_LEN(vacant),
+            vacant);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(vacant[0], TPM2_PERSISTENT_FIRST + 1);
+    assert_int_equal(vacant[1], TPM2_PERSISTENT_FIRST + 4);
+    assert_int_equal(vacant[2], TPM2_PERSISTENT_FIRST + 5);
+    assert_int_equal(vacant[3], TPM2_PERSISTENT_FIRST + 6);
+}
+
+static void test_find_vacant_platform(void **state) {
+    UNUSED(state);
+
+    TPM2_HANDLE handles[] = {
+        TPM2_PERSISTENT_FIRST,
+        PLATFORM_FIRST,
+    };
+    set_in_use(handles);
+
+    TPMI_DH_PERSISTENT vacant[2] = { 0 };
+    tool_rc rc = tpm2_capability_find_vacant_persistent_handles(
+            (ESYS_CONTEXT *) 0xDEADBEEF, TPM2_RH_PLATFORM, ARRAY_LEN(vacant),
+            vacant);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(vacant[0], PLATFORM_FIRST + 1);
+    assert_int_equal(vacant[1], PLATFORM_FIRST + 2);
+}
+
+static void test_find_vacant_exhausted(void **state) {
+    UNUSED(state);
+
+    TPM2_HANDLE handles[] = {
+        TPM2_PERSISTENT_LAST - 1,
+        TPM2_PERSISTENT_LAST,
+    };
+    set_in_use(handles);
+
+    /* only PLATFORM_FIRST .. TPM2_PERSISTENT_LAST - 2 are vacant */
+    UINT32 count = TPM2_PERSISTENT_LAST - 1 - PLATFORM_FIRST;
+    TPMI_DH_PERSISTENT *vacant = calloc(count + 1, sizeof(*vacant));
+    assert_non_null(vacant);
+
+    tool_rc rc = tpm2_capability_find_vacant_persistent_handles(
+            (ESYS_CONTEXT *) 0xDEADBEEF, TPM2_RH_PLATFORM, count, vacant);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(vacant[count - 1], TPM2_PERSISTENT_LAST - 2);
+
+    rc = tpm2_capability_find_vacant_persistent_handles(
+            (ESYS_CONTEXT *) 0xDEADBEEF, TPM2_RH_PLATFORM, count + 1, vacant);
+    assert_int_equal(rc, tool_rc_general_error);
+
+    free(vacant);
+}
+
+static void test_get_tpm_property(void **state) {
+    UNUSED(state);
+
+    UINT32 value = 0;
+    tool_rc rc = tpm2_capability_get_tpm_property(
+            (ESYS_CONTEXT *) 0xDEADBEEF, TPM2_PT_INPUT_BUFFER, &value);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(value, 1024);
+}
+
+static void test_get_tpm_property_missing(void **state) {
+    UNUSED(state);
+
+    /* the TPM skips to the next property it has */
+    UINT32 value = 0;
+    tool_rc rc = tpm2_capability_get_tpm_property(
+            (ESYS_CONTEXT *) 0xDEADBEEF, TPM2_PT_INPUT_BUFFER - 1, &value);
+    assert_int_equal(rc, tool_rc_general_error);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_find_vacant_empty),
+        cmocka_unit_test(test_find_vacant_unsorted),
+        cmocka_unit_test(test_find_vacant_bulk),
+        cmocka_unit_test(test_find_vacant_platform),
+        cmocka_unit_test(test_find_vacant_exhausted),
+        cmocka_unit_test(test_get_tpm_property),
+        cmocka_unit_test(test_get_tpm_property_missing),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
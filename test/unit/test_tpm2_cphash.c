@@ -0,0 +1,252 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_cphash.h"
+#include "tpm2_util.h"
+
+/* a sha256 object name, nameAlg followed by a made up digest */
+static void object_name(TPM2B_NAME *name) {
+
+    name->size = 2 + 32;
+    name->name[0] = 0x00;
+    name->name[1] = 0x0b;
+    memset(&name->name[2], 0x11, 32);
+}
+
+static void test_tpm2_cphash_handle_count(void **state) {
+    UNUSED(state);
+
+    UINT8 count = 0;
+    assert_true(tpm2_cphash_get_handle_count(TPM2_CC_NV_UndefineSpaceSpecial,
+            &count));
+    assert_int_equal(count, 2);
+
+    assert_true(tpm2_cphash_get_handle_count(TPM2_CC_PolicyNV, &count));
+    assert_int_equal(count, 3);
+
+    assert_true(tpm2_cphash_get_handle_count(TPM2_CC_Unseal, &count));
+    assert_int_equal(count, 1);
+
+    /* the handle is a parameter */
+    assert_true(tpm2_cphash_get_handle_count(TPM2_CC_FlushContext, &count));
+    assert_int_equal(count, 0);
+
+    assert_true(tpm2_cphash_get_handle_count(TPM2_CC_Policy_AC_SendSelect,
+            &count));
+    assert_int_equal(count, 1);
+
+    /* gaps in the command code space */
+    assert_false(tpm2_cphash_get_handle_count(0x123, &count));
+    assert_false(tpm2_cphash_get_handle_count(0x15A, &count));
+}
+
+static void test_tpm2_cphash_handle_to_name(void **state) {
+    UNUSED(state);
+
+    TPM2B_NAME name = { 0 };
+    assert_true(tpm2_cphash_handle_to_name(TPM2_RH_OWNER, &name));
+    UINT8 owner[] = { 0x40, 0x00, 0x00, 0x01 };
+    assert_int_equal(name.size, sizeof(owner));
+    assert_memory_equal(name.name, owner, sizeof(owner));
+
+    assert_true(tpm2_cphash_handle_to_name(7, &name));
+    UINT8 pcr[] = { 0x00, 0x00, 0x00, 0x07 };
+    assert_memory_equal(name.name, pcr, sizeof(pcr));
+
+    /* objects and NV indices are named by their public area */
+    assert_false(tpm2_cphash_handle_to_name(0x80000001, &name));
+    assert_false(tpm2_cphash_handle_to_name(0x81000001, &name));
+    assert_false(tpm2_cphash_handle_to_name(0x01000001, &name));
+}
+
+static void test_tpm2_cphash_unseal(void **state) {
+    UNUSED(state);
+
+    UINT8 command_bytes[] = {
+        /* TPM2_ST_SESSIONS, size, TPM2_CC_Unseal */
+        0x80, 0x02, 0x00, 0x00, 0x00, 0x1b, 0x00, 0x00, 0x01, 0x5e,
+        /* itemHandle */
+        0x80, 0x00, 0x00, 0x01,
+        /* authorization area: size, TPM2_RS_PW, nonce, attrs, hmac */
+        0x00, 0x00, 0x00, 0x09, 0x40, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00,
+        0x00, 0x00,
+    };
+
+    tpm2_cphash_command command;
+    bool result = tpm2_cphash_parse_command(command_bytes,
+            sizeof(command_bytes), &command);
+    assert_true(result);
+
+    assert_int_equal(command.command_code, TPM2_CC_Unseal);
+    assert_int_equal(command.handle_count, 1);
+    assert_int_equal(command.handles[0], 0x80000001);
+    assert_int_equal(command.parameters_size, 0);
+
+    TPM2B_NAME name;
+    object_name(&name);
+
+    TPM2B_DIGEST cp_hash = { 0 };
+    result = tpm2_cphash_compute(TPM2_ALG_SHA256, command.command_code, &name,
+            1, command.parameters, command.parameters_size, &cp_hash);
+    assert_true(result);
+
+    UINT8 expected[] = {
+        0x7c, 0x1c, 0x4b, 0x1b, 0x9d, 0x02, 0x79, 0x64, 0x83, 0x15, 0x59,
+        0xd1, 0x6c, 0x41, 0xd0, 0x44, 0x2b, 0xaa, 0x85, 0x93, 0x92, 0x50,
+        0x0f, 0xd9, 0x50, 0xa2, 0x41, 0xcc, 0xde, 0x43, 0x65, 0x00,
+    };
+    assert_int_equal(cp_hash.size, sizeof(expected));
+    assert_memory_equal(cp_hash.buffer, expected, sizeof(expected));
+}
+
+static void test_tpm2_cphash_pcr_extend(void **state) {
+    UNUSED(state);
+
+    UINT8 command_bytes[] = {
+        /* TPM2_ST_SESSIONS, size, TPM2_CC_PCR_Extend */
+        0x80, 0x02, 0x00, 0x00, 0x00, 0x1d, 0x00, 0x00, 0x01, 0x82,
+        /* pcrHandle */
+        0x00, 0x00, 0x00, 0x07,
+        /* authorization area */
+        0x00, 0x00, 0x00, 0x09, 0x40, 0x00, 0x00, 0x09, 0x00, 0x00, 0x00,
+        0x00, 0x00,
+        /* parameters, not a valid TPML_DIGEST_VALUES but hashed as is */
+        0x01, 0x02,
+    };
+
+    tpm2_cphash_command command;
+    bool result = tpm2_cphash_parse_command(command_bytes,
+            sizeof(command_bytes), &command);
+    assert_true(result);
+    assert_int_equal(command.parameters_size, 2);
+
+    TPM2B_NAME name;
+    result = tpm2_cphash_handle_to_name(command.handles[0], &name);
+    assert_true(result);
+
+    TPM2B_DIGEST cp_hash = { 0 };
+    result = tpm2_cphash_compute(TPM2_ALG_SHA256, command.command_code, &name,
+            1, command.parameters, command.parameters_size, &cp_hash);
+    assert_true(result);
+
+    UINT8 expected[] = {
+        0xb1, 0x5e, 0x77, 0x8b, 0x16, 0xaa, 0xe6, 0x79, 0x95, 0xd2, 0x2d,
+        0xe7, 0xd6, 0x8f, 0x53, 0xb0, 0x1e, 0xd1, 0x9d, 0x3c, 0xa1, 0xf3,
+        0x8a, 0x15, 0xe7, 0xf2, 0x26, 0x25, 0x32, 0x74, 0xae, 0xf9,
+    };
+    assert_memory_equal(cp_hash.buffer, expected, sizeof(expected));
+}
+
+static void test_tpm2_cphash_no_sessions(void **state) {
+    UNUSED(state);
+
+    UINT8 command_bytes[] = {
+        /* TPM2_ST_NO_SESSIONS, size, TPM2_CC_GetRandom, bytesRequested */
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x01, 0x7b,
+        0x00, 0x10,
+    };
+
+    tpm2_cphash_command command;
+    bool result = tpm2_cphash_parse_command(command_bytes,
+            sizeof(command_bytes), &command);
+    assert_true(result);
+    assert_int_equal(command.handle_count, 0);
+
+    TPM2B_DIGEST cp_hash = { 0 };
+    result = tpm2_cphash_compute(TPM2_ALG_SHA256, command.command_code, NULL,
+            0, command.parameters, command.parameters_size, &cp_hash);
+    assert_true(result);
+
+    UINT8 expected[] = {
+        0x3a, 0x93, 0x6d, 0x6e, 0xa4, 0x15, 0xe9, 0x91, 0x56, 0x59, 0x21,
+        0x75, 0xf5, 0x9f, 0x84, 0x86, 0x45, 0xd0, 0xb0, 0xc3, 0x1d, 0x48,
+        0x78, 0x75, 0x0e, 0x23, 0x4d, 0x23, 0xdd, 0x57, 0x23, 0xfb,
+    };
+    assert_memory_equal(cp_hash.buffer, expected, sizeof(expected));
+}
+
+static void test_tpm2_cphash_namehash(void **state) {
+    UNUSED(state);
+
+    TPM2B_NAME names[2];
+    assert_true(tpm2_cphash_handle_to_name(TPM2_RH_OWNER, &names[0]));
+    assert_true(tpm2_cphash_handle_to_name(7, &names[1]));
+
+    TPM2B_DIGEST name_hash = { 0 };
+    bool result = tpm2_cphash_compute_namehash(TPM2_ALG_SHA256, names, 2,
+            &name_hash);
+    assert_true(result);
+
+    UINT8 expected[] = {
+        0x6d, 0x98, 0x79, 0x4e, 0xb6, 0x96, 0xfa, 0xa9, 0x40, 0x1d, 0xb7,
+        0x14, 0xa7, 0xb0, 0xbe, 0x38, 0x3b, 0x74, 0xd3, 0x1d, 0x98, 0xdb,
+        0x4c, 0x86, 0xf8, 0x06, 0xfd, 0x9d, 0x4b, 0x14, 0xdd, 0x9d,
+    };
+    assert_memory_equal(name_hash.buffer, expected, sizeof(expected));
+}
+
+static void test_tpm2_cphash_bad_commands(void **state) {
+    UNUSED(state);
+
+    tpm2_cphash_command command;
+
+    /* header size does not match the buffer */
+    UINT8 short_command[] = {
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x0e, 0x00, 0x00, 0x01, 0x7b,
+        0x00, 0x10,
+    };
+    assert_false(tpm2_cphash_parse_command(short_command,
+            sizeof(short_command), &command));
+
+    /* unknown command code */
+    UINT8 unknown_command[] = {
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x0a, 0x00, 0x00, 0x01, 0x23,
+    };
+    assert_false(tpm2_cphash_parse_command(unknown_command,
+            sizeof(unknown_command), &command));
+
+    /* authorization area larger than the command */
+    UINT8 bad_auth[] = {
+        0x80, 0x02, 0x00, 0x00, 0x00, 0x12, 0x00, 0x00, 0x01, 0x5e,
+        0x80, 0x00, 0x00, 0x01, 0x00, 0x00, 0x00, 0x09,
+    };
+    assert_false(tpm2_cphash_parse_command(bad_auth, sizeof(bad_auth),
+            &command));
+
+    /* missing handle */
+    UINT8 no_handle[] = {
+        0x80, 0x01, 0x00, 0x00, 0x00, 0x0c, 0x00, 0x00, 0x01, 0x5e,
+        0x80, 0x00,
+    };
+    assert_false(tpm2_cphash_parse_command(no_handle, sizeof(no_handle),
+            &command));
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_cphash_handle_count),
+        cmocka_unit_test(test_tpm2_cphash_handle_to_name),
+        cmocka_unit_test(test_tpm2_cphash_unseal),
+        cmocka_unit_test(test_tpm2_cphash_pcr_extend),
+        cmocka_unit_test(test_tpm2_cphash_no_sessions),
+        cmocka_unit_test(test_tpm2_cphash_namehash),
+        cmocka_unit_test(test_tpm2_cphash_bad_commands),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,110 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_entropy.h"
+#include "tpm2_util.h"
+
+/* a byte stream with no long runs and no value overrepresented */
+static void counting_bytes(UINT8 *data, size_t size) {
+
+    size_t i;
+    for (i = 0; i < size; i++) {
+        data[i] = (UINT8)(i * 7 + (i >> 8));
+    }
+}
+
+static void test_tpm2_entropy_health_pass(void **state) {
+    UNUSED(state);
+
+    tpm2_entropy_health health;
+    tpm2_entropy_health_init(&health);
+
+    UINT8 data[4096];
+    counting_bytes(data, sizeof(data));
+
+    assert_true(tpm2_entropy_health_check(&health, data, sizeof(data)));
+    assert_int_equal(health.samples, sizeof(data));
+    assert_int_equal(health.rct.failures, 0);
+    assert_int_equal(health.apt.failures, 0);
+}
+
+static void test_tpm2_entropy_health_repetition(void **state) {
+    UNUSED(state);
+
+    tpm2_entropy_health health;
+    tpm2_entropy_health_init(&health);
+
+    /* five repeats pass, six fail */
+    UINT8 data[] = { 0x01, 0xAA, 0xAA, 0xAA, 0xAA, 0xAA, 0x02 };
+    assert_true(tpm2_entropy_health_check(&health, data, sizeof(data)));
+
+    UINT8 run[] = { 0xBB, 0xBB, 0xBB, 0xBB, 0xBB, 0xBB };
+    assert_false(tpm2_entropy_health_check(&health, run, sizeof(run)));
+    assert_int_equal(health.rct.failures, 1);
+}
+
+static void test_tpm2_entropy_health_repetition_across_calls(void **state) {
+    UNUSED(state);
+
+    tpm2_entropy_health health;
+    tpm2_entropy_health_init(&health);
+
+    UINT8 run[] = { 0xCC, 0xCC, 0xCC };
+    assert_true(tpm2_entropy_health_check(&health, run, sizeof(run)));
+    assert_false(tpm2_entropy_health_check(&health, run, sizeof(run)));
+    assert_int_equal(health.rct.failures, 1);
+}
+
+static void test_tpm2_entropy_health_proportion(void **state) {
+    UNUSED(state);
+
+    tpm2_entropy_health health;
+    tpm2_entropy_health_init(&health);
+
+    /* the window's first sample recurring every 16 samples, 32 times */
+    UINT8 data[TPM2_ENTROPY_APT_WINDOW];
+    counting_bytes(data, sizeof(data));
+    size_t i;
+    for (i = 0; i < sizeof(data); i++) {
+        if (data[i] == data[0]) {
+            data[i] ^= 0x80;
+        }
+    }
+    for (i = 0; i < sizeof(data); i += 16) {
+        data[i] = data[0];
+    }
+
+    assert_false(tpm2_entropy_health_check(&health, data, sizeof(data)));
+    assert_int_equal(health.rct.failures, 0);
+    assert_int_equal(health.apt.failures, 1);
+
+    /* a new window starts over */
+    counting_bytes(data, sizeof(data));
+    assert_true(tpm2_entropy_health_check(&health, data, sizeof(data)));
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_entropy_health_pass),
+        cmocka_unit_test(test_tpm2_entropy_health_repetition),
+        cmocka_unit_test(test_tpm2_entropy_health_repetition_across_calls),
+        cmocka_unit_test(test_tpm2_entropy_health_proportion),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,140 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_manifest.h"
+#include "tpm2_util.h"
+
+typedef struct parsed parsed;
+struct parsed {
+    char text[256];
+    unsigned sections;
+    unsigned fields;
+};
+
+static bool on_section(const char *section, unsigned lineno, void *userdata) {
+
+    parsed *p = userdata;
+    p->sections++;
+    size_t len = strlen(p->text);
+    snprintf(&p->text[len], sizeof(p->text) - len, "[%s]@%u;", section,
+            lineno);
+
+    return true;
+}
+
+static bool on_field(const char *field, const char *value, unsigned lineno,
+        void *userdata) {
+
+    parsed *p = userdata;
+    p->fields++;
+    size_t len = strlen(p->text);
+    snprintf(&p->text[len], sizeof(p->text) - len, "%s=%s@%u;", field, value,
+            lineno);
+
+    return true;
+}
+
+static bool parse(const char *manifest, parsed *p) {
+
+    memset(p, 0, sizeof(*p));
+
+    FILE *f = fmemopen((void *) manifest, strlen(manifest), "r");
+    assert_non_null(f);
+
+    bool result = tpm2_manifest_parse(f, "test", on_section, on_field, p);
+    fclose(f);
+
+    return result;
+}
+
+static void test_tpm2_manifest_parse(void **state) {
+    UNUSED(state);
+
+    parsed p;
+    bool result = parse(
+            "# a comment\n"
+            "\n"
+            "[ first ]\n"
+            "  a = 1\n"
+            "b=\t two words \r\n"
+            "[second]\n"
+            "c =\n", &p);
+    assert_true(result);
+    assert_int_equal(p.sections, 2);
+    assert_int_equal(p.fields, 3);
+    assert_string_equal(p.text,
+            "[first]@3;a=1@4;b=two words@5;[second]@6;c=@7;");
+}
+
+static void test_tpm2_manifest_parse_field_first(void **state) {
+    UNUSED(state);
+
+    parsed p;
+    assert_false(parse("a = 1\n[first]\n", &p));
+    assert_int_equal(p.fields, 0);
+}
+
+static void test_tpm2_manifest_parse_malformed(void **state) {
+    UNUSED(state);
+
+    parsed p;
+    assert_false(parse("[first\n", &p));
+    assert_false(parse("[first] a = 1\n", &p));
+    assert_false(parse("[first]\nno value\n", &p));
+}
+
+static void test_tpm2_manifest_parse_long_line(void **state) {
+    UNUSED(state);
+
+    char *manifest = malloc(TPM2_MANIFEST_LINE_MAX + 16);
+    assert_non_null(manifest);
+
+    strcpy(manifest, "[first]\na=");
+    size_t len = strlen(manifest);
+    memset(&manifest[len], 'x', TPM2_MANIFEST_LINE_MAX);
+    strcpy(&manifest[len + TPM2_MANIFEST_LINE_MAX], "\n");
+
+    parsed p;
+    assert_false(parse(manifest, &p));
+
+    free(manifest);
+}
+
+static void test_tpm2_util_trim(void **state) {
+    UNUSED(state);
+
+    char s[] = " \t value with blanks \t\r\n";
+    assert_string_equal(tpm2_util_trim(s), "value with blanks");
+
+    char empty[] = " \n";
+    assert_string_equal(tpm2_util_trim(empty), "");
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_manifest_parse),
+        cmocka_unit_test(test_tpm2_manifest_parse_field_first),
+        cmocka_unit_test(test_tpm2_manifest_parse_malformed),
+        cmocka_unit_test(test_tpm2_manifest_parse_long_line),
+        cmocka_unit_test(test_tpm2_util_trim),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
@@ -0,0 +1,220 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_merkle.h"
+#include "tpm2_util.h"
+
+static TPM2B_DIGEST *leaves_new(UINT32 count) {
+
+    TPM2B_DIGEST *leaves = calloc(count, sizeof(*leaves));
+    assert_non_null(leaves);
+
+    UINT32 i;
+    for (i = 0; i < count; i++) {
+        bool result = tpm2_merkle_leaf_hash(TPM2_ALG_SHA256, (UINT8 *)&i,
+                sizeof(i), &leaves[i]);
+        assert_true(result);
+        assert_int_equal(leaves[i].size, 32);
+    }
+
+    return leaves;
+}
+
+static void test_tpm2_merkle_single_leaf(void **state) {
+    UNUSED(state);
+
+    TPM2B_DIGEST *leaves = leaves_new(1);
+    tpm2_merkle_tree *tree = tpm2_merkle_tree_new(TPM2_ALG_SHA256, leaves, 1);
+    assert_non_null(tree);
+
+    /* a lone leaf is its own root and needs no siblings */
+    const TPM2B_DIGEST *root = tpm2_merkle_tree_root(tree);
+    assert_memory_equal(root, &leaves[0], sizeof(*root));
+
+    tpm2_merkle_proof proof;
+    assert_true(tpm2_merkle_tree_proof(tree, 0, &proof));
+    assert_int_equal(proof.depth, 0);
+    assert_true(tpm2_merkle_proof_verify(&leaves[0], &proof, root));
+
+    tpm2_merkle_tree_free(tree);
+    free(leaves);
+}
+
+static void test_tpm2_merkle_all_proofs(void **state) {
+    UNUSED(state);
+
+    UINT32 count;
+    for (count = 2; count <= 33; count++) {
+        TPM2B_DIGEST *leaves = leaves_new(count);
+        tpm2_merkle_tree *tree = tpm2_merkle_tree_new(TPM2_ALG_SHA256, leaves,
+                count);
+        assert_non_null(tree);
+        const TPM2B_DIGEST *root = tpm2_merkle_tree_root(tree);
+
+        UINT32 i;
+        for (i = 0; i < count; i++) {
+            tpm2_merkle_proof proof;
+            assert_true(tpm2_merkle_tree_proof(tree, i, &proof));
+            assert_true(tpm2_merkle_proof_verify(&leaves[i], &proof, root));
+
+            /* the proof of one leaf does not vouch for another */
+            UINT32 other = (i + 1) % count;
+            assert_false(tpm2_merkle_proof_verify(&leaves[other], &proof,
+                    root));
+        }
+
+        assert_false(tpm2_merkle_tree_proof(tree, count, NULL));
+
+        tpm2_merkle_tree_free(tree);
+        free(leaves);
+    }
+}
+
+static void test_tpm2_merkle_tampered(void **state) {
+    UNUSED(state);
+
+    TPM2B_DIGEST *leaves = leaves_new(5);
+    tpm2_merkle_tree *tree = tpm2_merkle_tree_new(TPM2_ALG_SHA256, leaves, 5);
+    assert_non_null(tree);
+    const TPM2B_DIGEST *root = tpm2_merkle_tree_root(tree);
+
+    tpm2_merkle_proof proof;
+    assert_true(tpm2_merkle_tree_proof(tree, 2, &proof));
+
+    tpm2_merkle_proof bad = proof;
+    bad.siblings[0].buffer[0] ^= 1;
+    assert_false(tpm2_merkle_proof_verify(&leaves[2], &bad, root));
+
+    bad = proof;
+    bad.index = 3;
+    assert_false(tpm2_merkle_proof_verify(&leaves[2], &bad, root));
+
+    bad = proof;
+    bad.depth--;
+    assert_false(tpm2_merkle_proof_verify(&leaves[2], &bad, root));
+
+    tpm2_merkle_tree_free(tree);
+    free(leaves);
+}
+
+static void test_tpm2_merkle_leaf_hash_file(void **state) {
+    UNUSED(state);
+
+    /* larger than one read, so the file is hashed in pieces */
+    static UINT8 data[40000];
+    size_t i;
+    for (i = 0; i < sizeof(data); i++) {
+        data[i] = (UINT8)(i * 31);
+    }
+
+    FILE *f = tmpfile();
+    assert_non_null(f);
+    assert_int_equal(fwrite(data, 1, sizeof(data), f), sizeof(data));
+    rewind(f);
+
+    TPM2B_DIGEST from_file;
+    assert_true(tpm2_merkle_leaf_hash_file(TPM2_ALG_SHA256, f, &from_file));
+    fclose(f);
+
+    TPM2B_DIGEST from_data;
+    assert_true(tpm2_merkle_leaf_hash(TPM2_ALG_SHA256, data, sizeof(data),
+            &from_data));
+    assert_int_equal(from_file.size, from_data.size);
+    assert_memory_equal(from_file.buffer, from_data.buffer, from_data.size);
+}
+
+static void test_tpm2_merkle_proof_root(void **state) {
+    UNUSED(state);
+
+    TPM2B_DIGEST *leaves = leaves_new(6);
+    tpm2_merkle_tree *tree = tpm2_merkle_tree_new(TPM2_ALG_SHA256, leaves, 6);
+    assert_non_null(tree);
+    const TPM2B_DIGEST *root = tpm2_merkle_tree_root(tree);
+
+    tpm2_merkle_proof proof;
+    assert_true(tpm2_merkle_tree_proof(tree, 4, &proof));
+
+    TPM2B_DIGEST computed;
+    assert_true(tpm2_merkle_proof_root(&leaves[4], &proof, &computed));
+    assert_int_equal(computed.size, root->size);
+    assert_memory_equal(computed.buffer, root->buffer, root->size);
+
+    tpm2_merkle_tree_free(tree);
+    free(leaves);
+}
+
+static void test_tpm2_merkle_bad_count(void **state) {
+    UNUSED(state);
+
+    TPM2B_DIGEST leaf = { .size = 0 };
+    assert_null(tpm2_merkle_tree_new(TPM2_ALG_SHA256, &leaf, 0));
+    assert_null(tpm2_merkle_tree_new(TPM2_ALG_SHA256, &leaf,
+            TPM2_MERKLE_MAX_LEAVES + 1));
+}
+
+static void test_tpm2_merkle_save_load(void **state) {
+    UNUSED(state);
+
+    TPM2B_DIGEST *leaves = leaves_new(7);
+    tpm2_merkle_tree *tree = tpm2_merkle_tree_new(TPM2_ALG_SHA256, leaves, 7);
+    assert_non_null(tree);
+
+    tpm2_merkle_proof proof;
+    assert_true(tpm2_merkle_tree_proof(tree, 6, &proof));
+
+    char path[] = "/tmp/test_tpm2_merkle_XXXXXX";
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    close(fd);
+
+    assert_true(tpm2_merkle_proof_save(&proof, path));
+
+    tpm2_merkle_proof loaded;
+    assert_true(tpm2_merkle_proof_load(path, &loaded));
+    assert_int_equal(loaded.halg, TPM2_ALG_SHA256);
+    assert_int_equal(loaded.index, 6);
+    assert_int_equal(loaded.count, 7);
+    assert_int_equal(loaded.depth, proof.depth);
+    assert_true(tpm2_merkle_proof_verify(&leaves[6], &loaded,
+            tpm2_merkle_tree_root(tree)));
+
+    /* a truncated proof does not load */
+    assert_int_equal(truncate(path, 30), 0);
+    assert_false(tpm2_merkle_proof_load(path, &loaded));
+
+    unlink(path);
+    tpm2_merkle_tree_free(tree);
+    free(leaves);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_merkle_single_leaf),
+        cmocka_unit_test(test_tpm2_merkle_all_proofs),
+        cmocka_unit_test(test_tpm2_merkle_tampered),
+        cmocka_unit_test(test_tpm2_merkle_leaf_hash_file),
+        cmocka_unit_test(test_tpm2_merkle_proof_root),
+        cmocka_unit_test(test_tpm2_merkle_bad_count),
+        cmocka_unit_test(test_tpm2_merkle_save_load),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
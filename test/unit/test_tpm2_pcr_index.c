@@ -0,0 +1,191 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_pcr_index.h"
+#include "tpm2_util.h"
+
+#define INDEX_DIGESTS 1000
+
+static const TPML_PCR_SELECTION selection = {
+    .count = 1,
+    .pcrSelections = {
+        {
+            .hash = TPM2_ALG_SHA256,
+            .sizeofSelect = 3,
+            .pcrSelect = { 0x01, 0x80, 0x40 },
+        },
+    },
+};
+
+/* a deterministic digest, spread like a real one */
+static void digest_for(UINT32 n, TPM2B_DIGEST *digest) {
+
+    digest->size = 32;
+
+    UINT32 x = n * 2654435761u + 1;
+    UINT8 i;
+    for (i = 0; i < digest->size; i++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        digest->buffer[i] = x >> 24;
+    }
+}
+
+static tpm2_pcr_index *index_saved(char *path) {
+
+    tpm2_pcr_index *index = tpm2_pcr_index_new();
+    assert_non_null(index);
+
+    UINT32 i;
+    for (i = 0; i < INDEX_DIGESTS; i++) {
+        TPM2B_DIGEST digest;
+        digest_for(i, &digest);
+        assert_true(tpm2_pcr_index_add(index, TPM2_ALG_SHA256, &selection,
+                &digest));
+    }
+
+    /* duplicates are stored once */
+    TPM2B_DIGEST digest;
+    digest_for(0, &digest);
+    assert_true(tpm2_pcr_index_add(index, TPM2_ALG_SHA256, &selection,
+            &digest));
+
+    int fd = mkstemp(path);
+    assert_true(fd >= 0);
+    close(fd);
+
+    assert_true(tpm2_pcr_index_save(index, path));
+    assert_int_equal(tpm2_pcr_index_count(index), INDEX_DIGESTS);
+    tpm2_pcr_index_free(index);
+
+    index = tpm2_pcr_index_load(path);
+    assert_non_null(index);
+    assert_int_equal(tpm2_pcr_index_count(index), INDEX_DIGESTS);
+
+    return index;
+}
+
+static void test_tpm2_pcr_index_lookup(void **state) {
+    UNUSED(state);
+
+    char path[] = "/tmp/test_tpm2_pcr_index_XXXXXX";
+    tpm2_pcr_index *index = index_saved(path);
+
+    UINT32 i;
+    for (i = 0; i < INDEX_DIGESTS; i++) {
+        TPM2B_DIGEST digest;
+        digest_for(i, &digest);
+        assert_true(tpm2_pcr_index_lookup(index, TPM2_ALG_SHA256, &selection,
+                &digest));
+    }
+
+    for (i = INDEX_DIGESTS; i < 2 * INDEX_DIGESTS; i++) {
+        TPM2B_DIGEST digest;
+        digest_for(i, &digest);
+        assert_false(tpm2_pcr_index_lookup(index, TPM2_ALG_SHA256,
+                &selection, &digest));
+    }
+
+    /* a digest differing in its last byte only */
+    TPM2B_DIGEST digest;
+    digest_for(7, &digest);
+    digest.buffer[31] ^= 1;
+    assert_false(tpm2_pcr_index_lookup(index, TPM2_ALG_SHA256, &selection,
+            &digest));
+
+    unlink(path);
+    tpm2_pcr_index_free(index);
+}
+
+static void test_tpm2_pcr_index_selection(void **state) {
+    UNUSED(state);
+
+    char path[] = "/tmp/test_tpm2_pcr_index_XXXXXX";
+    tpm2_pcr_index *index = index_saved(path);
+
+    TPM2B_DIGEST digest;
+    digest_for(42, &digest);
+
+    /* a longer select bitmap selecting the same PCRs matches */
+    TPML_PCR_SELECTION wider = selection;
+    wider.pcrSelections[0].sizeofSelect = 4;
+    assert_true(tpm2_pcr_index_lookup(index, TPM2_ALG_SHA256, &wider,
+            &digest));
+
+    TPML_PCR_SELECTION other = selection;
+    other.pcrSelections[0].pcrSelect[0] = 0x03;
+    assert_false(tpm2_pcr_index_lookup(index, TPM2_ALG_SHA256, &other,
+            &digest));
+
+    other = selection;
+    other.pcrSelections[0].hash = TPM2_ALG_SHA1;
+    assert_false(tpm2_pcr_index_lookup(index, TPM2_ALG_SHA256, &other,
+            &digest));
+
+    assert_false(tpm2_pcr_index_lookup(index, TPM2_ALG_SHA384, &selection,
+            &digest));
+
+    unlink(path);
+    tpm2_pcr_index_free(index);
+}
+
+static void test_tpm2_pcr_index_bad_digest(void **state) {
+    UNUSED(state);
+
+    tpm2_pcr_index *index = tpm2_pcr_index_new();
+    assert_non_null(index);
+
+    TPM2B_DIGEST digest;
+    digest_for(0, &digest);
+    assert_false(tpm2_pcr_index_add(index, TPM2_ALG_SHA1, &selection,
+            &digest));
+
+    tpm2_pcr_index_free(index);
+}
+
+static void test_tpm2_pcr_index_truncated(void **state) {
+    UNUSED(state);
+
+    char path[] = "/tmp/test_tpm2_pcr_index_XXXXXX";
+    tpm2_pcr_index *index = index_saved(path);
+    tpm2_pcr_index_free(index);
+
+    /* cut after the first of the digests */
+    assert_int_equal(truncate(path, 12 + 2 + 2 + 10 + 2 + 4 + 32), 0);
+    assert_null(tpm2_pcr_index_load(path));
+
+    assert_int_equal(truncate(path, 0), 0);
+    assert_null(tpm2_pcr_index_load(path));
+
+    unlink(path);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test(test_tpm2_pcr_index_lookup),
+        cmocka_unit_test(test_tpm2_pcr_index_selection),
+        cmocka_unit_test(test_tpm2_pcr_index_bad_digest),
+        cmocka_unit_test(test_tpm2_pcr_index_truncated),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
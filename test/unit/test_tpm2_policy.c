@@ -123,6 +123,14 @@ TSS2_RC __wrap_Esys_PolicyGetDigest(ESYS_CONTEXT *esysContext,
     return TPM2_RC_SUCCESS;
 }
 
+/*
+ * The pcrUpdateCounter reported by PCR reads and how many reads of PCR
+ * values and of only the counter were made.
+ */
+static UINT32 pcr_update_counter;
+static unsigned full_reads;
+static unsigned counter_reads;
+
 TSS2_RC __wrap_Esys_PCR_Read(ESYS_CONTEXT *esysContext,
             ESYS_TR shandle1, ESYS_TR shandle2, ESYS_TR shandle3,
             const TPML_PCR_SELECTION *pcrSelectionIn, UINT32 *pcrUpdateCounter,
@@ -132,30 +140,93 @@ TSS2_RC __wrap_Esys_PCR_Read(ESYS_CONTEXT *esysContext,
     UNUSED(shandle1);
     UNUSED(shandle2);
     UNUSED(shandle3);
-    UNUSED(pcrSelectionIn);
-    UNUSED(pcrUpdateCounter);
     UNUSED(pcrSelectionOut);
 
+    *pcrUpdateCounter = pcr_update_counter;
+
     *pcrValues = calloc(1, sizeof(TPML_DIGEST));
     if (*pcrValues == NULL) {
         return TPM2_RC_FAILURE;
     }
 
+    if (!pcrSelectionIn->count) {
+        counter_reads++;
+        return TPM2_RC_SUCCESS;
+    }
+
+    full_reads++;
+
+    /* every selected PCR, in every bank, reads as pcr_value */
     UINT32 i;
-    /* NOTE: magic number of 4... The prior (SAPI) implementation had a
-     * semi-populated pcrValues with an appropriate count value set.
-     * This ESAPI call allocates the pcrValues out-value and thus we don't have
-     * an appropriate count number at call time, therefore we hard-code the
-     * expected value for the *one* call we're currently making in this unit
-     * test.
-     */
-    for (i = 0; i < 4; i++) {
-        (*pcrValues)->digests[i] = pcr_value;
+    for (i = 0; i < pcrSelectionIn->count; i++) {
+        const TPMS_PCR_SELECTION *sel = &pcrSelectionIn->pcrSelections[i];
+        UINT32 j;
+        for (j = 0; j < sel->sizeofSelect; j++) {
+            UINT32 cnt = tpm2_util_pop_count(sel->pcrSelect[j]);
+            while (cnt--) {
+                (*pcrValues)->digests[(*pcrValues)->count++] = pcr_value;
+            }
+        }
     }
 
     return TPM2_RC_SUCCESS;
 }
 
+/* PCR 16, the debug PCR, is not counted in pcrUpdateCounter */
+#define NO_INCREMENT_PCR 16
+
+TSS2_RC __wrap_Esys_GetCapability(ESYS_CONTEXT *esysContext,
+            ESYS_TR shandle1, ESYS_TR shandle2, ESYS_TR shandle3,
+            TPM2_CAP capability, UINT32 property, UINT32 propertyCount,
+            TPMI_YES_NO *moreData, TPMS_CAPABILITY_DATA **capabilityData) {
+
+    UNUSED(esysContext);
+    UNUSED(shandle1);
+    UNUSED(shandle2);
+    UNUSED(shandle3);
+    UNUSED(propertyCount);
+
+    assert_int_equal(capability, TPM2_CAP_PCR_PROPERTIES);
+    assert_int_equal(property, TPM2_PT_PCR_NO_INCREMENT);
+
+    *moreData = TPM2_NO;
+
+    *capabilityData = calloc(1, sizeof(TPMS_CAPABILITY_DATA));
+    if (*capabilityData == NULL) {
+        return TPM2_RC_FAILURE;
+    }
+
+    (*capabilityData)->capability = capability;
+    TPML_TAGGED_PCR_PROPERTY *props = &(*capabilityData)->data.pcrProperties;
+    props->count = 1;
+    props->pcrProperty[0].tag = TPM2_PT_PCR_NO_INCREMENT;
+    props->pcrProperty[0].sizeofSelect = 3;
+    props->pcrProperty[0].pcrSelect[NO_INCREMENT_PCR / 8] =
+            1 << (NO_INCREMENT_PCR % 8);
+
+    return TPM2_RC_SUCCESS;
+}
+
+/* how many times a policy session was reset */
+static unsigned policy_restarts;
+
+TSS2_RC __wrap_Esys_PolicyRestart(ESYS_CONTEXT *esysContext,
+            ESYS_TR sessionHandle,
+            ESYS_TR shandle1, ESYS_TR shandle2, ESYS_TR shandle3) {
+
+    UNUSED(esysContext);
+    UNUSED(shandle1);
+    UNUSED(shandle2);
+    UNUSED(shandle3);
+
+    assert_int_equal(sessionHandle, SESSION_HANDLE);
+
+    current_digest.size = 0;
+    policy_restarts++;
+
+    return TPM2_RC_SUCCESS;
+}
+
 TSS2_RC __wrap_Esys_FlushContext(ESYS_CONTEXT *esysContext, ESYS_TR flushHandle) {
     UNUSED(esysContext);
     UNUSED(flushHandle);
@@ -356,6 +427,106 @@ static void test_tpm2_policy_build_pcr_file_bad_size(void **state) {
     assert_int_equal(trc, tool_rc_general_error);
 }
 
+static void get_pcr_digest(const char *spec, TPM2B_DIGEST *digest) {
+
+    TPML_PCR_SELECTION pcr_selections;
+    bool res = pcr_parse_selections(spec, &pcr_selections);
+    assert_true(res);
+
+    tool_rc rc = tpm2_policy_get_pcr_digest(ESAPI_CONTEXT, TPM2_ALG_SHA256,
+            NULL, &pcr_selections, digest);
+    assert_int_equal(rc, tool_rc_success);
+}
+
+static void test_tpm2_policy_get_pcr_digest_cached(void **state) {
+    UNUSED(state);
+
+    TPM2B_DIGEST first = TPM2B_EMPTY_INIT;
+    TPM2B_DIGEST second = TPM2B_EMPTY_INIT;
+
+    full_reads = counter_reads = 0;
+    pcr_update_counter = 10;
+
+    /* the first use has nothing cached and only reads the PCRs */
+    get_pcr_digest("sha256:4,5", &first);
+    assert_int_equal(full_reads, 1);
+    assert_int_equal(counter_reads, 0);
+
+    /* an unchanged counter serves the digest from the cache */
+    get_pcr_digest("sha256:4,5", &second);
+    assert_int_equal(full_reads, 1);
+    assert_int_equal(counter_reads, 1);
+    assert_int_equal(first.size, second.size);
+    assert_memory_equal(first.buffer, second.buffer, first.size);
+
+    /* an extend bumps the counter and the PCRs are read again */
+    pcr_update_counter++;
+    get_pcr_digest("sha256:4,5", &second);
+    assert_int_equal(full_reads, 2);
+    assert_int_equal(counter_reads, 2);
+
+    /* a different selection is a different entry */
+    get_pcr_digest("sha256:4", &second);
+    assert_int_equal(full_reads, 3);
+    assert_int_equal(counter_reads, 2);
+}
+
+static void test_tpm2_policy_get_pcr_digest_no_increment(void **state) {
+    UNUSED(state);
+
+    TPM2B_DIGEST digest = TPM2B_EMPTY_INIT;
+
+    full_reads = counter_reads = 0;
+
+    /* extending PCR 16 leaves the counter alone, so it is never cached */
+    get_pcr_digest("sha256:6,16", &digest);
+    get_pcr_digest("sha256:6,16", &digest);
+    assert_int_equal(full_reads, 2);
+    assert_int_equal(counter_reads, 0);
+}
+
+static void test_tpm2_policy_restart_pcr_cached(void **state) {
+    UNUSED(state);
+
+    tpm2_session_data *d = tpm2_session_data_new(TPM2_SE_POLICY);
+    assert_non_null(d);
+
+    tpm2_session *s = NULL;
+    tool_rc rc = tpm2_session_open(ESAPI_CONTEXT, d, &s);
+    assert_int_equal(rc, tool_rc_success);
+
+    TPML_PCR_SELECTION pcr_selections;
+    bool res = pcr_parse_selections(PCR_SEL_SPEC, &pcr_selections);
+    assert_true(res);
+
+    /* a counter no earlier test used, so the first build reads the PCRs */
+    pcr_update_counter = 20;
+
+    rc = tpm2_policy_build_pcr(ESAPI_CONTEXT, s, NULL, &pcr_selections);
+    assert_int_equal(rc, tool_rc_success);
+
+    full_reads = counter_reads = policy_restarts = 0;
+
+    /* each reuse resets the session and takes the digest from the cache */
+    unsigned i;
+    for (i = 1; i <= 3; i++) {
+        rc = tpm2_policy_restart_pcr(ESAPI_CONTEXT, s, NULL, &pcr_selections);
+        assert_int_equal(rc, tool_rc_success);
+        assert_int_equal(policy_restarts, i);
+        assert_int_equal(full_reads, 0);
+        assert_int_equal(counter_reads, i);
+
+        TPM2B_DIGEST *policy_digest;
+        rc = tpm2_policy_get_digest(ESAPI_CONTEXT, s, &policy_digest);
+        assert_int_equal(rc, tool_rc_success);
+        assert_int_equal(policy_digest->size, expected_policy_digest.size);
+        assert_memory_equal(policy_digest->buffer,
+                expected_policy_digest.buffer, expected_policy_digest.size);
+    }
+
+    tpm2_session_close(&s);
+}
+
 /* link required symbol, but tpm2_tool.c declares it AND main, which
  * we have a main below for cmocka tests.
  */
@@ -370,7 +541,10 @@ int main(int argc, char *argv[]) {
         cmocka_unit_test_setup_teardown(test_tpm2_policy_build_pcr_file_good,
                 test_setup, test_teardown),
         cmocka_unit_test_setup_teardown(test_tpm2_policy_build_pcr_file_bad_size,
-                test_setup, test_teardown)
+                test_setup, test_teardown),
+        cmocka_unit_test(test_tpm2_policy_get_pcr_digest_cached),
+        cmocka_unit_test(test_tpm2_policy_get_pcr_digest_no_increment),
+        cmocka_unit_test(test_tpm2_policy_restart_pcr_cached)
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
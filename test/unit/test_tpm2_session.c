@@ -11,10 +11,13 @@
 
 #include <tss2/tss2_mu.h>
 
+#include "files.h"
 #include "test_session_common.h"
 #include "tpm2_session.h"
 
 ESYS_TR _save_handle;
+static unsigned _context_saves;
+static unsigned _context_loads;
 
 static void test_tpm2_create_dummy_context(TPMS_CONTEXT *context) {
     context->hierarchy = TPM2_RH_ENDORSEMENT;
@@ -35,6 +38,7 @@ tool_rc __wrap_tpm2_context_save(ESYS_CONTEXT *esysContext,
     test_tpm2_create_dummy_context(dummy_context);
     *context = dummy_context;
     _save_handle = saveHandle;
+    _context_saves++;
 
     return tool_rc_success;
 }
@@ -46,10 +50,39 @@ TSS2_RC __wrap_Esys_ContextLoad(ESYS_CONTEXT *esysContext,
     UNUSED(context);
 
     *loadedHandle = _save_handle;
+    _context_loads++;
 
     return TPM2_RC_SUCCESS;
 }
 
+/* a resident session serializes to just its ESYS_TR */
+TSS2_RC __wrap_Esys_TR_Serialize(ESYS_CONTEXT *esysContext, ESYS_TR object,
+            uint8_t **buffer, size_t *buffer_size) {
+
+    UNUSED(esysContext);
+
+    *buffer = malloc(sizeof(object));
+    if (!*buffer) {
+        return TSS2_ESYS_RC_MEMORY;
+    }
+
+    memcpy(*buffer, &object, sizeof(object));
+    *buffer_size = sizeof(object);
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC __wrap_Esys_TR_Deserialize(ESYS_CONTEXT *esysContext,
+            uint8_t const *buffer, size_t buffer_size, ESYS_TR *esys_handle) {
+
+    UNUSED(esysContext);
+
+    assert_int_equal(buffer_size, sizeof(*esys_handle));
+    memcpy(esys_handle, buffer, sizeof(*esys_handle));
+
+    return TSS2_RC_SUCCESS;
+}
+
 static TSS2_RC policy_restart_return() {
     return (TSS2_RC)mock();
 }
@@ -235,6 +268,76 @@ static void test_tpm2_session_save(void **state) {
     assert_null(s);
 }
 
+static void test_tpm2_session_save_resident(void **state) {
+
+    set_expected_defaults(TPM2_SE_POLICY, SESSION_HANDLE, TPM2_RC_SUCCESS);
+
+    tpm2_session_data *d = tpm2_session_data_new(TPM2_SE_POLICY);
+    assert_non_null(d);
+
+    tpm2_session_set_path(d, (char *)*state);
+    tpm2_session_set_resident(d, true);
+
+    tpm2_session *s = NULL;
+    tool_rc rc = tpm2_session_open(CONTEXT, d, &s);
+    assert_int_equal(rc, tool_rc_success);
+    assert_non_null(s);
+
+    ESYS_TR handle1 = tpm2_session_get_handle(s);
+
+    _context_saves = _context_loads = 0;
+
+    rc = tpm2_session_close(&s);
+    assert_int_equal(rc, tool_rc_success);
+    assert_null(s);
+
+    rc = tpm2_session_restore(CONTEXT, (char *)*state, false, &s);
+    assert_int_equal(rc, tool_rc_success);
+    assert_non_null(s);
+
+    /* neither saving nor restoring touched the TPM */
+    assert_int_equal(_context_saves, 0);
+    assert_int_equal(_context_loads, 0);
+
+    assert_int_equal(tpm2_session_get_handle(s), handle1);
+    assert_int_equal(tpm2_session_get_type(s), TPM2_SE_POLICY);
+    assert_int_equal(tpm2_session_get_authhash(s), TPM2_ALG_SHA256);
+
+    /* and it is saved as resident again */
+    rc = tpm2_session_close(&s);
+    assert_int_equal(rc, tool_rc_success);
+    assert_int_equal(_context_saves, 0);
+}
+
+static void test_tpm2_session_restore_version_2(void **state) {
+
+    const char *path = (char *)*state;
+
+    FILE *f = fopen(path, "w+b");
+    assert_non_null(f);
+
+    TPM2_SE type = TPM2_SE_POLICY;
+    bool result = files_write_header(f, 2)
+            && files_write_bytes(f, &type, sizeof(type))
+            && files_write_16(f, TPM2_ALG_SHA256);
+    assert_true(result);
+
+    tool_rc rc = files_save_tpm_context_to_file(CONTEXT, SESSION_HANDLE, f);
+    assert_int_equal(rc, tool_rc_success);
+    fclose(f);
+
+    tpm2_session *s = NULL;
+    rc = tpm2_session_restore(NULL, path, false, &s);
+    assert_int_equal(rc, tool_rc_success);
+    assert_non_null(s);
+
+    assert_int_equal(tpm2_session_get_handle(s), SESSION_HANDLE);
+    assert_int_equal(tpm2_session_get_type(s), TPM2_SE_POLICY);
+
+    tpm2_session_close(&s);
+    assert_null(s);
+}
+
 static void test_tpm2_session_restart(void **state) {
     UNUSED(state);
 
@@ -303,6 +406,10 @@ int main(int argc, char *argv[]) {
     cmocka_unit_test(test_tpm2_session_defaults_bad),
     cmocka_unit_test_setup_teardown(test_tpm2_session_save,
             test_session_setup, test_session_teardown),
+    cmocka_unit_test_setup_teardown(test_tpm2_session_save_resident,
+            test_session_setup, test_session_teardown),
+    cmocka_unit_test_setup_teardown(test_tpm2_session_restore_version_2,
+            test_session_setup, test_session_teardown),
     cmocka_unit_test(test_tpm2_session_restart),
     cmocka_unit_test(test_tpm2_session_is_trial_test)
     };
@@ -0,0 +1,251 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include <setjmp.h>
+#include <cmocka.h>
+
+#include "tpm2_session_broker.h"
+#include "tpm2_util.h"
+
+/* dummy handle for esys context */
+#define ESAPI_CONTEXT ((ESYS_CONTEXT *)0xDEADBEEF)
+
+#define SALT_KEY 0xCAFE
+
+/* the TPM handle the first session gets, later sessions count up from it */
+#define TPM_SESSION_HANDLE 0x02000000
+
+static unsigned sessions_started;
+static unsigned sessions_flushed;
+
+TSS2_RC __wrap_Esys_StartAuthSession(ESYS_CONTEXT *esysContext,
+            ESYS_TR tpmKey, ESYS_TR bind,
+            ESYS_TR shandle1, ESYS_TR shandle2, ESYS_TR shandle3,
+            const TPM2B_NONCE *nonceCaller, TPM2_SE sessionType,
+            const TPMT_SYM_DEF *symmetric, TPMI_ALG_HASH authHash,
+            ESYS_TR *sessionHandle) {
+
+    UNUSED(esysContext);
+    UNUSED(bind);
+    UNUSED(shandle1);
+    UNUSED(shandle2);
+    UNUSED(shandle3);
+    UNUSED(nonceCaller);
+    UNUSED(authHash);
+
+    assert_int_equal(tpmKey, SALT_KEY);
+    assert_int_equal(sessionType, TPM2_SE_HMAC);
+    assert_int_equal(symmetric->algorithm, TPM2_ALG_AES);
+
+    *sessionHandle = TPM_SESSION_HANDLE + sessions_started++;
+
+    return TPM2_RC_SUCCESS;
+}
+
+TSS2_RC __wrap_Esys_TRSess_SetAttributes(ESYS_CONTEXT *esysContext,
+            ESYS_TR session, TPMA_SESSION flags, TPMA_SESSION mask) {
+
+    UNUSED(esysContext);
+    UNUSED(session);
+    UNUSED(mask);
+
+    assert_true(flags & TPMA_SESSION_CONTINUESESSION);
+    assert_true(flags & TPMA_SESSION_DECRYPT);
+    assert_true(flags & TPMA_SESSION_ENCRYPT);
+
+    return TPM2_RC_SUCCESS;
+}
+
+TSS2_RC __wrap_Esys_TR_Close(ESYS_CONTEXT *esysContext, ESYS_TR *handle) {
+    UNUSED(esysContext);
+
+    *handle = ESYS_TR_NONE;
+
+    return TSS2_RC_SUCCESS;
+}
+
+TSS2_RC __wrap_Esys_FlushContext(ESYS_CONTEXT *esysContext, ESYS_TR flushHandle) {
+    UNUSED(esysContext);
+    UNUSED(flushHandle);
+
+    sessions_flushed++;
+
+    return TSS2_RC_SUCCESS;
+}
+
+typedef struct run_data run_data;
+struct run_data {
+    unsigned calls;
+    ESYS_TR last_handle;
+    /* fail this many calls, with this TPM response code */
+    unsigned failures;
+    TSS2_RC tpm_rc;
+};
+
+static tool_rc run_cb(ESYS_CONTEXT *ectx, tpm2_session *session,
+        void *userdata, TSS2_RC *tpm_rc) {
+
+    UNUSED(ectx);
+
+    run_data *data = (run_data *) userdata;
+    data->calls++;
+    data->last_handle = tpm2_session_get_handle(session);
+
+    assert_int_equal(*tpm_rc, TPM2_RC_SUCCESS);
+
+    if (data->failures) {
+        data->failures--;
+        *tpm_rc = data->tpm_rc;
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
+static int test_setup(void **state) {
+
+    sessions_started = 0;
+    sessions_flushed = 0;
+
+    tpm2_session_broker *broker = NULL;
+    tool_rc rc = tpm2_session_broker_new(ESAPI_CONTEXT, SALT_KEY, NULL,
+            &broker);
+    assert_int_equal(rc, tool_rc_success);
+
+    *state = broker;
+    return 0;
+}
+
+static int test_teardown(void **state) {
+
+    tpm2_session_broker *broker = (tpm2_session_broker *) *state;
+    tool_rc rc = tpm2_session_broker_free(&broker);
+    assert_int_equal(rc, tool_rc_success);
+    assert_null(broker);
+    return 0;
+}
+
+static void test_tpm2_session_broker_reuse(void **state) {
+
+    tpm2_session_broker *broker = (tpm2_session_broker *) *state;
+
+    run_data data = { 0 };
+    unsigned i;
+    for (i = 0; i < 3; i++) {
+        tool_rc rc = tpm2_session_broker_run(broker, run_cb, &data);
+        assert_int_equal(rc, tool_rc_success);
+    }
+
+    /* one salted session serves every command */
+    assert_int_equal(sessions_started, 1);
+    assert_int_equal(data.calls, 3);
+    assert_int_equal(data.last_handle, TPM_SESSION_HANDLE);
+}
+
+static void test_evicted(void **state, TSS2_RC tpm_rc) {
+
+    tpm2_session_broker *broker = (tpm2_session_broker *) *state;
+
+    run_data data = { .failures = 1, .tpm_rc = tpm_rc };
+    tool_rc rc = tpm2_session_broker_run(broker, run_cb, &data);
+    assert_int_equal(rc, tool_rc_success);
+
+    /* the old session is flushed and the callback retried on a new one */
+    assert_int_equal(sessions_flushed, 1);
+    assert_int_equal(sessions_started, 2);
+    assert_int_equal(data.calls, 2);
+    assert_int_equal(data.last_handle, TPM_SESSION_HANDLE + 1);
+}
+
+static void test_tpm2_session_broker_evicted(void **state) {
+
+    test_evicted(state, TPM2_RC_REFERENCE_S0 + 1);
+}
+
+static void test_tpm2_session_broker_evicted_handle(void **state) {
+
+    /* TPM2_RC_HANDLE on the second session handle */
+    test_evicted(state, TPM2_RC_HANDLE | TPM2_RC_S | TPM2_RC_2);
+}
+
+static void test_tpm2_session_broker_evicted_resmgr(void **state) {
+
+    test_evicted(state, TSS2_RESMGR_TPM_RC_LAYER | TPM2_RC_REFERENCE_S0);
+}
+
+static void test_not_evicted(void **state, TSS2_RC tpm_rc) {
+
+    tpm2_session_broker *broker = (tpm2_session_broker *) *state;
+
+    run_data data = { .failures = 1, .tpm_rc = tpm_rc };
+    tool_rc rc = tpm2_session_broker_run(broker, run_cb, &data);
+    assert_int_equal(rc, tool_rc_general_error);
+
+    /* the failure is passed on as is and the callback is not run twice */
+    assert_int_equal(sessions_flushed, 0);
+    assert_int_equal(sessions_started, 1);
+    assert_int_equal(data.calls, 1);
+}
+
+static void test_tpm2_session_broker_other_error(void **state) {
+
+    test_not_evicted(state, TPM2_RC_AUTH_FAIL | TPM2_RC_S | TPM2_RC_1);
+}
+
+static void test_tpm2_session_broker_object_handle(void **state) {
+
+    /* TPM2_RC_HANDLE on an object handle leaves the session alone */
+    test_not_evicted(state, TPM2_RC_HANDLE | TPM2_RC_H | TPM2_RC_1);
+}
+
+static void test_tpm2_session_broker_tool_error(void **state) {
+
+    /* a failure before any TPM command */
+    test_not_evicted(state, TPM2_RC_SUCCESS);
+}
+
+static void test_tpm2_session_broker_no_salt_key(void **state) {
+    UNUSED(state);
+
+    tpm2_session_broker *broker = NULL;
+    tool_rc rc = tpm2_session_broker_new(ESAPI_CONTEXT, ESYS_TR_NONE, NULL,
+            &broker);
+    assert_int_equal(rc, tool_rc_general_error);
+    assert_null(broker);
+}
+
+/* link required symbol, but tpm2_tool.c declares it AND main, which
+ * we have a main below for cmocka tests.
+ */
+bool output_enabled = true;
+
+int main(int argc, char *argv[]) {
+    UNUSED(argc);
+    UNUSED(argv);
+
+    const struct CMUnitTest tests[] = {
+        cmocka_unit_test_setup_teardown(test_tpm2_session_broker_reuse,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_tpm2_session_broker_evicted,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(
+                test_tpm2_session_broker_evicted_handle,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(
+                test_tpm2_session_broker_evicted_resmgr,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_tpm2_session_broker_other_error,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(
+                test_tpm2_session_broker_object_handle,
+                test_setup, test_teardown),
+        cmocka_unit_test_setup_teardown(test_tpm2_session_broker_tool_error,
+                test_setup, test_teardown),
+        cmocka_unit_test(test_tpm2_session_broker_no_salt_key),
+    };
+
+    return cmocka_run_group_tests(tests, NULL, NULL);
+}
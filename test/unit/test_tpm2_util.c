@@ -173,6 +173,24 @@ static void test_tpm2_util_handle_from_optarg_nv_invalid_offset(void **state) {
     assert_false(result);
 }
 
+static void test_tpm2_util_elapsed_us(void **state) {
+    UNUSED(state);
+
+    struct timespec start = { .tv_sec = 1, .tv_nsec = 500000 };
+    struct timespec end = { .tv_sec = 1, .tv_nsec = 750999 };
+    assert_int_equal(tpm2_util_elapsed_us(&start, &end), 250);
+
+    end = (struct timespec) { .tv_sec = 3, .tv_nsec = 500000 };
+    assert_int_equal(tpm2_util_elapsed_us(&start, &end), 2000000);
+
+    /* the nanoseconds of the end are below those of the start */
+    start = (struct timespec) { .tv_sec = 1, .tv_nsec = 999999000 };
+    end = (struct timespec) { .tv_sec = 2, .tv_nsec = 1000 };
+    assert_int_equal(tpm2_util_elapsed_us(&start, &end), 2);
+
+    assert_int_equal(tpm2_util_elapsed_us(&start, &start), 0);
+}
+
 /* link required symbol, but tpm2_tool.c declares it AND main, which
  * we have a main below for cmocka tests.
  */
@@ -192,6 +210,7 @@ int main(int argc, char* argv[]) {
         cmocka_unit_test(test_tpm2_util_handle_from_optarg_valid_ids_enabled),
         cmocka_unit_test(test_tpm2_util_handle_from_optarg_nv_valid_range),
         cmocka_unit_test(test_tpm2_util_handle_from_optarg_nv_invalid_offset),
+        cmocka_unit_test(test_tpm2_util_elapsed_us),
     };
 
     return cmocka_run_group_tests(tests, NULL, NULL);
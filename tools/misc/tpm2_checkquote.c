@@ -5,13 +5,21 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <openssl/pem.h>
+#include <tss2/tss2_mu.h>
+
 #include "files.h"
 #include "log.h"
 #include "object.h"
+#include "pcr.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_attest_bundle.h"
 #include "tpm2_convert.h"
+#include "tpm2_merkle.h"
 #include "tpm2_openssl.h"
 #include "tpm2_options.h"
+#include "tpm2_pcr_index.h"
+#include "tpm2_tool.h"
 
 typedef struct tpm2_verifysig_ctx tpm2_verifysig_ctx;
 struct tpm2_verifysig_ctx {
@@ -34,11 +42,16 @@ struct tpm2_verifysig_ctx {
     TPM2B_DIGEST quoteHash;
     TPM2B_DATA quoteExtraData;
     TPM2B_DATA extraData;
+    TPML_PCR_SELECTION quotePcrSelect;
     TPMT_SIGNATURE signature;
     char *msg_file_path;
     char *sig_file_path;
     char *out_file_path;
     char *pcr_file_path;
+    const char *proof_file_path;
+    const char *pcr_index_path;
+    const char *bundle_path;
+    tpm2_pcr_index *pcr_index;
     const char *pubkey_file_path;
     tpm2_loaded_object key_context_object;
 };
@@ -53,6 +66,79 @@ static tpm2_verifysig_ctx ctx = {
         .extraData = TPM2B_TYPE_INIT(TPM2B_DATA, buffer),
 };
 
+/*
+ * tpm2_quote builds the batch tree with the hash algorithm it signs with,
+ * a proof is only accepted with that algorithm so it cannot pick its own.
+ */
+static bool verify_batch_nonce(TPMI_ALG_HASH halg) {
+
+    tpm2_merkle_proof proof;
+    bool result = tpm2_merkle_proof_load(ctx.proof_file_path, &proof);
+    if (!result) {
+        return false;
+    }
+
+    if (proof.halg != halg) {
+        LOG_ERR("The proof uses hash algorithm %s, the quote is signed with"
+                " %s", tpm2_alg_util_algtostr(proof.halg,
+                        tpm2_alg_util_flags_hash),
+                tpm2_alg_util_algtostr(halg, tpm2_alg_util_flags_hash));
+        return false;
+    }
+
+    TPM2B_DIGEST leaf;
+    result = tpm2_merkle_leaf_hash(proof.halg, ctx.extraData.buffer,
+            ctx.extraData.size, &leaf);
+    if (!result) {
+        return false;
+    }
+
+    /* with a batch quote the extra data is the root over all the nonces */
+    TPM2B_DIGEST root = { .size = ctx.quoteExtraData.size };
+    if (root.size > sizeof(root.buffer)) {
+        return false;
+    }
+    memcpy(root.buffer, ctx.quoteExtraData.buffer, root.size);
+
+    return tpm2_merkle_proof_verify(&leaf, &proof, &root);
+}
+
+static bool attest_from_quote(const TPM2B_ATTEST *msg, TPMS_ATTEST *attest) {
+
+    size_t offset = 0;
+    TSS2_RC rc = Tss2_MU_TPMS_ATTEST_Unmarshal(msg->attestationData,
+            msg->size, &offset, attest);
+    if (rc != TSS2_RC_SUCCESS) {
+        LOG_PERR(Tss2_MU_TPMS_ATTEST_Unmarshal, rc);
+        return false;
+    }
+
+    if (attest->type != TPM2_ST_ATTEST_QUOTE) {
+        LOG_ERR("The message is not a quote, got type: 0x%x", attest->type);
+        return false;
+    }
+
+    return true;
+}
+
+static bool pcr_select_from_quote(TPM2B_ATTEST *msg) {
+
+    TPMS_ATTEST attest;
+    bool result = attest_from_quote(msg, &attest);
+    if (result) {
+        ctx.quotePcrSelect = attest.attested.quote.pcrSelect;
+    }
+
+    return result;
+}
+
+static bool verify_nonce(const TPM2B_DATA *quoteExtraData) {
+
+    return quoteExtraData->size == ctx.extraData.size
+            && !memcmp(quoteExtraData->buffer, ctx.extraData.buffer,
+                    ctx.extraData.size);
+}
+
 static bool verify_signature() {
 
     bool result = false;
@@ -86,12 +172,14 @@ static bool verify_signature() {
         goto err;
     }
 
-    // Ensure nonce is the same as given
-    if (ctx.flags.extra) {
-        if (
-            ctx.quoteExtraData.size != ctx.extraData.size
-            || memcmp(ctx.quoteExtraData.buffer, ctx.extraData.buffer, ctx.extraData.size) != 0
-        ) {
+    // Ensure nonce is the same as given, or part of the batch quoted
+    if (ctx.proof_file_path) {
+        if (!verify_batch_nonce(ctx.signature.signature.rsassa.hash)) {
+            LOG_ERR("Error validating nonce against the batch root in the quote");
+            goto err;
+        }
+    } else if (ctx.flags.extra) {
+        if (!verify_nonce(&ctx.quoteExtraData)) {
             LOG_ERR("Error validating nonce from quote");
             goto err;
         }
@@ -103,6 +191,12 @@ static bool verify_signature() {
             LOG_ERR("Error validating PCR composite against signed message");
             goto err;
         }
+    } else if (ctx.pcr_index) {
+        if (!tpm2_pcr_index_lookup(ctx.pcr_index, ctx.halg,
+                &ctx.quotePcrSelect, &ctx.quoteHash)) {
+            LOG_ERR("PCR composite of the quote is not in the known good index");
+            goto err;
+        }
     }
 
     result = true;
@@ -145,64 +239,6 @@ static TPM2B_ATTEST *message_from_file(const char *msg_file_path) {
     return msg;
 }
 
-static bool pcrs_from_file(const char *pcr_file_path,
-        TPML_PCR_SELECTION *pcrSel, tpm2_pcrs *pcrs) {
-
-    bool result = false;
-    unsigned long size;
-
-    if (!files_get_file_size_path(pcr_file_path, &size)) {
-        return false;
-    }
-
-    if (!size) {
-        LOG_ERR("The pcr file \"%s\" is empty", pcr_file_path);
-        return false;
-    }
-
-    FILE *pcr_input = fopen(pcr_file_path, "rb");
-    if (!pcr_input) {
-        LOG_ERR("Could not open PCRs input file \"%s\" error: \"%s\"",
-                pcr_file_path, strerror(errno));
-        goto out;
-    }
-
-    // Import TPML_PCR_SELECTION structure to pcr outfile
-    if (fread(pcrSel, sizeof(TPML_PCR_SELECTION), 1, pcr_input) != 1) {
-        LOG_ERR("Failed to read PCR selection from file");
-        goto out;
-    }
-
-    // Import PCR digests to pcr outfile
-    if (fread(&pcrs->count, sizeof(UINT32), 1, pcr_input) != 1) {
-        LOG_ERR("Failed to read PCR digests header from file");
-        goto out;
-    }
-
-    if (pcrs->count > ARRAY_LEN(pcrs->pcr_values)) {
-        LOG_ERR("Malformed PCR file, pcr count cannot be greater than %zu, got: %zu",
-                ARRAY_LEN(pcrs->pcr_values), pcrs->count);
-        goto out;
-    }
-
-    UINT32 j;
-    for (j = 0; j < pcrs->count; j++) {
-        if (fread(&pcrs->pcr_values[j], sizeof(TPML_DIGEST), 1, pcr_input) != 1) {
-            LOG_ERR("Failed to read PCR digest from file");
-            goto out;
-        }
-    }
-
-    result = true;
-
-out:
-    if (pcr_input) {
-        fclose(pcr_input);
-    }
-
-    return result;
-}
-
 static tool_rc init(void) {
 
     /* check flags for mismatches */
@@ -212,6 +248,16 @@ static tool_rc init(void) {
         return tool_rc_option_error;
     }
 
+    if (ctx.proof_file_path && !ctx.flags.extra) {
+        LOG_ERR("--proof requires the verifier's nonce with -q");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.pcr_index_path && ctx.flags.pcr) {
+        LOG_ERR("Specify one of --pcr (-f) or --pcr-index");
+        return tool_rc_option_error;
+    }
+
     TPM2B_ATTEST *msg = NULL;
     TPML_PCR_SELECTION pcrSel;
     tpm2_pcrs pcrs;
@@ -244,8 +290,8 @@ static tool_rc init(void) {
     }
 
     if (ctx.flags.pcr) {
-        if (!pcrs_from_file(ctx.pcr_file_path, &pcrSel, &pcrs)) {
-            /* pcrs_from_file() logs specific error no need to here */
+        if (!pcr_load_pcr_file(ctx.pcr_file_path, &pcrSel, &pcrs)) {
+            /* pcr_load_pcr_file() logs specific error no need to here */
             goto err;
         }
 
@@ -265,6 +311,10 @@ static tool_rc init(void) {
         goto err;
     }
 
+    if (ctx.pcr_index_path && !pcr_select_from_quote(msg)) {
+        goto err;
+    }
+
     // Figure out the digest for this message
     bool res = tpm2_openssl_hash_compute_data(ctx.halg, msg->attestationData,
         msg->size, &ctx.msgHash);
@@ -281,6 +331,227 @@ err:
 
 }
 
+static EVP_PKEY *load_pinned_ak(void) {
+
+    FILE *f = fopen(ctx.pubkey_file_path, "rb");
+    if (!f) {
+        LOG_ERR("Could not open AK public key file \"%s\" error: \"%s\"",
+                ctx.pubkey_file_path, strerror(errno));
+        return NULL;
+    }
+
+    EVP_PKEY *pkey = PEM_read_PUBKEY(f, NULL, NULL, NULL);
+    fclose(f);
+    if (!pkey) {
+        LOG_ERR("Failed to load AK public key from \"%s\"",
+                ctx.pubkey_file_path);
+    }
+
+    return pkey;
+}
+
+static bool selects_pcrs(const TPML_PCR_SELECTION *selection) {
+
+    UINT32 i;
+    for (i = 0; i < selection->count; i++) {
+        const TPMS_PCR_SELECTION *s = &selection->pcrSelections[i];
+        UINT8 j;
+        for (j = 0; j < s->sizeofSelect && j < sizeof(s->pcrSelect); j++) {
+            if (s->pcrSelect[j]) {
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+/*
+ * The PCR selection of a bundle is not signed, only the one in the quote is,
+ * so a bundle must select what was quoted or its values prove nothing. A
+ * quote of PCRs is only verified when its PCR digest is checked, against
+ * the values in the bundle or against the index.
+ */
+static bool verify_bundle_pcrs(tpm2_attest_bundle *bundle, TPMI_ALG_HASH halg,
+        TPMS_QUOTE_INFO *quote) {
+
+    if ((bundle->fields & TPM2_ATTEST_BUNDLE_PCR_SELECTION)
+            && !pcr_selection_equal(&bundle->pcr_selection,
+                    &quote->pcrSelect)) {
+        LOG_ERR("The PCR selection of the bundle is not the one quoted");
+        return false;
+    }
+
+    if (ctx.pcr_index) {
+        bool result = tpm2_pcr_index_lookup(ctx.pcr_index, halg,
+                &quote->pcrSelect, &quote->pcrDigest);
+        if (!result) {
+            LOG_ERR("PCR composite of the quote is not in the known good index");
+        }
+        return result;
+    }
+
+    if (!(bundle->fields & TPM2_ATTEST_BUNDLE_PCR_VALUES)) {
+        if (selects_pcrs(&quote->pcrSelect)) {
+            LOG_ERR("The quote selects PCRs, but the bundle has no PCR "
+                    "values to check them against, use --pcr-index");
+            return false;
+        }
+        return true;
+    }
+
+    TPM2B_DIGEST pcr_digest = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer);
+    bool result = tpm2_openssl_hash_pcr_banks(halg, &bundle->pcr_selection,
+            &bundle->pcrs, &pcr_digest);
+    if (!result) {
+        LOG_ERR("Failed to hash PCR values related to quote!");
+        return false;
+    }
+
+    result = tpm2_util_verify_digests(&quote->pcrDigest, &pcr_digest);
+    if (!result) {
+        LOG_ERR("Error validating PCR composite against signed message");
+    }
+
+    return result;
+}
+
+/*
+ * A bundle is verified with the AK it carries, which must be the one the
+ * verifier trusts with -u, or anyone could sign a bundle of their own.
+ */
+static bool verify_bundle(tpm2_attest_bundle *bundle, EVP_PKEY *pinned) {
+
+    if (!(bundle->fields & TPM2_ATTEST_BUNDLE_AK_PUBLIC)) {
+        LOG_ERR("The bundle does not carry the AK public");
+        return false;
+    }
+
+    TPMS_ATTEST attest;
+    bool result = attest_from_quote(&bundle->attest, &attest);
+    if (!result) {
+        return false;
+    }
+
+    EVP_PKEY *pkey = tpm2_convert_pubkey_to_evp(&bundle->ak_public.publicArea);
+    if (!pkey) {
+        return false;
+    }
+
+    if (EVP_PKEY_cmp(pkey, pinned) != 1) {
+        LOG_ERR("The AK of the bundle is not the one given with -u");
+        result = false;
+        goto out;
+    }
+
+    /* the quote and its PCR composite are digested with the signing hash */
+    TPMI_ALG_HASH halg = bundle->signature.signature.any.hashAlg;
+    TPM2B_DIGEST digest = TPM2B_TYPE_INIT(TPM2B_DIGEST, buffer);
+    result = tpm2_openssl_hash_compute_data(halg,
+            bundle->attest.attestationData, bundle->attest.size, &digest);
+    if (!result) {
+        LOG_ERR("Compute message hash failed!");
+        goto out;
+    }
+
+    result = tpm2_convert_sig_check_key(&bundle->ak_public.publicArea,
+            &bundle->signature)
+            && tpm2_convert_sig_verify(pkey, &bundle->signature, &digest);
+    if (!result) {
+        LOG_ERR("Error validating signed message with the AK of the bundle");
+        goto out;
+    }
+
+    if (ctx.flags.extra) {
+        result = verify_nonce(&attest.extraData);
+        if (!result) {
+            LOG_ERR("Error validating nonce from quote");
+            goto out;
+        }
+    }
+
+    result = verify_bundle_pcrs(bundle, halg, &attest.attested.quote);
+
+out:
+    EVP_PKEY_free(pkey);
+    return result;
+}
+
+static void print_bundle(UINT32 index, tpm2_attest_bundle *bundle,
+        bool verified) {
+
+    tpm2_tool_output("- bundle: %u\n", index);
+    /* the name parsed from the AK public, not a name the bundle claims */
+    if (bundle->fields & TPM2_ATTEST_BUNDLE_AK_PUBLIC) {
+        tpm2_tool_output("  ak-name: ");
+        tpm2_util_hexdump(bundle->ak_name.name, bundle->ak_name.size);
+        tpm2_tool_output("\n");
+    }
+    if (bundle->fields & TPM2_ATTEST_BUNDLE_EVENT_LOG) {
+        tpm2_tool_output("  event-log: %s\n", bundle->event_log);
+    }
+    tpm2_tool_output("  verified: %s\n", verified ? "true" : "false");
+}
+
+/*
+ * Verifies every bundle of a stream in a single pass over the mapped file,
+ * reporting each. A malformed bundle ends the stream.
+ */
+static tool_rc verify_bundles(void) {
+
+    EVP_PKEY *pinned = load_pinned_ak();
+    if (!pinned) {
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tool_rc_general_error;
+    tpm2_attest_bundle *bundle = NULL;
+    bool is_stdin = !strcmp(ctx.bundle_path, "-");
+    tpm2_attest_bundle_stream *stream =
+            tpm2_attest_bundle_stream_open(is_stdin ? NULL : ctx.bundle_path);
+    if (!stream) {
+        goto out;
+    }
+
+    bundle = malloc(sizeof(*bundle));
+    if (!bundle) {
+        LOG_ERR("oom");
+        goto out;
+    }
+
+    bool all_verified = true;
+    UINT32 count = 0;
+    for (;;) {
+        bool done = false;
+        bool result = tpm2_attest_bundle_stream_next(stream, bundle, &done);
+        if (!result) {
+            goto out;
+        }
+
+        if (done) {
+            break;
+        }
+
+        bool verified = verify_bundle(bundle, pinned);
+        print_bundle(count++, bundle, verified);
+        all_verified &= verified;
+    }
+
+    if (!count) {
+        LOG_ERR("No attestation bundles in \"%s\"", ctx.bundle_path);
+        goto out;
+    }
+
+    rc = all_verified ? tool_rc_success : tool_rc_general_error;
+
+out:
+    free(bundle);
+    tpm2_attest_bundle_stream_close(stream);
+    EVP_PKEY_free(pinned);
+
+    return rc;
+}
+
 static bool on_option(char key, char *value) {
 
 	switch (key) {
@@ -327,6 +598,15 @@ static bool on_option(char key, char *value) {
 		ctx.pcr_file_path = value;
 		ctx.flags.pcr = 1;
 		break;
+	case 0:
+		ctx.proof_file_path = value;
+		break;
+	case 1:
+		ctx.pcr_index_path = value;
+		break;
+	case 2:
+		ctx.bundle_path = value;
+		break;
 		/* no default */
 	}
 
@@ -343,6 +623,9 @@ bool tpm2_tool_onstart(tpm2_options **opts) {
             { "pcr",                required_argument, NULL, 'f' },
             { "public",             required_argument, NULL, 'u' },
             { "qualification",      required_argument, NULL, 'q' },
+            { "proof",              required_argument, NULL,  0  },
+            { "pcr-index",          required_argument, NULL,  1  },
+            { "bundle",             required_argument, NULL,  2  },
     };
 
 
@@ -357,6 +640,28 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 	UNUSED(ectx);
 	UNUSED(flags);
 
+    if (ctx.bundle_path && (ctx.flags.msg || ctx.flags.sig || ctx.flags.pcr
+            || ctx.proof_file_path)) {
+        LOG_ERR("--bundle replaces -m, -s, -f and --proof");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.bundle_path && !ctx.pubkey_file_path) {
+        LOG_ERR("--bundle requires the trusted AK public key with -u");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.pcr_index_path) {
+        ctx.pcr_index = tpm2_pcr_index_load(ctx.pcr_index_path);
+        if (!ctx.pcr_index) {
+            return tool_rc_general_error;
+        }
+    }
+
+    if (ctx.bundle_path) {
+        return verify_bundles();
+    }
+
     /* initialize and process */
     tool_rc rc = init();
     if (rc != tool_rc_success) {
@@ -371,3 +676,8 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     return tool_rc_success;
 }
+
+void tpm2_tool_onexit(void) {
+
+    tpm2_pcr_index_free(ctx.pcr_index);
+}
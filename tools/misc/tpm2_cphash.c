@@ -0,0 +1,338 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "files.h"
+#include "log.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_cphash.h"
+#include "tpm2_header.h"
+#include "tpm2_tool.h"
+
+#define LIST_LINE_MAX 4096
+
+typedef struct tpm2_cphash_ctx tpm2_cphash_ctx;
+struct tpm2_cphash_ctx {
+    TPMI_ALG_HASH halg;
+    const char *list_path;
+    const char *out_dir;
+    const char *command_path;
+    const char *name_paths[TPM2_CPHASH_HANDLES_MAX];
+    UINT8 name_count;
+};
+
+static tpm2_cphash_ctx ctx = {
+    .halg = TPM2_ALG_SHA256,
+};
+
+static bool load_command(const char *path, UINT8 *buffer, UINT16 *size) {
+
+    unsigned long file_size = 0;
+    bool result = files_get_file_size_path(path, &file_size);
+    if (!result) {
+        return false;
+    }
+
+    if (file_size > TPM2_MAX_SIZE) {
+        LOG_ERR("Command file \"%s\" of %lu bytes exceeds %u bytes", path,
+                file_size, TPM2_MAX_SIZE);
+        return false;
+    }
+
+    *size = file_size;
+
+    return files_load_bytes_from_path(path, buffer, size);
+}
+
+/*
+ * Names the command's handles, in order. A name file given as "-" or not at
+ * all stands for a handle that is its own name.
+ */
+static bool load_names(tpm2_cphash_command *command, const char **paths,
+        UINT8 path_count, TPM2B_NAME *names) {
+
+    if (path_count > command->handle_count) {
+        LOG_ERR("Got %u names for a command with %u handle(s)", path_count,
+                command->handle_count);
+        return false;
+    }
+
+    UINT8 i;
+    for (i = 0; i < command->handle_count; i++) {
+        const char *path = i < path_count ? paths[i] : NULL;
+        if (path && strcmp(path, "-")) {
+            names[i].size = sizeof(names[i].name);
+            bool result = files_load_bytes_from_path(path, names[i].name,
+                    &names[i].size);
+            if (!result) {
+                return false;
+            }
+            continue;
+        }
+
+        bool result = tpm2_cphash_handle_to_name(command->handles[i],
+                &names[i]);
+        if (!result) {
+            LOG_ERR("Handle 0x%x needs a name file, see tpm2_readpublic -n"
+                    " and tpm2_nvreadpublic", command->handles[i]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool output_name(const char *command_path, const char *suffix,
+        char *path, size_t len) {
+
+    const char *base = strrchr(command_path, '/');
+    base = base ? base + 1 : command_path;
+
+    const char *ext = strrchr(base, '.');
+    int n = ext && ext != base ? (int)(ext - base) : (int)strlen(base);
+
+    int written = snprintf(path, len, "%s/%.*s.%s", ctx.out_dir, n, base,
+            suffix);
+    if (written < 0 || (size_t)written >= len) {
+        LOG_ERR("Output path for \"%s\" is too long", command_path);
+        return false;
+    }
+
+    return true;
+}
+
+static bool save_digest(const char *command_path, const char *suffix,
+        TPM2B_DIGEST *digest) {
+
+    char path[PATH_MAX];
+    bool result = output_name(command_path, suffix, path, sizeof(path));
+    if (!result) {
+        return false;
+    }
+
+    return files_save_bytes_to_file(path, digest->buffer, digest->size);
+}
+
+static void print_digest(const char *label, TPM2B_DIGEST *digest) {
+
+    tpm2_tool_output("  %s: ", label);
+    tpm2_util_hexdump(digest->buffer, digest->size);
+    tpm2_tool_output("\n");
+}
+
+static bool process_command(const char *command_path, const char **name_paths,
+        UINT8 name_count) {
+
+    UINT8 buffer[TPM2_MAX_SIZE];
+    UINT16 size = sizeof(buffer);
+    bool result = load_command(command_path, buffer, &size);
+    if (!result) {
+        return false;
+    }
+
+    tpm2_cphash_command command;
+    result = tpm2_cphash_parse_command(buffer, size, &command);
+    if (!result) {
+        LOG_ERR("Could not parse command file \"%s\"", command_path);
+        return false;
+    }
+
+    TPM2B_NAME names[TPM2_CPHASH_HANDLES_MAX];
+    result = load_names(&command, name_paths, name_count, names);
+    if (!result) {
+        return false;
+    }
+
+    TPM2B_DIGEST cp_hash = TPM2B_EMPTY_INIT;
+    result = tpm2_cphash_compute(ctx.halg, command.command_code, names,
+            command.handle_count, command.parameters, command.parameters_size,
+            &cp_hash);
+    if (!result) {
+        return false;
+    }
+
+    tpm2_tool_output("%s:\n", command_path);
+    tpm2_tool_output("  command-code: 0x%x\n", command.command_code);
+    print_digest("cphash", &cp_hash);
+
+    if (ctx.out_dir) {
+        result = save_digest(command_path, "cphash", &cp_hash);
+        if (!result) {
+            return false;
+        }
+    }
+
+    if (!command.handle_count) {
+        return true;
+    }
+
+    TPM2B_DIGEST name_hash = TPM2B_EMPTY_INIT;
+    result = tpm2_cphash_compute_namehash(ctx.halg, names,
+            command.handle_count, &name_hash);
+    if (!result) {
+        return false;
+    }
+
+    print_digest("namehash", &name_hash);
+
+    if (ctx.out_dir) {
+        result = save_digest(command_path, "namehash", &name_hash);
+    }
+
+    return result;
+}
+
+/*
+ * The list holds one planned command per line, the command file followed by
+ * up to three name files. Blank lines and lines starting with '#' are
+ * ignored.
+ */
+static bool process_list(FILE *f) {
+
+    char line[LIST_LINE_MAX];
+    unsigned lineno = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+
+        if (!strchr(line, '\n') && !feof(f)) {
+            LOG_ERR("%s:%u: Line exceeds %u characters", ctx.list_path,
+                    lineno, LIST_LINE_MAX - 2);
+            return false;
+        }
+
+        char *s = tpm2_util_trim(line);
+        if (!s[0] || s[0] == '#') {
+            continue;
+        }
+
+        char *saveptr = NULL;
+        const char *command_path = strtok_r(s, " \t", &saveptr);
+
+        const char *name_paths[TPM2_CPHASH_HANDLES_MAX];
+        UINT8 name_count = 0;
+        char *token;
+        while ((token = strtok_r(NULL, " \t", &saveptr))) {
+            if (name_count == TPM2_CPHASH_HANDLES_MAX) {
+                LOG_ERR("%s:%u: More than %u names", ctx.list_path, lineno,
+                        TPM2_CPHASH_HANDLES_MAX);
+                return false;
+            }
+            name_paths[name_count++] = token;
+        }
+
+        bool result = process_command(command_path, name_paths, name_count);
+        if (!result) {
+            LOG_ERR("%s:%u: Could not compute cpHash", ctx.list_path, lineno);
+            return false;
+        }
+    }
+
+    if (ferror(f)) {
+        LOG_ERR("Error reading command list \"%s\"", ctx.list_path);
+        return false;
+    }
+
+    return true;
+}
+
+static bool run_list(void) {
+
+    bool is_stdin = !strcmp(ctx.list_path, "-");
+
+    FILE *f = is_stdin ? stdin : fopen(ctx.list_path, "r");
+    if (!f) {
+        LOG_ERR("Could not open command list \"%s\", error: %s",
+                ctx.list_path, strerror(errno));
+        return false;
+    }
+
+    bool result = process_list(f);
+
+    if (!is_stdin) {
+        fclose(f);
+    }
+
+    return result;
+}
+
+static bool on_option(char key, char *value) {
+
+    switch (key) {
+    case 'g':
+        ctx.halg = tpm2_alg_util_from_optarg(value, tpm2_alg_util_flags_hash);
+        if (ctx.halg == TPM2_ALG_ERROR) {
+            LOG_ERR("Invalid choice for cpHash hash algorithm");
+            return false;
+        }
+        break;
+    case 'n':
+        if (ctx.name_count == TPM2_CPHASH_HANDLES_MAX) {
+            LOG_ERR("Commands have at most %u handles",
+                    TPM2_CPHASH_HANDLES_MAX);
+            return false;
+        }
+        ctx.name_paths[ctx.name_count++] = value;
+        break;
+    case 'l':
+        ctx.list_path = value;
+        break;
+    case 'o':
+        ctx.out_dir = value;
+        break;
+    }
+
+    return true;
+}
+
+static bool on_arg(int argc, char **argv) {
+
+    if (argc != 1) {
+        LOG_ERR("Specify a single command file, got %d", argc);
+        return false;
+    }
+
+    ctx.command_path = argv[0];
+
+    return true;
+}
+
+bool tpm2_tool_onstart(tpm2_options **opts) {
+
+    static struct option topts[] = {
+        { "hash-algorithm", required_argument, NULL, 'g' },
+        { "name",           required_argument, NULL, 'n' },
+        { "list",           required_argument, NULL, 'l' },
+        { "output",         required_argument, NULL, 'o' },
+    };
+
+    *opts = tpm2_options_new("g:n:l:o:", ARRAY_LEN(topts), topts, on_option,
+            on_arg, TPM2_OPTIONS_NO_SAPI);
+
+    return *opts != NULL;
+}
+
+tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
+    UNUSED(ectx);
+    UNUSED(flags);
+
+    if (!!ctx.command_path == !!ctx.list_path) {
+        LOG_ERR("Specify either a command file or a command list with -l");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.list_path && ctx.name_count) {
+        LOG_ERR("Names for listed commands are given in the list");
+        return tool_rc_option_error;
+    }
+
+    bool result = ctx.list_path ? run_list() :
+            process_command(ctx.command_path, ctx.name_paths, ctx.name_count);
+
+    return result ? tool_rc_success : tool_rc_general_error;
+}
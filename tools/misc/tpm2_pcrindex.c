@@ -0,0 +1,341 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "pcr.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_openssl.h"
+#include "tpm2_pcr_index.h"
+#include "tpm2_tool.h"
+
+/* the most worker processes hashing golden PCR files */
+#define PCRINDEX_JOBS_MAX 64
+
+typedef struct tpm2_pcrindex_ctx tpm2_pcrindex_ctx;
+struct tpm2_pcrindex_ctx {
+    TPMI_ALG_HASH halg;
+    const char *out_path;
+    UINT32 jobs;
+    char **pcr_paths;
+    UINT32 pcr_count;
+};
+
+static tpm2_pcrindex_ctx ctx = {
+    .halg = TPM2_ALG_SHA256,
+};
+
+/*
+ * What a worker reports for a golden PCR file. A record is well under
+ * PIPE_BUF, so it is written to and read from the pipe whole.
+ */
+typedef struct golden_record golden_record;
+struct golden_record {
+    UINT32 index;
+    TPML_PCR_SELECTION selection;
+    TPM2B_DIGEST digest;
+};
+
+typedef struct golden golden;
+struct golden {
+    bool done;
+    TPML_PCR_SELECTION selection;
+    TPM2B_DIGEST digest;
+};
+
+static bool hash_golden(UINT32 index, golden_record *record) {
+
+    tpm2_pcrs pcrs;
+    record->index = index;
+    bool result = pcr_load_pcr_file(ctx.pcr_paths[index], &record->selection,
+            &pcrs);
+    if (!result) {
+        return false;
+    }
+
+    record->digest.size = sizeof(record->digest.buffer);
+    result = tpm2_openssl_hash_pcr_banks(ctx.halg, &record->selection, &pcrs,
+            &record->digest);
+    if (!result) {
+        LOG_ERR("Could not hash the PCR values of \"%s\"",
+                ctx.pcr_paths[index]);
+    }
+
+    return result;
+}
+
+/* a worker hashes every jobs-th file from its first and never returns */
+static void run_worker(UINT32 first, int fd) {
+
+    UINT32 i;
+    for (i = first; i < ctx.pcr_count; i += ctx.jobs) {
+        golden_record record;
+        bool result = hash_golden(i, &record);
+        if (!result) {
+            _exit(1);
+        }
+
+        ssize_t written = write(fd, &record, sizeof(record));
+        if (written != sizeof(record)) {
+            LOG_ERR("Could not report to the parent, error: %s",
+                    strerror(errno));
+            _exit(1);
+        }
+    }
+
+    _exit(0);
+}
+
+static bool collect(struct pollfd *fds, UINT32 jobs, golden *goldens) {
+
+    UINT32 remaining = jobs;
+    while (remaining) {
+        int ready = poll(fds, jobs, -1);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERR("Error waiting for workers, error: %s", strerror(errno));
+            return false;
+        }
+
+        UINT32 i;
+        for (i = 0; i < jobs; i++) {
+            if (fds[i].fd < 0 || !fds[i].revents) {
+                continue;
+            }
+
+            golden_record record;
+            ssize_t got = read(fds[i].fd, &record, sizeof(record));
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+
+            if (!got) {
+                close(fds[i].fd);
+                fds[i].fd = -1;
+                remaining--;
+                continue;
+            }
+
+            if (got != sizeof(record) || record.index >= ctx.pcr_count) {
+                LOG_ERR("Malformed report from a worker");
+                return false;
+            }
+
+            goldens[record.index].done = true;
+            goldens[record.index].selection = record.selection;
+            goldens[record.index].digest = record.digest;
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Golden files are spread over worker processes, each hashing its share and
+ * reporting back over a pipe, so large sets of golden files are hashed on
+ * every CPU.
+ */
+static bool hash_goldens(golden *goldens) {
+
+    UINT32 jobs = ctx.jobs;
+    pid_t pids[PCRINDEX_JOBS_MAX];
+    struct pollfd fds[PCRINDEX_JOBS_MAX];
+    UINT32 started = 0;
+    bool result = true;
+
+    /* nothing buffered may be written twice by the workers */
+    fflush(NULL);
+
+    for (started = 0; started < jobs; started++) {
+        int fd[2];
+        if (pipe(fd)) {
+            LOG_ERR("Could not create pipe, error: %s", strerror(errno));
+            result = false;
+            break;
+        }
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            LOG_ERR("Could not fork worker, error: %s", strerror(errno));
+            close(fd[0]);
+            close(fd[1]);
+            result = false;
+            break;
+        }
+
+        if (!pid) {
+            UINT32 i;
+            for (i = 0; i < started; i++) {
+                close(fds[i].fd);
+            }
+            close(fd[0]);
+            run_worker(started, fd[1]);
+        }
+
+        close(fd[1]);
+        pids[started] = pid;
+        fds[started].fd = fd[0];
+        fds[started].events = POLLIN;
+    }
+
+    if (result) {
+        result = collect(fds, started, goldens);
+    }
+
+    UINT32 i;
+    for (i = 0; i < started; i++) {
+        if (fds[i].fd >= 0) {
+            close(fds[i].fd);
+        }
+
+        int status = 0;
+        while (waitpid(pids[i], &status, 0) < 0) {
+            if (errno != EINTR) {
+                break;
+            }
+        }
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+            result = false;
+        }
+    }
+
+    for (i = 0; result && i < ctx.pcr_count; i++) {
+        if (!goldens[i].done) {
+            LOG_ERR("No digest for \"%s\"", ctx.pcr_paths[i]);
+            result = false;
+        }
+    }
+
+    return result;
+}
+
+static bool build_index(void) {
+
+    golden *goldens = calloc(ctx.pcr_count, sizeof(*goldens));
+    if (!goldens) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    tpm2_pcr_index *index = NULL;
+    bool result = hash_goldens(goldens);
+    if (!result) {
+        goto out;
+    }
+
+    index = tpm2_pcr_index_new();
+    if (!index) {
+        result = false;
+        goto out;
+    }
+
+    tpm2_tool_output("golden:\n");
+
+    UINT32 i;
+    for (i = 0; i < ctx.pcr_count; i++) {
+        result = tpm2_pcr_index_add(index, ctx.halg, &goldens[i].selection,
+                &goldens[i].digest);
+        if (!result) {
+            goto out;
+        }
+
+        tpm2_tool_output("  - file: %s\n", ctx.pcr_paths[i]);
+        tpm2_tool_output("    digest: ");
+        tpm2_util_hexdump(goldens[i].digest.buffer, goldens[i].digest.size);
+        tpm2_tool_output("\n");
+    }
+
+    result = tpm2_pcr_index_save(index, ctx.out_path);
+    if (result) {
+        tpm2_tool_output("digests: %u\n", tpm2_pcr_index_count(index));
+    }
+
+out:
+    tpm2_pcr_index_free(index);
+    free(goldens);
+
+    return result;
+}
+
+static bool on_option(char key, char *value) {
+
+    switch (key) {
+    case 'g':
+        ctx.halg = tpm2_alg_util_from_optarg(value, tpm2_alg_util_flags_hash);
+        if (ctx.halg == TPM2_ALG_ERROR) {
+            LOG_ERR("Invalid choice for PCR composite hash algorithm");
+            return false;
+        }
+        break;
+    case 'o':
+        ctx.out_path = value;
+        break;
+    case 'j': {
+        bool result = tpm2_util_string_to_uint32(value, &ctx.jobs);
+        if (!result || !ctx.jobs || ctx.jobs > PCRINDEX_JOBS_MAX) {
+            LOG_ERR("Jobs must be between 1 and %u, got: \"%s\"",
+                    PCRINDEX_JOBS_MAX, value);
+            return false;
+        }
+    }
+        break;
+    }
+
+    return true;
+}
+
+static bool on_arg(int argc, char **argv) {
+
+    ctx.pcr_paths = argv;
+    ctx.pcr_count = argc;
+
+    return true;
+}
+
+bool tpm2_tool_onstart(tpm2_options **opts) {
+
+    static struct option topts[] = {
+        { "hash-algorithm", required_argument, NULL, 'g' },
+        { "output",         required_argument, NULL, 'o' },
+        { "jobs",           required_argument, NULL, 'j' },
+    };
+
+    *opts = tpm2_options_new("g:o:j:", ARRAY_LEN(topts), topts, on_option,
+            on_arg, TPM2_OPTIONS_NO_SAPI);
+
+    return *opts != NULL;
+}
+
+tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
+    UNUSED(ectx);
+    UNUSED(flags);
+
+    if (!ctx.out_path || !ctx.pcr_count) {
+        LOG_ERR("Specify the index with -o and at least one golden PCR file");
+        return tool_rc_option_error;
+    }
+
+    if (!ctx.jobs) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        ctx.jobs = cpus < 1 ? 1 :
+                cpus > PCRINDEX_JOBS_MAX ? PCRINDEX_JOBS_MAX : cpus;
+    }
+
+    if (ctx.jobs > ctx.pcr_count) {
+        ctx.jobs = ctx.pcr_count;
+    }
+
+    bool result = build_index();
+
+    return result ? tool_rc_success : tool_rc_general_error;
+}
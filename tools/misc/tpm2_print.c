@@ -3,17 +3,21 @@
 #include <inttypes.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #include "files.h"
 #include "log.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_attest_bundle.h"
+#include "tpm2_convert.h"
 #include "tpm2_tool.h"
 
 typedef enum {
     file_type_unknown = 0,
     file_type_TPMS_ATTEST,
     file_type_TPMS_CONTEXT,
+    file_type_ATTEST_BUNDLE,
 } file_type_id;
 
 typedef struct tpm2_print_ctx tpm2_print_ctx;
@@ -315,6 +319,105 @@ out:
     return result;
 }
 
+static bool print_attest_bundle_yaml(tpm2_attest_bundle *bundle) {
+
+    FILE *fd = fmemopen(bundle->attest.attestationData, bundle->attest.size,
+            "rb");
+    if (!fd) {
+        LOG_ERR("Could not open the attestation of the bundle");
+        return false;
+    }
+
+    bool res = print_TPMS_ATTEST_yaml(fd);
+    fclose(fd);
+    if (!res) {
+        return false;
+    }
+
+    UINT16 size;
+    BYTE *sig = tpm2_convert_sig(&size, &bundle->signature);
+    if (!sig) {
+        return false;
+    }
+    tpm2_tool_output("signature:\n");
+    tpm2_tool_output("  alg: %s\n", tpm2_alg_util_algtostr(
+            bundle->signature.sigAlg, tpm2_alg_util_flags_sig));
+    tpm2_tool_output("  sig: ");
+    tpm2_util_hexdump(sig, size);
+    tpm2_tool_output("\n");
+    free(sig);
+
+    if (bundle->fields & TPM2_ATTEST_BUNDLE_PCR_VALUES) {
+        res = pcr_print_pcr_struct(&bundle->pcr_selection, &bundle->pcrs);
+        if (!res) {
+            return false;
+        }
+    }
+
+    if (bundle->fields & TPM2_ATTEST_BUNDLE_AK_PUBLIC) {
+        tpm2_tool_output("ak-public:\n");
+        tpm2_util_public_to_yaml(&bundle->ak_public, "  ");
+    }
+
+    /* computed from the AK public, a name alone is not to be trusted */
+    if (bundle->fields & TPM2_ATTEST_BUNDLE_AK_PUBLIC) {
+        tpm2_tool_output("ak-name: ");
+        tpm2_util_hexdump(bundle->ak_name.name, bundle->ak_name.size);
+        tpm2_tool_output("\n");
+    }
+
+    if (bundle->fields & TPM2_ATTEST_BUNDLE_EVENT_LOG) {
+        tpm2_tool_output("event-log: %s\n", bundle->event_log);
+    }
+
+    return true;
+}
+
+/* every bundle of a stream is printed as a YAML document of its own */
+static bool print_attest_bundles(const char *path) {
+
+    tpm2_attest_bundle_stream *stream = tpm2_attest_bundle_stream_open(path);
+    if (!stream) {
+        return false;
+    }
+
+    bool res = false;
+    tpm2_attest_bundle *bundle = malloc(sizeof(*bundle));
+    if (!bundle) {
+        LOG_ERR("oom");
+        goto out;
+    }
+
+    UINT32 count = 0;
+    for (;;) {
+        bool done = false;
+        res = tpm2_attest_bundle_stream_next(stream, bundle, &done);
+        if (!res || done) {
+            break;
+        }
+
+        if (count++) {
+            tpm2_tool_output("---\n");
+        }
+
+        res = print_attest_bundle_yaml(bundle);
+        if (!res) {
+            break;
+        }
+    }
+
+    if (res && !count) {
+        LOG_ERR("No attestation bundles to print");
+        res = false;
+    }
+
+out:
+    free(bundle);
+    tpm2_attest_bundle_stream_close(stream);
+
+    return res;
+}
+
 static bool on_option(char key, char *value) {
     switch (key) {
     case 't':
@@ -323,9 +426,11 @@ static bool on_option(char key, char *value) {
 
         } else if (strcmp(value, "TPMS_CONTEXT") == 0) {
             ctx.file.type = file_type_TPMS_CONTEXT;
+        } else if (strcmp(value, "ATTEST_BUNDLE") == 0) {
+            ctx.file.type = file_type_ATTEST_BUNDLE;
         } else {
-            LOG_ERR("Invalid type specified. Only TPMS_ATTEST and TPMS_CONTEXT "
-                    "are presently supported.");
+            LOG_ERR("Invalid type specified. Only TPMS_ATTEST, TPMS_CONTEXT "
+                    "and ATTEST_BUNDLE are presently supported.");
             return false;
         }
         break;
@@ -376,6 +481,10 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
     case file_type_TPMS_CONTEXT:
         print_fn = print_TPMS_CONTEXT_yaml;
         break;
+    case file_type_ATTEST_BUNDLE:
+        /* bundles are mapped rather than read through a stream */
+        return print_attest_bundles(ctx.file.path) ?
+                tool_rc_success : tool_rc_general_error;
     default:
         LOG_ERR("Must specify a file type with -t option");
         return tool_rc_option_error;
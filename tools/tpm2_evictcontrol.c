@@ -100,6 +100,7 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     tool_rc rc = tool_rc_general_error;
     bool evicted = false;
+    ESYS_TR out_tr = ESYS_TR_NONE;
 
     tool_rc tmp_rc = tpm2_util_object_load(ectx, ctx.to_persist_key.ctx_path,
                 &ctx.to_persist_key.object, TPM2_HANDLE_ALL_W_NV);
@@ -113,30 +114,33 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         ctx.flags.p = 1;
     }
 
+    rc = tpm2_util_object_load_auth(ectx, ctx.auth_hierarchy.ctx_path,
+        ctx.auth_hierarchy.auth_str, &ctx.auth_hierarchy.object, false,
+        TPM2_HANDLE_FLAGS_O|TPM2_HANDLE_FLAGS_P);
+    if (rc != tool_rc_success) {
+        goto out;
+    }
+
     /* If we've been given a handle or context object to persist and not an
      * explicit persistent handle to use, find an available vacant handle in
-     * the persistent namespace and use that.
+     * the persistent namespace of the authorizing hierarchy and use that.
      */
     if (ctx.flags.c && !ctx.flags.p) {
-        tmp_rc = tpm2_capability_find_vacant_persistent_handle(ectx,
-                    &ctx.persist_handle);
-        if (tmp_rc != tool_rc_success) {
-            rc = tmp_rc;
+        rc = tpm2_capability_find_vacant_persistent_handle(ectx,
+                    ctx.auth_hierarchy.object.handle, &ctx.persist_handle);
+        if (rc != tool_rc_success) {
             goto out;
         }
         /* we searched and found a persistent handle, so mark that peristent handle valid */
         ctx.flags.p = 1;
     }
 
-    rc = tpm2_util_object_load_auth(ectx, ctx.auth_hierarchy.ctx_path,
-        ctx.auth_hierarchy.auth_str, &ctx.auth_hierarchy.object, false,
-        TPM2_HANDLE_FLAGS_O|TPM2_HANDLE_FLAGS_P);
     if (ctx.flags.o && !ctx.flags.p) {
         LOG_ERR("Cannot specify -o without using a persistent handle");
+        rc = tool_rc_general_error;
         goto out;
     }
 
-    ESYS_TR out_tr;
     rc = tpm2_evictcontrol(ectx, &ctx.auth_hierarchy.object,
         &ctx.to_persist_key.object, ctx.persist_handle, &out_tr);
     if (rc != tool_rc_success) {
@@ -159,7 +163,7 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
 out:
 
-    if (!evicted) {
+    if (!evicted && out_tr != ESYS_TR_NONE) {
         TSS2_RC rval = Esys_TR_Close(ectx, &out_tr);
         if (rval != TPM2_RC_SUCCESS) {
             LOG_PERR(Esys_TR_Close, rc);
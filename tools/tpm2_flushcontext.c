@@ -1,14 +1,18 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <inttypes.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "log.h"
 #include "object.h"
 #include "tpm2_capability.h"
+#include "tpm2_header.h"
 #include "tpm2_options.h"
 
 struct tpm_flush_context_ctx {
     TPM2_HANDLE property;
+    bool all;
     char *context_arg;
     unsigned encountered_option;
 };
@@ -29,27 +33,120 @@ static const char *get_property_name(TPM2_HANDLE handle) {
     return "invalid";
 }
 
+/*
+ * Issues a raw TPM2_FlushContext over the TCTI backing the ESAPI context.
+ * FlushContext carries no authorization and needs no object name, so going
+ * through an ESYS_TR would only add a TR_FromTPMPublic round trip per handle.
+ */
+static tool_rc flush_context_raw(TSS2_TCTI_CONTEXT *tcti, TPM2_HANDLE handle) {
+
+    UINT8 cmd[TPM2_COMMAND_HEADER_SIZE + sizeof(TPM2_HANDLE)];
+    tpm2_command_header *c = tpm2_command_header_from_bytes(cmd);
+    c->tag = tpm2_util_hton_16(TPM2_ST_NO_SESSIONS);
+    c->size = tpm2_util_hton_32(sizeof(cmd));
+    c->command_code = tpm2_util_hton_32(TPM2_CC_FlushContext);
+
+    UINT32 be_handle = tpm2_util_hton_32(handle);
+    memcpy(c->data, &be_handle, sizeof(be_handle));
+
+    TSS2_RC rval = Tss2_Tcti_Transmit(tcti, sizeof(cmd), cmd);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Tss2_Tcti_Transmit, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    UINT8 rbuf[TPM2_RESPONSE_HEADER_SIZE];
+    size_t rsize = sizeof(rbuf);
+    rval = Tss2_Tcti_Receive(tcti, &rsize, rbuf, TSS2_TCTI_TIMEOUT_BLOCK);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Tss2_Tcti_Receive, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    if (rsize < TPM2_RESPONSE_HEADER_SIZE) {
+        LOG_ERR("Short FlushContext response of %zu bytes", rsize);
+        return tool_rc_general_error;
+    }
+
+    tpm2_response_header *r = tpm2_response_header_from_bytes(rbuf);
+    rval = tpm2_response_header_get_code(r);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(TPM2_FlushContext, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
 static tool_rc flush_contexts_tpm2(ESYS_CONTEXT *ectx, TPM2_HANDLE handles[],
                           UINT32 count) {
 
-    UINT32 i;
+    TSS2_TCTI_CONTEXT *tcti;
+    TSS2_RC rval = Esys_GetTcti(ectx, &tcti);
+    if (rval != TPM2_RC_SUCCESS) {
+        LOG_PERR(Esys_GetTcti, rval);
+        return tool_rc_from_tpm(rval);
+    }
 
+    /*
+     * Keep going on failure, a handle may have been flushed by someone else
+     * in the meantime and the rest still needs cleaning up.
+     */
+    tool_rc rc = tool_rc_success;
+    UINT32 i;
     for (i = 0; i < count; ++i) {
 
-        ESYS_TR handle;
-        tool_rc rc = tpm2_util_sys_handle_to_esys_handle(ectx, handles[i],
-                    &handle);
+        tool_rc tmp_rc = flush_context_raw(tcti, handles[i]);
+        if (tmp_rc != tool_rc_success) {
+            LOG_ERR("Failed Flush Context for %s handle 0x%x",
+                    get_property_name(handles[i]), handles[i]);
+            rc = tmp_rc;
+        }
+    }
+
+    return rc;
+}
+
+static tool_rc get_handles(ESYS_CONTEXT *ectx, const TPM2_HANDLE properties[],
+        size_t len, TPM2_HANDLE **handles, UINT32 *count) {
+
+    *handles = NULL;
+    *count = 0;
+
+    size_t i;
+    for (i = 0; i < len; i++) {
+
+        TPMS_CAPABILITY_DATA *capability_data;
+        tool_rc rc = tpm2_capability_get(ectx, TPM2_CAP_HANDLES,
+                properties[i], TPM2_MAX_CAP_HANDLES, &capability_data);
         if (rc != tool_rc_success) {
+            free(*handles);
+            *handles = NULL;
             return rc;
         }
 
-        TPM2_RC rval = Esys_FlushContext(ectx, handle);
-        if (rval != TPM2_RC_SUCCESS) {
-            LOG_ERR("Failed Flush Context for %s handle 0x%x",
-                    get_property_name(handles[i]), handles[i]);
-            LOG_PERR(Esys_FlushContext, rval);
-            return tool_rc_from_tpm(rval);
+        TPML_HANDLE *found = &capability_data->data.handles;
+        if (!found->count) {
+            free(capability_data);
+            continue;
+        }
+
+        TPM2_HANDLE *tmp = realloc(*handles,
+                (*count + found->count) * sizeof(TPM2_HANDLE));
+        if (!tmp) {
+            LOG_ERR("oom");
+            free(capability_data);
+            free(*handles);
+            *handles = NULL;
+            return tool_rc_general_error;
         }
+        *handles = tmp;
+
+        memcpy(&tmp[*count], found->handle,
+                found->count * sizeof(TPM2_HANDLE));
+        *count += found->count;
+
+        free(capability_data);
     }
 
     return tool_rc_success;
@@ -75,7 +172,7 @@ static bool on_option(char key, char *value) {
     UNUSED(value);
 
     if (ctx.encountered_option) {
-        LOG_ERR("Options -t, -l and -s are mutually exclusive");
+        LOG_ERR("Options -t, -l, -s and -a are mutually exclusive");
         return false;
     }
 
@@ -91,6 +188,9 @@ static bool on_option(char key, char *value) {
     case 's':
         ctx.property = TPM2_ACTIVE_SESSION_FIRST;
         break;
+    case 'a':
+        ctx.all = true;
+        break;
     }
 
     return true;
@@ -114,9 +214,10 @@ bool tpm2_tool_onstart(tpm2_options **opts) {
         { "transient-object", no_argument,        NULL, 't' },
         { "loaded-session",   no_argument,        NULL, 'l' },
         { "saved-session",    no_argument,        NULL, 's' },
+        { "all",              no_argument,        NULL, 'a' },
     };
 
-    *opts = tpm2_options_new("tls", ARRAY_LEN(topts), topts,
+    *opts = tpm2_options_new("tlsa", ARRAY_LEN(topts), topts,
                              on_option, on_arg, 0);
 
     return *opts != NULL;
@@ -126,18 +227,27 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
-    if (ctx.property) {
-        TPMS_CAPABILITY_DATA *capability_data;
-        tool_rc rc = tpm2_capability_get(ectx, TPM2_CAP_HANDLES, ctx.property,
-                TPM2_MAX_CAP_HANDLES, &capability_data);
+    if (ctx.property || ctx.all) {
+        static const TPM2_HANDLE all[] = {
+            TPM2_TRANSIENT_FIRST,
+            TPM2_LOADED_SESSION_FIRST,
+            TPM2_ACTIVE_SESSION_FIRST,
+        };
+
+        const TPM2_HANDLE *properties = ctx.all ? all : &ctx.property;
+        size_t len = ctx.all ? ARRAY_LEN(all) : 1;
+
+        TPM2_HANDLE *handles;
+        UINT32 count;
+        tool_rc rc = get_handles(ectx, properties, len, &handles, &count);
         if (rc != tool_rc_success) {
             return rc;
         }
 
-        TPML_HANDLE *handles = &capability_data->data.handles;
-        rc = flush_contexts_tpm2(ectx, handles->handle,
-                                    handles->count);
-        free(capability_data);
+        LOG_INFO("Flushing %"PRIu32" handles", count);
+
+        rc = flush_contexts_tpm2(ectx, handles, count);
+        free(handles);
         return rc;
     }
 
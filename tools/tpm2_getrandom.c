@@ -1,23 +1,45 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <inttypes.h>
+#include <signal.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__linux__)
+#include <linux/random.h>
+#endif
 
 #include "files.h"
 #include "log.h"
 #include "tpm2_capability.h"
+#include "tpm2_entropy.h"
 #include "tpm2_tool.h"
 
+/* Spec enforce StirRandom input data to be not longer than 128 bytes */
+#define STIR_SIZE 128
+
 typedef struct tpm_random_ctx tpm_random_ctx;
 struct tpm_random_ctx {
     char *output_file;
     UINT16 num_of_bytes;
     bool force;
     bool hex;
+
+    /* entropy feed */
+    struct {
+        const char *path;
+        UINT32 rate;
+        UINT32 stir_interval;
+        UINT32 count;
+    } feed;
 };
 
 static tpm_random_ctx ctx;
@@ -46,38 +68,345 @@ static tool_rc get_random_and_save(ESYS_CONTEXT *ectx) {
     bool res = true;
 
     /*
-     * Either open an output file, or if stdout, do nothing as -Q
-     * was specified.
+     * Without an output file and with -Q specified there is nothing to do.
      */
-    FILE *out = stdout;
+    if (!ctx.output_file && !output_enabled) {
+        goto out;
+    }
+
+    if (!ctx.hex) {
+        /* write straight from the response, random bytes may become keys */
+        files_sink sink;
+        res = files_sink_open(&sink, ctx.output_file, true);
+        if (res) {
+            res = files_sink_write(&sink, random_bytes->buffer,
+                    random_bytes->size) && files_sink_commit(&sink);
+            files_sink_close(&sink);
+        }
+        goto out;
+    }
+
+    FILE *f = stdout;
     if (ctx.output_file) {
-        out = fopen(ctx.output_file, "wb+");
-        if (!out) {
+        f = fopen(ctx.output_file, "wb+");
+        if (!f) {
             LOG_ERR("Could not open output file \"%s\", error: %s",
                     ctx.output_file, strerror(errno));
+            res = false;
             goto out;
         }
-    } else if (!output_enabled) {
-        goto out;
-    }
-
-    if (ctx.hex) {
-        tpm2_util_print_tpm2b2(out, random_bytes);
-        goto out;
     }
 
-    res = files_write_bytes(out, random_bytes->buffer,
-                random_bytes->size);
+    tpm2_util_print_tpm2b2(f, random_bytes);
 
-out:
-    if (out && out != stdout) {
-        fclose(out);
+    if (f != stdout) {
+        fclose(f);
     }
 
+out:
     free(random_bytes);
     return res == true ? tool_rc_success : tool_rc_general_error;
 }
 
+static volatile sig_atomic_t feed_stop;
+
+static void feed_on_signal(int signum) {
+    UNUSED(signum);
+
+    feed_stop = 1;
+}
+
+typedef struct feed_sink feed_sink;
+struct feed_sink {
+    int fd;
+    bool is_pool;
+};
+
+typedef struct feed_stats feed_stats;
+struct feed_stats {
+    UINT64 bytes;
+    UINT64 chunks;
+    UINT64 stirs;
+};
+
+static double elapsed_s(const struct timespec *start) {
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/*
+ * A character device is taken as the kernel's random pool and the bytes are
+ * credited with RNDADDENTROPY, anything else, like a named pipe or a file,
+ * gets the bytes written to it.
+ */
+static bool feed_sink_open(feed_sink *sink) {
+
+    sink->fd = open(ctx.feed.path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (sink->fd < 0) {
+        LOG_ERR("Could not open \"%s\", error: %s", ctx.feed.path,
+                strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(sink->fd, &st)) {
+        LOG_ERR("Could not stat \"%s\", error: %s", ctx.feed.path,
+                strerror(errno));
+        close(sink->fd);
+        return false;
+    }
+
+    sink->is_pool = S_ISCHR(st.st_mode);
+#if !defined(RNDADDENTROPY)
+    if (sink->is_pool) {
+        LOG_ERR("Crediting entropy to \"%s\" is not supported", ctx.feed.path);
+        close(sink->fd);
+        return false;
+    }
+#endif
+
+    return true;
+}
+
+static bool feed_sink_write(feed_sink *sink, const UINT8 *data, UINT16 size) {
+
+#if defined(RNDADDENTROPY)
+    if (sink->is_pool) {
+        struct rand_pool_info *pool = malloc(sizeof(*pool) + size);
+        if (!pool) {
+            LOG_ERR("oom");
+            return false;
+        }
+
+        pool->entropy_count = size * 8;
+        pool->buf_size = size;
+        memcpy(pool->buf, data, size);
+
+        int rc = ioctl(sink->fd, RNDADDENTROPY, pool);
+        free(pool);
+        if (rc) {
+            LOG_ERR("Could not add entropy to \"%s\", error: %s",
+                    ctx.feed.path, strerror(errno));
+            return false;
+        }
+
+        return true;
+    }
+#endif
+
+    size_t written = 0;
+    while (written < size) {
+        ssize_t rc = write(sink->fd, &data[written], size - written);
+        if (rc < 0) {
+            if (errno == EINTR && !feed_stop) {
+                continue;
+            }
+            LOG_ERR("Could not write to \"%s\", error: %s", ctx.feed.path,
+                    strerror(errno));
+            return false;
+        }
+        written += rc;
+    }
+
+    return true;
+}
+
+/*
+ * Mixes host entropy into the TPM's random number generator.
+ */
+static tool_rc feed_stir(ESYS_CONTEXT *ectx) {
+
+    TPM2B_SENSITIVE_DATA in_data = { .size = STIR_SIZE };
+
+    FILE *f = fopen("/dev/urandom", "rb");
+    if (!f) {
+        LOG_ERR("Could not open /dev/urandom, error: %s", strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    bool result = files_read_bytes(f, in_data.buffer, in_data.size);
+    fclose(f);
+    if (!result) {
+        LOG_ERR("Could not read host entropy");
+        return tool_rc_general_error;
+    }
+
+    TSS2_RC rval = Esys_StirRandom(ectx, ESYS_TR_NONE, ESYS_TR_NONE,
+                                   ESYS_TR_NONE, &in_data);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_StirRandom, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+/*
+ * Holds the feed to the target rate by sleeping until the bytes fed so far
+ * are due.
+ */
+static void feed_rate_limit(const struct timespec *start, UINT64 bytes) {
+
+    if (!ctx.feed.rate) {
+        return;
+    }
+
+    double ahead = (double)bytes / ctx.feed.rate - elapsed_s(start);
+    if (ahead <= 0) {
+        return;
+    }
+
+    struct timespec delay = {
+        .tv_sec = (time_t)ahead,
+        .tv_nsec = (long)((ahead - (time_t)ahead) * 1e9),
+    };
+
+    nanosleep(&delay, NULL);
+}
+
+static tool_rc feed_get_random_finish(ESYS_CONTEXT *ectx,
+        TPM2B_DIGEST **random_bytes) {
+
+    TSS2_RC rval;
+    do {
+        rval = Esys_GetRandom_Finish(ectx, random_bytes);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_GetRandom_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    return tool_rc_success;
+}
+
+static void feed_report(feed_stats *stats, tpm2_entropy_health *health,
+        double seconds) {
+
+    tpm2_tool_output("feed:\n");
+    tpm2_tool_output("  bytes: %"PRIu64"\n", stats->bytes);
+    tpm2_tool_output("  chunks: %"PRIu64"\n", stats->chunks);
+    tpm2_tool_output("  seconds: %.3f\n", seconds);
+    tpm2_tool_output("  bytes-per-second: %"PRIu64"\n",
+            seconds > 0 ? (UINT64)(stats->bytes / seconds) : 0);
+    tpm2_tool_output("  stirs: %"PRIu64"\n", stats->stirs);
+    tpm2_tool_output("  health:\n");
+    tpm2_tool_output("    samples: %"PRIu64"\n", health->samples);
+    tpm2_tool_output("    repetition-count-failures: %"PRIu64"\n",
+            health->rct.failures);
+    tpm2_tool_output("    adaptive-proportion-failures: %"PRIu64"\n",
+            health->apt.failures);
+}
+
+/*
+ * Feeds TPM random bytes to the sink until the count is reached or a signal
+ * stops it. The next chunk is requested asynchronously, and while the TPM
+ * generates it the previous chunk is health tested, fed and rate limited.
+ * A chunk failing the health tests is not fed and stops the feed.
+ */
+static tool_rc feed(ESYS_CONTEXT *ectx) {
+
+    feed_sink sink;
+    if (!feed_sink_open(&sink)) {
+        return tool_rc_general_error;
+    }
+
+    struct sigaction sa = { .sa_handler = feed_on_signal };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    tpm2_entropy_health health;
+    tpm2_entropy_health_init(&health);
+
+    feed_stats stats = { 0 };
+    TPM2B_DIGEST *chunk = NULL;
+    tool_rc rc = tool_rc_success;
+
+    struct timespec start, last_stir;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    last_stir = start;
+
+    while (!feed_stop) {
+
+        bool is_last = ctx.feed.count
+                && stats.bytes + (chunk ? chunk->size : 0) >= ctx.feed.count;
+
+        if (!is_last) {
+            TSS2_RC rval = Esys_GetRandom_Async(ectx, ESYS_TR_NONE,
+                    ESYS_TR_NONE, ESYS_TR_NONE, ctx.num_of_bytes);
+            if (rval != TSS2_RC_SUCCESS) {
+                LOG_PERR(Esys_GetRandom_Async, rval);
+                rc = tool_rc_from_tpm(rval);
+                break;
+            }
+        }
+
+        bool result = true;
+        if (chunk) {
+            UINT16 size = chunk->size;
+            if (ctx.feed.count && stats.bytes + size > ctx.feed.count) {
+                size = ctx.feed.count - stats.bytes;
+            }
+
+            result = tpm2_entropy_health_check(&health, chunk->buffer,
+                    chunk->size);
+            if (!result) {
+                LOG_ERR("Random bytes failed the health tests, stopping");
+            } else {
+                result = feed_sink_write(&sink, chunk->buffer, size);
+            }
+
+            if (result) {
+                stats.bytes += size;
+                stats.chunks++;
+                feed_rate_limit(&start, stats.bytes);
+            }
+
+            free(chunk);
+            chunk = NULL;
+        }
+
+        if (!is_last) {
+            tool_rc tmp_rc = feed_get_random_finish(ectx, &chunk);
+            if (tmp_rc != tool_rc_success) {
+                rc = tmp_rc;
+                break;
+            }
+        }
+
+        if (!result) {
+            rc = tool_rc_general_error;
+            break;
+        }
+
+        if (is_last) {
+            break;
+        }
+
+        if (ctx.feed.stir_interval
+                && elapsed_s(&last_stir) >= ctx.feed.stir_interval) {
+            rc = feed_stir(ectx);
+            if (rc != tool_rc_success) {
+                break;
+            }
+            stats.stirs++;
+            clock_gettime(CLOCK_MONOTONIC, &last_stir);
+        }
+    }
+
+    free(chunk);
+    close(sink.fd);
+
+    feed_report(&stats, &health, elapsed_s(&start));
+
+    return rc;
+}
+
 static bool on_option(char key, char *value) {
 
     UNUSED(key);
@@ -91,6 +420,28 @@ static bool on_option(char key, char *value) {
         break;
     case 0:
         ctx.hex = true;
+        break;
+    case 1:
+        ctx.feed.path = value;
+        break;
+    case 2:
+        if (!tpm2_util_string_to_uint32(value, &ctx.feed.rate)) {
+            LOG_ERR("Invalid feed rate, got: \"%s\"", value);
+            return false;
+        }
+        break;
+    case 3:
+        if (!tpm2_util_string_to_uint32(value, &ctx.feed.stir_interval)) {
+            LOG_ERR("Invalid stir interval, got: \"%s\"", value);
+            return false;
+        }
+        break;
+    case 4:
+        if (!tpm2_util_string_to_uint32(value, &ctx.feed.count)) {
+            LOG_ERR("Invalid feed count, got: \"%s\"", value);
+            return false;
+        }
+        break;
         /* no default */
     }
 
@@ -147,6 +498,10 @@ bool tpm2_tool_onstart(tpm2_options **opts) {
         { "output",     required_argument, NULL, 'o' },
         { "force",      required_argument, NULL, 'f' },
         { "hex",        no_argument,       NULL,  0  },
+        { "feed",       required_argument, NULL,  1  },
+        { "rate",       required_argument, NULL,  2  },
+        { "stir-interval", required_argument, NULL, 3 },
+        { "count",      required_argument, NULL,  4  },
     };
 
     *opts = tpm2_options_new("o:f", ARRAY_LEN(topts), topts, on_option, on_args,
@@ -159,6 +514,29 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
+    if (!ctx.feed.path
+            && (ctx.feed.rate || ctx.feed.stir_interval || ctx.feed.count)) {
+        LOG_ERR("Options --rate, --stir-interval and --count need --feed");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.feed.path && (ctx.output_file || ctx.hex)) {
+        LOG_ERR("Options -o and --hex cannot be used with --feed");
+        return tool_rc_option_error;
+    }
+
+    /*
+     * Feed in the largest chunks the TPM returns, unless a size is given.
+     */
+    if (ctx.feed.path && !ctx.num_of_bytes) {
+        UINT32 max = 0;
+        tool_rc rc = get_max_random(ectx, &max);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+        ctx.num_of_bytes = max;
+    }
+
     /*
      * Error if bytes requested is bigger than max hash size, which is what TPMs
      * should bound their requests by and always have available per the spec.
@@ -184,5 +562,5 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         }
     }
 
-    return get_random_and_save(ectx);
+    return ctx.feed.path ? feed(ectx) : get_random_and_save(ectx);
 }
@@ -11,8 +11,28 @@
 #include "log.h"
 #include "tpm2.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_capability.h"
 #include "tpm2_tool.h"
 
+/* the most input files, and so HMAC sequences, taken at once */
+#define MAX_HMAC_INPUTS 64
+
+/*
+ * One input being HMAC'd with a sequence. The next chunk is read ahead while
+ * the TPM processes the previous one.
+ */
+typedef struct hmac_stream hmac_stream;
+struct hmac_stream {
+    const char *path;
+    FILE *input;
+    ESYS_TR sequence_handle;
+    TPM2B_MAX_BUFFER next;
+    /* next is the last chunk, to be passed to SequenceComplete */
+    bool is_last;
+    TPM2B_DIGEST *hmac;
+    TPMT_TK_HASHCHECK *validation;
+};
+
 typedef struct tpm_hmac_ctx tpm_hmac_ctx;
 struct tpm_hmac_ctx {
     struct {
@@ -22,20 +42,216 @@ struct tpm_hmac_ctx {
     } hmac_key;
 
     FILE *input;
+    const char *input_path;
     char *hmac_output_file_path;
     char *ticket_path;
     TPMI_ALG_HASH halg;
     bool hex;
+
+    hmac_stream streams[MAX_HMAC_INPUTS];
+    unsigned stream_count;
+    UINT16 chunk_size;
 };
 
 static tpm_hmac_ctx ctx;
 
+/*
+ * Sequence updates carry as much as the TPM takes in one command parameter,
+ * TPM2_PT_INPUT_BUFFER, up to what a TPM2B_MAX_BUFFER holds.
+ */
+static tool_rc get_chunk_size(ESYS_CONTEXT *ectx) {
+
+    UINT32 input_buffer = 0;
+    tool_rc rc = tpm2_capability_get_tpm_property(ectx, TPM2_PT_INPUT_BUFFER,
+            &input_buffer);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    UINT16 max = BUFFER_SIZE(TPM2B_MAX_BUFFER, buffer);
+    ctx.chunk_size = input_buffer && input_buffer < max ? input_buffer : max;
+
+    LOG_INFO("HMAC sequence chunk size: %u", ctx.chunk_size);
+
+    return tool_rc_success;
+}
+
+/*
+ * Reads ahead the next chunk of a stream. A short read marks the last chunk,
+ * possibly empty, which completes the sequence.
+ */
+static bool read_chunk(hmac_stream *s) {
+
+    size_t bytes_read = fread(s->next.buffer, 1, ctx.chunk_size, s->input);
+    if (ferror(s->input)) {
+        LOG_ERR("Error reading from input file \"%s\"", s->path);
+        return false;
+    }
+
+    s->next.size = bytes_read;
+    s->is_last = bytes_read < ctx.chunk_size;
+
+    return true;
+}
+
+/* drops a sequence that will not be completed, freeing its object slot */
+static void stream_flush(ESYS_CONTEXT *ectx, hmac_stream *s) {
+
+    if (s->sequence_handle != ESYS_TR_NONE) {
+        tpm2_flush_context(ectx, s->sequence_handle);
+        s->sequence_handle = ESYS_TR_NONE;
+    }
+}
+
+static tool_rc stream_start(ESYS_CONTEXT *ectx, hmac_stream *s) {
+
+    s->sequence_handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_hmac_start(ectx, &ctx.hmac_key.object, ctx.halg,
+            &s->sequence_handle);
+    if (rc != tool_rc_success) {
+        s->sequence_handle = ESYS_TR_NONE;
+        return rc;
+    }
+
+    if (!read_chunk(s)) {
+        stream_flush(ectx, s);
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
+/*
+ * Moves a stream one chunk forward. An update is sent asynchronously and the
+ * following chunk read while the TPM processes it, ESAPI has already
+ * marshaled the sent chunk so its buffer can be reused.
+ */
+static tool_rc stream_step(ESYS_CONTEXT *ectx, hmac_stream *s) {
+
+    if (s->is_last) {
+        tool_rc rc = tpm2_hmac_sequencecomplete(ectx, s->sequence_handle,
+                &ctx.hmac_key.object, &s->next, &s->hmac, &s->validation);
+        /* a failed SequenceComplete leaves the sequence loaded */
+        if (rc == tool_rc_success) {
+            s->sequence_handle = ESYS_TR_NONE;
+        }
+        return rc;
+    }
+
+    tool_rc rc = tpm2_hmac_sequenceupdate_async(ectx, s->sequence_handle,
+            &ctx.hmac_key.object, &s->next);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    bool result = read_chunk(s);
+
+    rc = tpm2_hmac_sequenceupdate_finish(ectx);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    return result ? tool_rc_success : tool_rc_general_error;
+}
+
+/*
+ * Every sequence takes a transient object slot for as long as it runs, so
+ * no more run at once than the TPM has slots available.
+ */
+static tool_rc get_max_sequences(ESYS_CONTEXT *ectx, unsigned *max) {
+
+    *max = 1;
+    if (ctx.stream_count == 1) {
+        return tool_rc_success;
+    }
+
+    UINT32 avail = 0;
+    tool_rc rc = tpm2_capability_get_tpm_property(ectx,
+            TPM2_PT_HR_TRANSIENT_AVAIL, &avail);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    if (!avail) {
+        LOG_ERR("No transient object slot available for an HMAC sequence");
+        return tool_rc_general_error;
+    }
+
+    *max = avail < ctx.stream_count ? avail : ctx.stream_count;
+
+    LOG_INFO("Running %u HMAC sequences at once", *max);
+
+    return tool_rc_success;
+}
+
+/*
+ * Runs the sequences of all streams, interleaving their chunks round robin
+ * across up to max_sequences active sequences. A finished sequence frees
+ * its slot for the next waiting stream.
+ */
+static tool_rc hmac_streams(ESYS_CONTEXT *ectx) {
+
+    tool_rc rc = get_chunk_size(ectx);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    unsigned max_sequences = 1;
+    rc = get_max_sequences(ectx, &max_sequences);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    hmac_stream *active[MAX_HMAC_INPUTS];
+    unsigned active_count = 0;
+    unsigned next_stream = 0;
+
+    while (active_count || next_stream < ctx.stream_count) {
+
+        while (active_count < max_sequences
+                && next_stream < ctx.stream_count) {
+            hmac_stream *s = &ctx.streams[next_stream++];
+            rc = stream_start(ectx, s);
+            if (rc != tool_rc_success) {
+                goto error;
+            }
+            active[active_count++] = s;
+        }
+
+        unsigned i = 0;
+        while (i < active_count) {
+            hmac_stream *s = active[i];
+            bool is_done = s->is_last;
+            rc = stream_step(ectx, s);
+            if (rc != tool_rc_success) {
+                LOG_ERR("Could not HMAC \"%s\"", s->path);
+                goto error;
+            }
+
+            if (is_done) {
+                active[i] = active[--active_count];
+                continue;
+            }
+            i++;
+        }
+    }
+
+    return tool_rc_success;
+
+error:
+    /* the sequences left running would hold their slots until a restart */
+    while (active_count) {
+        stream_flush(ectx, active[--active_count]);
+    }
+
+    return rc;
+}
+
 static tool_rc tpm_hmac_file(ESYS_CONTEXT *ectx, TPM2B_DIGEST **result, TPMT_TK_HASHCHECK **validation) {
 
     unsigned long file_size = 0;
     FILE *input = ctx.input;
 
-    tool_rc rc;
     /* Suppress error reporting with NULL path */
     bool res = files_get_file_size(input, &file_size, NULL);
 
@@ -60,76 +276,54 @@ static tool_rc tpm_hmac_file(ESYS_CONTEXT *ectx, TPM2B_DIGEST **result, TPMT_TK_
         return tpm2_hmac(ectx, &ctx.hmac_key.object, ctx.halg, &buffer, result);
     }
 
-    ESYS_TR sequence_handle;
     /*
      * Size is either unknown because the FILE * is a fifo, or it's too big
-     * to do in a single hash call. Based on the size figure out the chunks
-     * to loop over, if possible. This way we can call Complete with data.
+     * to do in a single hash call. Run it as a sequence of one stream, the
+     * read ahead finds the last chunk to complete the sequence with.
      */
-    rc = tpm2_hmac_start(ectx, &ctx.hmac_key.object, ctx.halg, &sequence_handle);
+    hmac_stream *s = &ctx.streams[0];
+    s->path = ctx.input_path;
+    s->input = input;
+    ctx.stream_count = 1;
+
+    tool_rc rc = hmac_streams(ectx);
+
+    /* the input is ctx.input's, closed with it */
+    s->input = NULL;
     if (rc != tool_rc_success) {
         return rc;
     }
 
-    /* If we know the file size, we decrement the amount read and terminate the
-     * loop when 1 block is left, else we go till feof.
-     */
-    size_t left = file_size;
-    bool use_left = !!res;
-
-    TPM2B_MAX_BUFFER data;
-
-    bool done = false;
-    while (!done) {
-
-        size_t bytes_read = fread(data.buffer, 1,
-                BUFFER_SIZE(typeof(data), buffer), input);
-        if (ferror(input)) {
-            LOG_ERR("Error reading from input file");
-            return tool_rc_general_error;
-        }
-
-        data.size = bytes_read;
+    *result = s->hmac;
+    *validation = s->validation;
+    s->hmac = NULL;
+    s->validation = NULL;
 
-        /* if data was read, update the sequence */
-        rc = tpm2_hmac_sequenceupdate(ectx, sequence_handle,
-            &ctx.hmac_key.object, &data);
-        if (rc != tool_rc_success) {
-            return rc;
-        }
+    return tool_rc_success;
+}
 
-        if (use_left) {
-            left -= bytes_read;
-            if (left <= TPM2_MAX_DIGEST_BUFFER) {
-                done = true;
-                continue;
-            }
-        } else if (feof(input)) {
-            done = true;
-        }
-    } /* end file read/hash update loop */
+/*
+ * With several input files every HMAC is displayed as YAML, keyed by its
+ * input file.
+ */
+static tool_rc do_hmac_streams_and_output(ESYS_CONTEXT *ectx) {
 
-    if (use_left) {
-        data.size = left;
-        bool res = files_read_bytes(input, data.buffer, left);
-        if (!res) {
-            LOG_ERR("Error reading from input file.");
-            return tool_rc_general_error;
-        }
-    } else {
-        data.size = 0;
+    tool_rc rc = hmac_streams(ectx);
+    if (rc != tool_rc_success) {
+        return rc;
     }
 
-    rc = tpm2_hmac_sequencecomplete(ectx, sequence_handle,
-        &ctx.hmac_key.object, &data, result, validation);
-        if (rc != tool_rc_success) {
-            return rc;
-        }
+    unsigned i;
+    for (i = 0; i < ctx.stream_count; i++) {
+        hmac_stream *s = &ctx.streams[i];
+        tpm2_tool_output("%s: ", s->path);
+        tpm2_util_hexdump(s->hmac->buffer, s->hmac->size);
+        tpm2_tool_output("\n");
+    }
 
     return tool_rc_success;
 }
 
-
 static tool_rc do_hmac_and_output(ESYS_CONTEXT *ectx) {
 
     TPM2B_DIGEST *hmac_out = NULL;
@@ -221,16 +415,34 @@ static bool on_option(char key, char *value) {
 
 static bool on_args(int argc, char **argv) {
 
-    if (argc > 1) {
-        LOG_ERR("Expected 1 hmac input file, got: %d", argc);
+    if (argc > MAX_HMAC_INPUTS) {
+        LOG_ERR("Expected at most %u hmac input files, got: %d",
+                MAX_HMAC_INPUTS, argc);
         return false;
     }
 
-    ctx.input = fopen(argv[0], "rb");
-    if (!ctx.input) {
-        LOG_ERR("Error opening file \"%s\", error: %s", argv[0],
-                strerror(errno));
-        return false;
+    if (argc == 1) {
+        ctx.input = fopen(argv[0], "rb");
+        if (!ctx.input) {
+            LOG_ERR("Error opening file \"%s\", error: %s", argv[0],
+                    strerror(errno));
+            return false;
+        }
+        ctx.input_path = argv[0];
+        return true;
+    }
+
+    int i;
+    for (i = 0; i < argc; i++) {
+        hmac_stream *s = &ctx.streams[ctx.stream_count];
+        s->input = fopen(argv[i], "rb");
+        if (!s->input) {
+            LOG_ERR("Error opening file \"%s\", error: %s", argv[i],
+                    strerror(errno));
+            return false;
+        }
+        s->path = argv[i];
+        ctx.stream_count++;
     }
 
     return true;
@@ -248,6 +460,7 @@ bool tpm2_tool_onstart(tpm2_options **opts) {
     };
 
     ctx.input = stdin;
+    ctx.input_path = "stdin";
 
     *opts = tpm2_options_new("c:p:o:g:t:", ARRAY_LEN(topts), topts, on_option,
                              on_args, 0);
@@ -274,6 +487,11 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return tool_rc_option_error;
     }
 
+    if (ctx.stream_count && (ctx.hmac_output_file_path || ctx.ticket_path)) {
+        LOG_ERR("Options o and t take a single input file");
+        return tool_rc_option_error;
+    }
+
     tool_rc rc = tpm2_util_object_load_auth(ectx, ctx.hmac_key.ctx_path,
         ctx.hmac_key.auth_str, &ctx.hmac_key.object, false, TPM2_HANDLE_ALL_W_NV);
     if (rc != tool_rc_success) {
@@ -304,7 +522,8 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         free(pub);
     }
 
-    return do_hmac_and_output(ectx);
+    return ctx.stream_count ? do_hmac_streams_and_output(ectx) :
+            do_hmac_and_output(ectx);
 }
 
 tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
@@ -314,5 +533,15 @@ tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
         fclose(ctx.input);
     }
 
+    unsigned i;
+    for (i = 0; i < ctx.stream_count; i++) {
+        hmac_stream *s = &ctx.streams[i];
+        if (s->input) {
+            fclose(s->input);
+        }
+        free(s->hmac);
+        free(s->validation);
+    }
+
     return tpm2_session_close(&ctx.hmac_key.object.session);
 }
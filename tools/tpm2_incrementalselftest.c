@@ -1,18 +1,35 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <inttypes.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "log.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_capability.h"
 #include "tpm2_tool.h"
+#include "tpm2_util.h"
 
 typedef struct tpm_incrementalselftest_ctx tpm_incrementalselftest_ctx;
 
 struct tpm_incrementalselftest_ctx {
     TPML_ALG    inputalgs;
+    struct {
+        bool enabled;
+        UINT32 batch_size;
+        UINT32 yield_ms;
+        UINT32 poll_ms;
+    } orchestrate;
 };
 
-static tpm_incrementalselftest_ctx ctx;
+static tpm_incrementalselftest_ctx ctx = {
+    .orchestrate = {
+        .batch_size = 1,
+        .yield_ms = 10,
+        .poll_ms = 1,
+    },
+};
 
 static tool_rc tpm_incrementalselftest(ESYS_CONTEXT *ectx) {
 
@@ -48,6 +65,214 @@ static tool_rc tpm_incrementalselftest(ESYS_CONTEXT *ectx) {
     return tool_rc_success;
 }
 
+static void sleep_ms(UINT32 ms) {
+
+    struct timespec delay = {
+        .tv_sec = ms / 1000,
+        .tv_nsec = (ms % 1000) * 1000000L,
+    };
+
+    nanosleep(&delay, NULL);
+}
+
+/*
+ * Without an algorithm list, every algorithm the TPM implements is tested.
+ */
+static tool_rc get_algorithms(ESYS_CONTEXT *ectx) {
+
+    if (ctx.inputalgs.count) {
+        return tool_rc_success;
+    }
+
+    TPMS_CAPABILITY_DATA *cap_data = NULL;
+    tool_rc rc = tpm2_capability_get(ectx, TPM2_CAP_ALGS, TPM2_ALG_FIRST,
+            TPM2_MAX_CAP_ALGS, &cap_data);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TPML_ALG_PROPERTY *algs = &cap_data->data.algorithms;
+    UINT32 i;
+    for (i = 0; i < algs->count && i < TPM2_MAX_ALG_LIST_SIZE; i++) {
+        ctx.inputalgs.algorithms[i] = algs->algProperties[i].alg;
+    }
+    ctx.inputalgs.count = i;
+
+    free(cap_data);
+
+    return tool_rc_success;
+}
+
+/*
+ * Polls TPM2_GetTestResult until the TPM is done testing. The result is
+ * TPM2_RC_NEEDS_TEST while algorithms outside the batches tested so far
+ * remain untested.
+ */
+static tool_rc wait_for_tests(ESYS_CONTEXT *ectx, UINT32 *polls,
+        TPM2_RC *status) {
+
+    while (true) {
+        TPM2B_MAX_BUFFER *output = NULL;
+        TSS2_RC rval = Esys_GetTestResult(ectx, ESYS_TR_NONE, ESYS_TR_NONE,
+                ESYS_TR_NONE, &output, status);
+        if (rval != TSS2_RC_SUCCESS) {
+            LOG_PERR(Esys_GetTestResult, rval);
+            return tool_rc_from_tpm(rval);
+        }
+
+        free(output);
+        (*polls)++;
+
+        if (*status != TPM2_RC_TESTING) {
+            return tool_rc_success;
+        }
+
+        sleep_ms(ctx.orchestrate.poll_ms);
+    }
+}
+
+/*
+ * Tests the algorithms in batches, waiting on TPM2_GetTestResult for each
+ * batch to be tested and sleeping between batches, so that commands of
+ * other TPM users get in between instead of waiting out a full self test.
+ * The time of a batch, from the request to the end of testing, is reported
+ * for each of its algorithms.
+ */
+static tool_rc tpm_orchestrated_selftest(ESYS_CONTEXT *ectx) {
+
+    tool_rc rc = get_algorithms(ectx);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    TPM2_RC status = TPM2_RC_SUCCESS;
+    bool is_failed = false;
+    TPML_ALG *totest = NULL;
+    UINT32 batches = 0;
+
+    tpm2_tool_output("algorithms:\n");
+
+    UINT32 first;
+    for (first = 0; first < ctx.inputalgs.count;
+            first += ctx.orchestrate.batch_size) {
+
+        if (batches) {
+            sleep_ms(ctx.orchestrate.yield_ms);
+        }
+
+        TPML_ALG batch = { .count = ctx.inputalgs.count - first };
+        if (batch.count > ctx.orchestrate.batch_size) {
+            batch.count = ctx.orchestrate.batch_size;
+        }
+        memcpy(batch.algorithms, &ctx.inputalgs.algorithms[first],
+                batch.count * sizeof(batch.algorithms[0]));
+
+        struct timespec batch_start;
+        clock_gettime(CLOCK_MONOTONIC, &batch_start);
+
+        free(totest);
+        totest = NULL;
+        TSS2_RC rval = Esys_IncrementalSelfTest(ectx, ESYS_TR_NONE,
+                ESYS_TR_NONE, ESYS_TR_NONE, &batch, &totest);
+        if (rval != TSS2_RC_SUCCESS) {
+            LOG_PERR(Esys_IncrementalSelfTest, rval);
+            return tool_rc_from_tpm(rval);
+        }
+
+        UINT32 polls = 0;
+        rc = wait_for_tests(ectx, &polls, &status);
+        if (rc != tool_rc_success) {
+            free(totest);
+            return rc;
+        }
+
+        struct timespec batch_end;
+        clock_gettime(CLOCK_MONOTONIC, &batch_end);
+        UINT64 us = tpm2_util_elapsed_us(&batch_start, &batch_end);
+
+        UINT32 i;
+        for (i = 0; i < batch.count; i++) {
+            tpm2_tool_output("  - algorithm: %s\n",
+                    tpm2_alg_util_algtostr(batch.algorithms[i],
+                            tpm2_alg_util_flags_any));
+            tpm2_tool_output("    batch: %"PRIu32"\n", batches);
+            tpm2_tool_output("    time-us: %"PRIu64"\n", us);
+            tpm2_tool_output("    polls: %"PRIu32"\n", polls);
+        }
+
+        batches++;
+
+        if (status != TPM2_RC_SUCCESS && status != TPM2_RC_NEEDS_TEST) {
+            LOG_ERR("Self test failed after batch %"PRIu32", result: 0x%x",
+                    batches - 1, status);
+            is_failed = true;
+            break;
+        }
+    }
+
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    tpm2_tool_output("batches: %"PRIu32"\n", batches);
+    tpm2_tool_output("total-us: %"PRIu64"\n",
+            tpm2_util_elapsed_us(&start, &end));
+
+    tpm2_tool_output("status: ");
+    if (is_failed) {
+        tpm2_tool_output("failed\n");
+    } else if (!totest || !totest->count) {
+        tpm2_tool_output("complete\n");
+    } else {
+        tpm2_tool_output("success\n");
+        tpm2_tool_output("remaining:\n");
+
+        UINT32 i;
+        for (i = 0; i < totest->count; i++) {
+            print_yaml_indent(1);
+            tpm2_tool_output("%s\n",
+                    tpm2_alg_util_algtostr(totest->algorithms[i],
+                            tpm2_alg_util_flags_any));
+        }
+    }
+
+    free(totest);
+
+    return is_failed ? tool_rc_general_error : tool_rc_success;
+}
+
+static bool on_option(char key, char *value) {
+
+    switch (key) {
+    case 0:
+        ctx.orchestrate.enabled = true;
+        break;
+    case 1:
+        if (!tpm2_util_string_to_uint32(value, &ctx.orchestrate.batch_size)
+                || !ctx.orchestrate.batch_size) {
+            LOG_ERR("Invalid batch size, got: \"%s\"", value);
+            return false;
+        }
+        break;
+    case 2:
+        if (!tpm2_util_string_to_uint32(value, &ctx.orchestrate.yield_ms)) {
+            LOG_ERR("Invalid yield time, got: \"%s\"", value);
+            return false;
+        }
+        break;
+    case 3:
+        if (!tpm2_util_string_to_uint32(value, &ctx.orchestrate.poll_ms)) {
+            LOG_ERR("Invalid poll interval, got: \"%s\"", value);
+            return false;
+        }
+        break;
+    }
+
+    return true;
+}
+
 static bool on_arg(int argc, char **argv){
     int i;
     TPM2_ALG_ID algorithm;
@@ -73,7 +298,15 @@ static bool on_arg(int argc, char **argv){
 
 bool tpm2_tool_onstart(tpm2_options **opts) {
 
-    *opts = tpm2_options_new(NULL, 0, NULL, NULL, on_arg, 0);
+    const struct option topts[] = {
+        { "orchestrate", no_argument,       NULL, 0 },
+        { "batch-size",  required_argument, NULL, 1 },
+        { "yield",       required_argument, NULL, 2 },
+        { "poll",        required_argument, NULL, 3 },
+    };
+
+    *opts = tpm2_options_new(NULL, ARRAY_LEN(topts), topts, on_option, on_arg,
+            0);
 
     return *opts != NULL;
 }
@@ -82,5 +315,6 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
-    return tpm_incrementalselftest(ectx);
+    return ctx.orchestrate.enabled ? tpm_orchestrated_selftest(ectx) :
+            tpm_incrementalselftest(ectx);
 }
@@ -60,7 +60,7 @@ static tool_rc nv_space_define(ESYS_CONTEXT *ectx) {
     public_info.nvPublic.dataSize = ctx.size;
 
     tool_rc rc = tpm2_nv_definespace(ectx, &ctx.auth_hierarchy.object, &ctx.nvAuth,
-        &public_info);
+        &public_info, NULL);
     if (rc != tool_rc_success) {
         LOG_INFO("Success to define NV area at index 0x%x.", ctx.nvIndex);
         return rc;
@@ -1,23 +1,475 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
 
+#include "tpm2.h"
+#include "tpm2_auth_util.h"
 #include "tpm2_nv_util.h"
 #include "tpm2_tool.h"
 
+#define MAX_COUNTERS 64
+#define MAX_REQUEST_INDICES 32
+
+typedef struct nv_counter nv_counter;
+struct nv_counter {
+    TPM2_HANDLE index;
+    ESYS_TR tr_handle;
+    /* only used when the counter authorizes itself */
+    tpm2_loaded_object auth;
+    bool has_auth;
+    bool is_auth_used;
+};
+
+typedef struct service_stats service_stats;
+struct service_stats {
+    UINT64 requests;
+    UINT64 increments;
+    UINT64 reads;
+    UINT64 increment_us;
+};
+
 typedef struct tpm_nvincrement_ctx tpm_nvincrement_ctx;
 struct tpm_nvincrement_ctx {
     struct {
         const char *ctx_path;
         const char *auth_str;
         tpm2_loaded_object object;
+        bool is_used;
     } auth_hierarchy;
 
     TPM2_HANDLE nv_index;
+
+    struct {
+        bool enabled;
+        const char *socket_path;
+        nv_counter counters[MAX_COUNTERS];
+        size_t count;
+        service_stats stats;
+    } service;
 };
 static tpm_nvincrement_ctx ctx;
 
+static volatile sig_atomic_t service_stop;
+
+static void service_on_signal(int signum) {
+
+    UNUSED(signum);
+
+    service_stop = 1;
+}
+
+/*
+ * Every request uses the authorization again, while a policy session is
+ * reset by its first use. Only a "pcr:" policy can be satisfied again, so
+ * any other policy session is refused.
+ */
+static tool_rc check_service_auth(tpm2_loaded_object *auth) {
+
+    if (auth->session && !tpm2_auth_util_is_pcr(ctx.auth_hierarchy.auth_str)
+            && tpm2_session_get_type(auth->session) == TPM2_SE_POLICY) {
+        LOG_ERR("The counter service supports password, HMAC session and "
+                "\"pcr:\" authorizations, a policy session is spent by the "
+                "first request");
+        return tool_rc_option_error;
+    }
+
+    return tool_rc_success;
+}
+
+/*
+ * Restarts a used "pcr:" policy session and satisfies it again, before the
+ * authorization is used by a command.
+ */
+static tool_rc prepare_auth(ESYS_CONTEXT *ectx, tpm2_loaded_object *auth,
+        bool *is_used) {
+
+    if (*is_used && tpm2_auth_util_is_pcr(ctx.auth_hierarchy.auth_str)) {
+        tool_rc rc = tpm2_auth_util_restart_pcr(ectx,
+                ctx.auth_hierarchy.auth_str, auth->session);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+    }
+    *is_used = true;
+
+    return tool_rc_success;
+}
+
+/*
+ * Returns the resident handle of the counter, resolving it, and loading its
+ * authorization when no -C was given, on first use only.
+ */
+static tool_rc get_counter(ESYS_CONTEXT *ectx, TPM2_HANDLE index,
+        nv_counter **counter) {
+
+    size_t i;
+    for (i = 0; i < ctx.service.count; i++) {
+        if (ctx.service.counters[i].index == index) {
+            *counter = &ctx.service.counters[i];
+            return tool_rc_success;
+        }
+    }
+
+    if (ctx.service.count == MAX_COUNTERS) {
+        LOG_ERR("Too many counters, the maximum is %u", MAX_COUNTERS);
+        return tool_rc_general_error;
+    }
+
+    nv_counter *c = &ctx.service.counters[ctx.service.count];
+    memset(c, 0, sizeof(*c));
+    c->index = index;
+
+    tool_rc rc;
+    if (ctx.auth_hierarchy.ctx_path) {
+        rc = tpm2_from_tpm_public(ectx, index, ESYS_TR_NONE, ESYS_TR_NONE,
+                ESYS_TR_NONE, &c->tr_handle);
+    } else {
+        char path[16];
+        snprintf(path, sizeof(path), "0x%X", index);
+        rc = tpm2_util_object_load_auth(ectx, path,
+                ctx.auth_hierarchy.auth_str, &c->auth, false,
+                TPM2_HANDLE_FLAGS_NV);
+        c->tr_handle = c->auth.tr_handle;
+        c->has_auth = rc == tool_rc_success;
+        if (c->has_auth) {
+            rc = check_service_auth(&c->auth);
+            if (rc != tool_rc_success) {
+                tpm2_session_close(&c->auth.session);
+                c->has_auth = false;
+            }
+        }
+    }
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    ctx.service.count++;
+    *counter = c;
+
+    return tool_rc_success;
+}
+
+static tool_rc counter_auth(ESYS_CONTEXT *ectx, nv_counter *c,
+        tpm2_loaded_object **auth) {
+
+    *auth = c->has_auth ? &c->auth : &ctx.auth_hierarchy.object;
+
+    return prepare_auth(ectx, *auth, c->has_auth ?
+            &c->is_auth_used : &ctx.auth_hierarchy.is_used);
+}
+
+static tool_rc counter_increment(ESYS_CONTEXT *ectx, nv_counter *c) {
+
+    tpm2_loaded_object *auth;
+    tool_rc rc = counter_auth(ectx, c, &auth);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    rc = tpm2_nv_increment_tr(ectx, auth, c->tr_handle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to increment NV counter at index 0x%X", c->index);
+        return rc;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ctx.service.stats.increments++;
+    ctx.service.stats.increment_us += tpm2_util_elapsed_us(&start, &end);
+
+    return tool_rc_success;
+}
+
+static tool_rc counter_read(ESYS_CONTEXT *ectx, nv_counter *c,
+        UINT64 *value) {
+
+    tpm2_loaded_object *auth;
+    tool_rc rc = counter_auth(ectx, c, &auth);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    ESYS_TR shandle = ESYS_TR_NONE;
+    rc = tpm2_auth_util_get_shandle(ectx, auth->tr_handle,
+            auth->session, &shandle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to get shandle");
+        return rc;
+    }
+
+    TPM2B_MAX_NV_BUFFER *data = NULL;
+    rc = tpm2_nv_read(ectx, auth->tr_handle, c->tr_handle, shandle,
+            ESYS_TR_NONE, ESYS_TR_NONE, sizeof(*value), 0, &data);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to read NV counter at index 0x%X", c->index);
+        return rc;
+    }
+
+    if (data->size != sizeof(*value)) {
+        LOG_ERR("NV counter at index 0x%X returned %u bytes", c->index,
+                data->size);
+        free(data);
+        return tool_rc_general_error;
+    }
+
+    /* counters are stored big endian */
+    UINT64 v = 0;
+    UINT16 i;
+    for (i = 0; i < data->size; i++) {
+        v = (v << 8) | data->buffer[i];
+    }
+    *value = v;
+
+    free(data);
+
+    ctx.service.stats.reads++;
+
+    return tool_rc_success;
+}
+
+/*
+ * Handles one request line, "inc INDEX..." or "read INDEX...", and writes
+ * its reply line. Increments are issued in order, an index listed twice is
+ * incremented twice, and then every distinct index is read back once.
+ * A failing request gets an error reply and the service carries on.
+ */
+static void handle_request(ESYS_CONTEXT *ectx, char *line, FILE *out) {
+
+    char *saveptr = NULL;
+    char *op = strtok_r(line, " \t\r\n", &saveptr);
+    if (!op) {
+        return;
+    }
+
+    ctx.service.stats.requests++;
+
+    bool is_inc = !strcmp(op, "inc");
+    if (!is_inc && strcmp(op, "read")) {
+        fprintf(out, "error unknown operation \"%s\"\n", op);
+        return;
+    }
+
+    nv_counter *counters[MAX_REQUEST_INDICES];
+    size_t count = 0;
+    char *tok;
+    while ((tok = strtok_r(NULL, " \t\r\n", &saveptr))) {
+        TPMI_RH_NV_INDEX index;
+        if (!tpm2_util_handle_from_optarg(tok, &index, TPM2_HANDLE_FLAGS_NV)
+                || !index) {
+            fprintf(out, "error invalid NV index \"%s\"\n", tok);
+            return;
+        }
+
+        if (count == MAX_REQUEST_INDICES) {
+            fprintf(out, "error too many indices, the maximum is %u\n",
+                    MAX_REQUEST_INDICES);
+            return;
+        }
+
+        tool_rc rc = get_counter(ectx, index, &counters[count]);
+        if (rc != tool_rc_success) {
+            fprintf(out, "error could not load NV index 0x%X\n", index);
+            return;
+        }
+        count++;
+    }
+
+    if (!count) {
+        fprintf(out, "error no NV index given\n");
+        return;
+    }
+
+    size_t i, j;
+    for (i = 0; is_inc && i < count; i++) {
+        tool_rc rc = counter_increment(ectx, counters[i]);
+        if (rc != tool_rc_success) {
+            fprintf(out, "error increment of 0x%X failed\n",
+                    counters[i]->index);
+            return;
+        }
+    }
+
+    UINT64 values[MAX_REQUEST_INDICES];
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < i && counters[j] != counters[i]; j++);
+        if (j < i) {
+            values[i] = values[j];
+            continue;
+        }
+
+        tool_rc rc = counter_read(ectx, counters[i], &values[i]);
+        if (rc != tool_rc_success) {
+            fprintf(out, "error read of 0x%X failed\n", counters[i]->index);
+            return;
+        }
+    }
+
+    fprintf(out, "ok");
+    for (i = 0; i < count; i++) {
+        for (j = 0; j < i && counters[j] != counters[i]; j++);
+        if (j == i) {
+            fprintf(out, " 0x%X=%" PRIu64, counters[i]->index, values[i]);
+        }
+    }
+    fprintf(out, "\n");
+}
+
+/* serves requests until end of input, an output error or a signal */
+static void serve_stream(ESYS_CONTEXT *ectx, FILE *in, FILE *out) {
+
+    char *line = NULL;
+    size_t len = 0;
+
+    while (!service_stop && getline(&line, &len, in) != -1) {
+        handle_request(ectx, line, out);
+        if (fflush(out) || ferror(out)) {
+            LOG_WARN("Could not write reply, dropping the client");
+            break;
+        }
+    }
+
+    free(line);
+}
+
+/*
+ * Serves one client at a time, to the end of its stream. Others wait in the
+ * listen backlog until it disconnects.
+ */
+static tool_rc serve_socket(ESYS_CONTEXT *ectx) {
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(ctx.service.socket_path) >= sizeof(addr.sun_path)) {
+        LOG_ERR("Socket path too long, got: \"%s\"", ctx.service.socket_path);
+        return tool_rc_option_error;
+    }
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s",
+            ctx.service.socket_path);
+
+    /* only a stale socket is replaced, never a file of another kind */
+    struct stat sb;
+    if (!lstat(addr.sun_path, &sb)) {
+        if (!S_ISSOCK(sb.st_mode)) {
+            LOG_ERR("\"%s\" exists and is not a socket", addr.sun_path);
+            return tool_rc_general_error;
+        }
+
+        if (unlink(addr.sun_path)) {
+            LOG_ERR("Could not remove stale socket \"%s\", error: %s",
+                    addr.sun_path, strerror(errno));
+            return tool_rc_general_error;
+        }
+    } else if (errno != ENOENT) {
+        LOG_ERR("Could not stat \"%s\", error: %s", addr.sun_path,
+                strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    int sfd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (sfd < 0) {
+        LOG_ERR("Could not create socket, error: %s", strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    if (bind(sfd, (struct sockaddr *) &addr, sizeof(addr))
+            || listen(sfd, 8)) {
+        LOG_ERR("Could not listen on \"%s\", error: %s", addr.sun_path,
+                strerror(errno));
+        close(sfd);
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tool_rc_success;
+    while (!service_stop) {
+        int cfd = accept(sfd, NULL, NULL);
+        if (cfd < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERR("Could not accept a client, error: %s", strerror(errno));
+            rc = tool_rc_general_error;
+            break;
+        }
+
+        int ofd = dup(cfd);
+        FILE *in = fdopen(cfd, "r");
+        FILE *out = ofd < 0 ? NULL : fdopen(ofd, "w");
+        if (!in || !out) {
+            LOG_ERR("Could not open client streams, error: %s",
+                    strerror(errno));
+            if (in) {
+                fclose(in);
+            } else {
+                close(cfd);
+            }
+            if (out) {
+                fclose(out);
+            } else if (ofd >= 0) {
+                close(ofd);
+            }
+            continue;
+        }
+
+        serve_stream(ectx, in, out);
+
+        fclose(in);
+        fclose(out);
+    }
+
+    close(sfd);
+    unlink(addr.sun_path);
+
+    return rc;
+}
+
+/*
+ * Keeps the counter handles and the authorization resident and serves
+ * increment and read requests from stdin, or from clients of a UNIX socket,
+ * so that each increment costs about one TPM2_NV_Increment.
+ */
+static tool_rc nvincrement_service(ESYS_CONTEXT *ectx) {
+
+    struct sigaction sa = { .sa_handler = service_on_signal };
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    tool_rc rc = tool_rc_success;
+    if (ctx.service.socket_path) {
+        rc = serve_socket(ectx);
+    } else {
+        serve_stream(ectx, stdin, stdout);
+    }
+
+    service_stats *stats = &ctx.service.stats;
+    LOG_INFO("Served %" PRIu64 " requests with %" PRIu64 " increments and %"
+            PRIu64 " reads, mean increment latency %" PRIu64 " us",
+            stats->requests, stats->increments, stats->reads,
+            stats->increments ?
+                    stats->increment_us / stats->increments : 0);
+
+    return rc;
+}
+
 static bool on_arg(int argc, char **argv) {
+
+    if (ctx.service.enabled) {
+        LOG_ERR("The counter service takes NV indices in its requests");
+        return false;
+    }
+
     /* If the user doesn't specify an authorization hierarchy use the index
     * passed to -x/--index for the authorization index.
     */
@@ -36,6 +488,12 @@ static bool on_option(char key, char *value) {
     case 'P':
         ctx.auth_hierarchy.auth_str = value;
         break;
+    case 0:
+        ctx.service.enabled = true;
+        break;
+    case 1:
+        ctx.service.socket_path = value;
+        break;
     }
 
     return true;
@@ -47,6 +505,8 @@ bool tpm2_tool_onstart(tpm2_options **opts) {
     const struct option topts[] = {
         { "hierarchy",            required_argument, NULL, 'C' },
         { "auth",                 required_argument, NULL, 'P' },
+        { "service",              no_argument,       NULL, 0 },
+        { "socket",               required_argument, NULL, 1 },
     };
 
     *opts = tpm2_options_new("C:P:", ARRAY_LEN(topts), topts,
@@ -59,6 +519,15 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
+    if (ctx.service.socket_path && !ctx.service.enabled) {
+        LOG_ERR("Option --socket requires --service");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.service.enabled && !ctx.auth_hierarchy.ctx_path) {
+        return nvincrement_service(ectx);
+    }
+
     tool_rc rc = tpm2_util_object_load_auth(ectx, ctx.auth_hierarchy.ctx_path,
         ctx.auth_hierarchy.auth_str, &ctx.auth_hierarchy.object, false,
         TPM2_HANDLE_FLAGS_NV|TPM2_HANDLE_FLAGS_O|TPM2_HANDLE_FLAGS_P);
@@ -67,6 +536,11 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
+    if (ctx.service.enabled) {
+        rc = check_service_auth(&ctx.auth_hierarchy.object);
+        return rc != tool_rc_success ? rc : nvincrement_service(ectx);
+    }
+
     rc = tpm2_nv_increment(ectx, &ctx.auth_hierarchy.object, ctx.nv_index);
     if (rc != tool_rc_success) {
         LOG_ERR("Failed to increment NV counter at index 0x%X", ctx.nv_index);
@@ -78,5 +552,19 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
 tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
     UNUSED(ectx);
-    return tpm2_session_close(&ctx.auth_hierarchy.object.session);
+
+    tool_rc rc = tool_rc_success;
+    size_t i;
+    for (i = 0; i < ctx.service.count; i++) {
+        if (ctx.service.counters[i].has_auth) {
+            tool_rc tmp_rc = tpm2_session_close(
+                    &ctx.service.counters[i].auth.session);
+            if (tmp_rc != tool_rc_success) {
+                rc = tmp_rc;
+            }
+        }
+    }
+
+    tool_rc tmp_rc = tpm2_session_close(&ctx.auth_hierarchy.object.session);
+    return tmp_rc != tool_rc_success ? tmp_rc : rc;
 }
@@ -0,0 +1,877 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "files.h"
+#include "log.h"
+#include "tpm2.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_attr_util.h"
+#include "tpm2_auth_util.h"
+#include "tpm2_capability.h"
+#include "tpm2_manifest.h"
+#include "tpm2_nv_util.h"
+#include "tpm2_tool.h"
+
+/* attributes the TPM changes on its own, they never make an index differ */
+#define NV_STATE_ATTRS \
+    (TPMA_NV_WRITTEN|TPMA_NV_WRITELOCKED|TPMA_NV_READLOCKED)
+
+typedef struct provision_nv provision_nv;
+struct provision_nv {
+    char *hierarchy_str;
+    char *size_str;
+    char *attrs_str;
+    char *halg;
+    char *policy;
+    char *auth_str;
+    char *data_path;
+    char *lock;
+    unsigned lineno;
+
+    TPMI_RH_NV_INDEX index;
+    TPMI_RH_PROVISION hierarchy;
+    TPM2B_NV_PUBLIC public;
+    UINT8 *data;
+    UINT16 data_size;
+    bool write_lock;
+    bool read_lock;
+
+    tpm2_session *session;
+    ESYS_TR tr_handle;
+    TPMA_NV attrs;
+};
+
+typedef struct tpm_nvprovision_ctx tpm_nvprovision_ctx;
+struct tpm_nvprovision_ctx {
+    const char *manifest_path;
+    struct {
+        struct {
+            char *auth_str;
+            tpm2_session *session;
+        } owner;
+        struct {
+            char *auth_str;
+            tpm2_session *session;
+        } platform;
+    } auth;
+
+    UINT32 index_max;
+    UINT32 buffer_max;
+
+    provision_nv *indices;
+    size_t count;
+};
+
+static tpm_nvprovision_ctx ctx;
+
+static bool set_field(provision_nv *n, const char *field, const char *value,
+        unsigned lineno) {
+
+    if (!strcmp(field, "hierarchy")) {
+        return tpm2_manifest_set_string(&n->hierarchy_str, value);
+    } else if (!strcmp(field, "size")) {
+        return tpm2_manifest_set_string(&n->size_str, value);
+    } else if (!strcmp(field, "attributes")) {
+        return tpm2_manifest_set_string(&n->attrs_str, value);
+    } else if (!strcmp(field, "hash-algorithm")) {
+        return tpm2_manifest_set_string(&n->halg, value);
+    } else if (!strcmp(field, "policy")) {
+        return tpm2_manifest_set_string(&n->policy, value);
+    } else if (!strcmp(field, "auth")) {
+        return tpm2_manifest_set_string(&n->auth_str, value);
+    } else if (!strcmp(field, "data")) {
+        return tpm2_manifest_set_string(&n->data_path, value);
+    } else if (!strcmp(field, "lock")) {
+        return tpm2_manifest_set_string(&n->lock, value);
+    }
+
+    LOG_ERR("%s:%u: Unknown field \"%s\"", ctx.manifest_path, lineno, field);
+    return false;
+}
+
+static provision_nv *find_index(TPMI_RH_NV_INDEX index) {
+
+    size_t i;
+    for (i = 0; i < ctx.count; i++) {
+        if (ctx.indices[i].index == index) {
+            return &ctx.indices[i];
+        }
+    }
+
+    return NULL;
+}
+
+static bool add_index(const char *section, unsigned lineno) {
+
+    TPMI_RH_NV_INDEX index;
+    bool result = tpm2_util_string_to_uint32(section, &index);
+    if (!result || index >> TPM2_HR_SHIFT != TPM2_HT_NV_INDEX) {
+        LOG_ERR("%s:%u: Invalid NV index, got: \"%s\"", ctx.manifest_path,
+                lineno, section);
+        return false;
+    }
+
+    if (find_index(index)) {
+        LOG_ERR("%s:%u: Duplicate NV index 0x%x", ctx.manifest_path, lineno,
+                index);
+        return false;
+    }
+
+    provision_nv *tmp = realloc(ctx.indices, (ctx.count + 1) * sizeof(*tmp));
+    if (!tmp) {
+        LOG_ERR("oom");
+        return false;
+    }
+    ctx.indices = tmp;
+
+    provision_nv *n = &ctx.indices[ctx.count++];
+    memset(n, 0, sizeof(*n));
+    n->index = index;
+    n->lineno = lineno;
+    n->tr_handle = ESYS_TR_NONE;
+
+    return true;
+}
+
+static bool on_section(const char *section, unsigned lineno,
+        void *userdata) {
+    UNUSED(userdata);
+
+    return add_index(section, lineno);
+}
+
+static bool on_field(const char *field, const char *value, unsigned lineno,
+        void *userdata) {
+    UNUSED(userdata);
+
+    return set_field(&ctx.indices[ctx.count - 1], field, value, lineno);
+}
+
+/*
+ * The manifest is a list of sections, one per NV index:
+ *
+ * [0x1500018]
+ * field = value
+ *
+ * Blank lines and lines starting with '#' are ignored.
+ */
+static bool parse_manifest(FILE *f) {
+
+    bool result = tpm2_manifest_parse(f, ctx.manifest_path, on_section,
+            on_field, NULL);
+    if (!result) {
+        return false;
+    }
+
+    if (!ctx.count) {
+        LOG_ERR("Manifest \"%s\" does not describe any NV index",
+                ctx.manifest_path);
+        return false;
+    }
+
+    return true;
+}
+
+static TPM2_NT index_type(TPMA_NV attrs) {
+
+    return (attrs & TPMA_NV_TPM2_NT_MASK) >> TPMA_NV_TPM2_NT_SHIFT;
+}
+
+static bool parse_lock(provision_nv *n) {
+
+    if (!n->lock) {
+        return true;
+    }
+
+    char *saveptr = NULL;
+    char *token = strtok_r(n->lock, "|", &saveptr);
+    while (token) {
+        token = tpm2_util_trim(token);
+        if (!strcmp(token, "write")) {
+            n->write_lock = true;
+        } else if (!strcmp(token, "read")) {
+            n->read_lock = true;
+        } else {
+            LOG_ERR("%s:%u: Invalid lock for NV index 0x%x, expected write,"
+                    " read or write|read, got: \"%s\"", ctx.manifest_path,
+                    n->lineno, n->index, token);
+            return false;
+        }
+        token = strtok_r(NULL, "|", &saveptr);
+    }
+
+    return true;
+}
+
+static bool load_data(provision_nv *n) {
+
+    unsigned long file_size;
+    bool result = files_get_file_size_path(n->data_path, &file_size);
+    if (!result) {
+        return false;
+    }
+
+    if (file_size > ctx.index_max) {
+        LOG_ERR("%s:%u: Data \"%s\" of %lu bytes exceeds the TPM NV index"
+                " maximum of %u bytes", ctx.manifest_path, n->lineno,
+                n->data_path, file_size, ctx.index_max);
+        return false;
+    }
+
+    n->data = malloc(file_size ? file_size : 1);
+    if (!n->data) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    n->data_size = file_size;
+
+    return files_load_bytes_from_path(n->data_path, n->data, &n->data_size);
+}
+
+/*
+ * Checks everything that does not need the TPM up front, against the limits
+ * read once, so a bad entry fails the run before any index is touched.
+ */
+static bool validate_index(provision_nv *n) {
+
+    bool result = tpm2_util_handle_from_optarg(
+            n->hierarchy_str ? n->hierarchy_str : "o", &n->hierarchy,
+            TPM2_HANDLE_FLAGS_O|TPM2_HANDLE_FLAGS_P);
+    if (!result) {
+        LOG_ERR("%s:%u: Invalid hierarchy for NV index 0x%x, only o and p"
+                " can define indices", ctx.manifest_path, n->lineno, n->index);
+        return false;
+    }
+
+    if (!n->attrs_str) {
+        LOG_ERR("%s:%u: NV index 0x%x is missing its attributes",
+                ctx.manifest_path, n->lineno, n->index);
+        return false;
+    }
+
+    TPMA_NV attrs = 0;
+    result = tpm2_util_string_to_uint32(n->attrs_str, &attrs);
+    if (!result) {
+        result = tpm2_attr_util_nv_strtoattr(n->attrs_str, &attrs);
+        if (!result) {
+            LOG_ERR("%s:%u: Could not convert NV attributes to number or"
+                    " keyword", ctx.manifest_path, n->lineno);
+            return false;
+        }
+    }
+
+    bool platform = n->hierarchy == TPM2_RH_PLATFORM;
+    if (!!(attrs & TPMA_NV_PLATFORMCREATE) != platform) {
+        LOG_ERR("%s:%u: NV index 0x%x must %sset platformcreate to be"
+                " defined under the %s hierarchy", ctx.manifest_path,
+                n->lineno, n->index, platform ? "" : "not ",
+                platform ? "platform" : "owner");
+        return false;
+    }
+
+    TPMI_ALG_HASH halg = TPM2_ALG_SHA256;
+    if (n->halg) {
+        halg = tpm2_alg_util_from_optarg(n->halg, tpm2_alg_util_flags_hash);
+        if (halg == TPM2_ALG_ERROR) {
+            LOG_ERR("%s:%u: Invalid hash algorithm, got: \"%s\"",
+                    ctx.manifest_path, n->lineno, n->halg);
+            return false;
+        }
+    }
+
+    TPMS_NV_PUBLIC *pub = &n->public.nvPublic;
+    pub->nvIndex = n->index;
+    pub->nameAlg = halg;
+    pub->attributes = attrs;
+
+    if (n->policy) {
+        pub->authPolicy.size = BUFFER_SIZE(TPM2B_DIGEST, buffer);
+        result = files_load_bytes_from_path(n->policy, pub->authPolicy.buffer,
+                &pub->authPolicy.size);
+        if (!result) {
+            return false;
+        }
+    }
+
+    if (n->data_path && !load_data(n)) {
+        return false;
+    }
+
+    TPM2_NT type = index_type(attrs);
+    if (n->data_path && type != TPM2_NT_ORDINARY) {
+        LOG_ERR("%s:%u: Only ordinary NV indices can be written with data",
+                ctx.manifest_path, n->lineno);
+        return false;
+    }
+
+    /* counter, bit field and pin indices have a fixed size */
+    UINT32 size = type == TPM2_NT_EXTEND ? tpm2_alg_util_get_hash_size(halg) :
+            type != TPM2_NT_ORDINARY ? sizeof(UINT64) : n->data_size;
+    if (n->size_str) {
+        result = tpm2_util_string_to_uint32(n->size_str, &size);
+        if (!result) {
+            LOG_ERR("%s:%u: Invalid size, got: \"%s\"", ctx.manifest_path,
+                    n->lineno, n->size_str);
+            return false;
+        }
+    } else if (type == TPM2_NT_ORDINARY && !n->data_path) {
+        LOG_ERR("%s:%u: NV index 0x%x needs a size or data",
+                ctx.manifest_path, n->lineno, n->index);
+        return false;
+    }
+
+    if (size > ctx.index_max) {
+        LOG_ERR("%s:%u: Size %u of NV index 0x%x exceeds the TPM maximum of"
+                " %u bytes", ctx.manifest_path, n->lineno, size, n->index,
+                ctx.index_max);
+        return false;
+    }
+
+    if (n->data_size > size) {
+        LOG_ERR("%s:%u: Data of %u bytes does not fit NV index 0x%x of %u"
+                " bytes", ctx.manifest_path, n->lineno, n->data_size,
+                n->index, size);
+        return false;
+    }
+
+    pub->dataSize = size;
+
+    if (n->data_path
+            && !(attrs & (TPMA_NV_OWNERWRITE|TPMA_NV_PPWRITE
+                    |TPMA_NV_AUTHWRITE))) {
+        LOG_ERR("%s:%u: NV index 0x%x can only be written with a policy,"
+                " set ownerwrite, ppwrite or authwrite", ctx.manifest_path,
+                n->lineno, n->index);
+        return false;
+    }
+
+    if (!parse_lock(n)) {
+        return false;
+    }
+
+    if (n->write_lock
+            && !(attrs & (TPMA_NV_WRITEDEFINE|TPMA_NV_WRITE_STCLEAR))) {
+        LOG_ERR("%s:%u: NV index 0x%x can only be write locked with"
+                " writedefine or write_stclear", ctx.manifest_path, n->lineno,
+                n->index);
+        return false;
+    }
+
+    if (n->write_lock
+            && !(attrs & (TPMA_NV_OWNERWRITE|TPMA_NV_PPWRITE
+                    |TPMA_NV_AUTHWRITE))) {
+        LOG_ERR("%s:%u: NV index 0x%x can only be write locked with a"
+                " policy", ctx.manifest_path, n->lineno, n->index);
+        return false;
+    }
+
+    if (n->read_lock && !(attrs & TPMA_NV_READ_STCLEAR)) {
+        LOG_ERR("%s:%u: NV index 0x%x can only be read locked with"
+                " read_stclear", ctx.manifest_path, n->lineno, n->index);
+        return false;
+    }
+
+    if (n->read_lock
+            && !(attrs & (TPMA_NV_OWNERREAD|TPMA_NV_PPREAD
+                    |TPMA_NV_AUTHREAD))) {
+        LOG_ERR("%s:%u: NV index 0x%x can only be read locked with a"
+                " policy", ctx.manifest_path, n->lineno, n->index);
+        return false;
+    }
+
+    /* only password authorizations can double as the index auth value */
+    tool_rc rc = tpm2_auth_util_from_optarg(NULL, n->auth_str, &n->session,
+            true);
+    if (rc != tool_rc_success) {
+        LOG_ERR("%s:%u: Invalid index authorization for NV index 0x%x",
+                ctx.manifest_path, n->lineno, n->index);
+        return false;
+    }
+
+    return true;
+}
+
+static tool_rc validate_indices(ESYS_CONTEXT *ectx) {
+
+    tool_rc rc = tpm2_capability_get_tpm_property(ectx, TPM2_PT_NV_INDEX_MAX,
+            &ctx.index_max);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    rc = tpm2_util_nv_max_buffer_size(ectx, &ctx.buffer_max);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    UINT16 max = BUFFER_SIZE(TPM2B_MAX_NV_BUFFER, buffer);
+    if (!ctx.buffer_max || ctx.buffer_max > max) {
+        ctx.buffer_max = max;
+    }
+
+    if (ctx.index_max > UINT16_MAX) {
+        ctx.index_max = UINT16_MAX;
+    }
+
+    size_t i;
+    for (i = 0; i < ctx.count; i++) {
+        if (!validate_index(&ctx.indices[i])) {
+            return tool_rc_general_error;
+        }
+    }
+
+    return tool_rc_success;
+}
+
+static tpm2_loaded_object hierarchy_object(TPMI_RH_PROVISION hierarchy) {
+
+    tpm2_loaded_object object = {
+        .handle = hierarchy,
+        .tr_handle = hierarchy == TPM2_RH_PLATFORM ?
+                ESYS_TR_RH_PLATFORM : ESYS_TR_RH_OWNER,
+        .session = hierarchy == TPM2_RH_PLATFORM ?
+                ctx.auth.platform.session : ctx.auth.owner.session,
+    };
+
+    return object;
+}
+
+/*
+ * Picks the authorization for a write or read out of the attributes, the
+ * hierarchies first as they are not subject to dictionary attack lockout.
+ */
+static bool index_auth_object(provision_nv *n, TPMA_NV owner, TPMA_NV pp,
+        TPMA_NV auth, tpm2_loaded_object *object) {
+
+    TPMA_NV attrs = n->public.nvPublic.attributes;
+    if (attrs & owner) {
+        *object = hierarchy_object(TPM2_RH_OWNER);
+    } else if (attrs & pp) {
+        *object = hierarchy_object(TPM2_RH_PLATFORM);
+    } else if (attrs & auth) {
+        object->handle = n->index;
+        object->tr_handle = n->tr_handle;
+        object->path = NULL;
+        object->session = n->session;
+    } else {
+        return false;
+    }
+
+    return true;
+}
+
+static bool public_matches(const TPMS_NV_PUBLIC *want,
+        const TPMS_NV_PUBLIC *have) {
+
+    return want->nameAlg == have->nameAlg
+            && (want->attributes & ~NV_STATE_ATTRS)
+                    == (have->attributes & ~NV_STATE_ATTRS)
+            && want->dataSize == have->dataSize
+            && want->authPolicy.size == have->authPolicy.size
+            && !memcmp(want->authPolicy.buffer, have->authPolicy.buffer,
+                    want->authPolicy.size);
+}
+
+static bool is_defined(TPML_HANDLE *defined, TPMI_RH_NV_INDEX index) {
+
+    UINT32 i;
+    for (i = 0; i < defined->count; i++) {
+        if (defined->handle[i] == index) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static tool_rc define_index(ESYS_CONTEXT *ectx, provision_nv *n,
+        TPML_HANDLE *defined, const char **state) {
+
+    if (!is_defined(defined, n->index)) {
+        tpm2_loaded_object hierarchy = hierarchy_object(n->hierarchy);
+        tool_rc rc = tpm2_nv_definespace(ectx, &hierarchy,
+                tpm2_session_get_auth_value(n->session), &n->public,
+                &n->tr_handle);
+        if (rc != tool_rc_success) {
+            LOG_ERR("Failed to define NV index 0x%x", n->index);
+            return rc;
+        }
+
+        n->attrs = n->public.nvPublic.attributes;
+        *state = "defined";
+        return tool_rc_success;
+    }
+
+    tool_rc rc = tpm2_from_tpm_public(ectx, n->index, ESYS_TR_NONE,
+            ESYS_TR_NONE, ESYS_TR_NONE, &n->tr_handle);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TPM2B_NV_PUBLIC *public = NULL;
+    rc = tpm2_nv_readpublic(ectx, n->tr_handle, ESYS_TR_NONE, ESYS_TR_NONE,
+            ESYS_TR_NONE, &public, NULL);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    bool matches = public_matches(&n->public.nvPublic, &public->nvPublic);
+    n->attrs = public->nvPublic.attributes;
+    free(public);
+
+    if (!matches) {
+        LOG_ERR("%s:%u: NV index 0x%x is already defined with a different"
+                " public area, undefine it first", ctx.manifest_path,
+                n->lineno, n->index);
+        return tool_rc_general_error;
+    }
+
+    *state = "unchanged";
+
+    return tool_rc_success;
+}
+
+/*
+ * Compares the written contents with the data. *verified is only set when
+ * the contents could be read back, read locked indices and indices without
+ * a read authorization this tool holds cannot be compared.
+ */
+static tool_rc compare_data(ESYS_CONTEXT *ectx, provision_nv *n,
+        bool *verified, bool *same) {
+
+    *verified = false;
+    *same = false;
+
+    tpm2_loaded_object object;
+    if ((n->attrs & TPMA_NV_READLOCKED)
+            || !index_auth_object(n, TPMA_NV_OWNERREAD, TPMA_NV_PPREAD,
+                    TPMA_NV_AUTHREAD, &object)) {
+        return tool_rc_success;
+    }
+
+    *verified = true;
+
+    UINT16 offset = 0;
+    while (offset < n->data_size) {
+        UINT16 len = n->data_size - offset < ctx.buffer_max ?
+                n->data_size - offset : ctx.buffer_max;
+
+        ESYS_TR shandle = ESYS_TR_NONE;
+        tool_rc rc = tpm2_auth_util_get_shandle(ectx, object.tr_handle,
+                object.session, &shandle);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        TPM2B_MAX_NV_BUFFER *chunk = NULL;
+        rc = tpm2_nv_read(ectx, object.tr_handle, n->tr_handle, shandle,
+                ESYS_TR_NONE, ESYS_TR_NONE, len, offset, &chunk);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        bool differs = chunk->size != len
+                || memcmp(chunk->buffer, &n->data[offset], len);
+        free(chunk);
+        if (differs) {
+            return tool_rc_success;
+        }
+
+        offset += len;
+    }
+
+    *same = true;
+
+    return tool_rc_success;
+}
+
+static tool_rc write_data(ESYS_CONTEXT *ectx, provision_nv *n,
+        const char **state) {
+
+    if (!n->data) {
+        *state = "none";
+        return tool_rc_success;
+    }
+
+    if (n->attrs & TPMA_NV_WRITTEN) {
+        bool verified;
+        bool same;
+        tool_rc rc = compare_data(ectx, n, &verified, &same);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        if (same) {
+            *state = "unchanged";
+            return tool_rc_success;
+        }
+
+        /* locked contents cannot be rewritten, report what is known */
+        if (n->attrs & TPMA_NV_WRITELOCKED) {
+            if (!verified) {
+                *state = "unverified";
+                return tool_rc_success;
+            }
+            LOG_ERR("%s:%u: NV index 0x%x is write locked with different"
+                    " contents", ctx.manifest_path, n->lineno, n->index);
+            return tool_rc_general_error;
+        }
+    } else if (n->attrs & TPMA_NV_WRITELOCKED) {
+        LOG_ERR("%s:%u: NV index 0x%x is write locked before it was written",
+                ctx.manifest_path, n->lineno, n->index);
+        return tool_rc_general_error;
+    }
+
+    tpm2_loaded_object object;
+    index_auth_object(n, TPMA_NV_OWNERWRITE, TPMA_NV_PPWRITE,
+            TPMA_NV_AUTHWRITE, &object);
+
+    UINT16 offset = 0;
+    while (offset < n->data_size) {
+        TPM2B_MAX_NV_BUFFER chunk = { .size = 0 };
+        chunk.size = n->data_size - offset < ctx.buffer_max ?
+                n->data_size - offset : ctx.buffer_max;
+        memcpy(chunk.buffer, &n->data[offset], chunk.size);
+
+        tool_rc rc = tpm2_nv_write_tr(ectx, &object, n->tr_handle, &chunk,
+                offset);
+        if (rc != tool_rc_success) {
+            LOG_ERR("Failed to write NV index 0x%x at offset %u", n->index,
+                    offset);
+            return rc;
+        }
+
+        offset += chunk.size;
+    }
+
+    n->attrs |= TPMA_NV_WRITTEN;
+    *state = "written";
+
+    return tool_rc_success;
+}
+
+static tool_rc lock_index(ESYS_CONTEXT *ectx, provision_nv *n,
+        const char **state) {
+
+    bool locked = false;
+
+    if (n->write_lock && !(n->attrs & TPMA_NV_WRITELOCKED)) {
+        tpm2_loaded_object object;
+        index_auth_object(n, TPMA_NV_OWNERWRITE, TPMA_NV_PPWRITE,
+                TPMA_NV_AUTHWRITE, &object);
+        tool_rc rc = tpm2_nv_writelock_tr(ectx, &object, n->tr_handle);
+        if (rc != tool_rc_success) {
+            LOG_ERR("Failed to write lock NV index 0x%x", n->index);
+            return rc;
+        }
+        locked = true;
+    }
+
+    if (n->read_lock && !(n->attrs & TPMA_NV_READLOCKED)) {
+        tpm2_loaded_object object;
+        index_auth_object(n, TPMA_NV_OWNERREAD, TPMA_NV_PPREAD,
+                TPMA_NV_AUTHREAD, &object);
+        tool_rc rc = tpm2_nv_readlock_tr(ectx, &object, n->tr_handle);
+        if (rc != tool_rc_success) {
+            LOG_ERR("Failed to read lock NV index 0x%x", n->index);
+            return rc;
+        }
+        locked = true;
+    }
+
+    *state = !n->write_lock && !n->read_lock ? "none" :
+            locked ? "locked" : "unchanged";
+
+    return tool_rc_success;
+}
+
+static tool_rc provision_one(ESYS_CONTEXT *ectx, provision_nv *n,
+        TPML_HANDLE *defined) {
+
+    const char *define_state;
+    tool_rc rc = define_index(ectx, n, defined, &define_state);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    const char *write_state;
+    rc = write_data(ectx, n, &write_state);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    const char *lock_state;
+    rc = lock_index(ectx, n, &lock_state);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    tpm2_tool_output("0x%x:\n", n->index);
+    tpm2_tool_output("  define: %s\n", define_state);
+    tpm2_tool_output("  write: %s\n", write_state);
+    tpm2_tool_output("  lock: %s\n", lock_state);
+
+    return tool_rc_success;
+}
+
+static bool on_option(char key, char *value) {
+
+    switch (key) {
+    case 'w':
+        ctx.auth.owner.auth_str = value;
+        break;
+    case 'p':
+        ctx.auth.platform.auth_str = value;
+        break;
+    }
+
+    return true;
+}
+
+static bool on_arg(int argc, char **argv) {
+
+    if (argc != 1) {
+        LOG_ERR("Expected one manifest file, got: %d", argc);
+        return false;
+    }
+
+    ctx.manifest_path = argv[0];
+
+    return true;
+}
+
+bool tpm2_tool_onstart(tpm2_options **opts) {
+
+    const struct option topts[] = {
+        { "owner-auth",    required_argument, NULL, 'w' },
+        { "platform-auth", required_argument, NULL, 'p' },
+    };
+
+    *opts = tpm2_options_new("w:p:", ARRAY_LEN(topts), topts, on_option,
+                             on_arg, 0);
+
+    return *opts != NULL;
+}
+
+tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
+
+    UNUSED(flags);
+
+    if (!ctx.manifest_path) {
+        LOG_ERR("Expected a manifest file argument");
+        return tool_rc_option_error;
+    }
+
+    FILE *f = strcmp(ctx.manifest_path, "-") ?
+            fopen(ctx.manifest_path, "r") : stdin;
+    if (!f) {
+        LOG_ERR("Could not open manifest \"%s\", error: %s",
+                ctx.manifest_path, strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    bool result = parse_manifest(f);
+    if (f != stdin) {
+        fclose(f);
+    }
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = validate_indices(ectx);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    rc = tpm2_auth_util_from_optarg(ectx, ctx.auth.owner.auth_str,
+            &ctx.auth.owner.session, false);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Invalid owner authorization");
+        return rc;
+    }
+
+    rc = tpm2_auth_util_from_optarg(ectx, ctx.auth.platform.auth_str,
+            &ctx.auth.platform.session, false);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Invalid platform authorization");
+        return rc;
+    }
+
+    /* one snapshot of the defined indices serves the whole manifest */
+    TPMS_CAPABILITY_DATA *cap_data = NULL;
+    rc = tpm2_capability_get(ectx, TPM2_CAP_HANDLES, TPM2_NV_INDEX_FIRST,
+            TPM2_MAX_CAP_HANDLES, &cap_data);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    size_t i;
+    for (i = 0; i < ctx.count; i++) {
+        rc = provision_one(ectx, &ctx.indices[i], &cap_data->data.handles);
+        if (rc != tool_rc_success) {
+            break;
+        }
+    }
+
+    free(cap_data);
+
+    return rc;
+}
+
+tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
+
+    tool_rc rc = tool_rc_success;
+
+    size_t i;
+    for (i = 0; i < ctx.count; i++) {
+        provision_nv *n = &ctx.indices[i];
+        if (n->tr_handle != ESYS_TR_NONE) {
+            tool_rc tmp_rc = tpm2_close(ectx, &n->tr_handle);
+            if (tmp_rc != tool_rc_success) {
+                rc = tmp_rc;
+            }
+        }
+
+        tool_rc tmp_rc = tpm2_session_close(&n->session);
+        if (tmp_rc != tool_rc_success) {
+            rc = tmp_rc;
+        }
+    }
+
+    tpm2_session **sessions[] = {
+        &ctx.auth.owner.session,
+        &ctx.auth.platform.session,
+    };
+
+    for (i = 0; i < ARRAY_LEN(sessions); i++) {
+        tool_rc tmp_rc = tpm2_session_close(sessions[i]);
+        if (tmp_rc != tool_rc_success) {
+            rc = tmp_rc;
+        }
+    }
+
+    return rc;
+}
+
+void tpm2_tool_onexit(void) {
+
+    size_t i;
+    for (i = 0; i < ctx.count; i++) {
+        provision_nv *n = &ctx.indices[i];
+        free(n->hierarchy_str);
+        free(n->size_str);
+        free(n->attrs_str);
+        free(n->halg);
+        free(n->policy);
+        free(n->auth_str);
+        free(n->data_path);
+        free(n->lock);
+        free(n->data);
+    }
+
+    free(ctx.indices);
+}
@@ -35,15 +35,19 @@ static tool_rc nv_read(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         goto out;
     }
 
-    /* dump data_buffer to output file, if specified */
-    if (ctx.output_file) {
-        if (!files_save_bytes_to_file(ctx.output_file, data_buffer, bytes_written)) {
+    /* dump data_buffer to output file, if specified, else use stdout if
+     * quiet is not specified */
+    if (ctx.output_file || !flags.quiet) {
+        files_sink sink;
+        if (!files_sink_open(&sink, ctx.output_file, true)) {
             rc = tool_rc_general_error;
             goto out;
         }
-    /* else use stdout if quiet is not specified */
-    } else if (!flags.quiet) {
-        if (!files_write_bytes(stdout, data_buffer, bytes_written)) {
+
+        bool result = files_sink_write(&sink, data_buffer, bytes_written)
+                && files_sink_commit(&sink);
+        files_sink_close(&sink);
+        if (!result) {
             rc = tool_rc_general_error;
             goto out;
         }
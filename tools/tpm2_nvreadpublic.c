@@ -1,12 +1,61 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
 #include <stdlib.h>
+#include <string.h>
 
+#include <openssl/evp.h>
+#include <tss2/tss2_mu.h>
+
+#include "files.h"
 #include "tpm2_alg_util.h"
 #include "tpm2_attr_util.h"
 #include "tpm2_nv_util.h"
+#include "tpm2_openssl.h"
 #include "tpm2_tool.h"
 
+#define NV_CACHE_MAGIC 0x4E56494E
+#define NV_CACHE_VERSION 2
+
+typedef enum nv_contents nv_contents;
+enum nv_contents {
+    nv_contents_none = 0,
+    nv_contents_hashed,
+    nv_contents_unwritten,
+    nv_contents_unreadable,
+};
+
+typedef struct nv_entry nv_entry;
+struct nv_entry {
+    TPMI_RH_NV_INDEX index;
+    TPM2B_NAME name;
+    TPM2B_NV_PUBLIC public;
+    nv_contents contents;
+    TPMI_ALG_HASH halg;
+    TPM2B_DIGEST digest;
+};
+
+typedef struct tpm_nvreadpublic_ctx tpm_nvreadpublic_ctx;
+struct tpm_nvreadpublic_ctx {
+    struct {
+        bool enabled;
+        TPMI_ALG_HASH halg;
+        const char *cache_path;
+        UINT32 max_read;
+        nv_entry *entries;
+        UINT32 count;
+        nv_entry *cache;
+        UINT32 cache_count;
+        UINT32 cache_hits;
+    } inventory;
+};
+
+static tpm_nvreadpublic_ctx ctx = {
+    .inventory = {
+        .halg = TPM2_ALG_NULL,
+    },
+};
+
 static void print_nv_public(TPM2B_NV_PUBLIC *nv_public) {
 
     char *attrs = tpm2_attr_util_nv_attrtostr(nv_public->nvPublic.attributes);
@@ -81,9 +130,459 @@ static tool_rc nv_readpublic(ESYS_CONTEXT *context) {
     return tool_rc_success;
 }
 
+static void print_nv_entry(nv_entry *e) {
+
+    tpm2_tool_output("0x%x:\n", e->index);
+    tpm2_tool_output("  name: ");
+    tpm2_util_print_tpm2b(&e->name);
+    tpm2_tool_output("\n");
+
+    print_nv_public(&e->public);
+
+    switch (e->contents) {
+    case nv_contents_hashed:
+        tpm2_tool_output("  contents:\n");
+        tpm2_tool_output("    hash algorithm: %s\n",
+                tpm2_alg_util_algtostr(e->halg, tpm2_alg_util_flags_hash));
+        tpm2_tool_output("    digest: ");
+        tpm2_util_print_tpm2b(&e->digest);
+        tpm2_tool_output("\n");
+        break;
+    case nv_contents_unwritten:
+        tpm2_tool_output("  contents: unwritten\n");
+        break;
+    case nv_contents_unreadable:
+        tpm2_tool_output("  contents: unreadable\n");
+        break;
+    case nv_contents_none:
+        break;
+    }
+
+    tpm2_tool_output("\n");
+}
+
+/*
+ * A cache entry holds what a later run reuses: the name to match the index
+ * against, and the public area. The contents are hashed again every run.
+ */
+static bool write_entry(FILE *f, nv_entry *e) {
+
+    UINT8 buffer[sizeof(TPM2B_NV_PUBLIC)];
+    size_t offset = 0;
+    TSS2_RC rval = Tss2_MU_TPM2B_NAME_Marshal(&e->name, buffer,
+            sizeof(buffer), &offset);
+    if (rval != TSS2_RC_SUCCESS || !files_write_frame(f, buffer, offset)) {
+        return false;
+    }
+
+    offset = 0;
+    rval = Tss2_MU_TPM2B_NV_PUBLIC_Marshal(&e->public, buffer,
+            sizeof(buffer), &offset);
+    if (rval != TSS2_RC_SUCCESS || !files_write_frame(f, buffer, offset)) {
+        return false;
+    }
+
+    return files_write_32(f, e->index);
+}
+
+static bool read_entry(FILE *f, nv_entry *e) {
+
+    UINT8 buffer[sizeof(TPM2B_NV_PUBLIC)];
+    UINT16 size = sizeof(buffer);
+    size_t offset = 0;
+    bool eof;
+    if (!files_read_frame(f, buffer, &size, &eof) || eof
+            || Tss2_MU_TPM2B_NAME_Unmarshal(buffer, size, &offset, &e->name)
+                != TSS2_RC_SUCCESS) {
+        return false;
+    }
+
+    size = sizeof(buffer);
+    offset = 0;
+    if (!files_read_frame(f, buffer, &size, &eof) || eof
+            || Tss2_MU_TPM2B_NV_PUBLIC_Unmarshal(buffer, size, &offset,
+                    &e->public) != TSS2_RC_SUCCESS) {
+        return false;
+    }
+
+    return files_read_32(f, &e->index);
+}
+
+/*
+ * Loads the entries of a previous inventory. A missing or malformed cache
+ * is not an error, every index is then read from the TPM.
+ */
+static void cache_load(const char *path) {
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        LOG_INFO("No NV inventory cache at \"%s\"", path);
+        return;
+    }
+
+    UINT32 magic = 0, version = 0, count = 0;
+    bool result = files_read_32(f, &magic)
+        && files_read_32(f, &version)
+        && files_read_32(f, &count);
+    if (!result || magic != NV_CACHE_MAGIC || version != NV_CACHE_VERSION
+            || count > TPM2_MAX_CAP_HANDLES) {
+        LOG_WARN("Ignoring NV inventory cache \"%s\" of unknown format",
+                path);
+        goto out;
+    }
+
+    ctx.inventory.cache = calloc(count ? count : 1, sizeof(nv_entry));
+    if (!ctx.inventory.cache) {
+        LOG_ERR("oom");
+        goto out;
+    }
+
+    UINT32 i;
+    for (i = 0; i < count; i++) {
+        if (!read_entry(f, &ctx.inventory.cache[i])) {
+            LOG_WARN("Ignoring truncated NV inventory cache \"%s\"", path);
+            i = 0;
+            break;
+        }
+    }
+    ctx.inventory.cache_count = i;
+
+out:
+    fclose(f);
+}
+
+static tool_rc cache_store(const char *path) {
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        LOG_ERR("Could not open NV inventory cache \"%s\", error: %s", path,
+                strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    bool result = files_write_32(f, NV_CACHE_MAGIC)
+        && files_write_32(f, NV_CACHE_VERSION)
+        && files_write_32(f, ctx.inventory.count);
+
+    UINT32 i;
+    for (i = 0; result && i < ctx.inventory.count; i++) {
+        result = write_entry(f, &ctx.inventory.entries[i]);
+    }
+
+    fclose(f);
+
+    if (!result) {
+        LOG_ERR("Could not write NV inventory cache \"%s\"", path);
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
+/*
+ * The name of an index is the digest of its public area, so a cached entry
+ * with the same name has the same public area.
+ */
+static nv_entry *cache_lookup(nv_entry *e) {
+
+    UINT32 i;
+    for (i = 0; i < ctx.inventory.cache_count; i++) {
+        nv_entry *c = &ctx.inventory.cache[i];
+        if (c->index == e->index && c->name.size == e->name.size
+                && !memcmp(c->name.name, e->name.name, e->name.size)) {
+            return c;
+        }
+    }
+
+    return NULL;
+}
+
+/*
+ * Picks an authorization that reads the index with an empty password
+ * without risking dictionary attack lockout: the hierarchies are not
+ * subject to it, the index only when it has TPMA_NV_NO_DA.
+ */
+static ESYS_TR read_auth(nv_entry *e, ESYS_TR tr_handle) {
+
+    TPMA_NV attrs = e->public.nvPublic.attributes;
+    if (attrs & TPMA_NV_OWNERREAD) {
+        return ESYS_TR_RH_OWNER;
+    }
+    if (attrs & TPMA_NV_PPREAD) {
+        return ESYS_TR_RH_PLATFORM;
+    }
+    if ((attrs & TPMA_NV_AUTHREAD) && (attrs & TPMA_NV_NO_DA)) {
+        return tr_handle;
+    }
+
+    return ESYS_TR_NONE;
+}
+
+/*
+ * Hashes the contents in TPM2_PT_NV_BUFFER_MAX sized reads. The next read
+ * is issued before the previous chunk is hashed, so hashing overlaps the
+ * TPM command. A failed read marks the contents unreadable.
+ */
+static tool_rc hash_contents(ESYS_CONTEXT *ectx, nv_entry *e,
+        ESYS_TR tr_handle) {
+
+    TPMA_NV attrs = e->public.nvPublic.attributes;
+    if (!(attrs & TPMA_NV_WRITTEN)) {
+        e->contents = nv_contents_unwritten;
+        return tool_rc_success;
+    }
+
+    ESYS_TR auth = read_auth(e, tr_handle);
+    if ((attrs & TPMA_NV_READLOCKED) || auth == ESYS_TR_NONE) {
+        e->contents = nv_contents_unreadable;
+        return tool_rc_success;
+    }
+
+    const EVP_MD *md = tpm2_openssl_halg_from_tpmhalg(ctx.inventory.halg);
+    EVP_MD_CTX *mdctx = EVP_MD_CTX_create();
+    if (!mdctx) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    TPM2B_MAX_NV_BUFFER *chunk = NULL;
+    tool_rc rc = tool_rc_general_error;
+    if (!EVP_DigestInit_ex(mdctx, md, NULL)) {
+        LOG_ERR("Could not initialize the digest");
+        goto out;
+    }
+
+    e->contents = nv_contents_unreadable;
+
+    UINT16 size = e->public.nvPublic.dataSize;
+    UINT16 offset = 0;
+    while (offset < size) {
+        UINT16 len = size - offset < ctx.inventory.max_read ?
+                size - offset : ctx.inventory.max_read;
+
+        TSS2_RC rval = Esys_NV_Read_Async(ectx, auth, tr_handle,
+                ESYS_TR_PASSWORD, ESYS_TR_NONE, ESYS_TR_NONE, len, offset);
+        if (rval != TSS2_RC_SUCCESS) {
+            LOG_PERR(Esys_NV_Read_Async, rval);
+            rc = tool_rc_from_tpm(rval);
+            goto out;
+        }
+
+        bool is_hashed = !chunk
+                || EVP_DigestUpdate(mdctx, chunk->buffer, chunk->size);
+        free(chunk);
+        chunk = NULL;
+
+        do {
+            rval = Esys_NV_Read_Finish(ectx, &chunk);
+        } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+        if (rval != TSS2_RC_SUCCESS) {
+            LOG_INFO("Could not read NV index 0x%X: 0x%x", e->index, rval);
+            rc = tool_rc_success;
+            goto out;
+        }
+
+        if (!is_hashed) {
+            LOG_ERR("Could not update the digest");
+            goto out;
+        }
+
+        offset += len;
+    }
+
+    if (chunk && !EVP_DigestUpdate(mdctx, chunk->buffer, chunk->size)) {
+        LOG_ERR("Could not update the digest");
+        goto out;
+    }
+
+    unsigned size_out = 0;
+    if (!EVP_DigestFinal_ex(mdctx, e->digest.buffer, &size_out)) {
+        LOG_ERR("Could not finalize the digest");
+        goto out;
+    }
+    e->digest.size = size_out;
+    e->halg = ctx.inventory.halg;
+    e->contents = nv_contents_hashed;
+
+    rc = tool_rc_success;
+
+out:
+    free(chunk);
+    EVP_MD_CTX_destroy(mdctx);
+
+    return rc;
+}
+
+/*
+ * Fills in an entry: resolving the index, which reads its public area and
+ * name, then the public area itself unless the cache has it and finally
+ * the contents digest. The name only covers the public area, the contents
+ * can be rewritten under the same name, so they are always hashed afresh.
+ */
+static tool_rc inventory_entry(ESYS_CONTEXT *ectx, nv_entry *e,
+        nv_entry *previous) {
+
+    TSS2_RC rval = Esys_TR_FromTPMPublic_Async(ectx, e->index, ESYS_TR_NONE,
+            ESYS_TR_NONE, ESYS_TR_NONE);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_TR_FromTPMPublic_Async, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    /* output the previous entry while the TPM works */
+    if (previous) {
+        print_nv_entry(previous);
+    }
+
+    ESYS_TR tr_handle = ESYS_TR_NONE;
+    do {
+        rval = Esys_TR_FromTPMPublic_Finish(ectx, &tr_handle);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_TR_FromTPMPublic_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    TPM2B_NAME *name = NULL;
+    rval = Esys_TR_GetName(ectx, tr_handle, &name);
+    if (rval != TSS2_RC_SUCCESS) {
+        LOG_PERR(Esys_TR_GetName, rval);
+        tpm2_close(ectx, &tr_handle);
+        return tool_rc_from_tpm(rval);
+    }
+    e->name = *name;
+    free(name);
+
+    tool_rc rc = tool_rc_success;
+    tool_rc tmp_rc;
+    nv_entry *cached = cache_lookup(e);
+    if (cached) {
+        e->public = cached->public;
+        ctx.inventory.cache_hits++;
+    } else {
+        TPM2B_NV_PUBLIC *nv_public = NULL;
+        rc = tpm2_nv_readpublic(ectx, tr_handle, ESYS_TR_NONE, ESYS_TR_NONE,
+                ESYS_TR_NONE, &nv_public, NULL);
+        if (rc != tool_rc_success) {
+            LOG_ERR("Failed to read the public part of NV index 0x%X",
+                    e->index);
+            goto out;
+        }
+        e->public = *nv_public;
+        free(nv_public);
+    }
+
+    if (ctx.inventory.halg == TPM2_ALG_NULL) {
+        goto out;
+    }
+
+    rc = hash_contents(ectx, e, tr_handle);
+
+out:
+    tmp_rc = tpm2_close(ectx, &tr_handle);
+    if (rc == tool_rc_success) {
+        rc = tmp_rc;
+    }
+
+    return rc;
+}
+
+/*
+ * Lists every NV index, from one paged TPM2_CAP_HANDLES read, with its
+ * name and optionally a digest of its contents.
+ */
+static tool_rc nv_inventory(ESYS_CONTEXT *ectx) {
+
+    TPMS_CAPABILITY_DATA *cap_data = NULL;
+    tool_rc rc = tpm2_capability_get(ectx, TPM2_CAP_HANDLES,
+            TPM2_NV_INDEX_FIRST, TPM2_MAX_CAP_HANDLES, &cap_data);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TPML_HANDLE *handles = &cap_data->data.handles;
+    ctx.inventory.entries = calloc(handles->count ? handles->count : 1,
+            sizeof(nv_entry));
+    if (!ctx.inventory.entries) {
+        LOG_ERR("oom");
+        free(cap_data);
+        return tool_rc_general_error;
+    }
+
+    UINT32 i;
+    for (i = 0; i < handles->count; i++) {
+        ctx.inventory.entries[i].index = handles->handle[i];
+    }
+    ctx.inventory.count = handles->count;
+    free(cap_data);
+
+    if (ctx.inventory.halg != TPM2_ALG_NULL) {
+        rc = tpm2_util_nv_max_buffer_size(ectx, &ctx.inventory.max_read);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+        UINT16 max = BUFFER_SIZE(TPM2B_MAX_NV_BUFFER, buffer);
+        if (!ctx.inventory.max_read || ctx.inventory.max_read > max) {
+            ctx.inventory.max_read = max;
+        }
+    }
+
+    if (ctx.inventory.cache_path) {
+        cache_load(ctx.inventory.cache_path);
+    }
+
+    for (i = 0; i < ctx.inventory.count; i++) {
+        rc = inventory_entry(ectx, &ctx.inventory.entries[i],
+                i ? &ctx.inventory.entries[i - 1] : NULL);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+    }
+
+    if (ctx.inventory.count) {
+        print_nv_entry(&ctx.inventory.entries[ctx.inventory.count - 1]);
+    }
+
+    LOG_INFO("Inventoried %u NV indices, %u public areas from the cache",
+            ctx.inventory.count, ctx.inventory.cache_hits);
+
+    return ctx.inventory.cache_path ?
+            cache_store(ctx.inventory.cache_path) : tool_rc_success;
+}
+
+static bool on_option(char key, char *value) {
+
+    switch (key) {
+    case 'g':
+        ctx.inventory.halg = tpm2_alg_util_from_optarg(value,
+                tpm2_alg_util_flags_hash);
+        if (ctx.inventory.halg == TPM2_ALG_ERROR) {
+            LOG_ERR("Invalid choice for contents hash algorithm");
+            return false;
+        }
+        ctx.inventory.enabled = true;
+        break;
+    case 0:
+        ctx.inventory.enabled = true;
+        break;
+    case 1:
+        ctx.inventory.cache_path = value;
+        ctx.inventory.enabled = true;
+        break;
+    }
+
+    return true;
+}
+
 bool tpm2_tool_onstart(tpm2_options **opts) {
 
-    *opts = tpm2_options_new(NULL, 0, NULL, NULL, NULL,
+    const struct option topts[] = {
+        { "hash-algorithm", required_argument, NULL, 'g' },
+        { "inventory",      no_argument,       NULL, 0 },
+        { "cache",          required_argument, NULL, 1 },
+    };
+
+    *opts = tpm2_options_new("g:", ARRAY_LEN(topts), topts, on_option, NULL,
             0);
 
     return *opts != NULL;
@@ -93,5 +592,16 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *context, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
-    return nv_readpublic(context);
+    return ctx.inventory.enabled ? nv_inventory(context) :
+            nv_readpublic(context);
+}
+
+tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
+
+    UNUSED(ectx);
+
+    free(ctx.inventory.entries);
+    free(ctx.inventory.cache);
+
+    return tool_rc_success;
 }
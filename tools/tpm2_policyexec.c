@@ -0,0 +1,578 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "pcr.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_cc_util.h"
+#include "tpm2_policy.h"
+#include "tpm2_tool.h"
+
+#define SCRIPT_LINE_MAX 1024
+#define STEP_ARGS_MAX 4
+
+typedef enum policy_cmd policy_cmd;
+enum policy_cmd {
+    policy_cmd_pcr = 0,
+    policy_cmd_commandcode,
+    policy_cmd_locality,
+    policy_cmd_password,
+    policy_cmd_secret,
+    policy_cmd_or,
+    policy_cmd_authorize,
+    policy_cmd_duplicationselect,
+};
+
+typedef struct policy_cmd_info policy_cmd_info;
+struct policy_cmd_info {
+    const char *name;
+    policy_cmd cmd;
+    int min_args;
+    int max_args;
+};
+
+static const policy_cmd_info cmd_table[] = {
+    { "pcr",               policy_cmd_pcr,               1, 2 },
+    { "commandcode",       policy_cmd_commandcode,       1, 1 },
+    { "locality",          policy_cmd_locality,          1, 1 },
+    { "password",          policy_cmd_password,          0, 0 },
+    { "secret",            policy_cmd_secret,            1, 2 },
+    { "or",                policy_cmd_or,                1, 1 },
+    { "authorize",         policy_cmd_authorize,         4, 4 },
+    { "duplicationselect", policy_cmd_duplicationselect, 2, 3 },
+};
+
+typedef struct policy_step policy_step;
+struct policy_step {
+    const policy_cmd_info *info;
+    unsigned lineno;
+    char *line;
+    char *argv[STEP_ARGS_MAX];
+    int argc;
+    union {
+        TPML_PCR_SELECTION pcrs;
+        TPM2_CC command_code;
+        TPMA_LOCALITY locality;
+        TPML_DIGEST policy_list;
+    } arg;
+};
+
+typedef struct tpm2_policyexec_ctx tpm2_policyexec_ctx;
+struct tpm2_policyexec_ctx {
+    const char *script_path;
+    const char *session_path;
+    const char *out_policy_dgst_path;
+    TPMI_ALG_HASH halg;
+    bool trial_first;
+
+    policy_step *steps;
+    size_t count;
+
+    tpm2_session *session;
+    TPM2B_DIGEST *trial_digest;
+};
+
+static tpm2_policyexec_ctx ctx = {
+    .halg = TPM2_ALG_SHA256,
+};
+
+static const policy_cmd_info *find_cmd(const char *name) {
+
+    size_t i;
+    for (i = 0; i < ARRAY_LEN(cmd_table); i++) {
+        if (!strcmp(cmd_table[i].name, name)) {
+            return &cmd_table[i];
+        }
+    }
+
+    return NULL;
+}
+
+/* "-" leaves an optional file argument out */
+static const char *optional_path(policy_step *s, int i) {
+
+    if (i >= s->argc || !strcmp(s->argv[i], "-")) {
+        return NULL;
+    }
+
+    return s->argv[i];
+}
+
+static bool parse_locality(const char *str, TPMA_LOCALITY *locality) {
+
+    if (!strcmp(str, "zero")) {
+        *locality = TPMA_LOCALITY_TPM2_LOC_ZERO;
+    } else if (!strcmp(str, "one")) {
+        *locality = TPMA_LOCALITY_TPM2_LOC_ONE;
+    } else if (!strcmp(str, "two")) {
+        *locality = TPMA_LOCALITY_TPM2_LOC_TWO;
+    } else if (!strcmp(str, "three")) {
+        *locality = TPMA_LOCALITY_TPM2_LOC_THREE;
+    } else if (!strcmp(str, "four")) {
+        *locality = TPMA_LOCALITY_TPM2_LOC_FOUR;
+    } else {
+        return tpm2_util_string_to_uint8(str, locality);
+    }
+
+    return true;
+}
+
+static bool parse_policy_list(const char *str, TPML_DIGEST *policy_list) {
+
+    /* the list is tokenized in place, keep the original for the log */
+    char *list = strdup(str);
+    if (!list) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    policy_list->count = 0;
+    bool result = tpm2_policy_parse_policy_list(list, policy_list);
+    free(list);
+
+    return result;
+}
+
+/*
+ * Converts the arguments that do not depend on TPM state once, so a script
+ * error is reported before any command is sent.
+ */
+static bool parse_step_args(policy_step *s) {
+
+    bool result = true;
+
+    switch (s->info->cmd) {
+    case policy_cmd_pcr:
+        result = pcr_parse_selections(s->argv[0], &s->arg.pcrs);
+        break;
+    case policy_cmd_commandcode:
+        result = tpm2_cc_util_from_str(s->argv[0], &s->arg.command_code);
+        break;
+    case policy_cmd_locality:
+        result = parse_locality(s->argv[0], &s->arg.locality);
+        break;
+    case policy_cmd_or:
+        result = parse_policy_list(s->argv[0], &s->arg.policy_list);
+        break;
+    case policy_cmd_duplicationselect:
+        if (s->argc == 3 && strcmp(s->argv[2], "include")) {
+            LOG_ERR("%s:%u: Expected \"include\", got: \"%s\"",
+                    ctx.script_path, s->lineno, s->argv[2]);
+            return false;
+        }
+        break;
+    default:
+        break;
+    }
+
+    if (!result) {
+        LOG_ERR("%s:%u: Invalid argument to \"%s\", got: \"%s\"",
+                ctx.script_path, s->lineno, s->info->name, s->argv[0]);
+    }
+
+    return result;
+}
+
+static bool add_step(char *line, unsigned lineno) {
+
+    policy_step *tmp = realloc(ctx.steps, (ctx.count + 1) * sizeof(*tmp));
+    if (!tmp) {
+        LOG_ERR("oom");
+        return false;
+    }
+    ctx.steps = tmp;
+
+    policy_step *s = &ctx.steps[ctx.count++];
+    memset(s, 0, sizeof(*s));
+    s->lineno = lineno;
+
+    s->line = strdup(line);
+    if (!s->line) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    char *saveptr = NULL;
+    char *name = strtok_r(s->line, " \t", &saveptr);
+
+    s->info = find_cmd(name);
+    if (!s->info) {
+        LOG_ERR("%s:%u: Unknown policy command \"%s\"", ctx.script_path,
+                lineno, name);
+        return false;
+    }
+
+    char *token;
+    while ((token = strtok_r(NULL, " \t", &saveptr))) {
+        if (s->argc == s->info->max_args) {
+            LOG_ERR("%s:%u: Too many arguments to \"%s\"", ctx.script_path,
+                    lineno, s->info->name);
+            return false;
+        }
+        s->argv[s->argc++] = token;
+    }
+
+    if (s->argc < s->info->min_args) {
+        LOG_ERR("%s:%u: \"%s\" expects at least %d argument(s), got %d",
+                ctx.script_path, lineno, s->info->name, s->info->min_args,
+                s->argc);
+        return false;
+    }
+
+    return parse_step_args(s);
+}
+
+/*
+ * The script holds one policy command per line, named after the tool
+ * implementing it without the "tpm2_policy" prefix, followed by that
+ * command's arguments. Blank lines and lines starting with '#' are ignored.
+ */
+static bool parse_script(FILE *f) {
+
+    char line[SCRIPT_LINE_MAX];
+    unsigned lineno = 0;
+
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+
+        if (!strchr(line, '\n') && !feof(f)) {
+            LOG_ERR("%s:%u: Line exceeds %u characters", ctx.script_path,
+                    lineno, SCRIPT_LINE_MAX - 2);
+            return false;
+        }
+
+        char *s = tpm2_util_trim(line);
+        if (!s[0] || s[0] == '#') {
+            continue;
+        }
+
+        if (!add_step(s, lineno)) {
+            return false;
+        }
+    }
+
+    if (ferror(f)) {
+        LOG_ERR("Error reading policy script \"%s\"", ctx.script_path);
+        return false;
+    }
+
+    if (!ctx.count) {
+        LOG_ERR("Policy script \"%s\" is empty", ctx.script_path);
+        return false;
+    }
+
+    return true;
+}
+
+static bool load_script(void) {
+
+    FILE *f = fopen(ctx.script_path, "r");
+    if (!f) {
+        LOG_ERR("Could not open policy script \"%s\", error: %s",
+                ctx.script_path, strerror(errno));
+        return false;
+    }
+
+    bool result = parse_script(f);
+
+    fclose(f);
+
+    return result;
+}
+
+static tool_rc run_secret(ESYS_CONTEXT *ectx, tpm2_session *session,
+        policy_step *s) {
+
+    const char *auth_str = s->argc > 1 ? s->argv[1] : NULL;
+
+    tpm2_loaded_object object;
+    tool_rc rc = tpm2_util_object_load_auth(ectx, s->argv[0], auth_str,
+            &object, true, TPM2_HANDLE_ALL_W_NV);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    rc = tpm2_policy_build_policysecret(ectx, session, &object);
+    tool_rc tmp_rc = tpm2_session_close(&object.session);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    return tmp_rc;
+}
+
+static tool_rc run_step(ESYS_CONTEXT *ectx, tpm2_session *session,
+        policy_step *s) {
+
+    switch (s->info->cmd) {
+    case policy_cmd_pcr:
+        return tpm2_policy_build_pcr(ectx, session, optional_path(s, 1),
+                &s->arg.pcrs);
+    case policy_cmd_commandcode:
+        return tpm2_policy_build_policycommandcode(ectx, session,
+                s->arg.command_code);
+    case policy_cmd_locality:
+        return tpm2_policy_build_policylocality(ectx, session,
+                s->arg.locality);
+    case policy_cmd_password:
+        return tpm2_policy_build_policypassword(ectx, session);
+    case policy_cmd_secret:
+        return run_secret(ectx, session, s);
+    case policy_cmd_or:
+        return tpm2_policy_build_policyor(ectx, session, &s->arg.policy_list);
+    case policy_cmd_authorize:
+        return tpm2_policy_build_policyauthorize(ectx, session, s->argv[0],
+                optional_path(s, 1), s->argv[2], optional_path(s, 3));
+    case policy_cmd_duplicationselect:
+        return tpm2_policy_build_policyduplicationselect(ectx, session,
+                optional_path(s, 0), s->argv[1],
+                s->argc == 3 ? TPM2_YES : TPM2_NO);
+    }
+
+    return tool_rc_general_error;
+}
+
+static tool_rc run_script(ESYS_CONTEXT *ectx, tpm2_session *session) {
+
+    size_t i;
+    for (i = 0; i < ctx.count; i++) {
+        policy_step *s = &ctx.steps[i];
+        tool_rc rc = run_step(ectx, session, s);
+        if (rc != tool_rc_success) {
+            LOG_ERR("%s:%u: Could not run policy command \"%s\"",
+                    ctx.script_path, s->lineno, s->info->name);
+            return rc;
+        }
+    }
+
+    return tool_rc_success;
+}
+
+static tool_rc start_trial_session(ESYS_CONTEXT *ectx, TPMI_ALG_HASH halg,
+        tpm2_session **session) {
+
+    tpm2_session_data *d = tpm2_session_data_new(TPM2_SE_TRIAL);
+    if (!d) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    tpm2_session_set_authhash(d, halg);
+
+    return tpm2_session_open(ectx, d, session);
+}
+
+/*
+ * A trial session starts from an empty policy digest and cannot be seeded,
+ * so its digest only predicts that of a session nothing was run on yet.
+ */
+static tool_rc check_session_unused(ESYS_CONTEXT *ectx) {
+
+    TPM2B_DIGEST *digest = NULL;
+    tool_rc rc = tpm2_policy_get_digest(ectx, ctx.session, &digest);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    UINT16 i;
+    for (i = 0; i < digest->size && !digest->buffer[i]; i++);
+    bool is_empty = i == digest->size;
+    free(digest);
+
+    if (!is_empty) {
+        LOG_ERR("--trial-first requires a session with an empty policy "
+                "digest, session \"%s\" was already extended",
+                ctx.session_path);
+        return tool_rc_option_error;
+    }
+
+    return tool_rc_success;
+}
+
+/*
+ * Runs the script against a throwaway trial session, so mistakes in it are
+ * caught before the real session is extended, and remembers the digest the
+ * real session is expected to end up with.
+ */
+static tool_rc run_trial(ESYS_CONTEXT *ectx) {
+
+    tool_rc rc = check_session_unused(ectx);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    tpm2_session *trial = NULL;
+    rc = start_trial_session(ectx,
+            tpm2_session_get_authhash(ctx.session), &trial);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    rc = run_script(ectx, trial);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Trial run failed, session \"%s\" was not modified",
+                ctx.session_path);
+        goto out;
+    }
+
+    rc = tpm2_policy_get_digest(ectx, trial, &ctx.trial_digest);
+
+out:
+    {
+        tool_rc tmp_rc = tpm2_session_close(&trial);
+        if (rc == tool_rc_success) {
+            rc = tmp_rc;
+        }
+    }
+
+    return rc;
+}
+
+static tool_rc check_trial_digest(ESYS_CONTEXT *ectx) {
+
+    TPM2B_DIGEST *digest = NULL;
+    tool_rc rc = tpm2_policy_get_digest(ectx, ctx.session, &digest);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    bool is_equal = digest->size == ctx.trial_digest->size
+            && !memcmp(digest->buffer, ctx.trial_digest->buffer,
+                    digest->size);
+    free(digest);
+
+    if (!is_equal) {
+        LOG_ERR("Policy digest of session \"%s\" differs from the trial run",
+                ctx.session_path);
+        tpm2_tool_output("expected: ");
+        tpm2_util_hexdump(ctx.trial_digest->buffer, ctx.trial_digest->size);
+        tpm2_tool_output("\n");
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
+static bool on_option(char key, char *value) {
+
+    switch (key) {
+    case 'S':
+        ctx.session_path = value;
+        break;
+    case 'L':
+        ctx.out_policy_dgst_path = value;
+        break;
+    case 'g':
+        ctx.halg = tpm2_alg_util_from_optarg(value, tpm2_alg_util_flags_hash);
+        if (ctx.halg == TPM2_ALG_ERROR) {
+            LOG_ERR("Invalid choice for policy digest hash algorithm");
+            return false;
+        }
+        break;
+    case 0:
+        ctx.trial_first = true;
+        break;
+    }
+
+    return true;
+}
+
+static bool on_arg(int argc, char **argv) {
+
+    if (argc != 1) {
+        LOG_ERR("Specify a single policy script, got %d", argc);
+        return false;
+    }
+
+    ctx.script_path = argv[0];
+
+    return true;
+}
+
+bool tpm2_tool_onstart(tpm2_options **opts) {
+
+    static struct option topts[] = {
+        { "session",        required_argument, NULL, 'S' },
+        { "policy",         required_argument, NULL, 'L' },
+        { "hash-algorithm", required_argument, NULL, 'g' },
+        { "trial-first",    no_argument,       NULL,  0  },
+    };
+
+    *opts = tpm2_options_new("S:L:g:", ARRAY_LEN(topts), topts, on_option,
+            on_arg, 0);
+
+    return *opts != NULL;
+}
+
+tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
+
+    UNUSED(flags);
+
+    if (!ctx.script_path) {
+        LOG_ERR("Must specify a policy script");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.trial_first && !ctx.session_path) {
+        LOG_ERR("--trial-first requires a session with -S");
+        return tool_rc_option_error;
+    }
+
+    bool result = load_script();
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    /*
+     * Without a session file the script only computes its policy digest,
+     * like tpm2_createpolicy does.
+     */
+    tool_rc rc = ctx.session_path ?
+            tpm2_session_restore(ectx, ctx.session_path, false, &ctx.session) :
+            start_trial_session(ectx, ctx.halg, &ctx.session);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    if (ctx.trial_first) {
+        rc = run_trial(ectx);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+    }
+
+    rc = run_script(ectx, ctx.session);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    if (ctx.trial_first) {
+        rc = check_trial_digest(ectx);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+    }
+
+    return tpm2_policy_tool_finish(ectx, ctx.session, ctx.out_policy_dgst_path);
+}
+
+tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
+    UNUSED(ectx);
+
+    free(ctx.trial_digest);
+
+    return tpm2_session_close(&ctx.session);
+}
+
+void tpm2_tool_onexit(void) {
+
+    size_t i;
+    for (i = 0; i < ctx.count; i++) {
+        free(ctx.steps[i].line);
+    }
+    free(ctx.steps);
+}
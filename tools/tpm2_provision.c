@@ -0,0 +1,797 @@
+/* SPDX-License-Identifier: BSD-3-Clause */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "files.h"
+#include "log.h"
+#include "tpm2.h"
+#include "tpm2_alg_util.h"
+#include "tpm2_auth_util.h"
+#include "tpm2_capability.h"
+#include "tpm2_convert.h"
+#include "tpm2_ctx_mgmt.h"
+#include "tpm2_hierarchy.h"
+#include "tpm2_manifest.h"
+#include "tpm2_tool.h"
+
+#define PRIMARY_DEFAULT_ATTRS \
+     TPMA_OBJECT_RESTRICTED|TPMA_OBJECT_DECRYPT \
+    |TPMA_OBJECT_FIXEDTPM|TPMA_OBJECT_FIXEDPARENT \
+    |TPMA_OBJECT_SENSITIVEDATAORIGIN|TPMA_OBJECT_USERWITHAUTH
+
+#define KEY_DEFAULT_ATTRS \
+     TPMA_OBJECT_DECRYPT|TPMA_OBJECT_SIGN_ENCRYPT|TPMA_OBJECT_FIXEDTPM \
+    |TPMA_OBJECT_FIXEDPARENT|TPMA_OBJECT_SENSITIVEDATAORIGIN \
+    |TPMA_OBJECT_USERWITHAUTH
+
+#define DEFAULT_PRIMARY_KEY_ALG "rsa2048:null:aes128cfb"
+#define DEFAULT_KEY_ALG "rsa2048"
+
+
+typedef enum provision_state provision_state;
+enum provision_state {
+    provision_state_new = 0,
+    provision_state_visiting,
+    provision_state_ordered,
+};
+
+/* a public portion export, a key may have several */
+typedef struct provision_public provision_public;
+struct provision_public {
+    char *path;
+    tpm2_convert_pubkey_fmt format;
+};
+
+typedef struct provision_key provision_key;
+struct provision_key {
+    char *name;
+    char *parent_name;
+    char *hierarchy_str;
+    char *alg;
+    char *halg;
+    char *attrs;
+    char *policy;
+    char *auth_str;
+    provision_public *publics;
+    size_t public_count;
+    TPMI_DH_PERSISTENT persist_handle;
+    unsigned lineno;
+
+    provision_key *parent;
+    TPMI_RH_PROVISION hierarchy;
+    provision_state state;
+    ESYS_TR tr_handle;
+};
+
+typedef struct tpm_provision_ctx tpm_provision_ctx;
+struct tpm_provision_ctx {
+    const char *manifest_path;
+    struct {
+        struct {
+            char *auth_str;
+            tpm2_session *session;
+        } owner;
+        struct {
+            char *auth_str;
+            tpm2_session *session;
+        } endorse;
+        struct {
+            char *auth_str;
+            tpm2_session *session;
+        } platform;
+    } auth;
+
+    provision_key *keys;
+    size_t count;
+    /* creation order, parents before their children */
+    provision_key **order;
+    size_t ordered;
+};
+
+static tpm_provision_ctx ctx;
+
+static bool add_public(provision_key *k, const char *path) {
+
+    provision_public *tmp = realloc(k->publics,
+            (k->public_count + 1) * sizeof(*tmp));
+    if (!tmp) {
+        LOG_ERR("oom");
+        return false;
+    }
+    k->publics = tmp;
+
+    provision_public *p = &k->publics[k->public_count];
+    p->format = pubkey_format_tss;
+    p->path = strdup(path);
+    if (!p->path) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    k->public_count++;
+
+    return true;
+}
+
+static bool set_field(provision_key *k, const char *field, const char *value,
+        unsigned lineno) {
+
+    if (!strcmp(field, "parent")) {
+        return tpm2_manifest_set_string(&k->parent_name, value);
+    } else if (!strcmp(field, "hierarchy")) {
+        return tpm2_manifest_set_string(&k->hierarchy_str, value);
+    } else if (!strcmp(field, "algorithm")) {
+        return tpm2_manifest_set_string(&k->alg, value);
+    } else if (!strcmp(field, "hash-algorithm")) {
+        return tpm2_manifest_set_string(&k->halg, value);
+    } else if (!strcmp(field, "attributes")) {
+        return tpm2_manifest_set_string(&k->attrs, value);
+    } else if (!strcmp(field, "policy")) {
+        return tpm2_manifest_set_string(&k->policy, value);
+    } else if (!strcmp(field, "auth")) {
+        return tpm2_manifest_set_string(&k->auth_str, value);
+    } else if (!strcmp(field, "public")) {
+        return add_public(k, value);
+    } else if (!strcmp(field, "format")) {
+        /* the format applies to the public export it follows */
+        if (!k->public_count) {
+            LOG_ERR("%s:%u: \"format\" must follow a \"public\" field",
+                    ctx.manifest_path, lineno);
+            return false;
+        }
+        provision_public *p = &k->publics[k->public_count - 1];
+        p->format = tpm2_convert_pubkey_fmt_from_optarg(value);
+        return p->format != pubkey_format_err;
+    } else if (!strcmp(field, "persistent-handle")) {
+        /* "-" asks for a handle out of the vacant-handle plan */
+        if (!strcmp(value, "-")) {
+            k->persist_handle = 0;
+            return true;
+        }
+        bool result = tpm2_util_string_to_uint32(value, &k->persist_handle);
+        if (!result || k->persist_handle < TPM2_PERSISTENT_FIRST
+                || k->persist_handle > TPM2_PERSISTENT_LAST) {
+            LOG_ERR("%s:%u: Invalid persistent handle, expected one of"
+                    " 0x%x to 0x%x, got: \"%s\"", ctx.manifest_path, lineno,
+                    TPM2_PERSISTENT_FIRST, TPM2_PERSISTENT_LAST, value);
+            return false;
+        }
+        return true;
+    }
+
+    LOG_ERR("%s:%u: Unknown field \"%s\"", ctx.manifest_path, lineno, field);
+    return false;
+}
+
+static provision_key *find_key(const char *name) {
+
+    size_t i;
+    for (i = 0; i < ctx.count; i++) {
+        if (!strcmp(ctx.keys[i].name, name)) {
+            return &ctx.keys[i];
+        }
+    }
+
+    return NULL;
+}
+
+static bool add_key(const char *name, unsigned lineno) {
+
+    if (!name[0]) {
+        LOG_ERR("%s:%u: Empty key name", ctx.manifest_path, lineno);
+        return false;
+    }
+
+    if (find_key(name)) {
+        LOG_ERR("%s:%u: Duplicate key \"%s\"", ctx.manifest_path, lineno,
+                name);
+        return false;
+    }
+
+    provision_key *tmp = realloc(ctx.keys, (ctx.count + 1) * sizeof(*tmp));
+    if (!tmp) {
+        LOG_ERR("oom");
+        return false;
+    }
+    ctx.keys = tmp;
+
+    provision_key *k = &ctx.keys[ctx.count++];
+    memset(k, 0, sizeof(*k));
+    k->lineno = lineno;
+    k->tr_handle = ESYS_TR_NONE;
+
+    return tpm2_manifest_set_string(&k->name, name);
+}
+
+static bool on_section(const char *section, unsigned lineno,
+        void *userdata) {
+    UNUSED(userdata);
+
+    return add_key(section, lineno);
+}
+
+static bool on_field(const char *field, const char *value, unsigned lineno,
+        void *userdata) {
+    UNUSED(userdata);
+
+    return set_field(&ctx.keys[ctx.count - 1], field, value, lineno);
+}
+
+/*
+ * The manifest is a list of sections, one per key:
+ *
+ * [name]
+ * field = value
+ *
+ * Blank lines and lines starting with '#' are ignored.
+ */
+static bool parse_manifest(FILE *f) {
+
+    bool result = tpm2_manifest_parse(f, ctx.manifest_path, on_section,
+            on_field, NULL);
+    if (!result) {
+        return false;
+    }
+
+    if (!ctx.count) {
+        LOG_ERR("Manifest \"%s\" does not describe any key",
+                ctx.manifest_path);
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * An explicit handle must be in the persistent sub-range of the hierarchy
+ * persisting the key and unique in the manifest, or EvictControl would only
+ * fail once keys before it were created.
+ */
+static bool check_handle(provision_key *k) {
+
+    if (!k->persist_handle) {
+        return true;
+    }
+
+    bool platform = k->hierarchy == TPM2_RH_PLATFORM;
+    TPMI_DH_PERSISTENT first = platform ?
+            TPM2_PLATFORM_PERSISTENT_FIRST : TPM2_PERSISTENT_FIRST;
+    TPMI_DH_PERSISTENT last = platform ?
+            TPM2_PERSISTENT_LAST : TPM2_OWNER_PERSISTENT_LAST;
+    if (k->persist_handle < first || k->persist_handle > last) {
+        LOG_ERR("%s:%u: Persistent handle 0x%x of key \"%s\" is outside the"
+                " %s sub-range 0x%x to 0x%x", ctx.manifest_path, k->lineno,
+                k->persist_handle, k->name, platform ? "platform" : "owner",
+                first, last);
+        return false;
+    }
+
+    size_t i;
+    for (i = 0; i < ctx.count; i++) {
+        provision_key *other = &ctx.keys[i];
+        if (other != k && other->persist_handle == k->persist_handle) {
+            LOG_ERR("%s:%u: Persistent handle 0x%x of key \"%s\" is also"
+                    " claimed by key \"%s\"", ctx.manifest_path, k->lineno,
+                    k->persist_handle, k->name, other->name);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool order_key(provision_key *k) {
+
+    if (k->state == provision_state_ordered) {
+        return true;
+    }
+
+    if (k->state == provision_state_visiting) {
+        LOG_ERR("%s:%u: Key \"%s\" is part of a parent cycle",
+                ctx.manifest_path, k->lineno, k->name);
+        return false;
+    }
+
+    k->state = provision_state_visiting;
+
+    if (k->parent_name) {
+        if (k->hierarchy_str) {
+            LOG_ERR("%s:%u: Key \"%s\" cannot specify both a parent and a"
+                    " hierarchy", ctx.manifest_path, k->lineno, k->name);
+            return false;
+        }
+
+        k->parent = find_key(k->parent_name);
+        if (!k->parent) {
+            LOG_ERR("%s:%u: Unknown parent \"%s\" for key \"%s\"",
+                    ctx.manifest_path, k->lineno, k->parent_name, k->name);
+            return false;
+        }
+
+        if (!order_key(k->parent)) {
+            return false;
+        }
+
+        k->hierarchy = k->parent->hierarchy;
+    } else {
+        bool result = tpm2_util_handle_from_optarg(
+                k->hierarchy_str ? k->hierarchy_str : "o", &k->hierarchy,
+                TPM2_HANDLE_FLAGS_O|TPM2_HANDLE_FLAGS_P|TPM2_HANDLE_FLAGS_E);
+        if (!result) {
+            LOG_ERR("%s:%u: Invalid hierarchy for key \"%s\", only o, p and e"
+                    " can hold persistent keys", ctx.manifest_path, k->lineno,
+                    k->name);
+            return false;
+        }
+    }
+
+    if (!check_handle(k)) {
+        return false;
+    }
+
+    k->state = provision_state_ordered;
+    ctx.order[ctx.ordered++] = k;
+
+    return true;
+}
+
+static bool order_keys(void) {
+
+    ctx.order = calloc(ctx.count, sizeof(*ctx.order));
+    if (!ctx.order) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    size_t i;
+    for (i = 0; i < ctx.count; i++) {
+        if (!order_key(&ctx.keys[i])) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool is_platform_key(provision_key *k) {
+
+    return k->hierarchy == TPM2_RH_PLATFORM;
+}
+
+static bool is_explicit_handle(TPMI_DH_PERSISTENT handle) {
+
+    size_t i;
+    for (i = 0; i < ctx.count; i++) {
+        if (ctx.keys[i].persist_handle == handle) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Computes the persistent handles for all keys without an explicit one from a
+ * single capability snapshot per sub-range, before anything is created.
+ */
+static tool_rc plan_range(ESYS_CONTEXT *ectx, bool platform) {
+
+    UINT32 wanted = 0;
+    UINT32 claimed = 0;
+    size_t i;
+    for (i = 0; i < ctx.count; i++) {
+        provision_key *k = &ctx.keys[i];
+        if (is_platform_key(k) != platform) {
+            continue;
+        }
+
+        if (k->persist_handle) {
+            claimed++;
+        } else {
+            wanted++;
+        }
+    }
+
+    if (!wanted) {
+        return tool_rc_success;
+    }
+
+    /* over-reserve so handles claimed by the manifest itself can be skipped */
+    TPMI_DH_PERSISTENT *vacant = calloc(wanted + claimed, sizeof(*vacant));
+    if (!vacant) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tpm2_capability_find_vacant_persistent_handles(ectx,
+            platform ? TPM2_RH_PLATFORM : TPM2_RH_OWNER, wanted + claimed,
+            vacant);
+    if (rc != tool_rc_success) {
+        goto out;
+    }
+
+    UINT32 next = 0;
+    for (i = 0; i < ctx.count; i++) {
+        provision_key *k = &ctx.keys[i];
+        if (is_platform_key(k) != platform || k->persist_handle) {
+            continue;
+        }
+
+        while (is_explicit_handle(vacant[next])) {
+            next++;
+        }
+        k->persist_handle = vacant[next++];
+    }
+
+out:
+    free(vacant);
+    return rc;
+}
+
+static tpm2_session *hierarchy_session(TPMI_RH_PROVISION hierarchy) {
+
+    switch (hierarchy) {
+    case TPM2_RH_PLATFORM:
+        return ctx.auth.platform.session;
+    case TPM2_RH_ENDORSEMENT:
+        return ctx.auth.endorse.session;
+    default:
+        return ctx.auth.owner.session;
+    }
+}
+
+static tool_rc set_sensitive(provision_key *k,
+        TPM2B_SENSITIVE_CREATE *sensitive) {
+
+    tpm2_session *tmp;
+    tool_rc rc = tpm2_auth_util_from_optarg(NULL, k->auth_str, &tmp, true);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Invalid key authorization for key \"%s\"", k->name);
+        return rc;
+    }
+
+    const TPM2B_AUTH *auth = tpm2_session_get_auth_value(tmp);
+    sensitive->sensitive.userAuth = *auth;
+
+    tpm2_session_close(&tmp);
+
+    return tool_rc_success;
+}
+
+static tool_rc create_primary(ESYS_CONTEXT *ectx, provision_key *k,
+        ESYS_TR *handle, TPM2B_PUBLIC **public) {
+
+    tpm2_hierarchy_pdata objdata = TPM2_HIERARCHY_DATA_INIT;
+    objdata.in.hierarchy = k->hierarchy;
+
+    tool_rc rc = set_sensitive(k, &objdata.in.sensitive);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    bool result = tpm2_alg_util_public_init(
+            k->alg ? k->alg : DEFAULT_PRIMARY_KEY_ALG, k->halg, k->attrs,
+            k->policy, NULL, PRIMARY_DEFAULT_ATTRS, &objdata.in.public);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    rc = tpm2_hierarchy_create_primary(ectx, hierarchy_session(k->hierarchy),
+            &objdata);
+    if (rc != tool_rc_success) {
+        tpm2_hierarchy_pdata_free(&objdata);
+        return rc;
+    }
+
+    *handle = objdata.out.handle;
+    *public = objdata.out.public;
+    objdata.out.public = NULL;
+    tpm2_hierarchy_pdata_free(&objdata);
+
+    return tool_rc_success;
+}
+
+static tool_rc create_key(ESYS_CONTEXT *ectx, provision_key *k,
+        ESYS_TR *handle, TPM2B_PUBLIC **public) {
+
+    TPM2B_SENSITIVE_CREATE sensitive = TPM2B_SENSITIVE_CREATE_EMPTY_INIT;
+    tool_rc rc = set_sensitive(k, &sensitive);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    char *alg = k->alg ? k->alg : DEFAULT_KEY_ALG;
+    TPMA_OBJECT attrs = KEY_DEFAULT_ATTRS;
+    if (!k->attrs && !strncmp("hmac", alg, 4)) {
+        attrs &= ~TPMA_OBJECT_DECRYPT;
+    }
+
+    TPM2B_PUBLIC in_public;
+    bool result = tpm2_alg_util_public_init(alg, k->halg, k->attrs, k->policy,
+            NULL, attrs, &in_public);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    if (k->policy && !k->auth_str) {
+        in_public.publicArea.objectAttributes &= ~TPMA_OBJECT_USERWITHAUTH;
+    }
+
+    size_t offset = 0;
+    TPM2B_TEMPLATE template = { .size = 0 };
+    rc = tpm2_mu_tpmt_public_marshal(&in_public.publicArea,
+            &template.buffer[0], sizeof(TPMT_PUBLIC), &offset);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+    template.size = offset;
+
+    /* the parent is already persistent, address it by its ESYS_TR */
+    tpm2_loaded_object parent = {
+        .handle = k->parent->persist_handle,
+        .tr_handle = k->parent->tr_handle,
+    };
+    rc = tpm2_auth_util_from_optarg(ectx, k->parent->auth_str,
+            &parent.session, false);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Invalid parent key authorization for key \"%s\"", k->name);
+        return rc;
+    }
+
+    TPM2B_PRIVATE *private = NULL;
+    rc = tpm2_create_loaded(ectx, &parent, &sensitive, &template, handle,
+            &private, public);
+    free(private);
+
+    tool_rc tmp_rc = tpm2_session_close(&parent.session);
+    if (rc == tool_rc_success) {
+        rc = tmp_rc;
+    }
+
+    return rc;
+}
+
+static tool_rc provision_one(ESYS_CONTEXT *ectx, provision_key *k) {
+
+    ESYS_TR transient = ESYS_TR_NONE;
+    TPM2B_PUBLIC *public = NULL;
+
+    tool_rc rc = k->parent ?
+            create_key(ectx, k, &transient, &public) :
+            create_primary(ectx, k, &transient, &public);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to create key \"%s\"", k->name);
+        return rc;
+    }
+
+    /* persist right away so only one transient slot is ever in use */
+    bool platform = is_platform_key(k);
+    rc = tpm2_ctx_mgmt_evictcontrol(ectx,
+            platform ? ESYS_TR_RH_PLATFORM : ESYS_TR_RH_OWNER,
+            platform ? ctx.auth.platform.session : ctx.auth.owner.session,
+            transient, k->persist_handle, &k->tr_handle);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Failed to persist key \"%s\" at 0x%x", k->name,
+                k->persist_handle);
+        tpm2_flush_context(ectx, transient);
+        goto out;
+    }
+
+    rc = tpm2_flush_context(ectx, transient);
+    if (rc != tool_rc_success) {
+        goto out;
+    }
+
+    tpm2_tool_output("%s:\n", k->name);
+    tpm2_tool_output("  persistent-handle: 0x%x\n", k->persist_handle);
+
+    size_t i;
+    for (i = 0; i < k->public_count; i++) {
+        bool result = tpm2_convert_pubkey_save(public, k->publics[i].format,
+                k->publics[i].path);
+        if (!result) {
+            rc = tool_rc_general_error;
+        }
+    }
+
+out:
+    free(public);
+    return rc;
+}
+
+/*
+ * Evicts the keys this run persisted, children before their parents, so a
+ * failed manifest leaves the TPM as it was and can simply be run again.
+ */
+static void rollback(ESYS_CONTEXT *ectx, size_t provisioned) {
+
+    while (provisioned--) {
+        provision_key *k = ctx.order[provisioned];
+        if (k->tr_handle == ESYS_TR_NONE) {
+            continue;
+        }
+
+        bool platform = is_platform_key(k);
+        ESYS_TR out_tr = ESYS_TR_NONE;
+        tool_rc rc = tpm2_ctx_mgmt_evictcontrol(ectx,
+                platform ? ESYS_TR_RH_PLATFORM : ESYS_TR_RH_OWNER,
+                platform ? ctx.auth.platform.session : ctx.auth.owner.session,
+                k->tr_handle, k->persist_handle, &out_tr);
+        if (rc != tool_rc_success) {
+            LOG_ERR("Could not evict key \"%s\" at 0x%x, remove it with "
+                    "tpm2_evictcontrol", k->name, k->persist_handle);
+            continue;
+        }
+
+        /* evicting a persistent object releases its ESYS_TR */
+        k->tr_handle = ESYS_TR_NONE;
+        LOG_WARN("Evicted key \"%s\" at 0x%x", k->name, k->persist_handle);
+    }
+}
+
+static bool on_option(char key, char *value) {
+
+    switch (key) {
+    case 'w':
+        ctx.auth.owner.auth_str = value;
+        break;
+    case 'P':
+        ctx.auth.endorse.auth_str = value;
+        break;
+    case 'p':
+        ctx.auth.platform.auth_str = value;
+        break;
+    }
+
+    return true;
+}
+
+static bool on_arg(int argc, char **argv) {
+
+    if (argc != 1) {
+        LOG_ERR("Expected one manifest file, got: %d", argc);
+        return false;
+    }
+
+    ctx.manifest_path = argv[0];
+
+    return true;
+}
+
+bool tpm2_tool_onstart(tpm2_options **opts) {
+
+    const struct option topts[] = {
+        { "owner-auth",    required_argument, NULL, 'w' },
+        { "eh-auth",       required_argument, NULL, 'P' },
+        { "platform-auth", required_argument, NULL, 'p' },
+    };
+
+    *opts = tpm2_options_new("w:P:p:", ARRAY_LEN(topts), topts, on_option,
+                             on_arg, 0);
+
+    return *opts != NULL;
+}
+
+tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
+
+    UNUSED(flags);
+
+    if (!ctx.manifest_path) {
+        LOG_ERR("Expected a manifest file argument");
+        return tool_rc_option_error;
+    }
+
+    FILE *f = strcmp(ctx.manifest_path, "-") ?
+            fopen(ctx.manifest_path, "r") : stdin;
+    if (!f) {
+        LOG_ERR("Could not open manifest \"%s\", error: %s",
+                ctx.manifest_path, strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    bool result = parse_manifest(f);
+    if (f != stdin) {
+        fclose(f);
+    }
+    if (!result || !order_keys()) {
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = plan_range(ectx, false);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    rc = plan_range(ectx, true);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    rc = tpm2_auth_util_from_optarg(ectx, ctx.auth.owner.auth_str,
+            &ctx.auth.owner.session, false);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Invalid owner authorization");
+        return rc;
+    }
+
+    rc = tpm2_auth_util_from_optarg(ectx, ctx.auth.endorse.auth_str,
+            &ctx.auth.endorse.session, false);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Invalid endorse authorization");
+        return rc;
+    }
+
+    rc = tpm2_auth_util_from_optarg(ectx, ctx.auth.platform.auth_str,
+            &ctx.auth.platform.session, false);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Invalid platform authorization");
+        return rc;
+    }
+
+    size_t i;
+    for (i = 0; i < ctx.ordered; i++) {
+        rc = provision_one(ectx, ctx.order[i]);
+        if (rc != tool_rc_success) {
+            rollback(ectx, i + 1);
+            return rc;
+        }
+    }
+
+    return tool_rc_success;
+}
+
+tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
+
+    tool_rc rc = tool_rc_success;
+
+    size_t i;
+    for (i = 0; i < ctx.count; i++) {
+        if (ctx.keys[i].tr_handle != ESYS_TR_NONE) {
+            tool_rc tmp_rc = tpm2_close(ectx, &ctx.keys[i].tr_handle);
+            if (tmp_rc != tool_rc_success) {
+                rc = tmp_rc;
+            }
+        }
+    }
+
+    tpm2_session **sessions[] = {
+        &ctx.auth.owner.session,
+        &ctx.auth.endorse.session,
+        &ctx.auth.platform.session,
+    };
+
+    for (i = 0; i < ARRAY_LEN(sessions); i++) {
+        tool_rc tmp_rc = tpm2_session_close(sessions[i]);
+        if (tmp_rc != tool_rc_success) {
+            rc = tmp_rc;
+        }
+    }
+
+    return rc;
+}
+
+void tpm2_tool_onexit(void) {
+
+    size_t i;
+    for (i = 0; i < ctx.count; i++) {
+        provision_key *k = &ctx.keys[i];
+        free(k->name);
+        free(k->parent_name);
+        free(k->hierarchy_str);
+        free(k->alg);
+        free(k->halg);
+        free(k->attrs);
+        free(k->policy);
+        free(k->auth_str);
+        size_t j;
+        for (j = 0; j < k->public_count; j++) {
+            free(k->publics[j].path);
+        }
+        free(k->publics);
+    }
+
+    free(ctx.keys);
+    free(ctx.order);
+}
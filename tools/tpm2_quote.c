@@ -1,15 +1,24 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "files.h"
 #include "log.h"
 #include "tpm2.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_attest_bundle.h"
 #include "tpm2_convert.h"
+#include "tpm2_merkle.h"
 #include "tpm2_openssl.h"
 #include "tpm2_tool.h"
 
@@ -24,6 +33,8 @@ struct tpm_quote_ctx {
     char *signature_path;
     char *message_path;
     char *pcr_path;
+    const char *bundle_path;
+    const char *event_log_path;
     FILE *pcr_output;
     tpm2_convert_sig_fmt sig_format;
     TPMI_ALG_HASH sig_hash_algorithm;
@@ -32,6 +43,16 @@ struct tpm_quote_ctx {
     TPML_PCR_SELECTION pcrSelections;
     TPMS_CAPABILITY_DATA cap_data;
     tpm2_pcrs pcrs;
+
+    struct {
+        const char *path;
+        const char *proof_dir;
+        UINT32 window_ms;
+        bool is_window;
+        TPM2B_DATA *nonces;
+        UINT32 count;
+        tpm2_merkle_tree *tree;
+    } batch;
 };
 
 static tpm_quote_ctx ctx = {
@@ -91,6 +112,59 @@ static bool write_output_files(TPM2B_ATTEST *quoted, TPMT_SIGNATURE *signature)
     return res;
 }
 
+static tool_rc write_bundle(ESYS_CONTEXT *ectx, TPM2B_ATTEST *quoted,
+        TPMT_SIGNATURE *signature) {
+
+    if (!ctx.bundle_path) {
+        return tool_rc_success;
+    }
+
+    tpm2_attest_bundle *bundle = calloc(1, sizeof(*bundle));
+    if (!bundle) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    TPM2B_PUBLIC *public = NULL;
+    TPM2B_NAME *name = NULL;
+    tool_rc rc = tpm2_readpublic(ectx, ctx.key.object.tr_handle,
+            ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE, &public, &name, NULL);
+    if (rc != tool_rc_success) {
+        goto out;
+    }
+
+    bundle->fields = TPM2_ATTEST_BUNDLE_ATTEST | TPM2_ATTEST_BUNDLE_SIGNATURE
+            | TPM2_ATTEST_BUNDLE_PCR_SELECTION | TPM2_ATTEST_BUNDLE_PCR_VALUES
+            | TPM2_ATTEST_BUNDLE_AK_PUBLIC | TPM2_ATTEST_BUNDLE_AK_NAME;
+    bundle->attest = *quoted;
+    bundle->signature = *signature;
+    bundle->pcr_selection = ctx.pcrSelections;
+    bundle->pcrs = ctx.pcrs;
+    bundle->ak_public = *public;
+    bundle->ak_name = *name;
+
+    if (ctx.event_log_path) {
+        size_t len = strlen(ctx.event_log_path);
+        if (len >= sizeof(bundle->event_log)) {
+            LOG_ERR("Event log path is too long");
+            rc = tool_rc_option_error;
+            goto out;
+        }
+        memcpy(bundle->event_log, ctx.event_log_path, len + 1);
+        bundle->fields |= TPM2_ATTEST_BUNDLE_EVENT_LOG;
+    }
+
+    bool result = tpm2_attest_bundle_save(bundle, ctx.bundle_path);
+    rc = result ? tool_rc_success : tool_rc_general_error;
+
+out:
+    free(public);
+    free(name);
+    free(bundle);
+
+    return rc;
+}
+
 static tool_rc quote(ESYS_CONTEXT *ectx, TPML_PCR_SELECTION *pcrSelection) {
 
     TPM2B_ATTEST *quoted = NULL;
@@ -126,7 +200,7 @@ static tool_rc quote(ESYS_CONTEXT *ectx, TPML_PCR_SELECTION *pcrSelection) {
     tpm2_tool_output("\n");
     free(sig);
 
-    if (ctx.pcr_output) {
+    if (ctx.pcr_output || ctx.bundle_path) {
         // Filter out invalid/unavailable PCR selections
         if (!pcr_check_pcr_selection(&ctx.cap_data, &ctx.pcrSelections)) {
             LOG_ERR("Failed to filter unavailable PCR values for quote!");
@@ -173,11 +247,262 @@ static tool_rc quote(ESYS_CONTEXT *ectx, TPML_PCR_SELECTION *pcrSelection) {
 
     // Write everything out
     bool res = write_output_files(quoted, signature);
+    rc = res ? write_bundle(ectx, quoted, signature) : tool_rc_general_error;
 
     free(quoted);
     free(signature);
 
-    return res ? tool_rc_success : tool_rc_general_error;
+    return rc;
+}
+
+static UINT64 now_ms(void) {
+
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (UINT64)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static bool batch_add_nonce(char *line) {
+
+    while (isspace((unsigned char)*line)) {
+        line++;
+    }
+
+    size_t len = strlen(line);
+    while (len && isspace((unsigned char)line[len - 1])) {
+        line[--len] = '\0';
+    }
+
+    if (!len || line[0] == '#') {
+        return true;
+    }
+
+    if (ctx.batch.count == TPM2_MERKLE_MAX_LEAVES) {
+        LOG_ERR("A batch holds at most %u nonces", TPM2_MERKLE_MAX_LEAVES);
+        return false;
+    }
+
+    /* grow the list whenever the count reaches a power of two */
+    UINT32 count = ctx.batch.count;
+    if (!(count & (count - 1))) {
+        TPM2B_DATA *nonces = realloc(ctx.batch.nonces,
+                (count ? 2 * count : 1) * sizeof(*nonces));
+        if (!nonces) {
+            LOG_ERR("oom");
+            return false;
+        }
+        ctx.batch.nonces = nonces;
+    }
+
+    TPM2B_DATA *nonce = &ctx.batch.nonces[count];
+    nonce->size = sizeof(nonce->buffer);
+    if (tpm2_util_hex_to_byte_structure(line, &nonce->size, nonce->buffer)) {
+        LOG_ERR("Could not convert nonce \"%s\" from a hex string to byte array!",
+                line);
+        return false;
+    }
+
+    ctx.batch.count++;
+
+    return true;
+}
+
+/*
+ * Collects the nonces of a batch, one hex string per line. Without a window
+ * the batch is everything up to end of file. With one, the window opens with
+ * the first nonce and the batch is whatever arrived before it closes, which
+ * lets a FIFO or pipe feed one quote per window.
+ */
+static bool batch_read_nonces(void) {
+
+    int fd = STDIN_FILENO;
+    if (strcmp(ctx.batch.path, "-")) {
+        fd = open(ctx.batch.path, O_RDONLY);
+        if (fd < 0) {
+            LOG_ERR("Could not open batch file \"%s\", error: %s",
+                    ctx.batch.path, strerror(errno));
+            return false;
+        }
+    }
+
+    bool result = false;
+    char buf[4096];
+    size_t len = 0;
+    bool is_eof = false;
+    UINT64 deadline = 0;
+
+    for (;;) {
+        int timeout = -1;
+        if (ctx.batch.is_window && ctx.batch.count) {
+            UINT64 now = now_ms();
+            if (now >= deadline) {
+                break;
+            }
+            timeout = deadline - now > INT_MAX ? INT_MAX : deadline - now;
+        }
+
+        struct pollfd pfd = { .fd = fd, .events = POLLIN };
+        int ready = poll(&pfd, 1, timeout);
+        if (ready < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERR("Could not poll batch file \"%s\", error: %s",
+                    ctx.batch.path, strerror(errno));
+            goto out;
+        }
+
+        if (!ready) {
+            break;
+        }
+
+        ssize_t got = read(fd, &buf[len], sizeof(buf) - 1 - len);
+        if (got < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            LOG_ERR("Could not read batch file \"%s\", error: %s",
+                    ctx.batch.path, strerror(errno));
+            goto out;
+        }
+
+        if (!got) {
+            is_eof = true;
+            break;
+        }
+
+        UINT32 before = ctx.batch.count;
+        len += got;
+        buf[len] = '\0';
+
+        char *line = buf;
+        char *nl;
+        while ((nl = strchr(line, '\n'))) {
+            *nl = '\0';
+            if (!batch_add_nonce(line)) {
+                goto out;
+            }
+            line = nl + 1;
+        }
+
+        len -= line - buf;
+        memmove(buf, line, len);
+        if (len == sizeof(buf) - 1) {
+            LOG_ERR("Nonce line too long in batch file \"%s\"", ctx.batch.path);
+            goto out;
+        }
+
+        if (ctx.batch.is_window && !before && ctx.batch.count) {
+            deadline = now_ms() + ctx.batch.window_ms;
+        }
+    }
+
+    if (len) {
+        buf[len] = '\0';
+        if (is_eof) {
+            if (!batch_add_nonce(buf)) {
+                goto out;
+            }
+        } else {
+            LOG_WARN("Dropping the partial nonce line \"%s\" at the end of the "
+                    "window", buf);
+        }
+    }
+
+    if (!ctx.batch.count) {
+        LOG_ERR("No nonces in batch file \"%s\"", ctx.batch.path);
+        goto out;
+    }
+
+    result = true;
+
+out:
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+
+    return result;
+}
+
+static tool_rc batch_build_tree(void) {
+
+    bool result = batch_read_nonces();
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    TPM2B_DIGEST *leaves = calloc(ctx.batch.count, sizeof(*leaves));
+    if (!leaves) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    UINT32 i;
+    for (i = 0; result && i < ctx.batch.count; i++) {
+        TPM2B_DATA *nonce = &ctx.batch.nonces[i];
+        result = tpm2_merkle_leaf_hash(ctx.sig_hash_algorithm, nonce->buffer,
+                nonce->size, &leaves[i]);
+    }
+
+    if (result) {
+        ctx.batch.tree = tpm2_merkle_tree_new(ctx.sig_hash_algorithm, leaves,
+                ctx.batch.count);
+    }
+    free(leaves);
+    if (!ctx.batch.tree) {
+        return tool_rc_general_error;
+    }
+
+    /* the TPM signs the root in place of a single verifier's nonce */
+    const TPM2B_DIGEST *root = tpm2_merkle_tree_root(ctx.batch.tree);
+    ctx.qualifyingData.size = root->size;
+    memcpy(ctx.qualifyingData.buffer, root->buffer, root->size);
+
+    return tool_rc_success;
+}
+
+static tool_rc batch_write_proofs(void) {
+
+    tpm2_tool_output("batch:\n");
+    tpm2_tool_output("  hash-algorithm: %s\n",
+            tpm2_alg_util_algtostr(ctx.sig_hash_algorithm,
+                    tpm2_alg_util_flags_hash));
+    tpm2_tool_output("  root: ");
+    tpm2_util_hexdump(ctx.qualifyingData.buffer, ctx.qualifyingData.size);
+    tpm2_tool_output("\n");
+    tpm2_tool_output("  nonces:\n");
+
+    UINT32 i;
+    for (i = 0; i < ctx.batch.count; i++) {
+        tpm2_merkle_proof proof;
+        bool result = tpm2_merkle_tree_proof(ctx.batch.tree, i, &proof);
+        if (!result) {
+            return tool_rc_general_error;
+        }
+
+        char path[PATH_MAX];
+        int n = snprintf(path, sizeof(path), "%s/%u.proof", ctx.batch.proof_dir,
+                i);
+        if (n < 0 || (size_t)n >= sizeof(path)) {
+            LOG_ERR("Proof path too long for directory \"%s\"",
+                    ctx.batch.proof_dir);
+            return tool_rc_general_error;
+        }
+
+        result = tpm2_merkle_proof_save(&proof, path);
+        if (!result) {
+            return tool_rc_general_error;
+        }
+
+        TPM2B_DATA *nonce = &ctx.batch.nonces[i];
+        tpm2_tool_output("    - nonce: ");
+        tpm2_util_hexdump(nonce->buffer, nonce->size);
+        tpm2_tool_output("\n");
+        tpm2_tool_output("      proof: %s\n", path);
+    }
+
+    return tool_rc_success;
 }
 
 static bool on_option(char key, char *value) {
@@ -228,6 +553,25 @@ static bool on_option(char key, char *value) {
             return false;
         }
         break;
+    case 0:
+        ctx.batch.path = value;
+        break;
+    case 1:
+        if (!tpm2_util_string_to_uint32(value, &ctx.batch.window_ms)) {
+            LOG_ERR("Could not convert window, got: \"%s\"", value);
+            return false;
+        }
+        ctx.batch.is_window = true;
+        break;
+    case 2:
+        ctx.batch.proof_dir = value;
+        break;
+    case 3:
+        ctx.bundle_path = value;
+        break;
+    case 4:
+        ctx.event_log_path = value;
+        break;
     }
 
     return true;
@@ -244,7 +588,12 @@ bool tpm2_tool_onstart(tpm2_options **opts) {
         { "message",              required_argument, NULL, 'm' },
         { "pcr",                  required_argument, NULL, 'o' },
         { "format",               required_argument, NULL, 'f' },
-        { "hash-algorithm",       required_argument, NULL, 'g' }
+        { "hash-algorithm",       required_argument, NULL, 'g' },
+        { "batch",                required_argument, NULL,  0  },
+        { "window",               required_argument, NULL,  1  },
+        { "proof-dir",            required_argument, NULL,  2  },
+        { "bundle",               required_argument, NULL,  3  },
+        { "event-log",            required_argument, NULL,  4  },
     };
 
     *opts = tpm2_options_new("c:p:l:q:s:m:o:f:g:", ARRAY_LEN(topts), topts,
@@ -263,6 +612,26 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return tool_rc_option_error;
     }
 
+    if (ctx.batch.path) {
+        if (ctx.qualifyingData.size) {
+            LOG_ERR("Cannot specify both -q and --batch");
+            return tool_rc_option_error;
+        }
+
+        if (!ctx.batch.proof_dir) {
+            LOG_ERR("Expected --proof-dir with --batch");
+            return tool_rc_option_error;
+        }
+    } else if (ctx.batch.is_window || ctx.batch.proof_dir) {
+        LOG_ERR("--window and --proof-dir require --batch");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.event_log_path && !ctx.bundle_path) {
+        LOG_ERR("--event-log requires --bundle");
+        return tool_rc_option_error;
+    }
+
     tool_rc rc = tpm2_util_object_load_auth(ectx, ctx.key.ctx_path,
         ctx.key.auth_str, &ctx.key.object, false, TPM2_HANDLE_ALL_W_NV);
     if (rc != tool_rc_success) {
@@ -284,7 +653,19 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
-    return quote(ectx, &ctx.pcrSelections);
+    if (ctx.batch.path) {
+        rc = batch_build_tree();
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+    }
+
+    rc = quote(ectx, &ctx.pcrSelections);
+    if (rc != tool_rc_success || !ctx.batch.path) {
+        return rc;
+    }
+
+    return batch_write_proofs();
 }
 
 tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
@@ -292,5 +673,7 @@ tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
     if (ctx.pcr_output) {
         fclose(ctx.pcr_output);
     }
+    tpm2_merkle_tree_free(ctx.batch.tree);
+    free(ctx.batch.nonces);
     return tpm2_session_close(&ctx.key.object.session);
 }
@@ -1,11 +1,16 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
+#include <inttypes.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #include "files.h"
 #include "log.h"
 #include "tpm2.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_auth_util.h"
 #include "tpm2_options.h"
 
 typedef struct tpm_rsadecrypt_ctx tpm_rsadecrypt_ctx;
@@ -21,6 +26,8 @@ struct tpm_rsadecrypt_ctx {
     char *input_path;
     char *output_file_path;
     TPMT_RSA_DECRYPT scheme;
+    bool batch;
+    bool is_pcr;
 };
 
 static tpm_rsadecrypt_ctx ctx = {
@@ -59,6 +66,187 @@ out:
     return ret ? tool_rc_success : tool_rc_general_error;
 }
 
+/*
+ * Batch frames are marshaled TPM2B_PUBLIC_KEY_RSA structures, see
+ * files_read_frame().
+ */
+static bool read_frame(FILE *f, bool *eof) {
+
+    ctx.cipher_text.size = BUFFER_SIZE(TPM2B_PUBLIC_KEY_RSA, buffer);
+    bool result = files_read_frame(f, ctx.cipher_text.buffer,
+            &ctx.cipher_text.size, eof);
+    if (!result) {
+        LOG_ERR("Could not read ciphertext frame");
+    }
+
+    return result;
+}
+
+typedef struct batch_stats batch_stats;
+struct batch_stats {
+    UINT64 items;
+    UINT64 total_us;
+    UINT64 min_us;
+    UINT64 max_us;
+};
+
+static void batch_stats_add(batch_stats *stats, UINT64 us) {
+
+    stats->items++;
+    stats->total_us += us;
+    stats->min_us = us < stats->min_us ? us : stats->min_us;
+    stats->max_us = us > stats->max_us ? us : stats->max_us;
+
+    LOG_INFO("ciphertext %"PRIu64": %"PRIu64" us", stats->items, us);
+}
+
+static void batch_stats_report(batch_stats *stats, UINT64 wall_us) {
+
+    if (!stats->items) {
+        LOG_INFO("no ciphertexts decrypted");
+        return;
+    }
+
+    LOG_INFO("decrypted %"PRIu64" ciphertexts in %"PRIu64" us", stats->items,
+            wall_us);
+    LOG_INFO("latency us: min %"PRIu64" max %"PRIu64" mean %"PRIu64,
+            stats->min_us, stats->max_us, stats->total_us / stats->items);
+    if (wall_us) {
+        LOG_INFO("throughput: %"PRIu64" decryptions per second",
+                stats->items * 1000000 / wall_us);
+    }
+}
+
+/*
+ * Decrypts every frame of the input with the one loaded key and its
+ * authorization. While the TPM decrypts a ciphertext, the previous
+ * plaintext is written out and the next ciphertext read in. ESAPI has
+ * marshaled the command by the time the async call returns, so the
+ * ciphertext buffer can take the next frame right away.
+ *
+ * The latency of a ciphertext is the time spent submitting it and
+ * collecting its plaintext, the frame I/O overlapped with the TPM is not
+ * counted.
+ */
+static tool_rc rsa_decrypt_batch(ESYS_CONTEXT *ectx, FILE *in, FILE *out) {
+
+    batch_stats stats = { .min_us = UINT64_MAX };
+    TPM2B_PUBLIC_KEY_RSA *pending = NULL;
+    tool_rc rc = tool_rc_general_error;
+
+    struct timespec batch_start, batch_end;
+    clock_gettime(CLOCK_MONOTONIC, &batch_start);
+
+    bool eof = false;
+    bool result = read_frame(in, &eof);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    while (!eof) {
+        /*
+         * A policy session is reset by every use, a "pcr:" policy is
+         * satisfied again before every ciphertext after the first.
+         */
+        if (ctx.is_pcr && stats.items) {
+            rc = tpm2_auth_util_restart_pcr(ectx, ctx.key.auth_str,
+                    ctx.key.object.session);
+            if (rc != tool_rc_success) {
+                goto out;
+            }
+        }
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        rc = tpm2_rsa_decrypt_async(ectx, &ctx.key.object, &ctx.cipher_text,
+                &ctx.scheme, &ctx.label);
+        if (rc != tool_rc_success) {
+            goto out;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        UINT64 us = tpm2_util_elapsed_us(&start, &end);
+
+        rc = tool_rc_general_error;
+        if (pending) {
+            result = files_write_frame(out, pending->buffer, pending->size);
+            free(pending);
+            pending = NULL;
+            if (!result) {
+                LOG_ERR("Could not write plaintext frame");
+                goto out;
+            }
+        }
+
+        result = read_frame(in, &eof);
+        if (!result) {
+            /* collect the response so the context is left usable */
+            tpm2_rsa_decrypt_finish(ectx, &pending);
+            goto out;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        rc = tpm2_rsa_decrypt_finish(ectx, &pending);
+        if (rc != tool_rc_success) {
+            LOG_ERR("Could not decrypt ciphertext %"PRIu64, stats.items + 1);
+            goto out;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        batch_stats_add(&stats, us + tpm2_util_elapsed_us(&start, &end));
+    }
+
+    rc = tool_rc_general_error;
+    if (pending && !files_write_frame(out, pending->buffer, pending->size)) {
+        LOG_ERR("Could not write plaintext frame");
+        goto out;
+    }
+
+    rc = tool_rc_success;
+
+    clock_gettime(CLOCK_MONOTONIC, &batch_end);
+    batch_stats_report(&stats, tpm2_util_elapsed_us(&batch_start, &batch_end));
+
+out:
+    free(pending);
+
+    return rc;
+}
+
+static tool_rc rsa_decrypt_batch_and_save(ESYS_CONTEXT *ectx) {
+
+    FILE *in = ctx.input_path ? fopen(ctx.input_path, "rb") : stdin;
+    if (!in) {
+        LOG_ERR("Could not open file \"%s\", error: %s", ctx.input_path,
+                strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tool_rc_general_error;
+    FILE *out = ctx.output_file_path ?
+            fopen(ctx.output_file_path, "wb+") : stdout;
+    if (!out) {
+        LOG_ERR("Could not open file \"%s\", error: %s",
+                ctx.output_file_path, strerror(errno));
+        goto out;
+    }
+
+    rc = rsa_decrypt_batch(ectx, in, out);
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+out:
+    if (in != stdin) {
+        fclose(in);
+    }
+
+    return rc;
+}
+
 static bool on_option(char key, char *value) {
 
     switch (key) {
@@ -73,14 +261,13 @@ static bool on_option(char key, char *value) {
         break;
     }
     case 's':
-        ctx.scheme.scheme = tpm2_alg_util_from_optarg(value,
-                tpm2_alg_util_flags_rsa_scheme);
-        if (ctx.scheme.scheme == TPM2_ALG_ERROR) {
-            return false;
-        }
-        break;
+        return tpm2_alg_util_rsa_decrypt_scheme_from_optarg(value,
+                &ctx.scheme);
     case 'l':
         return tpm2_util_get_label(value, &ctx.label);
+    case 'b':
+        ctx.batch = true;
+        break;
     }
     return true;
 }
@@ -105,9 +292,10 @@ bool tpm2_tool_onstart(tpm2_options **opts) {
       { "key-context",  required_argument, NULL, 'c' },
       { "scheme",       required_argument, NULL, 's' },
       { "label",        required_argument, NULL, 'l'},
+      { "batch",        no_argument,       NULL, 'b'},
     };
 
-    *opts = tpm2_options_new("p:o:c:s:l:", ARRAY_LEN(topts), topts,
+    *opts = tpm2_options_new("p:o:c:s:l:b", ARRAY_LEN(topts), topts,
                              on_option, on_args, 0);
 
     return *opts != NULL;
@@ -120,6 +308,32 @@ static tool_rc init(ESYS_CONTEXT *ectx) {
         return tool_rc_option_error;
     }
 
+    if (ctx.batch) {
+        tool_rc rc = tpm2_util_object_load_auth(ectx, ctx.key.ctx_path,
+                ctx.key.auth_str, &ctx.key.object, false,
+                TPM2_HANDLE_ALL_W_NV);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        /*
+         * The first decryption spends a policy session. Only a "pcr:"
+         * policy can be satisfied again by the tool, any other policy
+         * would fail from the second ciphertext on.
+         */
+        ctx.is_pcr = tpm2_auth_util_is_pcr(ctx.key.auth_str);
+        if (ctx.key.object.session && !ctx.is_pcr
+                && tpm2_session_get_type(ctx.key.object.session)
+                        == TPM2_SE_POLICY) {
+            LOG_ERR("Batch mode supports password, HMAC session and \"pcr:\" "
+                    "authorizations, a policy session is spent by the first "
+                    "decryption");
+            return tool_rc_option_error;
+        }
+
+        return tool_rc_success;
+    }
+
     ctx.cipher_text.size = BUFFER_SIZE(TPM2B_PUBLIC_KEY_RSA, buffer);
     bool result = files_load_bytes_from_buffer_or_file_or_stdin(NULL,ctx.input_path,
         &ctx.cipher_text.size, ctx.cipher_text.buffer);
@@ -140,7 +354,8 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
-    return rsa_decrypt_and_save(ectx);
+    return ctx.batch ? rsa_decrypt_batch_and_save(ectx) :
+            rsa_decrypt_and_save(ectx);
 }
 
 tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
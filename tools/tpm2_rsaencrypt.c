@@ -1,12 +1,16 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "files.h"
 #include "log.h"
 #include "object.h"
 #include "tpm2_alg_util.h"
+#include "tpm2_convert.h"
+#include "tpm2_openssl.h"
 #include "tpm2_options.h"
 
 typedef struct tpm_rsaencrypt_ctx tpm_rsaencrypt_ctx;
@@ -18,6 +22,11 @@ struct tpm_rsaencrypt_ctx {
     char *input_path;
     TPMT_RSA_DECRYPT scheme;
     TPM2B_DATA label;
+    bool batch;
+
+    /* host side encryption, without a TPM */
+    TPM2B_PUBLIC public;
+    RSA *rsa;
 };
 
 static tpm_rsaencrypt_ctx ctx = {
@@ -25,19 +34,185 @@ static tpm_rsaencrypt_ctx ctx = {
     .scheme = { .scheme = TPM2_ALG_RSAES }
 };
 
-static tool_rc rsa_encrypt_and_save(ESYS_CONTEXT *context) {
-
-    bool ret = false;
-    TPM2B_PUBLIC_KEY_RSA *out_data = NULL;
+static tool_rc tpm_rsa_encrypt(ESYS_CONTEXT *context,
+        TPM2B_PUBLIC_KEY_RSA **out_data) {
 
     TSS2_RC rval = Esys_RSA_Encrypt(context, ctx.key_context.tr_handle,
                         ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
-                        &ctx.message, &ctx.scheme, &ctx.label, &out_data);
+                        &ctx.message, &ctx.scheme, &ctx.label, out_data);
     if (rval != TPM2_RC_SUCCESS) {
         LOG_PERR(Esys_RSA_Encrypt, rval);
         return tool_rc_from_tpm(rval);
     }
 
+    return tool_rc_success;
+}
+
+/*
+ * Picks the scheme as TPM2_RSA_Encrypt does, the key's scheme if it has one,
+ * which the requested scheme must then be NULL or match, and the requested
+ * scheme otherwise.
+ */
+static bool host_select_scheme(TPMT_RSA_DECRYPT *scheme) {
+
+    TPMT_PUBLIC *pub = &ctx.public.publicArea;
+    if (!(pub->objectAttributes & TPMA_OBJECT_DECRYPT)) {
+        LOG_ERR("The key does not have the decrypt attribute set");
+        return false;
+    }
+
+    TPMT_RSA_SCHEME *key_scheme = &pub->parameters.rsaDetail.scheme;
+    if (key_scheme->scheme == TPM2_ALG_NULL) {
+        *scheme = ctx.scheme;
+        return true;
+    }
+
+    if (ctx.scheme.scheme != TPM2_ALG_NULL
+            && ctx.scheme.scheme != key_scheme->scheme) {
+        LOG_ERR("Scheme %s does not match the key's scheme %s, use -s null",
+                tpm2_alg_util_algtostr(ctx.scheme.scheme,
+                        tpm2_alg_util_flags_any),
+                tpm2_alg_util_algtostr(key_scheme->scheme,
+                        tpm2_alg_util_flags_any));
+        return false;
+    }
+
+    scheme->scheme = key_scheme->scheme;
+    scheme->details = key_scheme->details;
+
+    return true;
+}
+
+/*
+ * Raw RSA encryption as the TPM does it for TPM2_ALG_NULL, the message with
+ * leading zeros stripped is left padded with zeros to the modulus size.
+ */
+static bool host_encode_raw(UINT8 *encoded, int mod_size) {
+
+    int i = 0;
+    while (i < ctx.message.size && !ctx.message.buffer[i]) {
+        i++;
+    }
+
+    int size = ctx.message.size - i;
+    if (size > mod_size) {
+        LOG_ERR("Message of %d bytes exceeds the key size of %d bytes", size,
+                mod_size);
+        return false;
+    }
+
+    memset(encoded, 0, mod_size - size);
+    memcpy(&encoded[mod_size - size], &ctx.message.buffer[i], size);
+
+    return true;
+}
+
+/*
+ * OAEP with the scheme's hash for both the digest and MGF1, and the label,
+ * its terminating zero included, as the TPM takes it.
+ */
+static bool host_encode_oaep(TPMI_ALG_HASH halg, UINT8 *encoded,
+        int mod_size) {
+
+    const EVP_MD *md = tpm2_openssl_halg_from_tpmhalg(halg);
+    if (!md) {
+        LOG_ERR("OAEP hash algorithm not supported, got: 0x%x", halg);
+        return false;
+    }
+
+    int rc = RSA_padding_add_PKCS1_OAEP_mgf1(encoded, mod_size,
+            ctx.message.buffer, ctx.message.size, ctx.label.buffer,
+            ctx.label.size, md, md);
+    if (rc != 1) {
+        LOG_ERR("OAEP padding failed: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+        return false;
+    }
+
+    return true;
+}
+
+/*
+ * Encrypts the message with the key's public area on the host. Decrypting
+ * the result with TPM2_RSA_Decrypt gives back the message, and for the NULL
+ * scheme the result is the same bytes TPM2_RSA_Encrypt returns.
+ */
+static tool_rc host_rsa_encrypt(TPM2B_PUBLIC_KEY_RSA **out_data) {
+
+    TPMT_RSA_DECRYPT scheme;
+    bool result = host_select_scheme(&scheme);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    int mod_size = RSA_size(ctx.rsa);
+    UINT8 encoded[sizeof(ctx.message.buffer)];
+
+    const UINT8 *from = encoded;
+    int from_size = mod_size;
+    int padding = RSA_NO_PADDING;
+
+    switch (scheme.scheme) {
+    case TPM2_ALG_NULL:
+        result = host_encode_raw(encoded, mod_size);
+        break;
+    case TPM2_ALG_OAEP:
+        result = host_encode_oaep(scheme.details.oaep.hashAlg, encoded,
+                mod_size);
+        break;
+    case TPM2_ALG_RSAES:
+        from = ctx.message.buffer;
+        from_size = ctx.message.size;
+        padding = RSA_PKCS1_PADDING;
+        break;
+    default:
+        LOG_ERR("Unsupported encryption scheme, got: %s",
+                tpm2_alg_util_algtostr(scheme.scheme, tpm2_alg_util_flags_any));
+        return tool_rc_general_error;
+    }
+
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    TPM2B_PUBLIC_KEY_RSA *out = calloc(1, sizeof(*out));
+    if (!out) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    int size = RSA_public_encrypt(from_size, from, out->buffer, ctx.rsa,
+            padding);
+    if (size < 0) {
+        LOG_ERR("RSA encryption failed: %s",
+                ERR_error_string(ERR_get_error(), NULL));
+        free(out);
+        return tool_rc_general_error;
+    }
+
+    out->size = size;
+    *out_data = out;
+
+    return tool_rc_success;
+}
+
+static tool_rc rsa_encrypt(ESYS_CONTEXT *context,
+        TPM2B_PUBLIC_KEY_RSA **out_data) {
+
+    return context ? tpm_rsa_encrypt(context, out_data) :
+            host_rsa_encrypt(out_data);
+}
+
+static tool_rc rsa_encrypt_and_save(ESYS_CONTEXT *context) {
+
+    bool ret = false;
+    TPM2B_PUBLIC_KEY_RSA *out_data = NULL;
+
+    tool_rc rc = rsa_encrypt(context, &out_data);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
     FILE *f = ctx.output_path ? fopen(ctx.output_path, "wb+") : stdout;
     if (!f) {
         goto out;
@@ -53,6 +228,81 @@ out:
     return ret ? tool_rc_success : tool_rc_general_error;
 }
 
+/*
+ * Encrypts every framed message of the input, see files_read_frame(), into
+ * a framed ciphertext.
+ */
+static tool_rc rsa_encrypt_batch(ESYS_CONTEXT *context, FILE *in, FILE *out) {
+
+    unsigned long count = 0;
+
+    while (true) {
+        bool eof = false;
+        ctx.message.size = BUFFER_SIZE(TPM2B_PUBLIC_KEY_RSA, buffer);
+        bool result = files_read_frame(in, ctx.message.buffer,
+                &ctx.message.size, &eof);
+        if (!result) {
+            LOG_ERR("Could not read message frame %lu", count + 1);
+            return tool_rc_general_error;
+        }
+
+        if (eof) {
+            break;
+        }
+
+        TPM2B_PUBLIC_KEY_RSA *out_data = NULL;
+        tool_rc rc = rsa_encrypt(context, &out_data);
+        if (rc != tool_rc_success) {
+            LOG_ERR("Could not encrypt message %lu", count + 1);
+            return rc;
+        }
+
+        result = files_write_frame(out, out_data->buffer, out_data->size);
+        free(out_data);
+        if (!result) {
+            LOG_ERR("Could not write ciphertext frame");
+            return tool_rc_general_error;
+        }
+
+        count++;
+    }
+
+    LOG_INFO("Encrypted %lu messages", count);
+
+    return tool_rc_success;
+}
+
+static tool_rc rsa_encrypt_batch_and_save(ESYS_CONTEXT *context) {
+
+    FILE *in = ctx.input_path ? fopen(ctx.input_path, "rb") : stdin;
+    if (!in) {
+        LOG_ERR("Could not open file \"%s\", error: %s", ctx.input_path,
+                strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    tool_rc rc = tool_rc_general_error;
+    FILE *out = ctx.output_path ? fopen(ctx.output_path, "wb+") : stdout;
+    if (!out) {
+        LOG_ERR("Could not open file \"%s\", error: %s", ctx.output_path,
+                strerror(errno));
+        goto out;
+    }
+
+    rc = rsa_encrypt_batch(context, in, out);
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+out:
+    if (in != stdin) {
+        fclose(in);
+    }
+
+    return rc;
+}
+
 static bool on_option(char key, char *value) {
 
     switch (key) {
@@ -63,14 +313,13 @@ static bool on_option(char key, char *value) {
         ctx.output_path = value;
         break;
     case 's':
-        ctx.scheme.scheme = tpm2_alg_util_from_optarg(value,
-                tpm2_alg_util_flags_rsa_scheme);
-        if (ctx.scheme.scheme == TPM2_ALG_ERROR) {
-            return false;
-        }
-        break;
+        return tpm2_alg_util_rsa_decrypt_scheme_from_optarg(value,
+                &ctx.scheme);
     case 'l':
         return tpm2_util_get_label(value, &ctx.label);
+    case 'b':
+        ctx.batch = true;
+        break;
     }
     return true;
 }
@@ -94,14 +343,36 @@ bool tpm2_tool_onstart(tpm2_options **opts) {
       {"key-context", required_argument, NULL, 'c'},
       {"scheme",      required_argument, NULL, 's'},
       {"label",       required_argument, NULL, 'l'},
+      {"batch",       no_argument,       NULL, 'b'},
     };
 
-    *opts = tpm2_options_new("o:c:s:l:", ARRAY_LEN(topts), topts,
-                             on_option, on_args, 0);
+    *opts = tpm2_options_new("o:c:s:l:b", ARRAY_LEN(topts), topts,
+                             on_option, on_args, TPM2_OPTIONS_OPTIONAL_SAPI);
 
     return *opts != NULL;
 }
 
+/*
+ * Without a TPM the key context is the key's public area, as saved by
+ * tpm2_create -u or tpm2_readpublic -o, and read once for all messages.
+ */
+static tool_rc host_init(void) {
+
+    bool result = files_load_public(ctx.context_arg, &ctx.public);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    if (ctx.public.publicArea.type != TPM2_ALG_RSA) {
+        LOG_ERR("Expected an RSA public key");
+        return tool_rc_general_error;
+    }
+
+    ctx.rsa = tpm2_convert_pubkey_to_rsa(&ctx.public.publicArea);
+
+    return ctx.rsa ? tool_rc_success : tool_rc_general_error;
+}
+
 static tool_rc init(ESYS_CONTEXT *context) {
 
     if (!ctx.context_arg) {
@@ -109,11 +380,17 @@ static tool_rc init(ESYS_CONTEXT *context) {
         return tool_rc_option_error;
     }
 
-    ctx.message.size = BUFFER_SIZE(TPM2B_PUBLIC_KEY_RSA, buffer);
-    bool result = files_load_bytes_from_buffer_or_file_or_stdin(NULL,ctx.input_path,
-        &ctx.message.size, ctx.message.buffer);
-    if (!result) {
-        return tool_rc_general_error;
+    if (!ctx.batch) {
+        ctx.message.size = BUFFER_SIZE(TPM2B_PUBLIC_KEY_RSA, buffer);
+        bool result = files_load_bytes_from_buffer_or_file_or_stdin(NULL,ctx.input_path,
+            &ctx.message.size, ctx.message.buffer);
+        if (!result) {
+            return tool_rc_general_error;
+        }
+    }
+
+    if (!context) {
+        return host_init();
     }
 
     return tpm2_util_object_load(context, ctx.context_arg, &ctx.key_context,
@@ -129,5 +406,11 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *context, tpm2_option_flags flags) {
         return rc;
     }
 
-    return rsa_encrypt_and_save(context);
+    return ctx.batch ? rsa_encrypt_batch_and_save(context) :
+            rsa_encrypt_and_save(context);
+}
+
+void tpm2_tool_onexit(void) {
+
+    RSA_free(ctx.rsa);
 }
@@ -5,16 +5,20 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "files.h"
 #include "log.h"
 #include "tpm2_header.h"
 #include "tpm2_tool.h"
+#include "tpm2_util.h"
 
 typedef struct tpm2_send_ctx tpm2_send_ctx;
 struct tpm2_send_ctx {
     FILE *input;
     FILE *output;
+    FILE *expected;
+    bool stream;
 };
 
 static tpm2_send_ctx ctx;
@@ -80,6 +84,182 @@ static bool write_response_to_file(FILE *f, UINT8 *rbuf) {
     return files_write_bytes(f, r->bytes, size);
 }
 
+/*
+ * Reads the next command or response of a stream, framed by the size in its
+ * header. A clean end of the stream before a header sets eof.
+ */
+static bool read_framed(FILE *f, const char *what, UINT8 buf[TPM2_MAX_SIZE],
+        UINT32 *size, bool *eof) {
+
+    /* command and response headers are the same size, tag then size */
+    UINT8 *header = buf;
+    size_t ret = fread(header, 1, TPM2_COMMAND_HEADER_SIZE, f);
+    if (ret != TPM2_COMMAND_HEADER_SIZE) {
+        if (ferror(f)) {
+            LOG_ERR("Failed to read %s header: %s", what, strerror(errno));
+            return false;
+        }
+        if (ret) {
+            LOG_ERR("Truncated %s header, got %zu bytes", what, ret);
+            return false;
+        }
+        *eof = true;
+        return true;
+    }
+
+    UINT32 frame_size = tpm2_command_header_get_size(
+            tpm2_command_header_from_bytes(header), true);
+    if (frame_size < TPM2_COMMAND_HEADER_SIZE || frame_size > TPM2_MAX_SIZE) {
+        LOG_ERR("Invalid %s size %"PRIu32", expected %zu to %u bytes", what,
+                frame_size, TPM2_COMMAND_HEADER_SIZE, TPM2_MAX_SIZE);
+        return false;
+    }
+
+    size_t body_size = frame_size - TPM2_COMMAND_HEADER_SIZE;
+    if (body_size) {
+        ret = fread(&buf[TPM2_COMMAND_HEADER_SIZE], body_size, 1, f);
+        if (ret != 1) {
+            LOG_ERR("Truncated %s body, expected %zu bytes", what, body_size);
+            return false;
+        }
+    }
+
+    *size = frame_size;
+    *eof = false;
+
+    return true;
+}
+
+typedef struct stream_stats stream_stats;
+struct stream_stats {
+    UINT64 commands;
+    UINT64 total_us;
+    UINT64 min_us;
+    UINT64 max_us;
+    UINT64 mismatches;
+};
+
+/*
+ * Compares a response against the next expected one. Responses whose size
+ * or bytes differ are counted as mismatches, not errors, so one run reports
+ * all of them.
+ */
+static bool check_response(UINT8 *rbuf, size_t rsize, bool *is_match) {
+
+    UINT8 expected[TPM2_MAX_SIZE];
+    UINT32 expected_size = 0;
+    bool eof = false;
+    bool result = read_framed(ctx.expected, "expected response", expected,
+            &expected_size, &eof);
+    if (!result) {
+        return false;
+    }
+
+    if (eof) {
+        LOG_ERR("Expected responses ended before the commands");
+        return false;
+    }
+
+    *is_match = expected_size == rsize && !memcmp(expected, rbuf, rsize);
+
+    return true;
+}
+
+static tool_rc send_stream(TSS2_TCTI_CONTEXT *tcti_context) {
+
+    stream_stats stats = { .min_us = UINT64_MAX };
+
+    tpm2_tool_output("commands:\n");
+
+    while (true) {
+        UINT8 cbuf[TPM2_MAX_SIZE];
+        UINT32 csize = 0;
+        bool eof = false;
+        bool result = read_framed(ctx.input, "command", cbuf, &csize, &eof);
+        if (!result) {
+            return tool_rc_general_error;
+        }
+
+        if (eof) {
+            break;
+        }
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        TSS2_RC rval = Tss2_Tcti_Transmit(tcti_context, csize, cbuf);
+        if (rval != TPM2_RC_SUCCESS) {
+            LOG_ERR("tss2_tcti_transmit failed: 0x%x", rval);
+            return tool_rc_from_tpm(rval);
+        }
+
+        size_t rsize = TPM2_MAX_SIZE;
+        UINT8 rbuf[TPM2_MAX_SIZE];
+        rval = Tss2_Tcti_Receive(tcti_context, &rsize, rbuf,
+                TSS2_TCTI_TIMEOUT_BLOCK);
+        if (rval != TPM2_RC_SUCCESS) {
+            LOG_ERR("tss2_tcti_receive failed: 0x%x", rval);
+            return tool_rc_from_tpm(rval);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        UINT64 us = tpm2_util_elapsed_us(&start, &end);
+        stats.commands++;
+        stats.total_us += us;
+        stats.min_us = us < stats.min_us ? us : stats.min_us;
+        stats.max_us = us > stats.max_us ? us : stats.max_us;
+
+        result = write_response_to_file(ctx.output, rbuf);
+        if (!result) {
+            LOG_ERR("Failed writing response to output file.");
+            return tool_rc_general_error;
+        }
+
+        tpm2_command_header *c = tpm2_command_header_from_bytes(cbuf);
+        tpm2_response_header *r = tpm2_response_header_from_bytes(rbuf);
+
+        tpm2_tool_output("  - command-code: 0x%x\n",
+                tpm2_command_header_get_code(c));
+        tpm2_tool_output("    response-code: 0x%x\n",
+                tpm2_response_header_get_code(r));
+        tpm2_tool_output("    latency-us: %"PRIu64"\n", us);
+
+        if (ctx.expected) {
+            bool is_match = false;
+            result = check_response(rbuf, rsize, &is_match);
+            if (!result) {
+                return tool_rc_general_error;
+            }
+            if (!is_match) {
+                stats.mismatches++;
+                LOG_ERR("Response to command %"PRIu64" differs from the"
+                        " expected response", stats.commands);
+            }
+            tpm2_tool_output("    match: %s\n", is_match ? "yes" : "no");
+        }
+    }
+
+    tpm2_tool_output("total:\n");
+    tpm2_tool_output("  commands: %"PRIu64"\n", stats.commands);
+    tpm2_tool_output("  time-us: %"PRIu64"\n", stats.total_us);
+    if (stats.commands) {
+        tpm2_tool_output("  min-us: %"PRIu64"\n", stats.min_us);
+        tpm2_tool_output("  max-us: %"PRIu64"\n", stats.max_us);
+        tpm2_tool_output("  mean-us: %"PRIu64"\n",
+                stats.total_us / stats.commands);
+    }
+    if (stats.total_us) {
+        tpm2_tool_output("  commands-per-second: %.1f\n",
+                stats.commands * 1000000.0 / stats.total_us);
+    }
+    if (ctx.expected) {
+        tpm2_tool_output("  mismatches: %"PRIu64"\n", stats.mismatches);
+    }
+
+    return stats.mismatches ? tool_rc_general_error : tool_rc_success;
+}
+
 static FILE *open_file(const char *path, const char *mode) {
     FILE *f = fopen(path, mode);
     if (!f) {
@@ -104,7 +284,15 @@ static bool on_option(char key, char *value) {
              return false;
          }
          break;
-    /* no break */
+    case 's':
+        ctx.stream = true;
+        break;
+    case 'e':
+        ctx.expected = open_file(value, "rb");
+        if (!ctx.expected) {
+            return false;
+        }
+        break;
     }
 
     return true;
@@ -130,10 +318,12 @@ static bool on_args(int argc, char **argv) {
 bool tpm2_tool_onstart(tpm2_options **opts) {
 
     static const struct option topts[] = {
-        { "output", required_argument, NULL, 'o' },
+        { "output",   required_argument, NULL, 'o' },
+        { "stream",   no_argument,       NULL, 's' },
+        { "expected", required_argument, NULL, 'e' },
     };
 
-    *opts = tpm2_options_new("o:", ARRAY_LEN(topts), topts,
+    *opts = tpm2_options_new("o:se:", ARRAY_LEN(topts), topts,
                              on_option, on_args, 0);
 
     ctx.input = stdin;
@@ -155,6 +345,33 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *context, tpm2_option_flags flags) {
 
     tool_rc rc = tool_rc_general_error;
 
+    if (ctx.expected && !ctx.stream) {
+        LOG_ERR("Expected responses can only be compared in stream mode");
+        rc = tool_rc_option_error;
+        goto out_files;
+    }
+
+    if (ctx.stream) {
+        /* stdout carries the timing report */
+        if (ctx.output == stdout) {
+            LOG_ERR("Stream mode requires an output file for responses, see"
+                    " -o");
+            rc = tool_rc_option_error;
+            goto out_files;
+        }
+
+        TSS2_TCTI_CONTEXT *tcti_context;
+        TSS2_RC rval = Esys_GetTcti(context, &tcti_context);
+        if (rval != TPM2_RC_SUCCESS) {
+            LOG_PERR(Esys_GetTctiContext, rval);
+            rc = tool_rc_from_tpm(rval);
+            goto out_files;
+        }
+
+        rc = send_stream(tcti_context);
+        goto out_files;
+    }
+
     UINT32 size;
     tpm2_command_header *command;
     bool result = read_command_from_file(ctx.input, &command, &size);
@@ -203,6 +420,7 @@ out:
 out_files:
     close_file(ctx.input);
     close_file(ctx.output);
+    close_file(ctx.expected);
 
     return rc;
 }
@@ -1,6 +1,9 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
+#include <limits.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -10,7 +13,9 @@
 #include "tpm2_alg_util.h"
 #include "tpm2_convert.h"
 #include "tpm2_hash.h"
+#include "tpm2_merkle.h"
 #include "tpm2_options.h"
+#include "tpm2_tool.h"
 
 typedef struct tpm_sign_ctx tpm_sign_ctx;
 struct tpm_sign_ctx {
@@ -31,6 +36,15 @@ struct tpm_sign_ctx {
     char *input_file;
     tpm2_convert_sig_fmt sig_format;
 
+    struct {
+        const char *list_path;
+        const char *proof_dir;
+        char **items;
+        TPM2B_DIGEST *leaves;
+        UINT32 count;
+        tpm2_merkle_tree *tree;
+    } tree;
+
     struct {
         UINT8 d : 1;
         UINT8 t : 1;
@@ -68,6 +82,153 @@ out:
     return rc;
 }
 
+static bool tree_add_item(char *path) {
+
+    if (ctx.tree.count == TPM2_MERKLE_MAX_LEAVES) {
+        LOG_ERR("A tree holds at most %u items", TPM2_MERKLE_MAX_LEAVES);
+        return false;
+    }
+
+    /* grow the lists whenever the count reaches a power of two */
+    UINT32 count = ctx.tree.count;
+    if (!(count & (count - 1))) {
+        UINT32 capacity = count ? 2 * count : 1;
+        char **items = realloc(ctx.tree.items, capacity * sizeof(*items));
+        if (items) {
+            ctx.tree.items = items;
+        }
+        TPM2B_DIGEST *leaves = realloc(ctx.tree.leaves,
+                capacity * sizeof(*leaves));
+        if (leaves) {
+            ctx.tree.leaves = leaves;
+        }
+        if (!items || !leaves) {
+            LOG_ERR("oom");
+            return false;
+        }
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        LOG_ERR("Could not open file \"%s\", error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    /* items are hashed on the host, only the root goes to the TPM */
+    bool result = tpm2_merkle_leaf_hash_file(ctx.halg, f,
+            &ctx.tree.leaves[count]);
+    fclose(f);
+    if (!result) {
+        LOG_ERR("Could not hash file \"%s\"", path);
+        return false;
+    }
+
+    ctx.tree.items[count] = strdup(path);
+    if (!ctx.tree.items[count]) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    ctx.tree.count++;
+
+    return true;
+}
+
+static tool_rc tree_build(void) {
+
+    FILE *list = strcmp(ctx.tree.list_path, "-") ?
+            fopen(ctx.tree.list_path, "r") : stdin;
+    if (!list) {
+        LOG_ERR("Could not open file \"%s\", error: %s", ctx.tree.list_path,
+                strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    bool result = true;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    while (result && (len = getline(&line, &size, list)) >= 0) {
+        while (len && (line[len - 1] == '\n' || line[len - 1] == '\r')) {
+            line[--len] = '\0';
+        }
+
+        if (len) {
+            result = tree_add_item(line);
+        }
+    }
+    free(line);
+
+    if (list != stdin) {
+        fclose(list);
+    }
+
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    if (!ctx.tree.count) {
+        LOG_ERR("No files listed in \"%s\"", ctx.tree.list_path);
+        return tool_rc_general_error;
+    }
+
+    ctx.tree.tree = tpm2_merkle_tree_new(ctx.halg, ctx.tree.leaves,
+            ctx.tree.count);
+    if (!ctx.tree.tree) {
+        return tool_rc_general_error;
+    }
+
+    ctx.digest = malloc(sizeof(TPM2B_DIGEST));
+    if (!ctx.digest) {
+        LOG_ERR("oom");
+        return tool_rc_general_error;
+    }
+
+    *ctx.digest = *tpm2_merkle_tree_root(ctx.tree.tree);
+
+    return tool_rc_success;
+}
+
+static tool_rc tree_write_proofs(void) {
+
+    tpm2_tool_output("tree:\n");
+    tpm2_tool_output("  hash-algorithm: %s\n",
+            tpm2_alg_util_algtostr(ctx.halg, tpm2_alg_util_flags_hash));
+    tpm2_tool_output("  root: ");
+    tpm2_util_hexdump(ctx.digest->buffer, ctx.digest->size);
+    tpm2_tool_output("\n");
+    tpm2_tool_output("  items:\n");
+
+    UINT32 i;
+    for (i = 0; i < ctx.tree.count; i++) {
+        tpm2_merkle_proof proof;
+        bool result = tpm2_merkle_tree_proof(ctx.tree.tree, i, &proof);
+        if (!result) {
+            return tool_rc_general_error;
+        }
+
+        char path[PATH_MAX];
+        int n = snprintf(path, sizeof(path), "%s/%u.proof", ctx.tree.proof_dir,
+                i);
+        if (n < 0 || (size_t)n >= sizeof(path)) {
+            LOG_ERR("Proof path too long for directory \"%s\"",
+                    ctx.tree.proof_dir);
+            return tool_rc_general_error;
+        }
+
+        result = tpm2_merkle_proof_save(&proof, path);
+        if (!result) {
+            return tool_rc_general_error;
+        }
+
+        tpm2_tool_output("    - file: %s\n", ctx.tree.items[i]);
+        tpm2_tool_output("      proof: %s\n", path);
+    }
+
+    return tool_rc_success;
+}
+
 static tool_rc init(ESYS_CONTEXT *ectx) {
 
     bool option_fail = false;
@@ -82,6 +243,21 @@ static tool_rc init(ESYS_CONTEXT *ectx) {
         option_fail = true;
     }
 
+    if (ctx.tree.list_path) {
+        if (ctx.input_file || ctx.flags.d || ctx.flags.t) {
+            LOG_ERR("Cannot specify --tree with an input file, -d or -t");
+            option_fail = true;
+        }
+
+        if (!ctx.tree.proof_dir) {
+            LOG_ERR("Expected --proof-dir with --tree");
+            option_fail = true;
+        }
+    } else if (ctx.tree.proof_dir) {
+        LOG_ERR("--proof-dir requires --tree");
+        option_fail = true;
+    }
+
     if (option_fail) {
         return tool_rc_option_error;
     }
@@ -91,7 +267,7 @@ static tool_rc init(ESYS_CONTEXT *ectx) {
                 " is ignored.");
     }
 
-    if (ctx.flags.d || !ctx.flags.t) {
+    if (ctx.flags.d || !ctx.flags.t || ctx.tree.list_path) {
         ctx.validation.tag = TPM2_ST_HASHCHECK;
         ctx.validation.hierarchy = TPM2_RH_NULL;
         memset(&ctx.validation.digest, 0, sizeof(ctx.validation.digest));
@@ -107,6 +283,11 @@ static tool_rc init(ESYS_CONTEXT *ectx) {
         return rc;
     }
 
+    /* the root is signed as a digest, the TPM never sees the items */
+    if (ctx.tree.list_path) {
+        return tree_build();
+    }
+
     /* Process the msg file if needed */
     if (!ctx.flags.d) {
       FILE *input = ctx.input_file ? fopen(ctx.input_file, "rb") : stdin;
@@ -190,6 +371,13 @@ static bool on_option(char key, char *value) {
         if (ctx.sig_format == signature_format_err) {
             return false;
         }
+        break;
+    case 0:
+        ctx.tree.list_path = value;
+        break;
+    case 1:
+        ctx.tree.proof_dir = value;
+        break;
     /* no default */
     }
 
@@ -218,7 +406,9 @@ bool tpm2_tool_onstart(tpm2_options **opts) {
       { "signature",            required_argument, NULL, 'o' },
       { "ticket",               required_argument, NULL, 't' },
       { "key-context",          required_argument, NULL, 'c' },
-      { "format",               required_argument, NULL, 'f' }
+      { "format",               required_argument, NULL, 'f' },
+      { "tree",                 required_argument, NULL,  0  },
+      { "proof-dir",            required_argument, NULL,  1  },
     };
 
     *opts = tpm2_options_new("p:g:dt:o:c:f:s:", ARRAY_LEN(topts), topts,
@@ -244,7 +434,12 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
         return rc;
     }
 
-    return sign_and_save(ectx);
+    rc = sign_and_save(ectx);
+    if (rc != tool_rc_success || !ctx.tree.list_path) {
+        return rc;
+    }
+
+    return tree_write_proofs();
 }
 
 tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
@@ -258,4 +453,12 @@ void tpm2_tool_onexit(void) {
         free(ctx.digest);
     }
     free(ctx.msg);
+
+    UINT32 i;
+    for (i = 0; i < ctx.tree.count; i++) {
+        free(ctx.tree.items[i]);
+    }
+    free(ctx.tree.items);
+    free(ctx.tree.leaves);
+    tpm2_merkle_tree_free(ctx.tree.tree);
 }
@@ -14,6 +14,7 @@ struct tpm2_startauthsession_ctx {
         TPMI_ALG_HASH halg;
         const char *key_context_arg_str;
         tpm2_loaded_object key_context_object;
+        bool resident;
     } session;
     struct {
         const char *path;
@@ -33,6 +34,9 @@ static bool on_option(char key, char *value) {
     case 0:
         ctx.session.type = TPM2_SE_POLICY;
         break;
+    case 1:
+        ctx.session.resident = true;
+        break;
     case 'g':
         ctx.session.halg = tpm2_alg_util_from_optarg(value, tpm2_alg_util_flags_hash);
         if(ctx.session.halg == TPM2_ALG_ERROR) {
@@ -55,6 +59,7 @@ bool tpm2_tool_onstart(tpm2_options **opts) {
 
     static struct option topts[] = {
         { "policy-session",      no_argument,       NULL,  0 },
+        { "resident",            no_argument,       NULL,  1 },
         { "key-context",         required_argument, NULL, 'c'},
         { "hash-algorithm",      required_argument, NULL, 'g'},
         { "session",             required_argument, NULL, 'S'},
@@ -114,6 +119,8 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     tpm2_session_set_authhash(session_data, ctx.session.halg);
 
+    tpm2_session_set_resident(session_data, ctx.session.resident);
+
     /* if it has an encryption key, set it as both the encryption key and bind key */
     if (has_key) {
         tpm2_session_set_key(session_data, ctx.session.key_context_object.tr_handle);
@@ -1,61 +1,112 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 #include "log.h"
+#include "tpm2.h"
 #include "tpm2_alg_util.h"
-#include "tpm2_options.h"
+#include "tpm2_capability.h"
+#include "tpm2_tool.h"
+#include "tpm2_util.h"
+
+#define MAX_SPECS 512
+#define MAX_SPEC_LEN 64
+
+typedef enum testparms_result testparms_result;
+enum testparms_result {
+    testparms_result_unknown = 0,
+    testparms_result_supported,
+    testparms_result_unsupported,
+};
+
+typedef struct testparms_spec testparms_spec;
+struct testparms_spec {
+    char name[MAX_SPEC_LEN];
+    TPMT_PUBLIC_PARMS parms;
+    testparms_result result;
+};
+
+typedef struct testparms_cache_entry testparms_cache_entry;
+struct testparms_cache_entry {
+    char name[MAX_SPEC_LEN];
+    testparms_result result;
+};
 
 typedef struct tpm_testparms_ctx tpm_testparms_ctx;
 
 struct tpm_testparms_ctx {
     TPMT_PUBLIC_PARMS  inputalg;
+    int argc;
+    char **argv;
+    struct {
+        bool derive;
+        const char *list_path;
+        const char *cache_path;
+        UINT32 manufacturer;
+        UINT64 firmware;
+        testparms_spec specs[MAX_SPECS];
+        size_t count;
+        size_t printed;
+        testparms_cache_entry cache[MAX_SPECS];
+        size_t cache_count;
+        bool cache_dirty;
+    } bulk;
 };
 
 static tpm_testparms_ctx ctx;
 
+/*
+ * Maps a TPM2_TestParms failure on the parameters to a reason, or NULL
+ * when the failure is not about the algorithm specification.
+ *
+ * TODO: this is a good candidate for flatten support via Tss2_RC_Decode(rval);
+ */
+static const char *testparms_reason(TSS2_RC rval) {
+
+    if ((rval & (TPM2_RC_P | TPM2_RC_1)) != (TPM2_RC_P | TPM2_RC_1)) {
+        return NULL;
+    }
+
+    rval &= ~(TPM2_RC_P | TPM2_RC_1);
+    switch (rval) {
+    case TPM2_RC_CURVE:
+        return "Specified elliptic curve is unsupported";
+    case TPM2_RC_HASH:
+        return "Specified hash is unsupported";
+    case TPM2_RC_SCHEME:
+        return "Specified signing scheme is unsupported or incompatible";
+    case TPM2_RC_KDF:
+        return "Specified key derivation function is unsupported";
+    case TPM2_RC_MGF:
+        return "Specified mask generation function is unsupported";
+    case TPM2_RC_KEY_SIZE:
+        return "Specified key size is unsupported";
+    case TPM2_RC_SYMMETRIC:
+        return "Specified symmetric algorithm or key length is unsupported";
+    case TPM2_RC_ASYMMETRIC:
+        return "Specified asymmetric algorithm is unsupported";
+    case TPM2_RC_MODE:
+        return "Specified symmetric mode unsupported";
+    case TPM2_RC_VALUE:
+    default:
+        return "Unsupported algorithm specification";
+    }
+}
+
 static tool_rc tpm_testparms(ESYS_CONTEXT *ectx) {
 
     TSS2_RC rval = Esys_TestParms(ectx, ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE, &(ctx.inputalg));
-    /*
-     * TODO: this is a good candidate for flatten support via Tss2_RC_Decode(rval);
-     */
     if (rval != TSS2_RC_SUCCESS) {
-        if ((rval & (TPM2_RC_P | TPM2_RC_1)) == (TPM2_RC_P | TPM2_RC_1)){
-            rval &= ~(TPM2_RC_P | TPM2_RC_1);
-            switch (rval){
-                case TPM2_RC_CURVE:
-                    LOG_ERR("Specified elliptic curve is unsupported");
-                    break;
-                case TPM2_RC_HASH:
-                    LOG_ERR("Specified hash is unsupported");
-                    break;
-                case TPM2_RC_SCHEME:
-                    LOG_ERR("Specified signing scheme is unsupported or incompatible");
-                    break;
-                case TPM2_RC_KDF:
-                    LOG_ERR("Specified key derivation function is unsupported");
-                    break;
-                case TPM2_RC_MGF:
-                    LOG_ERR("Specified mask generation function is unsupported");
-                    break;
-                case TPM2_RC_KEY_SIZE:
-                    LOG_ERR("Specified key size is unsupported");
-                    break;
-                case TPM2_RC_SYMMETRIC:
-                    LOG_ERR("Specified symmetric algorithm or key length is unsupported");
-                    break;
-                case TPM2_RC_ASYMMETRIC:
-                    LOG_ERR("Specified asymmetric algorithm is unsupported");
-                    break;
-                case TPM2_RC_MODE:
-                    LOG_ERR("Specified symmetric mode unsupported");
-                    break;
-                case TPM2_RC_VALUE:
-                default:
-                    LOG_ERR("Unsupported algorithm specification");
-                    break;
-            }
+        const char *reason = testparms_reason(rval);
+        if (reason) {
+            LOG_ERR("%s", reason);
             return tool_rc_unsupported;
         }
         LOG_PERR(Esys_TestParms, rval);
@@ -65,27 +116,672 @@ static tool_rc tpm_testparms(ESYS_CONTEXT *ectx) {
     return tool_rc_success;
 }
 
-static bool on_arg(int argc, char **argv){
+static bool parse_spec(const char *spec, TPMT_PUBLIC_PARMS *parms) {
 
-    if (argc < 1) {
-        LOG_ERR("Expected one algorithm specification, got: 0");
+    TPM2B_PUBLIC algorithm = { 0 };
+
+    if(!tpm2_alg_util_handle_ext_alg(spec, &algorithm)){
+        LOG_ERR("Invalid or unsupported by the tool : %s", spec);
         return false;
     }
 
-    TPM2B_PUBLIC algorithm = { 0 };
+    parms->type = algorithm.publicArea.type;
+    memcpy(&parms->parameters, &algorithm.publicArea.parameters, sizeof(TPMU_PUBLIC_PARMS));
+    return true;
+}
 
-    if(!tpm2_alg_util_handle_ext_alg(argv[0], &algorithm)){
-        LOG_ERR("Invalid or unsupported by the tool : %s", argv[0]);
+static bool add_spec(const char *spec) {
+
+    size_t i;
+    for (i = 0; i < ctx.bulk.count; i++) {
+        if (!strcmp(ctx.bulk.specs[i].name, spec)) {
+            return true;
+        }
+    }
+
+    if (ctx.bulk.count == MAX_SPECS) {
+        LOG_ERR("Too many algorithm specifications, the maximum is %u",
+                MAX_SPECS);
         return false;
     }
 
-    ctx.inputalg.type = algorithm.publicArea.type;
-    memcpy(&ctx.inputalg.parameters, &algorithm.publicArea.parameters, sizeof(TPMU_PUBLIC_PARMS));
+    if (strlen(spec) >= MAX_SPEC_LEN) {
+        LOG_ERR("Algorithm specification too long, got: \"%s\"", spec);
+        return false;
+    }
+
+    testparms_spec *s = &ctx.bulk.specs[ctx.bulk.count];
+    if (!parse_spec(spec, &s->parms)) {
+        return false;
+    }
+
+    snprintf(s->name, sizeof(s->name), "%s", spec);
+    s->result = testparms_result_unknown;
+    ctx.bulk.count++;
+
     return true;
 }
 
+/*
+ * Reads one algorithm specification per line, skipping blank lines and
+ * lines starting with '#'. A path of "-" reads stdin.
+ */
+static bool add_specs_from_list(const char *path) {
+
+    bool is_stdin = !strcmp(path, "-");
+    FILE *f = is_stdin ? stdin : fopen(path, "r");
+    if (!f) {
+        LOG_ERR("Could not open specification list \"%s\", error: %s", path,
+                strerror(errno));
+        return false;
+    }
+
+    bool result = true;
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+        char *spec = line;
+        while (*spec == ' ' || *spec == '\t') {
+            spec++;
+        }
+
+        size_t len = strlen(spec);
+        while (len && (spec[len - 1] == '\n' || spec[len - 1] == '\r'
+                || spec[len - 1] == ' ' || spec[len - 1] == '\t')) {
+            spec[--len] = '\0';
+        }
+
+        if (!len || spec[0] == '#') {
+            continue;
+        }
+
+        result = add_spec(spec);
+        if (!result) {
+            break;
+        }
+    }
+
+    if (!is_stdin) {
+        fclose(f);
+    }
+
+    return result;
+}
+
+static bool alg_is_listed(TPML_ALG_PROPERTY *algs, TPM2_ALG_ID alg) {
+
+    UINT32 i;
+    for (i = 0; i < algs->count; i++) {
+        if (algs->algProperties[i].alg == alg) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+static const char *curve_to_spec(TPM2_ECC_CURVE curve) {
+
+    switch (curve) {
+    case TPM2_ECC_NIST_P192:
+        return "ecc192";
+    case TPM2_ECC_NIST_P224:
+        return "ecc224";
+    case TPM2_ECC_NIST_P256:
+        return "ecc256";
+    case TPM2_ECC_NIST_P384:
+        return "ecc384";
+    case TPM2_ECC_NIST_P521:
+        return "ecc521";
+        /* no default */
+    }
+
+    return NULL;
+}
+
+static bool derive_asym_specs(ESYS_CONTEXT *ectx, TPML_ALG_PROPERTY *algs) {
+
+    static const char *rsa_sizes[] = { "1024", "2048", "4096" };
+    static const TPM2_ALG_ID rsa_schemes[] = {
+        TPM2_ALG_RSASSA, TPM2_ALG_RSAPSS, TPM2_ALG_RSAES
+    };
+    static const TPM2_ALG_ID ecc_schemes[] = {
+        TPM2_ALG_ECDSA, TPM2_ALG_ECSCHNORR, TPM2_ALG_ECDH
+    };
+
+    char spec[MAX_SPEC_LEN];
+    size_t i;
+
+    if (alg_is_listed(algs, TPM2_ALG_RSA)) {
+        for (i = 0; i < ARRAY_LEN(rsa_sizes); i++) {
+            snprintf(spec, sizeof(spec), "rsa%s", rsa_sizes[i]);
+            if (!add_spec(spec)) {
+                return false;
+            }
+        }
+        for (i = 0; i < ARRAY_LEN(rsa_schemes); i++) {
+            if (!alg_is_listed(algs, rsa_schemes[i])) {
+                continue;
+            }
+            snprintf(spec, sizeof(spec), "rsa2048:%s",
+                    tpm2_alg_util_algtostr(rsa_schemes[i],
+                            tpm2_alg_util_flags_any));
+            if (!add_spec(spec)) {
+                return false;
+            }
+        }
+    }
+
+    if (!alg_is_listed(algs, TPM2_ALG_ECC)) {
+        return true;
+    }
+
+    TPMS_CAPABILITY_DATA *cap_data = NULL;
+    tool_rc rc = tpm2_capability_get(ectx, TPM2_CAP_ECC_CURVES,
+            TPM2_ECC_NIST_P192, TPM2_MAX_ECC_CURVES, &cap_data);
+    if (rc != tool_rc_success) {
+        return false;
+    }
+
+    bool result = true;
+    TPML_ECC_CURVE *curves = &cap_data->data.eccCurves;
+    for (i = 0; i < curves->count && result; i++) {
+        const char *curve = curve_to_spec(curves->eccCurves[i]);
+        if (!curve) {
+            LOG_INFO("Skipping ECC curve 0x%x, it has no algorithm specifier",
+                    curves->eccCurves[i]);
+            continue;
+        }
+        result = add_spec(curve);
+    }
+
+    free(cap_data);
+
+    for (i = 0; i < ARRAY_LEN(ecc_schemes) && result; i++) {
+        if (!alg_is_listed(algs, ecc_schemes[i])) {
+            continue;
+        }
+        snprintf(spec, sizeof(spec), "ecc256:%s",
+                tpm2_alg_util_algtostr(ecc_schemes[i],
+                        tpm2_alg_util_flags_any));
+        result = add_spec(spec);
+    }
+
+    return result;
+}
+
+static bool derive_sym_specs(TPML_ALG_PROPERTY *algs) {
+
+    static const TPM2_ALG_ID ciphers[] = { TPM2_ALG_AES, TPM2_ALG_CAMELLIA };
+    static const char *sizes[] = { "128", "192", "256" };
+    static const TPM2_ALG_ID modes[] = {
+        TPM2_ALG_CFB, TPM2_ALG_CTR, TPM2_ALG_OFB, TPM2_ALG_CBC, TPM2_ALG_ECB
+    };
+
+    char spec[MAX_SPEC_LEN];
+    size_t c, s, m;
+
+    for (c = 0; c < ARRAY_LEN(ciphers); c++) {
+        if (!alg_is_listed(algs, ciphers[c])) {
+            continue;
+        }
+        for (s = 0; s < ARRAY_LEN(sizes); s++) {
+            for (m = 0; m < ARRAY_LEN(modes); m++) {
+                if (!alg_is_listed(algs, modes[m])) {
+                    continue;
+                }
+                snprintf(spec, sizeof(spec), "%s%s%s",
+                        tpm2_alg_util_algtostr(ciphers[c],
+                                tpm2_alg_util_flags_symmetric),
+                        sizes[s],
+                        tpm2_alg_util_algtostr(modes[m],
+                                tpm2_alg_util_flags_mode));
+                if (!add_spec(spec)) {
+                    return false;
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+static bool derive_keyedhash_specs(TPML_ALG_PROPERTY *algs) {
+
+    static const TPM2_ALG_ID schemes[] = { TPM2_ALG_HMAC, TPM2_ALG_XOR };
+
+    if (!alg_is_listed(algs, TPM2_ALG_KEYEDHASH)) {
+        return true;
+    }
+
+    char spec[MAX_SPEC_LEN];
+    size_t s;
+    UINT32 i;
+
+    for (s = 0; s < ARRAY_LEN(schemes); s++) {
+        if (!alg_is_listed(algs, schemes[s])) {
+            continue;
+        }
+        const char *scheme = tpm2_alg_util_algtostr(schemes[s],
+                tpm2_alg_util_flags_keyedhash);
+        for (i = 0; i < algs->count; i++) {
+            const char *hash = tpm2_alg_util_algtostr(
+                    algs->algProperties[i].alg, tpm2_alg_util_flags_hash);
+            if (!hash) {
+                continue;
+            }
+            snprintf(spec, sizeof(spec), "%s:%s", scheme, hash);
+            if (!add_spec(spec)) {
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+/*
+ * Builds the specifications to probe from the algorithms in TPM2_CAP_ALGS
+ * and the curves in TPM2_CAP_ECC_CURVES.
+ */
+static tool_rc derive_specs(ESYS_CONTEXT *ectx) {
+
+    TPMS_CAPABILITY_DATA *cap_data = NULL;
+    tool_rc rc = tpm2_capability_get(ectx, TPM2_CAP_ALGS, TPM2_ALG_FIRST,
+            TPM2_MAX_CAP_ALGS, &cap_data);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    TPML_ALG_PROPERTY *algs = &cap_data->data.algorithms;
+    bool result = derive_asym_specs(ectx, algs)
+            && derive_sym_specs(algs)
+            && derive_keyedhash_specs(algs);
+
+    free(cap_data);
+
+    return result ? tool_rc_success : tool_rc_general_error;
+}
+
+/*
+ * The results only hold for the firmware that produced them, so the
+ * manufacturer and firmware version key the matrix and its cache.
+ */
+static tool_rc get_firmware_key(ESYS_CONTEXT *ectx) {
+
+    UINT32 fw1, fw2;
+    tool_rc rc = tpm2_capability_get_tpm_property(ectx, TPM2_PT_MANUFACTURER,
+            &ctx.bulk.manufacturer);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    rc = tpm2_capability_get_tpm_property(ectx, TPM2_PT_FIRMWARE_VERSION_1,
+            &fw1);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    rc = tpm2_capability_get_tpm_property(ectx, TPM2_PT_FIRMWARE_VERSION_2,
+            &fw2);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    ctx.bulk.firmware = ((UINT64) fw1 << 32) | fw2;
+
+    return tool_rc_success;
+}
+
+static const char *result_to_str(testparms_result result) {
+
+    return result == testparms_result_supported ? "supported" : "unsupported";
+}
+
+static testparms_result result_from_str(const char *str) {
+
+    if (!strcmp(str, "supported")) {
+        return testparms_result_supported;
+    }
+    if (!strcmp(str, "unsupported")) {
+        return testparms_result_unsupported;
+    }
+    return testparms_result_unknown;
+}
+
+static void print_header(FILE *f) {
+
+    fprintf(f, "manufacturer: 0x%08x\n", ctx.bulk.manufacturer);
+    fprintf(f, "firmware-version: 0x%016" PRIx64 "\n", ctx.bulk.firmware);
+    fprintf(f, "specs:\n");
+}
+
+/*
+ * Loads the cached matrix at path when it was recorded for the same
+ * manufacturer and firmware version. Anything else is treated as a miss.
+ */
+static void cache_load(const char *path) {
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        LOG_INFO("No cached results at \"%s\"", path);
+        return;
+    }
+
+    UINT32 manufacturer = 0;
+    UINT64 firmware = 0;
+    bool has_manufacturer = false;
+    bool has_firmware = false;
+
+    char line[256];
+    while (fgets(line, sizeof(line), f)) {
+
+        line[strcspn(line, "\r\n")] = '\0';
+
+        if (sscanf(line, "manufacturer: 0x%" SCNx32, &manufacturer) == 1) {
+            has_manufacturer = true;
+            continue;
+        }
+
+        if (sscanf(line, "firmware-version: 0x%" SCNx64, &firmware) == 1) {
+            has_firmware = true;
+            continue;
+        }
+
+        if (strncmp(line, "  ", 2)) {
+            continue;
+        }
+
+        if (!has_manufacturer || !has_firmware
+                || manufacturer != ctx.bulk.manufacturer
+                || firmware != ctx.bulk.firmware) {
+            LOG_INFO("Cached results at \"%s\" are for different firmware, "
+                    "probing again", path);
+            ctx.bulk.cache_count = 0;
+            break;
+        }
+
+        /* results never contain ':' but specifications may */
+        char *sep = strrchr(line, ':');
+        if (!sep || ctx.bulk.cache_count == MAX_SPECS) {
+            continue;
+        }
+        *sep = '\0';
+
+        char *value = sep + 1;
+        while (*value == ' ') {
+            value++;
+        }
+
+        testparms_cache_entry *e = &ctx.bulk.cache[ctx.bulk.cache_count];
+        e->result = result_from_str(value);
+        if (e->result == testparms_result_unknown
+                || strlen(&line[2]) >= MAX_SPEC_LEN) {
+            continue;
+        }
+        snprintf(e->name, sizeof(e->name), "%s", &line[2]);
+        ctx.bulk.cache_count++;
+    }
+
+    fclose(f);
+
+    size_t i, j;
+    for (i = 0; i < ctx.bulk.count; i++) {
+        for (j = 0; j < ctx.bulk.cache_count; j++) {
+            if (!strcmp(ctx.bulk.specs[i].name, ctx.bulk.cache[j].name)) {
+                ctx.bulk.specs[i].result = ctx.bulk.cache[j].result;
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * The cache is written next to its path and renamed over it, so an
+ * interrupted run leaves the previous cache and never a truncated one.
+ */
+static tool_rc cache_store(const char *path) {
+
+    char tmp_path[PATH_MAX];
+    int len = snprintf(tmp_path, sizeof(tmp_path), "%s.XXXXXX", path);
+    if (len < 0 || (size_t) len >= sizeof(tmp_path)) {
+        LOG_ERR("Cache path \"%s\" is too long", path);
+        return tool_rc_general_error;
+    }
+
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        LOG_ERR("Could not create cache \"%s\", error: %s", tmp_path,
+                strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    /* mkstemp() makes it private, the cache is as readable as before */
+    mode_t mask = umask(0);
+    umask(mask);
+    if (fchmod(fd, 0666 & ~mask)) {
+        LOG_WARN("Could not set the mode of cache \"%s\", error: %s",
+                tmp_path, strerror(errno));
+    }
+
+    FILE *f = fdopen(fd, "w");
+    if (!f) {
+        LOG_ERR("Could not open cache \"%s\", error: %s", tmp_path,
+                strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+        return tool_rc_general_error;
+    }
+
+    print_header(f);
+
+    size_t i, j;
+    for (i = 0; i < ctx.bulk.count; i++) {
+        fprintf(f, "  %s: %s\n", ctx.bulk.specs[i].name,
+                result_to_str(ctx.bulk.specs[i].result));
+    }
+
+    /* keep what other invocations probed on this firmware */
+    for (j = 0; j < ctx.bulk.cache_count; j++) {
+        for (i = 0; i < ctx.bulk.count; i++) {
+            if (!strcmp(ctx.bulk.specs[i].name, ctx.bulk.cache[j].name)) {
+                break;
+            }
+        }
+        if (i == ctx.bulk.count) {
+            fprintf(f, "  %s: %s\n", ctx.bulk.cache[j].name,
+                    result_to_str(ctx.bulk.cache[j].result));
+        }
+    }
+
+    bool is_error = fflush(f) || ferror(f) || fsync(fileno(f));
+    is_error |= fclose(f) != 0;
+    if (is_error) {
+        LOG_ERR("Could not write cache \"%s\"", tmp_path);
+        unlink(tmp_path);
+        return tool_rc_general_error;
+    }
+
+    if (rename(tmp_path, path)) {
+        LOG_ERR("Could not rename cache \"%s\" to \"%s\", error: %s",
+                tmp_path, path, strerror(errno));
+        unlink(tmp_path);
+        return tool_rc_general_error;
+    }
+
+    return tool_rc_success;
+}
+
+/* prints the results before index end, they are all known by now */
+static void print_results(size_t end) {
+
+    for (; ctx.bulk.printed < end; ctx.bulk.printed++) {
+        testparms_spec *s = &ctx.bulk.specs[ctx.bulk.printed];
+        tpm2_tool_output("  %s: %s\n", s->name, result_to_str(s->result));
+    }
+}
+
+static tool_rc testparms_finish(ESYS_CONTEXT *ectx, testparms_spec *s) {
+
+    TSS2_RC rval;
+    do {
+        rval = Esys_TestParms_Finish(ectx);
+    } while (rval == TSS2_ESYS_RC_TRY_AGAIN);
+
+    if (rval == TSS2_RC_SUCCESS) {
+        s->result = testparms_result_supported;
+        return tool_rc_success;
+    }
+
+    const char *reason = testparms_reason(rval);
+    if (!reason) {
+        LOG_PERR(Esys_TestParms_Finish, rval);
+        return tool_rc_from_tpm(rval);
+    }
+
+    LOG_INFO("%s: %s", s->name, reason);
+    s->result = testparms_result_unsupported;
+
+    return tool_rc_success;
+}
+
+/*
+ * Issues TPM2_TestParms for every specification without a cached result.
+ * While one command is in flight the results that came before it are
+ * written out.
+ */
+static tool_rc probe_specs(ESYS_CONTEXT *ectx) {
+
+    size_t i;
+    for (i = 0; i < ctx.bulk.count; i++) {
+
+        testparms_spec *s = &ctx.bulk.specs[i];
+        if (s->result != testparms_result_unknown) {
+            continue;
+        }
+
+        TSS2_RC rval = Esys_TestParms_Async(ectx, ESYS_TR_NONE, ESYS_TR_NONE,
+                ESYS_TR_NONE, &s->parms);
+        if (rval != TSS2_RC_SUCCESS) {
+            LOG_PERR(Esys_TestParms_Async, rval);
+            return tool_rc_from_tpm(rval);
+        }
+
+        print_results(i);
+
+        tool_rc rc = testparms_finish(ectx, s);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        ctx.bulk.cache_dirty = true;
+    }
+
+    print_results(ctx.bulk.count);
+
+    return tool_rc_success;
+}
+
+static tool_rc tpm_testparms_bulk(ESYS_CONTEXT *ectx) {
+
+    int i;
+    for (i = 0; i < ctx.argc; i++) {
+        if (!add_spec(ctx.argv[i])) {
+            return tool_rc_option_error;
+        }
+    }
+
+    if (ctx.bulk.list_path && !add_specs_from_list(ctx.bulk.list_path)) {
+        return tool_rc_option_error;
+    }
+
+    tool_rc rc;
+    if (ctx.bulk.derive) {
+        rc = derive_specs(ectx);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+    }
+
+    if (!ctx.bulk.count) {
+        LOG_ERR("No algorithm specifications to probe");
+        return tool_rc_option_error;
+    }
+
+    rc = get_firmware_key(ectx);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    if (ctx.bulk.cache_path) {
+        cache_load(ctx.bulk.cache_path);
+    }
+
+    if (output_enabled) {
+        print_header(stdout);
+    }
+
+    rc = probe_specs(ectx);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    if (ctx.bulk.cache_path && ctx.bulk.cache_dirty) {
+        return cache_store(ctx.bulk.cache_path);
+    }
+
+    return tool_rc_success;
+}
+
+static bool is_bulk(void) {
+
+    return ctx.argc > 1 || ctx.bulk.derive || ctx.bulk.list_path
+            || ctx.bulk.cache_path;
+}
+
+static bool on_option(char key, char *value) {
+
+    switch (key) {
+    case 'l':
+        ctx.bulk.list_path = value;
+        break;
+    case 0:
+        ctx.bulk.derive = true;
+        break;
+    case 1:
+        ctx.bulk.cache_path = value;
+        break;
+    }
+
+    return true;
+}
+
+static bool on_arg(int argc, char **argv){
+
+    ctx.argc = argc;
+    ctx.argv = argv;
+
+    if (is_bulk()) {
+        return true;
+    }
+
+    if (argc != 1) {
+        LOG_ERR("Expected one algorithm specification, got: %d", argc);
+        return false;
+    }
+
+    return parse_spec(argv[0], &ctx.inputalg);
+}
+
 bool tpm2_tool_onstart(tpm2_options **opts) {
-    *opts = tpm2_options_new(NULL, 0, NULL, NULL, on_arg, 0);
+
+    const struct option topts[] = {
+        { "list",   required_argument, NULL, 'l' },
+        { "derive", no_argument,       NULL, 0 },
+        { "cache",  required_argument, NULL, 1 },
+    };
+
+    *opts = tpm2_options_new("l:", ARRAY_LEN(topts), topts, on_option, on_arg,
+            0);
 
     return *opts != NULL;
 }
@@ -94,5 +790,14 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
+    if (is_bulk()) {
+        return tpm_testparms_bulk(ectx);
+    }
+
+    if (!ctx.argc) {
+        LOG_ERR("Expected one algorithm specification, got: 0");
+        return tool_rc_option_error;
+    }
+
     return tpm_testparms(ectx);
 }
@@ -1,12 +1,23 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
 
 #include "files.h"
 #include "log.h"
 #include "tpm2.h"
+#include "tpm2_auth_util.h"
+#include "tpm2_session_broker.h"
 #include "tpm2_tool.h"
 
+#define MAX_SEALED_OBJECTS 128
+
+#define TAR_BLOCK_SIZE 512
+
 typedef struct tpm_unseal_ctx tpm_unseal_ctx;
 struct tpm_unseal_ctx {
     struct {
@@ -16,6 +27,27 @@ struct tpm_unseal_ctx {
     } sealkey;
 
     char *outFilePath;
+
+    /* bulk mode, sealed objects loaded under a shared parent */
+    struct {
+        const char *ctx_path;
+        const char *auth_str;
+        tpm2_loaded_object object;
+    } parent;
+
+    const char *pub_paths[MAX_SEALED_OBJECTS];
+    const char *priv_paths[MAX_SEALED_OBJECTS];
+    unsigned pub_count;
+    unsigned priv_count;
+
+    bool is_pcr;
+    bool is_policy_used;
+
+    /* a session salted by the parent, encrypting every unsealed blob */
+    tpm2_session_broker *broker;
+
+    files_sink archive;
+    bool is_archive;
 };
 
 static tpm_unseal_ctx ctx;
@@ -24,25 +56,25 @@ tool_rc unseal_and_save(ESYS_CONTEXT *ectx) {
 
     TPM2B_SENSITIVE_DATA *outData = NULL;
 
-    tool_rc rc = tpm2_unseal(ectx, &ctx.sealkey.object, &outData);
+    tool_rc rc = tpm2_unseal(ectx, &ctx.sealkey.object, ESYS_TR_NONE,
+            &outData, NULL);
     if (rc != tool_rc_success) {
         return rc;
     }
 
-    if (ctx.outFilePath) {
-        bool ret = files_save_bytes_to_file(ctx.outFilePath, (UINT8 *)
-                                        outData->buffer, outData->size);
-        if (!ret) {
-            rc = tool_rc_general_error;
-            goto out;
-        }
-    } else {
-        bool ret = files_write_bytes(stdout, (UINT8 *) outData->buffer,
-                                 outData->size);
-        if (!ret) {
-            rc = tool_rc_general_error;
-            goto out;
-        }
+    /* write straight from the response, the secret is never copied */
+    files_sink sink;
+    if (!files_sink_open(&sink, ctx.outFilePath, true)) {
+        rc = tool_rc_general_error;
+        goto out;
+    }
+
+    bool ret = files_sink_write(&sink, outData->buffer, outData->size)
+            && files_sink_commit(&sink);
+    files_sink_close(&sink);
+    if (!ret) {
+        rc = tool_rc_general_error;
+        goto out;
     }
 
     rc = tool_rc_success;
@@ -53,6 +85,329 @@ out:
     return rc;
 }
 
+/*
+ * The name an unsealed blob is stored under, the public file name with
+ * its directory and extension stripped, ie "keys/db.pub" becomes "db".
+ */
+static bool output_name(const char *pub_path, char *name, size_t len) {
+
+    const char *base = strrchr(pub_path, '/');
+    base = base ? base + 1 : pub_path;
+
+    const char *ext = strrchr(base, '.');
+    size_t n = ext && ext != base ? (size_t)(ext - base) : strlen(base);
+    if (!n || n >= len) {
+        LOG_ERR("Cannot derive an output name from \"%s\"", pub_path);
+        return false;
+    }
+
+    memcpy(name, base, n);
+    name[n] = '\0';
+
+    return true;
+}
+
+static bool save_to_dir(const char *name, TPM2B_SENSITIVE_DATA *data) {
+
+    char path[PATH_MAX];
+    int len = snprintf(path, sizeof(path), "%s/%s", ctx.outFilePath, name);
+    if (len < 0 || (size_t)len >= sizeof(path)) {
+        LOG_ERR("Path truncated");
+        return false;
+    }
+
+    /* unsealed data is secret, never let the umask widen it */
+    files_sink sink;
+    if (!files_sink_open(&sink, path, true)) {
+        return false;
+    }
+
+    bool ret = files_sink_write(&sink, data->buffer, data->size)
+            && files_sink_commit(&sink);
+    files_sink_close(&sink);
+
+    return ret;
+}
+
+/*
+ * Append a regular file entry to a POSIX ustar archive. One archive lets a
+ * caller place every unsealed blob on a single tmpfs file and hand it out
+ * with one descriptor.
+ */
+static bool save_to_archive(const char *name, TPM2B_SENSITIVE_DATA *data) {
+
+    UINT8 header[TAR_BLOCK_SIZE] = { 0 };
+
+    size_t len = strlen(name);
+    if (len >= 100) {
+        LOG_ERR("Archive member name too long: \"%s\"", name);
+        return false;
+    }
+
+    memcpy(&header[0], name, len);
+    snprintf((char *)&header[100], 8, "%07o", 0600);
+    snprintf((char *)&header[108], 8, "%07o", 0);
+    snprintf((char *)&header[116], 8, "%07o", 0);
+    snprintf((char *)&header[124], 12, "%011o", (unsigned)data->size);
+    snprintf((char *)&header[136], 12, "%011o", 0);
+    header[156] = '0';
+    memcpy(&header[257], "ustar", 6);
+    memcpy(&header[263], "00", 2);
+
+    /* the checksum is computed with its own field set to spaces */
+    memset(&header[148], ' ', 8);
+    unsigned sum = 0;
+    size_t i;
+    for (i = 0; i < sizeof(header); i++) {
+        sum += header[i];
+    }
+    snprintf((char *)&header[148], 8, "%06o", sum);
+
+    UINT8 pad[TAR_BLOCK_SIZE] = { 0 };
+    size_t pad_len = (TAR_BLOCK_SIZE - (data->size % TAR_BLOCK_SIZE))
+            % TAR_BLOCK_SIZE;
+
+    struct iovec iov[] = {
+        { .iov_base = header, .iov_len = sizeof(header) },
+        { .iov_base = data->buffer, .iov_len = data->size },
+        { .iov_base = pad, .iov_len = pad_len },
+    };
+
+    return files_sink_writev(&ctx.archive, iov, ARRAY_LEN(iov));
+}
+
+static tool_rc open_output(void) {
+
+    struct stat sb;
+    int rc = stat(ctx.outFilePath, &sb);
+    if (!rc && S_ISDIR(sb.st_mode)) {
+        return tool_rc_success;
+    }
+
+    ctx.is_archive = files_sink_open(&ctx.archive, ctx.outFilePath, true);
+
+    return ctx.is_archive ? tool_rc_success : tool_rc_general_error;
+}
+
+static tool_rc close_output(void) {
+
+    if (!ctx.is_archive) {
+        return tool_rc_success;
+    }
+
+    /* an archive ends with two zero filled blocks */
+    UINT8 eof[TAR_BLOCK_SIZE * 2] = { 0 };
+    bool ret = files_sink_write(&ctx.archive, eof, sizeof(eof))
+            && files_sink_commit(&ctx.archive);
+
+    files_sink_close(&ctx.archive);
+    ctx.is_archive = false;
+
+    return ret ? tool_rc_success : tool_rc_general_error;
+}
+
+typedef struct unseal_data unseal_data;
+struct unseal_data {
+    tpm2_loaded_object *sealed;
+    TPM2B_SENSITIVE_DATA *out_data;
+};
+
+/*
+ * Unseals one object with the broker's session as the encrypt session, so
+ * the blob does not cross the bus in the clear. The broker may run this a
+ * second time, which is harmless: a used pcr: policy session is restarted
+ * and satisfied again first, and Unseal changes nothing in the TPM.
+ */
+static tool_rc unseal_brokered(ESYS_CONTEXT *ectx, tpm2_session *session,
+        void *userdata, TSS2_RC *tpm_rc) {
+
+    unseal_data *data = (unseal_data *) userdata;
+
+    /*
+     * The policy session was satisfied when it was started. Every later
+     * use restarts it and replays PolicyPCR, with the PCR digest served
+     * from the policy cache rather than recomputed.
+     */
+    if (ctx.is_pcr && ctx.is_policy_used) {
+        tool_rc rc = tpm2_auth_util_restart_pcr(ectx, ctx.sealkey.auth_str,
+                ctx.sealkey.object.session);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+    }
+    ctx.is_policy_used = true;
+
+    /* Unseal has no command parameter, a decrypt session would fail it */
+    ESYS_TR encrypt_session = tpm2_session_get_handle(session);
+    tool_rc rc = tpm2_sess_set_attributes(ectx, encrypt_session, 0,
+            TPMA_SESSION_DECRYPT);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    return tpm2_unseal(ectx, data->sealed, encrypt_session, &data->out_data,
+            tpm_rc);
+}
+
+static tool_rc unseal_one(ESYS_CONTEXT *ectx, unsigned index) {
+
+    char name[PATH_MAX];
+    bool ret = output_name(ctx.pub_paths[index], name, sizeof(name));
+    if (!ret) {
+        return tool_rc_general_error;
+    }
+
+    TPM2B_PUBLIC pub = { 0 };
+    ret = files_load_public(ctx.pub_paths[index], &pub);
+    if (!ret) {
+        return tool_rc_general_error;
+    }
+
+    TPM2B_PRIVATE priv = { 0 };
+    ret = files_load_private(ctx.priv_paths[index], &priv);
+    if (!ret) {
+        return tool_rc_general_error;
+    }
+
+    ESYS_TR handle = ESYS_TR_NONE;
+    tool_rc rc = tpm2_load(ectx, &ctx.parent.object, &priv, &pub, &handle);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    tpm2_loaded_object sealed = {
+        .tr_handle = handle,
+        .path = ctx.pub_paths[index],
+        .session = ctx.sealkey.object.session,
+    };
+    unseal_data data = { .sealed = &sealed };
+
+    rc = tpm2_session_broker_run(ctx.broker, unseal_brokered, &data);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Could not unseal \"%s\"", ctx.pub_paths[index]);
+        goto flush;
+    }
+
+    ret = ctx.is_archive ? save_to_archive(name, data.out_data) :
+            save_to_dir(name, data.out_data);
+    free(data.out_data);
+    if (!ret) {
+        rc = tool_rc_general_error;
+    }
+
+flush:
+    if (tpm2_flush_context(ectx, handle) != tool_rc_success
+            && rc == tool_rc_success) {
+        rc = tool_rc_general_error;
+    }
+
+    return rc;
+}
+
+static tool_rc init_bulk_auth(ESYS_CONTEXT *ectx) {
+
+    /* the same auth session is reused for every sealed object */
+    ctx.is_pcr = tpm2_auth_util_is_pcr(ctx.sealkey.auth_str);
+
+    return tpm2_auth_util_from_optarg(ectx, ctx.sealkey.auth_str,
+            &ctx.sealkey.object.session, false);
+}
+
+static tool_rc unseal_bulk(ESYS_CONTEXT *ectx) {
+
+    tool_rc rc = tpm2_util_object_load_auth(ectx, ctx.parent.ctx_path,
+            ctx.parent.auth_str, &ctx.parent.object, false,
+            TPM2_HANDLES_FLAGS_TRANSIENT|TPM2_HANDLES_FLAGS_PERSISTENT);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Invalid parent key authorization");
+        return rc;
+    }
+
+    rc = init_bulk_auth(ectx);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    /* a sealed object's parent is a storage key, fit to salt a session */
+    rc = tpm2_session_broker_new(ectx, ctx.parent.object.tr_handle, NULL,
+            &ctx.broker);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    rc = open_output();
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    unsigned i;
+    for (i = 0; i < ctx.pub_count; i++) {
+        rc = unseal_one(ectx, i);
+        if (rc != tool_rc_success) {
+            break;
+        }
+    }
+
+    tool_rc tmp_rc = close_output();
+
+    return rc != tool_rc_success ? rc : tmp_rc;
+}
+
+/*
+ * Public files with the same name in different directories would be
+ * written to the same output, so reject them before anything is unsealed.
+ */
+static tool_rc check_output_names(void) {
+
+    static char names[MAX_SEALED_OBJECTS][NAME_MAX + 1];
+
+    unsigned i;
+    for (i = 0; i < ctx.pub_count; i++) {
+        bool ret = output_name(ctx.pub_paths[i], names[i], sizeof(names[i]));
+        if (!ret) {
+            return tool_rc_option_error;
+        }
+
+        unsigned j;
+        for (j = 0; j < i; j++) {
+            if (!strcmp(names[i], names[j])) {
+                LOG_ERR("\"%s\" and \"%s\" would both be unsealed to"
+                        " \"%s\"", ctx.pub_paths[j], ctx.pub_paths[i],
+                        names[i]);
+                return tool_rc_option_error;
+            }
+        }
+    }
+
+    return tool_rc_success;
+}
+
+static tool_rc check_bulk_options(void) {
+
+    if (ctx.sealkey.ctx_path) {
+        LOG_ERR("Cannot specify -c with -u and -r");
+        return tool_rc_option_error;
+    }
+
+    if (!ctx.parent.ctx_path) {
+        LOG_ERR("Expected parent object via -C");
+        return tool_rc_option_error;
+    }
+
+    if (ctx.pub_count != ctx.priv_count) {
+        LOG_ERR("Expected as many -u as -r options, got %u and %u",
+                ctx.pub_count, ctx.priv_count);
+        return tool_rc_option_error;
+    }
+
+    if (!ctx.outFilePath) {
+        LOG_ERR("Expected an output directory or archive via -o");
+        return tool_rc_option_error;
+    }
+
+    return check_output_names();
+}
+
 static tool_rc init(ESYS_CONTEXT *ectx) {
 
     if (!ctx.sealkey.ctx_path) {
@@ -84,6 +439,28 @@ static bool on_option(char key, char *value) {
     case 'o':
         ctx.outFilePath = value;
         break;
+    case 'C':
+        ctx.parent.ctx_path = value;
+        break;
+    case 'P':
+        ctx.parent.auth_str = value;
+        break;
+    case 'u':
+        if (ctx.pub_count == MAX_SEALED_OBJECTS) {
+            LOG_ERR("Cannot unseal more than %u objects at once",
+                    MAX_SEALED_OBJECTS);
+            return false;
+        }
+        ctx.pub_paths[ctx.pub_count++] = value;
+        break;
+    case 'r':
+        if (ctx.priv_count == MAX_SEALED_OBJECTS) {
+            LOG_ERR("Cannot unseal more than %u objects at once",
+                    MAX_SEALED_OBJECTS);
+            return false;
+        }
+        ctx.priv_paths[ctx.priv_count++] = value;
+        break;
         /* no default */
     }
 
@@ -96,9 +473,13 @@ bool tpm2_tool_onstart(tpm2_options **opts) {
       { "auth",             required_argument, NULL, 'p' },
       { "output",           required_argument, NULL, 'o' },
       { "object-context",   required_argument, NULL, 'c' },
+      { "parent-context",   required_argument, NULL, 'C' },
+      { "parent-auth",      required_argument, NULL, 'P' },
+      { "public",           required_argument, NULL, 'u' },
+      { "private",          required_argument, NULL, 'r' },
     };
 
-    *opts = tpm2_options_new("p:o:c:", ARRAY_LEN(topts), topts,
+    *opts = tpm2_options_new("p:o:c:C:P:u:r:", ARRAY_LEN(topts), topts,
                              on_option, NULL, 0);
 
     return *opts != NULL;
@@ -108,6 +489,15 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
     UNUSED(flags);
 
+    if (ctx.pub_count || ctx.priv_count) {
+        tool_rc rc = check_bulk_options();
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        return unseal_bulk(ectx);
+    }
+
     tool_rc rc = init(ectx);
     if (rc != tool_rc_success) {
         return rc;
@@ -118,5 +508,20 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *ectx, tpm2_option_flags flags) {
 
 tool_rc tpm2_tool_onstop(ESYS_CONTEXT *ectx) {
     UNUSED(ectx);
-    return tpm2_session_close(&ctx.sealkey.object.session);
+
+    /* an archive that was not completed is never linked into place */
+    if (ctx.is_archive) {
+        files_sink_close(&ctx.archive);
+    }
+
+    tool_rc rc = tpm2_session_broker_free(&ctx.broker);
+
+    tool_rc tmp_rc = tpm2_session_close(&ctx.parent.object.session);
+    if (rc == tool_rc_success) {
+        rc = tmp_rc;
+    }
+
+    tmp_rc = tpm2_session_close(&ctx.sealkey.object.session);
+
+    return rc != tool_rc_success ? rc : tmp_rc;
 }
@@ -1,14 +1,27 @@
 /* SPDX-License-Identifier: BSD-3-Clause */
 
+#include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "files.h"
 #include "log.h"
 #include "object.h"
+#include "tpm2.h"
 #include "tpm2_alg_util.h"
 #include "tpm2_convert.h"
 #include "tpm2_hash.h"
+#include "tpm2_merkle.h"
+#include "tpm2_openssl.h"
 #include "tpm2_options.h"
+#include "tpm2_tool.h"
+
+typedef struct path_list path_list;
+struct path_list {
+    const char **paths;
+    size_t count;
+};
 
 typedef struct tpm2_verifysig_ctx tpm2_verifysig_ctx;
 struct tpm2_verifysig_ctx {
@@ -26,30 +39,63 @@ struct tpm2_verifysig_ctx {
     } flags;
     TPMI_ALG_SIG_SCHEME format;
     TPMI_ALG_HASH halg;
-    TPM2B_DIGEST *msgHash;
-    TPMT_SIGNATURE signature;
-    char *msg_file_path;
-    char *sig_file_path;
+    path_list msgs;
+    path_list digests;
+    path_list sigs;
+    path_list proofs;
+    size_t count;
     char *out_file_path;
     const char *context_arg;
+    const char *public_path;
     tpm2_loaded_object key_context_object;
+    EVP_PKEY *pkey;
+    /* what the TPM would check of the key, kept for the host */
+    TPMT_PUBLIC public;
+    /* inputs given once for many signatures, read once */
+    struct {
+        TPM2B_DIGEST digest;
+        TPMT_SIGNATURE signature;
+        bool is_digest;
+        bool is_signature;
+    } shared;
 };
 
 static tpm2_verifysig_ctx ctx = {
         .format = TPM2_ALG_ERROR,
-        .msgHash = NULL,
         .halg = TPM2_ALG_SHA1
 };
 
-static tool_rc verify_signature(ESYS_CONTEXT *context) {
+static bool path_list_add(path_list *list, const char *path) {
+
+    const char **paths = realloc(list->paths,
+            (list->count + 1) * sizeof(*paths));
+    if (!paths) {
+        LOG_ERR("oom");
+        return false;
+    }
+
+    paths[list->count++] = path;
+    list->paths = paths;
+
+    return true;
+}
+
+/* a list given once applies to every signature */
+static const char *path_list_get(path_list *list, size_t i) {
+
+    return list->count == 1 ? list->paths[0] : list->paths[i];
+}
+
+static tool_rc verify_signature_tpm(ESYS_CONTEXT *context,
+        TPM2B_DIGEST *digest, TPMT_SIGNATURE *signature) {
 
     tool_rc rc = tool_rc_success;
-    TPMT_TK_VERIFIED *validation;
+    TPMT_TK_VERIFIED *validation = NULL;
 
     TSS2_RC rval = Esys_VerifySignature(context,
                         ctx.key_context_object.tr_handle,
                         ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE,
-                        ctx.msgHash, &ctx.signature, &validation);
+                        digest, signature, &validation);
     if (rval != TPM2_RC_SUCCESS) {
         LOG_PERR(Esys_VerifySignature, rval);
         rc = tool_rc_from_tpm(rval);
@@ -103,9 +149,240 @@ static TPM2B *message_from_file(const char *msg_file_path) {
     return msg;
 }
 
-static tool_rc init(ESYS_CONTEXT *context) {
+/*
+ * The signature of a tree covers its root, so the digest to verify is the
+ * root that the proof of the message leads to.
+ */
+static tool_rc tree_root_from_proof(const char *msg_file_path,
+        const char *proof_file_path, TPM2B_DIGEST *root) {
+
+    tpm2_merkle_proof proof;
+    bool result = tpm2_merkle_proof_load(proof_file_path, &proof);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    FILE *f = fopen(msg_file_path, "rb");
+    if (!f) {
+        LOG_ERR("Could not open file \"%s\", error: %s", msg_file_path,
+                strerror(errno));
+        return tool_rc_general_error;
+    }
+
+    TPM2B_DIGEST leaf;
+    result = tpm2_merkle_leaf_hash_file(proof.halg, f, &leaf);
+    fclose(f);
+    if (!result) {
+        return tool_rc_general_error;
+    }
+
+    result = tpm2_merkle_proof_root(&leaf, &proof, root);
+
+    return result ? tool_rc_success : tool_rc_general_error;
+}
+
+static tool_rc message_digest(ESYS_CONTEXT *context, const char *msg_file_path,
+        TPM2B_DIGEST *digest) {
+
+    /* the host hashes when the host verifies, sparing a round trip */
+    if (ctx.pkey) {
+        FILE *f = fopen(msg_file_path, "rb");
+        if (!f) {
+            LOG_ERR("Could not open file \"%s\", error: %s", msg_file_path,
+                    strerror(errno));
+            return tool_rc_general_error;
+        }
+
+        bool result = tpm2_openssl_hash_file(ctx.halg, f, digest);
+        fclose(f);
+        if (!result) {
+            LOG_ERR("Compute message hash failed!");
+            return tool_rc_general_error;
+        }
+
+        return tool_rc_success;
+    }
+
+    TPM2B *msg = message_from_file(msg_file_path);
+    if (!msg) {
+        /* message_from_file() logs specific error no need to here */
+        return tool_rc_general_error;
+    }
+
+    TPM2B_DIGEST *msgHash = NULL;
+    tool_rc rc = tpm2_hash_compute_data(context, ctx.halg,
+            TPM2_RH_NULL, msg->buffer, msg->size, &msgHash, NULL);
+    free(msg);
+    if (rc != tool_rc_success) {
+        LOG_ERR("Compute message hash failed!");
+        return rc;
+    }
+
+    *digest = *msgHash;
+    free(msgHash);
+
+    return tool_rc_success;
+}
+
+static tool_rc item_digest(ESYS_CONTEXT *context, size_t i,
+        TPM2B_DIGEST *digest) {
 
-    tool_rc rc = tool_rc_general_error;
+    if (ctx.flags.digest) {
+        const char *path = path_list_get(&ctx.digests, i);
+        digest->size = sizeof(digest->buffer);
+        if (!files_load_bytes_from_path(path, digest->buffer, &digest->size)) {
+            LOG_ERR("Could not load digest from file!");
+            return tool_rc_general_error;
+        }
+        return tool_rc_success;
+    }
+
+    const char *msg_file_path = path_list_get(&ctx.msgs, i);
+    if (ctx.proofs.count) {
+        return tree_root_from_proof(msg_file_path,
+                path_list_get(&ctx.proofs, i), digest);
+    }
+
+    return message_digest(context, msg_file_path, digest);
+}
+
+static tool_rc item_signature(size_t i, TPMT_SIGNATURE *signature) {
+
+    tpm2_convert_sig_fmt fmt = ctx.flags.fmt ? signature_format_plain : signature_format_tss;
+    bool res = tpm2_convert_sig_load(path_list_get(&ctx.sigs, i), fmt,
+            ctx.format, ctx.halg, signature);
+
+    return res ? tool_rc_success : tool_rc_general_error;
+}
+
+/*
+ * A message, digest or signature given once applies to every signature, so
+ * hash or load it here rather than once per signature.
+ */
+static tool_rc load_shared(ESYS_CONTEXT *context) {
+
+    if (ctx.count == 1) {
+        return tool_rc_success;
+    }
+
+    bool is_digest_once = ctx.flags.digest ? ctx.digests.count == 1 :
+            ctx.msgs.count == 1 && ctx.proofs.count <= 1;
+    if (is_digest_once) {
+        tool_rc rc = item_digest(context, 0, &ctx.shared.digest);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+        ctx.shared.is_digest = true;
+    }
+
+    if (ctx.sigs.count == 1) {
+        tool_rc rc = item_signature(0, &ctx.shared.signature);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+        ctx.shared.is_signature = true;
+    }
+
+    return tool_rc_success;
+}
+
+static tool_rc verify_item(ESYS_CONTEXT *context, size_t i) {
+
+    TPM2B_DIGEST item_dig = TPM2B_EMPTY_INIT;
+    TPM2B_DIGEST *digest = &ctx.shared.digest;
+    if (!ctx.shared.is_digest) {
+        tool_rc rc = item_digest(context, i, &item_dig);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+        digest = &item_dig;
+    }
+
+    TPMT_SIGNATURE item_sig;
+    TPMT_SIGNATURE *signature = &ctx.shared.signature;
+    if (!ctx.shared.is_signature) {
+        tool_rc rc = item_signature(i, &item_sig);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+        signature = &item_sig;
+    }
+
+    if (!ctx.pkey) {
+        return verify_signature_tpm(context, digest, signature);
+    }
+
+    bool res = tpm2_convert_sig_check_key(&ctx.public, signature)
+            && tpm2_convert_sig_verify(ctx.pkey, signature, digest);
+
+    return res ? tool_rc_success : tool_rc_general_error;
+}
+
+/*
+ * Signatures are checked with OpenSSL against a key converted once, the TPM
+ * is only needed for a ticket or a key that never leaves it, like an HMAC
+ * key.
+ */
+static tool_rc load_key(ESYS_CONTEXT *context) {
+
+    TPM2B_PUBLIC *public = NULL;
+    TPM2B_PUBLIC loaded = { .size = 0 };
+    if (ctx.public_path) {
+        if (!files_load_public(ctx.public_path, &loaded)) {
+            return tool_rc_general_error;
+        }
+        public = &loaded;
+    } else {
+        if (!context) {
+            LOG_ERR("--key-context (-c) requires a TPM, use --public (-u) "
+                    "with --tcti=none");
+            return tool_rc_option_error;
+        }
+
+        tool_rc rc = tpm2_util_object_load(context, ctx.context_arg,
+            &ctx.key_context_object, TPM2_HANDLE_ALL_W_NV);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        if (ctx.flags.ticket) {
+            return tool_rc_success;
+        }
+
+        rc = tpm2_readpublic(context, ctx.key_context_object.tr_handle,
+                ESYS_TR_NONE, ESYS_TR_NONE, ESYS_TR_NONE, &public, NULL, NULL);
+        if (rc != tool_rc_success) {
+            return rc;
+        }
+
+        if (public->publicArea.type != TPM2_ALG_RSA
+                && public->publicArea.type != TPM2_ALG_ECC) {
+            free(public);
+            return tool_rc_success;
+        }
+    }
+
+    ctx.public = public->publicArea;
+    ctx.pkey = tpm2_convert_pubkey_to_evp(&public->publicArea);
+    if (public != &loaded) {
+        free(public);
+    }
+
+    return ctx.pkey ? tool_rc_success : tool_rc_general_error;
+}
+
+static bool check_count(path_list *list, const char *name) {
+
+    if (list->count > 1 && list->count != ctx.count) {
+        LOG_ERR("Expected %s once or once per signature, got %zu for %zu "
+                "signatures", name, list->count, ctx.count);
+        return false;
+    }
+
+    return true;
+}
+
+static tool_rc init(void) {
 
     /* check flags for mismatches */
     if (ctx.flags.digest && (ctx.flags.msg || ctx.flags.halg)) {
@@ -114,62 +391,59 @@ static tool_rc init(ESYS_CONTEXT *context) {
         return tool_rc_option_error;
     }
 
-    if (!(ctx.context_arg && ctx.flags.sig)) {
+    if (!((ctx.context_arg || ctx.public_path) && ctx.flags.sig)) {
         LOG_ERR(
-                "--key-context (-c) and --sig (-s) are required");
+                "--key-context (-c) or --public (-u) and --sig (-s) are required");
         return tool_rc_option_error;
     }
 
-    TPM2B *msg = NULL;
+    if (ctx.context_arg && ctx.public_path) {
+        LOG_ERR("Cannot specify --key-context (-c) and --public (-u)");
+        return tool_rc_option_error;
+    }
 
-    tool_rc tmp_rc = tpm2_util_object_load(context, ctx.context_arg,
-        &ctx.key_context_object, TPM2_HANDLE_ALL_W_NV);
-    if (tmp_rc != tool_rc_success) {
-        return tmp_rc;
+    if (!ctx.flags.digest && !ctx.flags.msg) {
+        LOG_ERR("No digest set and no message file to compute from, cannot compute message hash!");
+        return tool_rc_option_error;
     }
 
-    if (ctx.flags.msg) {
-        msg = message_from_file(ctx.msg_file_path);
-        if (!msg) {
-            /* message_from_file() logs specific error no need to here */
-            return tool_rc_general_error;
-        }
+    if (ctx.proofs.count && !ctx.flags.msg) {
+        LOG_ERR("--proof requires the signed item with --message (-m)");
+        return tool_rc_option_error;
     }
 
-    if (ctx.flags.sig) {
+    ctx.count = ctx.sigs.count;
+    if (ctx.msgs.count > ctx.count) {
+        ctx.count = ctx.msgs.count;
+    }
+    if (ctx.digests.count > ctx.count) {
+        ctx.count = ctx.digests.count;
+    }
+    if (ctx.proofs.count > ctx.count) {
+        ctx.count = ctx.proofs.count;
+    }
 
-        tpm2_convert_sig_fmt fmt = ctx.flags.fmt ? signature_format_plain : signature_format_tss;
-        bool res = tpm2_convert_sig_load(ctx.sig_file_path, fmt, ctx.format, ctx.halg, &ctx.signature);
-        if (!res) {
-            goto err;
-        }
+    if (!check_count(&ctx.sigs, "--signature (-s)")
+            || !check_count(&ctx.msgs, "--message (-m)")
+            || !check_count(&ctx.digests, "--digest (-d)")
+            || !check_count(&ctx.proofs, "--proof")) {
+        return tool_rc_option_error;
     }
 
-    /* If no digest is specified, compute it */
-    if (!ctx.flags.digest) {
-        if (!msg) {
-            /*
-             * This is a redundant check since main() checks this case, but
-             * we'll add it here to silence any complainers (such as static
-             * analysers).
-             */
-            LOG_ERR("No digest set and no message file to compute from, cannot compute message hash!");
-            goto err;
+    if (ctx.flags.ticket) {
+        if (ctx.count > 1) {
+            LOG_ERR("A ticket (-t) is produced for a single signature only");
+            return tool_rc_option_error;
         }
-        tmp_rc = tpm2_hash_compute_data(context, ctx.halg,
-                TPM2_RH_NULL, msg->buffer, msg->size, &ctx.msgHash, NULL);
-        if (tmp_rc != tool_rc_success) {
-            rc = tmp_rc;
-            LOG_ERR("Compute message hash failed!");
-            goto err;
+
+        if (!ctx.context_arg) {
+            LOG_ERR("A ticket (-t) requires the key loaded with "
+                    "--key-context (-c)");
+            return tool_rc_option_error;
         }
     }
 
-    rc = tool_rc_success;
-
-err:
-    free(msg);
-    return rc;
+    return tool_rc_success;
 }
 
 static bool on_option(char key, char *value) {
@@ -178,6 +452,9 @@ static bool on_option(char key, char *value) {
 	case 'c':
 	    ctx.context_arg = value;
 	    break;
+	case 'u':
+	    ctx.public_path = value;
+	    break;
 	case 'g': {
 		ctx.halg = tpm2_alg_util_from_optarg(value, tpm2_alg_util_flags_hash);
 		if (ctx.halg == TPM2_ALG_ERROR) {
@@ -188,15 +465,14 @@ static bool on_option(char key, char *value) {
 	}
 		break;
 	case 'm': {
-		ctx.msg_file_path = value;
+		if (!path_list_add(&ctx.msgs, value)) {
+			return false;
+		}
 		ctx.flags.msg = 1;
 	}
 		break;
 	case 'd': {
-        ctx.msgHash = malloc(sizeof(TPM2B_DIGEST));
-	    ctx.msgHash->size = sizeof(ctx.msgHash->buffer);
-		if (!files_load_bytes_from_path(value, ctx.msgHash->buffer, &ctx.msgHash->size)) {
-			LOG_ERR("Could not load digest from file!");
+		if (!path_list_add(&ctx.digests, value)) {
 			return false;
 		}
 		ctx.flags.digest = 1;
@@ -212,13 +488,20 @@ static bool on_option(char key, char *value) {
 		ctx.flags.fmt = 1;
 	} break;
 	case 's':
-		ctx.sig_file_path = value;
+		if (!path_list_add(&ctx.sigs, value)) {
+			return false;
+		}
 		ctx.flags.sig = 1;
 		break;
 	case 't':
 		ctx.out_file_path = value;
 		ctx.flags.ticket = 1;
 		break;
+	case 0:
+		if (!path_list_add(&ctx.proofs, value)) {
+			return false;
+		}
+		break;
 		/* no default */
 	}
 
@@ -235,11 +518,13 @@ bool tpm2_tool_onstart(tpm2_options **opts) {
             { "signature",      required_argument, NULL, 's' },
             { "ticket",         required_argument, NULL, 't' },
             { "key-context",    required_argument, NULL, 'c' },
+            { "public",         required_argument, NULL, 'u' },
+            { "proof",          required_argument, NULL,  0  },
     };
 
 
-    *opts = tpm2_options_new("g:m:d:f:s:t:c:", ARRAY_LEN(topts), topts,
-                             on_option, NULL, 0);
+    *opts = tpm2_options_new("g:m:d:f:s:t:c:u:", ARRAY_LEN(topts), topts,
+                             on_option, NULL, TPM2_OPTIONS_OPTIONAL_SAPI);
 
     return *opts != NULL;
 }
@@ -249,22 +534,58 @@ tool_rc tpm2_tool_onrun(ESYS_CONTEXT *context, tpm2_option_flags flags) {
 	UNUSED(flags);
 
     /* initialize and process */
-    tool_rc rc = init(context);
+    tool_rc rc = init();
     if (rc != tool_rc_success) {
         return rc;
     }
 
-    rc = verify_signature(context);
+    rc = load_key(context);
     if (rc != tool_rc_success) {
-        LOG_ERR("Verify signature failed!");
         return rc;
     }
 
-    return tool_rc_success;
+    rc = load_shared(context);
+    if (rc != tool_rc_success) {
+        return rc;
+    }
+
+    if (ctx.count == 1) {
+        rc = verify_item(context, 0);
+        if (rc != tool_rc_success) {
+            LOG_ERR("Verify signature failed!");
+        }
+        return rc;
+    }
+
+    /* report every signature, so one bad signature does not hide the rest */
+    tool_rc result = tool_rc_success;
+    size_t i;
+    for (i = 0; i < ctx.count; i++) {
+        rc = verify_item(context, i);
+        if (rc != tool_rc_success) {
+            LOG_ERR("Verify signature \"%s\" failed!",
+                    path_list_get(&ctx.sigs, i));
+            result = tool_rc_general_error;
+        }
+
+        if (ctx.flags.digest) {
+            tpm2_tool_output("- digest: %s\n", path_list_get(&ctx.digests, i));
+        } else {
+            tpm2_tool_output("- message: %s\n", path_list_get(&ctx.msgs, i));
+        }
+        tpm2_tool_output("  signature: %s\n", path_list_get(&ctx.sigs, i));
+        tpm2_tool_output("  verified: %s\n",
+                rc == tool_rc_success ? "true" : "false");
+    }
+
+    return result;
 }
 
 void tpm2_tool_onexit(void) {
-    if (ctx.msgHash) {
-        free(ctx.msgHash);
-    }
+
+    EVP_PKEY_free(ctx.pkey);
+    free(ctx.msgs.paths);
+    free(ctx.digests.paths);
+    free(ctx.sigs.paths);
+    free(ctx.proofs.paths);
 }